@@ -19,6 +19,7 @@
 #define WITH_FS_EXT2
 #define WITH_FS_FAT
 #define WITH_FS_ROMFS
+#define WITH_FS_TMPFS
 #define WITH_KEYBOARD
 #define WITH_MASS_STORAGE
 #define WITH_RTC
@@ -27,6 +28,7 @@
 #define WITH_DRV_HID_PS2CONTROLLER
 #define WITH_DRV_MST_ATA
 #define WITH_DRV_MST_PARTITION
+#define WITH_DRV_MST_RAMDISK
 #define WITH_DRV_NET_ENCX24J600
 #define WITH_DRV_RTC_DS17485
 #define WITH_DRV_SER_MC68681
@@ -46,6 +48,8 @@
 
 /* Memory layout options */
 #define SLAB_RESERVED_MEM   65536   /* Memory reserved for slabs                                */
+/* #define RAMDISK_RESERVED_MEM 1048576 */  /* User memory reserved for a boot-time RAM disk     */
+/* #define TMPFS_SIZE_MAX 262144 */         /* Maximum file data stored by each tmpfs mount         */
 
 /* FIXME - target arch should be defined in platform/platform_specific.h, not here */
 #define TARGET_MC68010
@@ -259,6 +259,17 @@ s32 cpu_proc_init(regs_t *r, void *entry_point, void *arg, void *ustack_top, voi
 }
 
 
+/*
+    cpu_proc_set_data_base() - set the address of a new process' global offset table.  Code compiled
+    with -msep-data addresses its GOT through A5, so that the GOT need not be at a fixed distance
+    from the code.
+*/
+void cpu_proc_set_data_base(regs_t *r, void *base)
+{
+    r->a[5] = (u32) base;
+}
+
+
 /*
     mc68000_dump_status_register() - write a string describing the contents of the status register
 */
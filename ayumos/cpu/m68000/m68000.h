@@ -152,6 +152,42 @@ inline void cpu_disable_interrupts(void)
 }
 
 
+/*
+    cpu_disable_interrupts_save() - disable interrupts, and return the previous contents of the SR
+    so that the previous IRQ mask can be restored by cpu_restore_interrupts().
+*/
+inline u32 cpu_disable_interrupts_save(void)
+{
+    register u32 sr = 0;
+
+    asm volatile
+    (
+        "cpu_disable_interrupts_save_%=:    movew   %%sr, %0        \n"
+        "                                   oriw    #0x0700, %%sr   \n"
+        : "+d" (sr)
+        :
+        : "cc"
+    );
+
+    return sr;
+}
+
+
+/*
+    cpu_restore_interrupts() - restore the IRQ mask saved by cpu_disable_interrupts_save().
+*/
+inline void cpu_restore_interrupts(ku32 sr)
+{
+    asm volatile
+    (
+        "cpu_restore_interrupts_%=: movew   %0, %%sr        \n"
+        :
+        : "d" (sr)
+        : "cc"
+    );
+}
+
+
 /*
     cpu_tas() - atomically test and set a byte-sized memory location to 1, returning the previous
     contents of the location.
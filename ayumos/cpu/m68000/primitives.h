@@ -115,7 +115,18 @@ inline void memcpy_align4(void *dest, void *src, u32 count)
 };
 
 
-/* Scatter/gather primitives */
+/*
+    Scatter/gather primitives
+
+    These move data between memory and a 16-bit peripheral data port.  Each uses an inner loop
+    unrolled into blocks of MEM_XFER16_UNROLL transfers, preceded by a loop which handles the
+    remainder, so that the cost of the dbf instruction is spread across many transfers.  On the
+    MC68000 a "move.w (a0),(a1)+" takes 12 cycles, against 22 cycles per transfer (including the
+    dbf) in the non-unrolled loop.
+*/
+
+#define MEM_XFER16_UNROLL       16
+#define MEM_XFER16_UNROLL_STR   "16"
 
 
 /*
@@ -124,12 +135,53 @@ inline void memcpy_align4(void *dest, void *src, u32 count)
 #define HAVE_mem_gather16v
 inline void mem_gather16v(vu16 * restrict dest, ku16 * restrict src, u16 count)
 {
+    u16 blocks = count / MEM_XFER16_UNROLL;
+
+    count %= MEM_XFER16_UNROLL;
+
     asm volatile
     (
         "mem_gather16v_%=:          bras mem_gather16v_start_%=         \n"
-        "mem_gather16v_loop_%=:     movew %0@, %1@+                     \n"
+        "mem_gather16v_loop_%=:     movew %0@+, %1@                     \n"
         "mem_gather16v_start_%=:    dbf %2, mem_gather16v_loop_%=       \n"
-        : "+a" (src), "+a" (dest), "+d" (count)
+        "                           bras mem_gather16v_ustart_%=        \n"
+        "mem_gather16v_uloop_%=:    .rept " MEM_XFER16_UNROLL_STR "     \n"
+        "                           movew %0@+, %1@                     \n"
+        "                           .endr                               \n"
+        "mem_gather16v_ustart_%=:   dbf %3, mem_gather16v_uloop_%=      \n"
+        : "+a" (src), "+a" (dest), "+d" (count), "+d" (blocks)
+        :
+        : "cc", "memory"
+    );
+};
+
+
+/*
+    mem_gather16v_bswap() - "gather" <count> half-words from <src> into the volatile destination
+    <dest>, swapping the bytes in each half-word.
+*/
+#define HAVE_mem_gather16v_bswap
+inline void mem_gather16v_bswap(vu16 * restrict dest, ku16 * restrict src, u16 count)
+{
+    u16 blocks = count / MEM_XFER16_UNROLL, tmp;
+
+    count %= MEM_XFER16_UNROLL;
+
+    asm volatile
+    (
+        "mem_gather16v_bswap_%=:        bras mem_gather16v_bswap_start_%=       \n"
+        "mem_gather16v_bswap_loop_%=:   movew %0@+, %4                          \n"
+        "                               rolw #8, %4                             \n"
+        "                               movew %4, %1@                           \n"
+        "mem_gather16v_bswap_start_%=:  dbf %2, mem_gather16v_bswap_loop_%=     \n"
+        "                               bras mem_gather16v_bswap_ustart_%=      \n"
+        "mem_gather16v_bswap_uloop_%=:  .rept " MEM_XFER16_UNROLL_STR "         \n"
+        "                               movew %0@+, %4                          \n"
+        "                               rolw #8, %4                             \n"
+        "                               movew %4, %1@                           \n"
+        "                               .endr                                   \n"
+        "mem_gather16v_bswap_ustart_%=: dbf %3, mem_gather16v_bswap_uloop_%=    \n"
+        : "+a" (src), "+a" (dest), "+d" (count), "+d" (blocks), "=&d" (tmp)
         :
         : "cc", "memory"
     );
@@ -142,6 +194,10 @@ inline void mem_gather16v(vu16 * restrict dest, ku16 * restrict src, u16 count)
 #define HAVE_mem_gather16v_zf
 inline void mem_gather16v_zf(vu16 * restrict dest, u16 count)
 {
+    u16 blocks = count / MEM_XFER16_UNROLL;
+
+    count %= MEM_XFER16_UNROLL;
+
 #if defined(TARGET_MC68000) || defined(TARGET_MC68008)
     /*
         The MC68000/MC68008 has a microcode bug causing the "clr" instruction to read the location
@@ -152,9 +208,14 @@ inline void mem_gather16v_zf(vu16 * restrict dest, u16 count)
     (
         "mem_gather16v_zf_%=:       clrw %%d0                           \n"
         "                           bras mem_gather16v_zf_start_%=      \n"
-        "mem_gather16v_zf_loop_%=:  movew %%d0, %0@+                    \n"
+        "mem_gather16v_zf_loop_%=:  movew %%d0, %0@                     \n"
         "mem_gather16v_zf_start_%=: dbf %1, mem_gather16v_zf_loop_%=    \n"
-        : "+a" (dest), "+d" (count)
+        "                           bras mem_gather16v_zf_ustart_%=     \n"
+        "mem_gather16v_zf_uloop_%=: .rept " MEM_XFER16_UNROLL_STR "     \n"
+        "                           movew %%d0, %0@                     \n"
+        "                           .endr                               \n"
+        "mem_gather16v_zf_ustart_%=: dbf %2, mem_gather16v_zf_uloop_%=  \n"
+        : "+a" (dest), "+d" (count), "+d" (blocks)
         :
         : "cc", "memory", "d0"
     );
@@ -162,9 +223,14 @@ inline void mem_gather16v_zf(vu16 * restrict dest, u16 count)
     asm volatile
     (
         "mem_gather16v_zf_%=:       bras mem_gather16v_zf_start_%=      \n"
-        "mem_gather16v_zf_loop_%=:  clrw %0@+                           \n"
+        "mem_gather16v_zf_loop_%=:  clrw %0@                            \n"
         "mem_gather16v_zf_start_%=: dbf %1, mem_gather16v_zf_loop_%=    \n"
-        : "+a" (dest), "+d" (count)
+        "                           bras mem_gather16v_zf_ustart_%=     \n"
+        "mem_gather16v_zf_uloop_%=: .rept " MEM_XFER16_UNROLL_STR "     \n"
+        "                           clrw %0@                            \n"
+        "                           .endr                               \n"
+        "mem_gather16v_zf_ustart_%=: dbf %2, mem_gather16v_zf_uloop_%=  \n"
+        : "+a" (dest), "+d" (count), "+d" (blocks)
         :
         : "cc", "memory"
     );
@@ -179,15 +245,88 @@ inline void mem_gather16v_zf(vu16 * restrict dest, u16 count)
 #define HAVE_mem_scatter16v
 inline void mem_scatter16v(u16 * restrict dest, vu16 * restrict src, u16 count)
 {
+    u16 blocks = count / MEM_XFER16_UNROLL;
+
+    count %= MEM_XFER16_UNROLL;
+
     asm volatile
     (
         "mem_scatter16v_%=:         bras mem_scatter16v_start_%=        \n"
         "mem_scatter16v_loop_%=:    movew %0@, %1@+                     \n"
         "mem_scatter16v_start_%=:   dbf %2, mem_scatter16v_loop_%=      \n"
-        : "+a" (src), "+a" (dest), "+d" (count)
+        "                           bras mem_scatter16v_ustart_%=       \n"
+        "mem_scatter16v_uloop_%=:   .rept " MEM_XFER16_UNROLL_STR "     \n"
+        "                           movew %0@, %1@+                     \n"
+        "                           .endr                               \n"
+        "mem_scatter16v_ustart_%=:  dbf %3, mem_scatter16v_uloop_%=     \n"
+        : "+a" (src), "+a" (dest), "+d" (count), "+d" (blocks)
+        :
+        : "cc", "memory"
+    );
+};
+
+
+/*
+    mem_scatter16v_bswap() - "scatter" <count> half-words from the volatile source <src> into
+    destination <dest>, swapping the bytes in each half-word.
+*/
+#define HAVE_mem_scatter16v_bswap
+inline void mem_scatter16v_bswap(u16 * restrict dest, vu16 * restrict src, u16 count)
+{
+    u16 blocks = count / MEM_XFER16_UNROLL, tmp;
+
+    count %= MEM_XFER16_UNROLL;
+
+    asm volatile
+    (
+        "mem_scatter16v_bswap_%=:           bras mem_scatter16v_bswap_start_%=      \n"
+        "mem_scatter16v_bswap_loop_%=:      movew %0@, %4                           \n"
+        "                                   rolw #8, %4                             \n"
+        "                                   movew %4, %1@+                          \n"
+        "mem_scatter16v_bswap_start_%=:     dbf %2, mem_scatter16v_bswap_loop_%=    \n"
+        "                                   bras mem_scatter16v_bswap_ustart_%=     \n"
+        "mem_scatter16v_bswap_uloop_%=:     .rept " MEM_XFER16_UNROLL_STR "         \n"
+        "                                   movew %0@, %4                           \n"
+        "                                   rolw #8, %4                             \n"
+        "                                   movew %4, %1@+                          \n"
+        "                                   .endr                                   \n"
+        "mem_scatter16v_bswap_ustart_%=:    dbf %3, mem_scatter16v_bswap_uloop_%=   \n"
+        : "+a" (src), "+a" (dest), "+d" (count), "+d" (blocks), "=&d" (tmp)
         :
         : "cc", "memory"
     );
 };
 
+
+/*
+    mem_copy16v() - copy <count> half-words from the volatile, memory-mapped buffer <src> (e.g. a
+    window onto a peripheral's buffer RAM) to <dest>.  Blocks of 16 half-words are moved through
+    eight registers using movem.l, which costs about 10 cycles per half-word on the MC68000; the
+    remainder is moved one half-word at a time.  Both pointers must be half-word-aligned.  Note
+    that the MC68000 "movem" instruction reads one half-word beyond the end of the block it loads,
+    so the half-word following each block in <src> must be readable without side-effects.
+*/
+#define HAVE_mem_copy16v
+inline void mem_copy16v(u16 * restrict dest, vu16 * restrict src, u16 count)
+{
+    u16 blocks = count / 16;
+
+    count %= 16;
+
+    asm volatile
+    (
+        "mem_copy16v_%=:            bras mem_copy16v_start_%=           \n"
+        "mem_copy16v_loop_%=:       moveml %0@+, %%d2-%%d7/%%a2-%%a3    \n"
+        "                           moveml %%d2-%%d7/%%a2-%%a3, %1@     \n"
+        "                           lea %1@(32), %1                     \n"
+        "mem_copy16v_start_%=:      dbf %3, mem_copy16v_loop_%=         \n"
+        "                           bras mem_copy16v_tstart_%=          \n"
+        "mem_copy16v_tloop_%=:      movew %0@+, %1@+                    \n"
+        "mem_copy16v_tstart_%=:     dbf %2, mem_copy16v_tloop_%=        \n"
+        : "+a" (src), "+a" (dest), "+d" (count), "+d" (blocks)
+        :
+        : "cc", "memory", "d2", "d3", "d4", "d5", "d6", "d7", "a2", "a3"
+    );
+};
+
 #endif
@@ -15,6 +15,7 @@
 #else
 
 #include <driver/encx24j600.h>
+#include <kernel/include/memory/primitives.h>
 #include <kernel/include/memory/slab.h>
 #include <kernel/include/net/ethernet.h>
 #include <kernel/include/net/net.h>
@@ -128,16 +129,16 @@ void encx24j600_rx_buf_peek(dev_t *dev, u16 len, void *out)
 
     curr_part_len = MIN(len, (u16) (rx_buf_top - rx_read_ptr));
 
-    for(len -= curr_part_len; curr_part_len--;)
-        *out16++ = *rx_read_ptr++;
+    /*
+        The RX buffer is read through the controller's memory window, so it can be block-copied.
+        Any over-read past the top of the RX buffer by mem_copy16v() falls in the unused region
+        between the end of the controller's SRAM and its SFRs, and has no side-effects.
+    */
+    mem_copy16v(out16, rx_read_ptr, curr_part_len);
 
-    if(len)
-    {
-        rx_read_ptr = state->rx_buf_start;
-
-        while(len--)
-            *out16++ = *rx_read_ptr++;
-    }
+    /* Copy the remainder, if the data wraps round to the start of the RX buffer */
+    if(len -= curr_part_len)
+        mem_copy16v(out16 + curr_part_len, state->rx_buf_start, len);
 }
 
 
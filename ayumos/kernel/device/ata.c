@@ -16,6 +16,7 @@
 #include <kernel/include/byteorder.h>
 #include <kernel/include/error.h>
 #include <kernel/include/memory/primitives.h>
+#include <kernel/include/preempt.h>
 #include <kernel/util/kutil.h>
 #include <klibc/include/stdio.h>            // FIXME REMOVE
 #include <klibc/include/string.h>
@@ -34,6 +35,16 @@ s32 ata_shut_down(dev_t *dev);
 
 s32 ata_read(dev_t *dev, ku32 offset, u32 *len, void * buf);
 s32 ata_write(dev_t *dev, ku32 offset, u32 *len, const void * buf);
+s32 ata_request(dev_t *dev, ioreq_t *req);
+s32 ata_get_error(void * const base_addr);
+
+s32 ata_begin(dev_t *dev);
+s32 ata_start_command(dev_t *dev);
+s32 ata_poll_drq(dev_t *dev);
+void ata_xfer_block(dev_t *dev);
+void ata_service(dev_t *dev, ku8 status);
+void ata_finish(dev_t *dev, ks32 status);
+void ata_watchdog(void *arg);
 
 void ata_read_data(vu16 * const ata_data_port, void *buf);
 void ata_write_data(vu16 * const ata_data_port, const void *buf);
@@ -50,13 +61,26 @@ blockdev_stats_t g_ata_stats;
 */
 s32 ata_init(dev_t *dev)
 {
+    ata_bus_t *bus;
+    s32 ret;
+
     /* Disable ATA interrupts, and ensure that SRST is cleared for the bus */
     ATA_REG(dev->base_addr, ATA_R_DEVICE_CONTROL) = ATA_DEVICE_CONTROL_NIEN;
 
-    /* TODO: re-enable ATA interrupts... */
-    cpu_irq_add_handler(dev->irql, dev, ata_irq);      /* Install IRQ handler */
+    bus = (ata_bus_t *) CHECKED_KCALLOC(1, sizeof(ata_bus_t));
+    dev->data = bus;
 
-    return SUCCESS;
+    /* Install a watchdog to catch commands whose interrupts never arrive */
+    ret = tick_add_callback(ata_watchdog, dev, ATA_WATCHDOG_INTVL, &bus->watchdog);
+    if(ret != SUCCESS)
+    {
+        kfree(bus);
+        dev->data = NULL;
+        return ret;
+    }
+
+    /* Install IRQ handler.  ATA interrupts are enabled once a drive has been initialised. */
+    return cpu_irq_add_handler(dev->irql, dev, ata_irq);
 }
 
 
@@ -99,13 +123,21 @@ s32 ata_drive_init(dev_t *dev, const ata_drive_t drive)
 
     ret = ata_drive_do_init(dev);
 
+    if(ret == SUCCESS)
+        ret = ioqueue_init(&dev_data->queue, dev, ata_request, ATA_MAX_SECTORS);
+
     if(ret != SUCCESS)
     {
         kfree(dev->data);
         dev->data = NULL;
+        return ret;
     }
 
-    return ret;
+    /* Attach the drive to its bus, and enable interrupts */
+    ((ata_bus_t *) dev->parent->data)->drive[drive] = dev;
+    ATA_REG(dev->base_addr, ATA_R_DEVICE_CONTROL) = 0;
+
+    return SUCCESS;
 }
 
 
@@ -200,6 +232,20 @@ s32 ata_drive_do_init(dev_t *dev)
 
         dev->len = LE2N16(id.log_cyls) * LE2N16(id.log_heads) * LE2N16(id.log_sects_per_log_track);
 
+        /*
+            If the drive supports READ/WRITE MULTIPLE, enable it using the largest block size the
+            drive allows.  This reduces the number of interrupts per transfer.
+        */
+        dev_data->multiple = 0;
+        if(LE2N16(id.sects_per_int_multi) & 0xff)
+        {
+            ku8 multiple = LE2N16(id.sects_per_int_multi) & 0xff;
+
+            ATA_REG(base_addr, ATA_R_SECTOR_COUNT) = multiple;
+            if(ata_send_command(base_addr, drive, ATA_CMD_SET_MULTIPLE_MODE) == SUCCESS)
+                dev_data->multiple = multiple;
+        }
+
         return SUCCESS;
     }
 
@@ -220,26 +266,49 @@ s32 ata_shut_down(dev_t *dev)
 
 
 /*
-    ata_irq() - interrupt service routine
+    ata_irq() - interrupt service routine.  <data> points to the interface device.
 */
 void ata_irq(ku32 irql, void *data)
 {
-    u8 dummy;
+    dev_t * const dev = (dev_t *) data;
+    ata_bus_t * const bus = (ata_bus_t *) dev->data;
+    u8 status;
     UNUSED(irql);
-    UNUSED(data);
 
-    dev_t * const dev = (dev_t *) data;
+    /* Reading the status register clears the pending interrupt */
+    status = ATA_REG(dev->base_addr, ATA_R_STATUS);
 
-    /* Clear pending interrupts */
-    dummy = ATA_REG(dev->base_addr, ATA_R_STATUS);
-    dummy += 0;     /* Silence "set but not used" warning */
+    preempt_disable();
 
-return;
+    if(bus->active != NULL)
+        ata_service(bus->active, status);
 
-    putchar('#');
+    preempt_enable();
+}
+
+
+/*
+    ata_watchdog() - tick callback: fail the command in progress on an interface (<arg>) if the
+    drive has not interrupted in a timely fashion.
+*/
+void ata_watchdog(void *arg)
+{
+    ata_bus_t * const bus = (ata_bus_t *) ((dev_t *) arg)->data;
+    dev_t * const active = bus->active;
+    s32 ret;
 
-    /* TODO: implement this */
-    return;
+    if(active == NULL)
+        return;
+
+    if((s32) (get_ticks() - bus->deadline) >= 0)
+        ata_finish(active, -ETIME);
+    else if(((ata_dev_data_t *) active->data)->await_drq)
+    {
+        /* Supply the first block of a write command if the drive is now ready to accept it */
+        ret = ata_poll_drq(active);
+        if((ret != SUCCESS) && (ret != -EINPROGRESS))
+            ata_finish(active, ret);
+    }
 }
 
 
@@ -278,230 +347,396 @@ s32 ata_send_command(void * const base_addr, const ata_drive_t drive, const ata_
 
 
 /*
-    ata_read() - read sectors from an ATA device
+    ata_read() - read sectors from an ATA device, via the device's request queue
 */
 s32 ata_read(dev_t *dev, ku32 offset, u32 *len, void * buf)
 {
-    void * const base_addr = dev->base_addr;
-    const ata_drive_t drive = ((ata_dev_data_t *) dev->data)->drive;
-    u32 len_ = *len;
+    ata_dev_data_t * const dev_data = (ata_dev_data_t *) dev->data;
 
-    /* Select master / slave device */
-    if(drive == ata_drive_master)
-        ATA_REG(base_addr, ATA_R_DEVICE_HEAD) = 0;
-    else if(drive == ata_drive_slave)
-        ATA_REG(base_addr, ATA_R_DEVICE_HEAD) = ATA_DH_DEV;
-    else
-        return -ENODEV;
+    if((offset + *len < offset) || (offset + *len > dev->len))
+       return -EINVAL;
+
+    return ioqueue_submit(&dev_data->queue, IOREQ_READ, offset, *len, buf);
+}
 
-    if(!ATA_WAIT_NBSY(base_addr))
-        return -ETIME;
 
-    if((offset + len_ < offset) || (offset + len_ > dev->len))
+/*
+    ata_write() - write sectors to an ATA device, via the device's request queue
+*/
+s32 ata_write(dev_t *dev, ku32 offset, u32 *len, const void * buf)
+{
+    ata_dev_data_t * const dev_data = (ata_dev_data_t *) dev->data;
+
+    if((offset + *len < offset) || (offset + *len > dev->len))
        return -EINVAL;
 
-    /* TODO: check that requested # sectors is allowed by the device; split into smaller reads if not. */
+    return ioqueue_submit(&dev_data->queue, IOREQ_WRITE, offset, *len, buf);
+}
 
-    ATA_REG(base_addr, ATA_R_SECTOR_COUNT)      = len_;
 
-    ATA_REG(base_addr, ATA_R_SECTOR_NUMBER)     = offset & 0xff;
-    ATA_REG(base_addr, ATA_R_CYLINDER_LOW)      = (offset >> 8) & 0xff;
-    ATA_REG(base_addr, ATA_R_CYLINDER_HIGH)     = (offset >> 16) & 0xff;
-    ATA_REG(base_addr, ATA_R_DEVICE_HEAD)      |= ATA_DH_LBA | ((offset >> 24) & 0xf);
+/*
+    ata_get_error() - map the contents of the error register, following a failed command, to an
+    error code.
+*/
+s32 ata_get_error(void * const base_addr)
+{
+    ku8 err = ATA_REG(base_addr, ATA_R_ERROR);
 
-    /* Issue the command */
-    ATA_REG(base_addr, ATA_R_COMMAND) = ATA_CMD_READ_SECTORS;
+    if((err & ATA_ERROR_ABRT) || (err & ATA_ERROR_IDNF))
+        return -EINVAL;
+    else if(err & ATA_ERROR_WP)
+        return -EROFS;
+    else if(err & ATA_ERROR_UNC)
+        return -EDATA;
+    else if((err & ATA_ERROR_MC) || (err & ATA_ERROR_MCR))
+        return -EMEDIACHANGED;
+    else if(err & ATA_ERROR_NM)
+        return -ENOMEDIUM;
+    else
+        return -EUNKNOWN;
+}
 
-    if(!ATA_WAIT_NBSY(base_addr))
-        return -ETIME;
 
-    if(ATA_REG(base_addr, ATA_R_STATUS) & ATA_STATUS_ERR)
+/*
+    ata_request() - request queue dispatch function: begin servicing a request from a drive's
+    request queue.  The request may be the head of a run of merged requests for consecutive
+    sectors.  Called with pre-emption disabled.  The request is completed by ata_finish(), which is
+    normally called from the IRQ handler.
+*/
+s32 ata_request(dev_t *dev, ioreq_t *req)
+{
+    ata_dev_data_t * const dev_data = (ata_dev_data_t *) dev->data;
+    ata_bus_t * const bus = (ata_bus_t *) dev->parent->data;
+
+    dev_data->req           = req;
+    dev_data->xfer_req      = req;
+    dev_data->xfer_done     = 0;
+    dev_data->next_block    = req->block;
+    dev_data->remaining     = req->nblocks;
+    dev_data->cmd_remaining = 0;
+
+    /* If the other drive on the bus is busy, the request is started when it finishes */
+    if(bus->active != NULL)
     {
-        ku8 err = ATA_REG(base_addr, ATA_R_ERROR);
-        if((err & ATA_ERROR_ABRT) || (err & ATA_ERROR_IDNF))
-            return -EINVAL;
-        else if(err & ATA_ERROR_UNC)
-            return -EDATA;
-        else if((err & ATA_ERROR_MC) || (err & ATA_ERROR_MCR))
-            return -EMEDIACHANGED;
-        else if(err & ATA_ERROR_NM)
-            return -ENOMEDIUM;
-        else
-            return -EUNKNOWN;
+        dev_data->pending = 1;
+        return -EINPROGRESS;
     }
 
-    for(; len_--; buf += ATA_SECTOR_SIZE)
-        ata_read_data(ATA_REG_DATA_ADDR(base_addr), buf);
+    return ata_begin(dev);
+}
 
-    g_ata_stats.blocks_read += *len;
-    *len -= len_;
 
-    return SUCCESS;
+/*
+    ata_begin() - take control of the bus and issue the first command for a drive's current request.
+    Returns -EINPROGRESS on success.
+*/
+s32 ata_begin(dev_t *dev)
+{
+    ata_dev_data_t * const dev_data = (ata_dev_data_t *) dev->data;
+    ata_bus_t * const bus = (ata_bus_t *) dev->parent->data;
+    s32 ret;
+
+    dev_data->pending = 0;
+    bus->active = dev;
+
+    ret = ata_start_command(dev);
+    if(ret != SUCCESS)
+    {
+        bus->active = NULL;
+        dev_data->req = NULL;
+        return ret;
+    }
+
+    return -EINPROGRESS;
 }
 
 
 /*
-    ata_write() - write sectors to an ATA device
+    ata_start_command() - issue a READ or WRITE command covering as much as possible of the part of
+    the current request which has not yet been covered by a command.  Large requests are split into
+    commands of at most ATA_MAX_SECTORS sectors.
 */
-s32 ata_write(dev_t *dev, ku32 offset, u32 *len, const void * buf)
+s32 ata_start_command(dev_t *dev)
 {
     void * const base_addr = dev->base_addr;
-    const ata_drive_t drive = ((ata_dev_data_t *) dev->data)->drive;
-    u32 len_ = *len;
+    ata_dev_data_t * const dev_data = (ata_dev_data_t *) dev->data;
+    ata_bus_t * const bus = (ata_bus_t *) dev->parent->data;
+    ku32 offset = dev_data->next_block, count = MIN(dev_data->remaining, (u32) ATA_MAX_SECTORS);
+    ata_command_t cmd;
+    u32 u;
+    s32 ret;
 
     /* Select master / slave device */
-    if(drive == ata_drive_master)
-        ATA_REG(base_addr, ATA_R_DEVICE_HEAD) &= ~ATA_DH_DEV;
-    else if(drive == ata_drive_slave)
-        ATA_REG(base_addr, ATA_R_DEVICE_HEAD) |= ATA_DH_DEV;
+    if(dev_data->drive == ata_drive_master)
+        ATA_REG(base_addr, ATA_R_DEVICE_HEAD) = 0;
+    else if(dev_data->drive == ata_drive_slave)
+        ATA_REG(base_addr, ATA_R_DEVICE_HEAD) = ATA_DH_DEV;
     else
         return -ENODEV;
 
     if(!ATA_WAIT_NBSY(base_addr))
         return -ETIME;
 
-    if((offset + len_ < offset) || (offset + len_ > dev->len))
-       return -EINVAL;
-
-    /* TODO: check that requested # sectors is allowed by the device; split into smaller reads if not. */
-
-    ATA_REG(base_addr, ATA_R_SECTOR_COUNT)      = len_;
+    /* A sector count of zero means 256 sectors */
+    ATA_REG(base_addr, ATA_R_SECTOR_COUNT)      = count & 0xff;
 
     ATA_REG(base_addr, ATA_R_SECTOR_NUMBER)     = offset & 0xff;
     ATA_REG(base_addr, ATA_R_CYLINDER_LOW)      = (offset >> 8) & 0xff;
     ATA_REG(base_addr, ATA_R_CYLINDER_HIGH)     = (offset >> 16) & 0xff;
     ATA_REG(base_addr, ATA_R_DEVICE_HEAD)      |= ATA_DH_LBA | ((offset >> 24) & 0xf);
 
+    if(dev_data->req->dir == IOREQ_READ)
+        cmd = dev_data->multiple ? ATA_CMD_READ_MULTIPLE : ATA_CMD_READ_SECTORS;
+    else
+        cmd = dev_data->multiple ? ATA_CMD_WRITE_MULTIPLE : ATA_CMD_WRITE_SECTORS;
+
+    dev_data->next_block    += count;
+    dev_data->remaining     -= count;
+    dev_data->cmd_remaining  = count;
+
+    bus->deadline = get_ticks() + ATA_CMD_TIMEOUT;
+
     /* Issue the command */
-    ATA_REG(base_addr, ATA_R_COMMAND) = ATA_CMD_WRITE_SECTORS;
+    ATA_REG(base_addr, ATA_R_COMMAND) = cmd;
 
-    if(buf != NULL)
+    if(dev_data->req->dir == IOREQ_WRITE)
     {
-        for(; len_--; buf += ATA_SECTOR_SIZE)
-            ata_write_data(ATA_REG_DATA_ADDR(base_addr), buf);
-    }
-    else
-    {
-        while(len_--)
-            ata_write_data(ATA_REG_DATA_ADDR(base_addr), buf);
+        /*
+            The drive does not interrupt before accepting the first block of a write.  Poll briefly
+            for DRQ, then supply the block; if the drive is slower than that, the block is supplied
+            by the watchdog, rather than spinning here with pre-emption disabled.  Subsequent
+            blocks are supplied from the IRQ handler.
+        */
+        dev_data->await_drq = 1;
+
+        for(u = ATA_DRQ_POLL_VAL; u; --u)
+        {
+            ret = ata_poll_drq(dev);
+            if(ret != -EINPROGRESS)
+                return ret;
+        }
     }
 
+    return SUCCESS;
+}
 
-    if(!ATA_WAIT_NBSY(base_addr))
-        return -ETIME;
 
-    /* Did an error occur? */
-    if(ATA_REG(base_addr, ATA_R_STATUS) & ATA_STATUS_ERR)
-    {
-        ku8 err = ATA_REG(base_addr, ATA_R_ERROR);
-        if((err & ATA_ERROR_ABRT) || (err & ATA_ERROR_IDNF))
-            return -EINVAL;
-        else if(err & ATA_ERROR_WP)
-            return -EROFS;
-        else if(err & ATA_ERROR_UNC)
-            return -EDATA;
-        else if((err & ATA_ERROR_MC) || (err & ATA_ERROR_MCR))
-            return -EMEDIACHANGED;
-        else if(err & ATA_ERROR_NM)
-            return -ENOMEDIUM;
-        else
-            return -EUNKNOWN;
-    }
+/*
+    ata_poll_drq() - if the drive is ready to accept the first block of the current write command,
+    supply it.  Returns SUCCESS if the block was supplied, -EINPROGRESS if the drive is not yet
+    ready, or an error code.  Called with pre-emption disabled.
+*/
+s32 ata_poll_drq(dev_t *dev)
+{
+    ata_dev_data_t * const dev_data = (ata_dev_data_t *) dev->data;
+    ku8 status = ATA_REG(dev->base_addr, ATA_R_ALT_STATUS);
 
-    g_ata_stats.blocks_written += *len;
-    *len -= len_;
+    if(status & ATA_STATUS_BSY)
+        return -EINPROGRESS;
+
+    if(status & ATA_STATUS_ERR)
+        return ata_get_error(dev->base_addr);
+
+    if(!(status & ATA_STATUS_DRQ))
+        return -EINPROGRESS;
+
+    dev_data->await_drq = 0;
+    ata_xfer_block(dev);
 
     return SUCCESS;
 }
 
 
 /*
-    ata_read_data() - read from the ATA data buffer
+    ata_xfer_block() - transfer one DRQ data block (one sector, or <multiple> sectors if
+    READ/WRITE MULTIPLE is in use) between the drive and the buffers of the current request.
 */
-void ata_read_data(vu16 * const ata_data_port, void *buf)
+void ata_xfer_block(dev_t *dev)
 {
-    u16 *buf_ = (u16 *) buf;
+    ata_dev_data_t * const dev_data = (ata_dev_data_t *) dev->data;
+    vu16 * const port = ATA_REG_DATA_ADDR(dev->base_addr);
+    const ioreq_dir_t dir = dev_data->req->dir;
+    u32 count = dev_data->multiple ? MIN(dev_data->multiple, dev_data->cmd_remaining) : 1;
 
-#ifdef BUG_ATA_BYTE_SWAP
-    u16 count;
+    dev_data->cmd_remaining -= count;
 
-    for(count = ATA_SECTOR_SIZE / sizeof(u16); count; count--)
+    for(; count--;)
     {
-        /*
-            The lambda rev0 pcb has its ATA data bus connected to the CPU data bus as:
+        ioreq_t * const r = dev_data->xfer_req;
+        u8 * const buf = (r->buf != NULL) ?
+                            (u8 *) r->buf + (dev_data->xfer_done << ATA_LOG_SECTOR_SIZE) : NULL;
 
-                ATA_D[15..8] <=> CPU_D[15..8]
-                ATA_D[7..0]  <=> CPU_D[7..0]
+        if(dir == IOREQ_READ)
+            ata_read_data(port, buf);
+        else
+            ata_write_data(port, buf);
 
-            This seems correct but creates interop problems with volumes created on little-endian
-            hosts.  The desired electrical arrangement is:
+        /* Move on to the next request in the run, if this one is complete */
+        if(++dev_data->xfer_done == r->count)
+        {
+            dev_data->xfer_req = r->next_merged;
+            dev_data->xfer_done = 0;
+        }
+    }
+}
 
-                ATA_D[15..8] <=> CPU_D[7..0]
-                ATA_D[7..0]  <=> CPU_D[15..8]
 
-            ...i.e. byte-swapping.  This results in single bytes, being stored in memory in the
-            "correct" order when read from / written to little-endian file systems.  Note that
-            16-/32-bit (or larger) numerics need to be converted to target endianness under this
-            arrangement.
+/*
+    ata_service() - handle an interrupt from the drive executing a command.  <status> is the value
+    read from the status register.  Called with pre-emption disabled.
+*/
+void ata_service(dev_t *dev, ku8 status)
+{
+    ata_dev_data_t * const dev_data = (ata_dev_data_t *) dev->data;
+    ata_bus_t * const bus = (ata_bus_t *) dev->parent->data;
+    s32 ret;
 
-           If the BUG_ATA_BYTE_SWAP constant is defined, we therefore swap the bytes in each 16-bit
-           datum read/written in order to work round the incorrect board design.
-        */
-        u16 data = *ata_data_port;
-        bswap_16(data);
-        *buf_++ = data;
+    if(status & ATA_STATUS_BSY)
+        return;
+
+    if(status & ATA_STATUS_ERR)
+    {
+        ata_finish(dev, ata_get_error(dev->base_addr));
+        return;
     }
-#else
-    mem_scatter16v(buf_, ata_data_port, ATA_SECTOR_SIZE / sizeof(u16));
-#endif
+
+    /* The drive should not interrupt before accepting a write command's first block */
+    if(dev_data->await_drq)
+    {
+        ret = ata_poll_drq(dev);
+        if((ret != SUCCESS) && (ret != -EINPROGRESS))
+            ata_finish(dev, ret);
+
+        return;
+    }
+
+    bus->deadline = get_ticks() + ATA_CMD_TIMEOUT;
+
+    if(dev_data->req->dir == IOREQ_READ)
+    {
+        /* A data block is ready to be read */
+        if(!(status & ATA_STATUS_DRQ))
+        {
+            ata_finish(dev, -EDEVOPFAILED);
+            return;
+        }
+
+        ata_xfer_block(dev);
+    }
+    else if(dev_data->cmd_remaining)
+    {
+        /* The previous block has been written; the drive is ready for the next block */
+        ata_xfer_block(dev);
+        return;
+    }
+
+    if(dev_data->cmd_remaining)
+        return;
+
+    /* The command is complete.  Issue another, if the request was split. */
+    if(dev_data->remaining)
+    {
+        ret = ata_start_command(dev);
+        if(ret != SUCCESS)
+            ata_finish(dev, ret);
+
+        return;
+    }
+
+    if(dev_data->req->dir == IOREQ_READ)
+    {
+        ++g_ata_stats.reads;
+        g_ata_stats.blocks_read += dev_data->req->nblocks;
+    }
+    else
+    {
+        ++g_ata_stats.writes;
+        g_ata_stats.blocks_written += dev_data->req->nblocks;
+    }
+
+    ata_finish(dev, SUCCESS);
 }
 
 
 /*
-    ata_write_data() - write a sector to the ATA data buffer
+    ata_finish() - complete a drive's current request with status <status>, release the bus, and
+    start the next request, either on the same drive or on the other drive on the bus.  Called with
+    pre-emption disabled.
 */
-void ata_write_data(vu16 * const ata_data_port, const void *buf)
+void ata_finish(dev_t *dev, ks32 status)
 {
-    if(buf != NULL)
+    ata_dev_data_t * const dev_data = (ata_dev_data_t *) dev->data;
+    ata_bus_t * const bus = (ata_bus_t *) dev->parent->data;
+    u32 i;
+
+    bus->active = NULL;
+    dev_data->req = NULL;
+    dev_data->await_drq = 0;
+
+    /* Give the bus to a request which was waiting for it, if there is one */
+    for(i = 0; (bus->active == NULL) && (i < ARRAY_COUNT(bus->drive)); ++i)
     {
-#ifdef BUG_ATA_BYTE_SWAP
-        ku16 * const end = (ku16 *) ((u8 *) buf + ATA_SECTOR_SIZE), *buf_;
+        dev_t * const d = bus->drive[i];
 
-        for(buf_ = buf; buf_ != end;)
+        if((d != NULL) && ((ata_dev_data_t *) d->data)->pending)
         {
-            /*
-                The lambda rev0 pcb has its ATA data bus connected to the CPU data bus as:
+            ks32 ret = ata_begin(d);
+            if(ret != -EINPROGRESS)
+                ioqueue_done(&((ata_dev_data_t *) d->data)->queue, ret);
+        }
+    }
+
+    /* Complete the request; this may start (or defer) the drive's next request */
+    ioqueue_done(&dev_data->queue, status);
+}
 
-                    ATA_D[15..8] <=> CPU_D[15..8]
-                    ATA_D[7..0]  <=> CPU_D[7..0]
 
-                This seems correct but creates interop problems with volumes created on
-                little-endian hosts.  The desired electrical arrangement is:
+/*
+    The lambda rev0 pcb has its ATA data bus connected to the CPU data bus as:
 
-                    ATA_D[15..8] <=> CPU_D[7..0]
-                    ATA_D[7..0]  <=> CPU_D[15..8]
+        ATA_D[15..8] <=> CPU_D[15..8]
+        ATA_D[7..0]  <=> CPU_D[7..0]
 
-                ...i.e. byte-swapping.  This results in single bytes, being stored in memory in the
-                "correct" order when read from / written to little-endian file systems.  Note that
-                16-/32-bit (or larger) numerics need to be converted to target endianness under this
-                arrangement.
+    This seems correct but creates interop problems with volumes created on little-endian hosts.
+    The desired electrical arrangement is:
 
-               If the BUG_ATA_BYTE_SWAP constant is defined, we therefore swap the bytes in each
-               16-bit datum read/written in order to work round the incorrect board design.
-            */
-            u16 data = *buf_++;
-            bswap_16(data);
-            *ata_data_port = data;
-        }
+        ATA_D[15..8] <=> CPU_D[7..0]
+        ATA_D[7..0]  <=> CPU_D[15..8]
+
+    ...i.e. byte-swapping.  This results in single bytes, being stored in memory in the "correct"
+    order when read from / written to little-endian file systems.  Note that 16-/32-bit (or larger)
+    numerics need to be converted to target endianness under this arrangement.
+
+    If the BUG_ATA_BYTE_SWAP constant is defined, we therefore swap the bytes in each 16-bit datum
+    read/written in order to work round the incorrect board design.
+*/
+#ifdef BUG_ATA_BYTE_SWAP
+#define ata_data_in     mem_scatter16v_bswap
+#define ata_data_out    mem_gather16v_bswap
 #else
-        mem_gather16v(ata_data_port, buf, ATA_SECTOR_SIZE / sizeof(u16));
+#define ata_data_in     mem_scatter16v
+#define ata_data_out    mem_gather16v
 #endif
-    }
+
+
+/*
+    ata_read_data() - read a sector from the ATA data buffer
+*/
+void ata_read_data(vu16 * const ata_data_port, void *buf)
+{
+    ata_data_in((u16 *) buf, ata_data_port, ATA_SECTOR_SIZE / sizeof(u16));
+}
+
+
+/*
+    ata_write_data() - write a sector to the ATA data buffer
+*/
+void ata_write_data(vu16 * const ata_data_port, const void *buf)
+{
+    if(buf != NULL)
+        ata_data_out(ata_data_port, (ku16 *) buf, ATA_SECTOR_SIZE / sizeof(u16));
     else
-    {
-        /* Zero-fill the sector */
-        mem_gather16v_zf(ata_data_port, ATA_SECTOR_SIZE / sizeof(u16));
-    }
+        mem_gather16v_zf(ata_data_port, ATA_SECTOR_SIZE / sizeof(u16));     /* Zero-fill */
 }
 
 
@@ -553,6 +788,10 @@ s32 ata_drive_control(dev_t *dev, const devctl_fn_t fn, const void *in, void *ou
             *((s8 **) out) = ((ata_dev_data_t *) dev->data)->firmware;
             break;
 
+        case dc_get_ioqueue_stats:
+            *((ioqueue_stats_t *) out) = ((ata_dev_data_t *) dev->data)->queue.stats;
+            break;
+
         default:
             return -ENOSYS;
     }
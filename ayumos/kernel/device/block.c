@@ -6,9 +6,28 @@
 
     (c) Stuart Wallace, November 2016.
 
-    NOTE: this abstraction assumes a 512-byte block size.  This is likely to become a problem.
     NOTE: the block cache statistics object is not protected by locking.  The values stored in this
           object should therefore be regarded as approximate.
+
+    The cache stores blocks whose size is chosen per-device (see block_cache_set_block_size()); the
+    default is BLOCK_SIZE bytes.  All accesses to a device, regardless of their size, are mapped
+    onto the device's cache blocks, so a BLOCK_SIZE-byte access to a device cached in 4KB blocks
+    is satisfied from (and kept coherent with) the 4KB block containing it.
+
+    The cache memory is a single array of BLOCK_SIZE-byte units, grouped into lines of
+    BC_LINE_UNITS units.  A cache block of (BLOCK_SIZE << shift) bytes is stored at a unit index
+    aligned to (1 << shift); the descriptor for the first unit of the block describes the whole
+    block.  Each line is protected by the semaphore in the descriptor of its first unit.
+
+    The cache also holds "pages": BLOCK_SIZE-byte blocks of objects other than devices, identified
+    by an object pointer and a page number.  The VFS uses pages to cache file data (see vfs_read()),
+    so file data and device blocks share the cache memory.  A page may be dirty, i.e. newer than
+    the copy held by its owner.  The cache cannot write back a dirty page itself, because doing so
+    requires a call into a file system driver, which would in turn use the cache; so dirty pages
+    are pinned until their owner writes them back with block_cache_page_flush().  A device block
+    which maps onto a slot occupied by a dirty page is transferred without being cached.  The number
+    of dirty pages is limited to a fraction of the cache; once the limit is reached, the owner must
+    write new data through to its backing store.
 */
 
 #include <kernel/include/device/block.h>
@@ -22,105 +41,273 @@
 
 static block_cache_t bc;
 
-u32 block_cache_get_slot(const dev_t *dev, ku32 block);
+static u32 block_cache_get_slot(const void * const key, ku32 block, ku32 shift);
+static s32 block_cache_evict(block_descriptor_t * const bd);
+static s32 block_cache_evict_range(ku32 slot, ku32 shift);
+static s32 block_cache_read_part(dev_t * const dev, ku32 block, ku32 offset, ku32 count,
+                                 void *buf);
+static s32 block_cache_write_part(dev_t * const dev, ku32 block, ku32 offset, ku32 count,
+                                  const void *buf);
+static block_descriptor_t *block_cache_find_page(const void * const obj, ku32 page, ku32 slot);
+static u32 block_cache_present(const dev_t * const dev, ku32 block);
+static s32 block_cache_read_run(dev_t * const dev, ku32 block, ku32 count, void *buf);
 
 
 /*
-    block_cache_init() - initialise a fixed-size block cache
+    block_cache_init() - initialise a fixed-size block cache.  <size> is the size of the cache in
+    BLOCK_SIZE-byte units; it is rounded down to a whole number of cache lines.
 */
 s32 block_cache_init(ku32 size)
 {
+    ku32 nblocks = size & ~(BC_LINE_UNITS - 1);
     u32 i;
 
-    bc.descriptors = (block_descriptor_t *) umalloc(size * sizeof(block_descriptor_t));
+    bc.descriptors = (block_descriptor_t *) umalloc(nblocks * sizeof(block_descriptor_t));
     if(!bc.descriptors)
         return -ENOMEM;
 
-    bc.cache = (u8 *) umalloc(size * BLOCK_SIZE);
+    bc.cache = (u8 *) umalloc(nblocks * BLOCK_SIZE);
     if(!bc.cache)
     {
         ufree(bc.descriptors);
         return -ENOMEM;
     }
 
-    for(i = 0; i < size; ++i)
+    for(i = 0; i < nblocks; ++i)
     {
         bc.descriptors[i] = (block_descriptor_t)
         {
             .dev   = NULL,
+            .obj   = NULL,
             .block = 0,
-            .flags = 0
+            .flags = 0,
+            .shift = 0
         };
 
         sem_init(&bc.descriptors[i].sem);
     }
 
     bc.stats = (block_cache_stats_t) {0};
-    bc.nblocks = size;
+    bc.nblocks = nblocks;
+    bc.write_seq = 0;
 
-    printf("block cache: allocated %u bytes (%u blocks)\n", size * BLOCK_SIZE, size);
+    printf("block cache: allocated %u bytes (%u blocks)\n", nblocks * BLOCK_SIZE, nblocks);
     return SUCCESS;
 }
 
 
 /*
-    block_cache_get_slot() - return the slot in which a cached block must be stored.
+    block_cache_get_slot() - return the index of the unit at which a cache block of size
+    (BLOCK_SIZE << shift) must be stored.  <key> is the device or object containing the block.
 */
-u32 block_cache_get_slot(const dev_t * const dev, ku32 block)
+static u32 block_cache_get_slot(const void * const key, ku32 block, ku32 shift)
 {
-    return (((addr_t) dev ^ block) * GREAT_BIG_PRIME) % bc.nblocks;
+    u32 hash = ((addr_t) key ^ block) * GREAT_BIG_PRIME;
+
+    /* Fold the high bits into the low bits.  Without this, if the number of slots is a power of
+       two, blocks whose numbers differ by a multiple of the number of slots always collide - e.g.
+       the same metadata block in successive ext2 block groups. */
+    hash ^= hash >> 16;
+
+    return (hash % (bc.nblocks >> shift)) << shift;
 }
 
 
 /*
-    block_read() - read a block, using the block cache.
+    block_cache_in_use() - return non-zero if the descriptor <bd> describes a cached block or page.
 */
-s32 block_read(dev_t * const dev, ku32 block, void *buf)
+static inline u32 block_cache_in_use(const block_descriptor_t * const bd)
 {
-    block_descriptor_t *bd;
-    void *data;
-    u32 slot, one = 1;
-    s32 ret;
+    return (bd->dev != NULL) || (bd->flags & BC_PAGE);
+}
+
+
+/*
+    block_cache_line() - return the descriptor whose semaphore protects the line containing <slot>.
+*/
+static inline block_descriptor_t *block_cache_line(ku32 slot)
+{
+    return bc.descriptors + (slot & ~(BC_LINE_UNITS - 1));
+}
+
+
+/*
+    block_cache_evict() - write back the cache block described by <bd>, if it is dirty, and mark
+    the descriptor as unused.  Dirty pages cannot be evicted; fail with EBUSY if <bd> describes
+    one.  The caller must hold the line semaphore.
+*/
+static s32 block_cache_evict(block_descriptor_t * const bd)
+{
+    if(bd->flags & BC_PAGE)
+    {
+        if(bd->flags & BC_DIRTY)
+            return -EBUSY;
+
+        bd->obj = NULL;
+        bd->flags = 0;
+        return SUCCESS;
+    }
+
+    if(bd->dev == NULL)
+        return SUCCESS;
+
+    if(bd->flags & BC_DIRTY)
+    {
+        void * const data = bc.cache + ((bd - bc.descriptors) * BLOCK_SIZE);
+        u32 len = 1 << bd->shift;
+        s32 ret;
+
+        ret = bd->dev->write(bd->dev, bd->block << bd->shift, &len,
+                             (bd->flags & BC_ZERO) ? NULL : data);
+        if(ret != SUCCESS)
+            return ret;
+
+        ++bc.stats.evictions;
+    }
+
+    bd->dev = NULL;
+    bd->flags = 0;
+
+    return SUCCESS;
+}
+
+
+/*
+    block_cache_evict_range() - evict all cache blocks which overlap the (1 << shift) units
+    starting at <slot>.  The caller must hold the line semaphore.
+*/
+static s32 block_cache_evict_range(ku32 slot, ku32 shift)
+{
+    ku32 line = slot & ~(BC_LINE_UNITS - 1), end = slot + (1 << shift);
+    u32 u;
+
+    for(u = line; u < line + BC_LINE_UNITS; ++u)
+    {
+        block_descriptor_t * const bd = bc.descriptors + u;
+
+        if(block_cache_in_use(bd) && (u < end) && ((u + (1 << bd->shift)) > slot))
+        {
+            ks32 ret = block_cache_evict(bd);
+            if(ret != SUCCESS)
+                return ret;
+        }
+    }
+
+    return SUCCESS;
+}
+
+
+/*
+    block_cache_set_block_size() - set the size of the blocks in which <dev> is cached.  <size>
+    must be a power of two between BLOCK_SIZE and (BLOCK_SIZE << BC_MAX_SHIFT).  Any blocks
+    belonging to the device which are already present in the cache are written back (if dirty)
+    and discarded.
+*/
+s32 block_cache_set_block_size(dev_t * const dev, ku32 size)
+{
+    u32 shift, line, u;
 
     if(dev->type != DEV_TYPE_BLOCK)
         return -EINVAL;
 
-    if(!bc.nblocks)
-        return dev->read(dev, 0, &one, buf);
+    for(shift = 0; ((u32) BLOCK_SIZE << shift) < size; ++shift)
+        ;
 
-    slot = block_cache_get_slot(dev, block);
-    bd = bc.descriptors + slot;
-    data = bc.cache + (slot * BLOCK_SIZE);
+    if((shift > BC_MAX_SHIFT) || (((u32) BLOCK_SIZE << shift) != size))
+        return -EINVAL;
 
-    sem_acquire(&bd->sem);
+    if(shift == dev->cache_block_shift)
+        return SUCCESS;
 
-    if((bd->dev != dev) || (bd->block != block))
+    for(line = 0; line < bc.nblocks; line += BC_LINE_UNITS)
     {
-        if(bd->flags & BC_DIRTY)
+        block_descriptor_t * const ld = bc.descriptors + line;
+
+        sem_acquire(&ld->sem);
+
+        for(u = line; u < line + BC_LINE_UNITS; ++u)
         {
-            /* Descriptor in use; block is dirty; evict it. */
-            ret = bd->dev->write(bd->dev, bd->block, &one, (bd->flags & BC_ZERO) ? NULL : data);
-            if(ret < 1)
+            if(bc.descriptors[u].dev == dev)
             {
-                sem_release(&bd->sem);
-                return (ret == 0) ? -EWRITE : ret;
+                ks32 ret = block_cache_evict(bc.descriptors + u);
+                if(ret != SUCCESS)
+                {
+                    sem_release(&ld->sem);
+                    return ret;
+                }
             }
+        }
 
-            ++bc.stats.evictions;
-            bd->flags = 0;
+        sem_release(&ld->sem);
+    }
+
+    dev->cache_block_shift = shift;
+
+    return SUCCESS;
+}
+
+
+/*
+    block_cache_read_part() - read <count> BLOCK_SIZE-byte units, starting <offset> units into
+    cache block <block> of device <dev>, into <buf>.
+*/
+static s32 block_cache_read_part(dev_t * const dev, ku32 block, ku32 offset, ku32 count,
+                                 void *buf)
+{
+    ku32 shift = dev->cache_block_shift, slot = block_cache_get_slot(dev, block, shift);
+    block_descriptor_t * const bd = bc.descriptors + slot, * const ld = block_cache_line(slot);
+    u8 * const data = bc.cache + (slot * BLOCK_SIZE);
+    s32 ret;
+
+    sem_acquire(&ld->sem);
+
+    if((bd->dev != dev) || (bd->block != block) || (bd->shift != shift))
+    {
+        ku32 first = block << shift;
+        u32 len = 1 << shift;
+
+        ret = block_cache_evict_range(slot, shift);
+        if(ret != SUCCESS)
+        {
+            sem_release(&ld->sem);
+
+            if(ret != -EBUSY)
+                return ret;
+
+            /* The slot is pinned by a dirty page: read the units directly into <buf> */
+            len = count;
+            ++bc.stats.misses;
+            ++bc.stats.reads;
+
+            return dev->read(dev, first + offset, &len, buf);
+        }
+
+        /* Don't try to read beyond the end of the device */
+        if(dev->len && ((first + len) > dev->len))
+        {
+            if(first >= dev->len)
+            {
+                sem_release(&ld->sem);
+                return -EINVAL;
+            }
+
+            len = dev->len - first;
+            bzero(data + (len * BLOCK_SIZE), ((1 << shift) - len) * BLOCK_SIZE);
         }
 
         /* Read new block into slot */
-        ret = dev->read(dev, block, &one, data);
-        if(ret < 0)
+        ret = dev->read(dev, first, &len, data);
+        if(ret != SUCCESS)
         {
-            sem_release(&bd->sem);
-            return (ret == 0) ? -EREAD : ret;
+            sem_release(&ld->sem);
+            return ret;
         }
 
         /* Update descriptor */
         bd->dev = dev;
         bd->block = block;
+        bd->shift = shift;
+        bd->flags = 0;
 
         ++bc.stats.misses;
     }
@@ -130,103 +317,234 @@ s32 block_read(dev_t * const dev, ku32 block, void *buf)
     ++bc.stats.reads;
 
     if(bd->flags & BC_ZERO)
-        bzero(buf, BLOCK_SIZE);
+        bzero(buf, count * BLOCK_SIZE);
     else
-        memcpy(buf, data, BLOCK_SIZE);
+        memcpy(buf, data + (offset * BLOCK_SIZE), count * BLOCK_SIZE);
 
-    sem_release(&bd->sem);
+    sem_release(&ld->sem);
 
     return SUCCESS;
 }
 
 
 /*
-    block_write() - write a block, via the block cache.
+    block_cache_present() - return non-zero if cache block <block> of device <dev> is present in the
+    cache.  The line semaphore is not taken, so the result is only a hint.
 */
-s32 block_write(dev_t * const dev, ku32 block, const void * const buf)
+static u32 block_cache_present(const dev_t * const dev, ku32 block)
+{
+    ku32 shift = dev->cache_block_shift;
+    const block_descriptor_t * const bd = bc.descriptors + block_cache_get_slot(dev, block, shift);
+
+    return (bd->dev == dev) && (bd->block == block) && (bd->shift == shift);
+}
+
+
+/*
+    block_cache_read_run() - read <count> BLOCK_SIZE-byte units, starting at unit <block> of device
+    <dev>, into <buf> with a single device request, then copy each cache block read into the cache.
+    The run must consist of whole cache blocks, none of which was present in the cache.  As writes
+    are passed through to the device, the device's copy of an uncached block is always current.
+    The line semaphores are not held during the read, so a write made while the read is in progress
+    may leave the data read out of date; if any write was made, the blocks are not cached.
+*/
+static s32 block_cache_read_run(dev_t * const dev, ku32 block, ku32 count, void *buf)
 {
-    block_descriptor_t *bd;
-    void *data;
-    u32 slot, one = 1;
+    ku32 shift = dev->cache_block_shift, write_seq = bc.write_seq;
+    u32 len = count, u;
     s32 ret;
 
-    if(dev->type != DEV_TYPE_BLOCK)
-        return -EINVAL;
+    ret = dev->read(dev, block, &len, buf);
+    if(ret != SUCCESS)
+        return ret;
 
-    if(!bc.nblocks)
+    for(u = 0; u < count; u += 1 << shift)
     {
-        ret = dev->write(dev, 0, &one, buf);
-        if(ret < 1)
-            return (ret == 0) ? -EWRITE : ret;
+        ku32 cblock = (block + u) >> shift, slot = block_cache_get_slot(dev, cblock, shift);
+        block_descriptor_t * const bd = bc.descriptors + slot, * const ld = block_cache_line(slot);
+
+        sem_acquire(&ld->sem);
+
+        /*
+            Skip blocks cached in the meantime, and slots pinned by dirty pages.  Cache nothing if
+            a write was made during the read, as the block written might be in the run.
+        */
+        if((bc.write_seq == write_seq)
+           && ((bd->dev != dev) || (bd->block != cblock) || (bd->shift != shift))
+           && (block_cache_evict_range(slot, shift) == SUCCESS))
+        {
+            memcpy(bc.cache + (slot * BLOCK_SIZE), (u8 *) buf + (u * BLOCK_SIZE),
+                   BLOCK_SIZE << shift);
 
-        return SUCCESS;
+            bd->dev = dev;
+            bd->block = cblock;
+            bd->shift = shift;
+            bd->flags = 0;
+        }
+
+        sem_release(&ld->sem);
+
+        ++bc.stats.misses;
+        ++bc.stats.reads;
     }
 
-    slot = block_cache_get_slot(dev, block);
-    bd = bc.descriptors + slot;
-    data = bc.cache + (slot * BLOCK_SIZE);
+    return SUCCESS;
+}
+
+
+/*
+    block_cache_write_part() - write <count> BLOCK_SIZE-byte units from <buf>, starting <offset>
+    units into cache block <block> of device <dev>.  If <buf> is NULL, the units are zero-filled.
+    Writes are passed through to the device immediately.  A cache block is allocated for the write
+    only if the write covers the whole block; otherwise an existing cached copy is updated.
+*/
+static s32 block_cache_write_part(dev_t * const dev, ku32 block, ku32 offset, ku32 count,
+                                  const void *buf)
+{
+    ku32 shift = dev->cache_block_shift, slot = block_cache_get_slot(dev, block, shift);
+    block_descriptor_t * const bd = bc.descriptors + slot, * const ld = block_cache_line(slot);
+    u8 * const data = bc.cache + (slot * BLOCK_SIZE);
+    ku32 whole = (offset == 0) && (count == (1U << shift));
+    u32 len = count;
+    s32 ret;
+
+    sem_acquire(&ld->sem);
 
-    sem_acquire(&bd->sem);
+    /* Write the data to the device */
+    ret = dev->write(dev, (block << shift) + offset, &len, buf);
+    ++bc.write_seq;
+    if(ret != SUCCESS)
+    {
+        sem_release(&ld->sem);
+        return ret;
+    }
 
-    if((bd->dev != dev) || (bd->block != block))
+    if((bd->dev == dev) && (bd->block == block) && (bd->shift == shift))
     {
-        if(bd->flags & BC_DIRTY)
+        /* Block is present in the cache: update the cached copy */
+        if(whole)
         {
-            /* Descriptor in use; block is dirty; evict it. */
-            ret = bd->dev->write(bd->dev, bd->block, &one, (bd->flags & BC_ZERO) ? NULL : data);
-            if(ret < 1)
+            if(buf != NULL)
+                memcpy(data, buf, count * BLOCK_SIZE);
+
+            bd->flags = (buf == NULL) ? BC_ZERO : 0;
+        }
+        else if(buf != NULL)
+        {
+            if(bd->flags & BC_ZERO)
             {
-                sem_release(&bd->sem);
-                return (ret < 1) ? -EWRITE : ret;
+                bzero(data, BLOCK_SIZE << shift);
+                bd->flags &= ~BC_ZERO;
             }
 
-            ++bc.stats.evictions;
-            bd->flags = 0;
+            memcpy(data + (offset * BLOCK_SIZE), buf, count * BLOCK_SIZE);
         }
+        else if(!(bd->flags & BC_ZERO))
+            bzero(data + (offset * BLOCK_SIZE), count * BLOCK_SIZE);
 
-        ++bc.stats.misses;
+        ++bc.stats.hits;
     }
     else
-        ++bc.stats.hits;
-
-    /* Write the data to the device */
-    ret = dev->write(dev, block, &one, buf);
-    if(ret < 1)
     {
-        sem_release(&bd->sem);
-        return (ret == 0) ? -EWRITE : ret;
-    }
+        /* Cache a whole-block write, unless the slot is pinned by a dirty page */
+        if(whole && ((ret = block_cache_evict_range(slot, shift)) != -EBUSY))
+        {
+            if(ret != SUCCESS)
+            {
+                sem_release(&ld->sem);
+                return ret;
+            }
 
-    /* Copy the new block into the cache */
-    if(buf != NULL)
-        memcpy(data, buf, BLOCK_SIZE);
+            /* Copy the new block into the cache */
+            if(buf != NULL)
+                memcpy(data, buf, count * BLOCK_SIZE);
 
-    /* Update descriptor */
-    bd->dev = dev;
-    bd->block = block;
-    bd->flags = (buf == NULL) ? BC_ZERO : 0;
+            /* Update descriptor */
+            bd->dev = dev;
+            bd->block = block;
+            bd->shift = shift;
+            bd->flags = (buf == NULL) ? BC_ZERO : 0;
+        }
+
+        ++bc.stats.misses;
+    }
 
     ++bc.stats.writes;
-    sem_release(&bd->sem);
+    sem_release(&ld->sem);
 
     return SUCCESS;
 }
 
 
 /*
-    block_read_multi() - read multiple blocks, using the block cache.
+    block_read() - read a block, using the block cache.
+*/
+s32 block_read(dev_t * const dev, ku32 block, void *buf)
+{
+    ks32 ret = block_read_multi(dev, block, 1, buf);
+
+    return (ret < 0) ? ret : SUCCESS;
+}
+
+
+/*
+    block_write() - write a block, via the block cache.
+*/
+s32 block_write(dev_t * const dev, ku32 block, const void * const buf)
+{
+    ks32 ret = block_write_multi(dev, block, 1, buf);
+
+    return (ret < 0) ? ret : SUCCESS;
+}
+
+
+/*
+    block_read_multi() - read multiple blocks, using the block cache.  Each cache block touched by
+    the request is looked up once.  Runs of whole cache blocks which are not present in the cache
+    are read with a single device request.  Returns the number of blocks read, or a negative error
+    code.
 */
 s32 block_read_multi(dev_t * const dev, u32 block, u32 count, void *buf)
 {
     s32 ret;
     u8 *p;
-    u32 remaining;
+    u32 remaining, shift, mask;
+
+    if(dev->type != DEV_TYPE_BLOCK)
+        return -EINVAL;
+
+    if(!bc.nblocks)
+    {
+        remaining = count;
+        ret = dev->read(dev, block, &remaining, buf);
+        return (ret == SUCCESS) ? (s32) count : ret;
+    }
+
+    shift = dev->cache_block_shift;
+    mask = (1 << shift) - 1;
 
-    for(remaining = count, p = (u8 *) buf; remaining--; ++block, p += BLOCK_SIZE)
+    for(remaining = count, p = (u8 *) buf; remaining;)
     {
-        ret = block_read(dev, block, p);
+        ku32 offset = block & mask;
+        u32 n = MIN(remaining, (mask + 1) - offset);
+
+        if(!offset && (n == mask + 1) && !block_cache_present(dev, block >> shift))
+        {
+            /* Extend the run over the following whole, uncached cache blocks */
+            while((remaining - n > mask) && !block_cache_present(dev, (block + n) >> shift))
+                n += mask + 1;
+
+            ret = block_cache_read_run(dev, block, n, p);
+        }
+        else
+            ret = block_cache_read_part(dev, block >> shift, offset, n, p);
+
         if(ret != SUCCESS)
             return ret;
+
+        block += n;
+        remaining -= n;
+        p += n * BLOCK_SIZE;
     }
 
     return count;
@@ -234,68 +552,329 @@ s32 block_read_multi(dev_t * const dev, u32 block, u32 count, void *buf)
 
 
 /*
-    block_write_multi() - write multiple blocks, using the block cache.
+    block_write_multi() - write multiple blocks, via the block cache.  If <buf> is NULL, the blocks
+    are zero-filled.  Returns the number of blocks written, or a negative error code.
 */
 s32 block_write_multi(dev_t * const dev, u32 block, u32 count, const void *buf)
 {
     s32 ret;
     ku8 *p;
-    u32 remaining;
+    u32 remaining, shift, mask;
+
+    if(dev->type != DEV_TYPE_BLOCK)
+        return -EINVAL;
+
+    if(!bc.nblocks)
+    {
+        remaining = count;
+        ret = dev->write(dev, block, &remaining, buf);
+        return (ret == SUCCESS) ? (s32) count : ret;
+    }
+
+    shift = dev->cache_block_shift;
+    mask = (1 << shift) - 1;
+
+    for(remaining = count, p = (ku8 *) buf; remaining;)
+    {
+        ku32 offset = block & mask, n = MIN(remaining, (mask + 1) - offset);
+
+        ret = block_cache_write_part(dev, block >> shift, offset, n, p);
+        if(ret != SUCCESS)
+            return ret;
+
+        block += n;
+        remaining -= n;
+        if(p != NULL)
+            p += n * BLOCK_SIZE;
+    }
+
+    return count;
+}
+
+
+/*
+    block_cache_sync() - flush all dirty blocks.
+*/
+s32 block_cache_sync()
+{
+    u32 line, u, len;
+    s32 ret;
 
-    if(buf != NULL)
+    for(line = 0; line < bc.nblocks; line += BC_LINE_UNITS)
     {
-        for(remaining = count, p = (ku8 *) buf; remaining--; ++block, p += BLOCK_SIZE)
+        block_descriptor_t * const ld = bc.descriptors + line;
+
+        sem_acquire(&ld->sem);
+
+        for(u = line; u < line + BC_LINE_UNITS; ++u)
         {
-            ret = block_write(dev, block, p);
-            if(ret != SUCCESS)
-                return ret;
+            block_descriptor_t * const bd = bc.descriptors + u;
+
+            if((bd->dev != NULL) && (bd->flags & BC_DIRTY))
+            {
+                void *data = bc.cache + (u * BLOCK_SIZE);
+
+                len = 1 << bd->shift;
+                ret = bd->dev->write(bd->dev, bd->block << bd->shift, &len,
+                                     (bd->flags & BC_ZERO) ? NULL : data);
+                if(ret != SUCCESS)
+                {
+                    sem_release(&ld->sem);
+                    return ret;
+                }
+
+                bd->flags &= ~BC_DIRTY;
+            }
         }
+
+        sem_release(&ld->sem);
     }
-    else
+
+    return SUCCESS;
+}
+
+
+/*
+    block_cache_find_page() - return the descriptor of page <page> of object <obj>, or NULL if the
+    page is not cached.  <slot> is the slot at which the page would be stored, as returned by
+    block_cache_get_slot(); the caller must hold its line semaphore.
+*/
+static block_descriptor_t *block_cache_find_page(const void * const obj, ku32 page, ku32 slot)
+{
+    block_descriptor_t * const bd = bc.descriptors + slot;
+
+    return ((bd->flags & BC_PAGE) && (bd->obj == obj) && (bd->block == page)) ? bd : NULL;
+}
+
+
+/*
+    block_cache_page_read() - if page <page> of object <obj> is cached, copy it into <buf> and return
+    SUCCESS; otherwise return -ENOENT.
+*/
+s32 block_cache_page_read(const void * const obj, ku32 page, void *buf)
+{
+    u32 slot;
+    block_descriptor_t *bd, *ld;
+
+    if(!bc.nblocks)
+        return -ENOENT;
+
+    slot = block_cache_get_slot(obj, page, 0);
+    ld = block_cache_line(slot);
+
+    sem_acquire(&ld->sem);
+
+    bd = block_cache_find_page(obj, page, slot);
+    if(bd == NULL)
+    {
+        ++bc.stats.page_misses;
+        sem_release(&ld->sem);
+        return -ENOENT;
+    }
+
+    memcpy(buf, bc.cache + (slot * BLOCK_SIZE), BLOCK_SIZE);
+    ++bc.stats.page_hits;
+
+    sem_release(&ld->sem);
+
+    return SUCCESS;
+}
+
+
+/*
+    block_cache_page_store() - store <buf> as page <page> of object <obj>.  If <fill> is non-zero,
+    the data has just been read from the object's backing store: it is stored only if the page is
+    not already cached.  Otherwise, the data replaces any cached copy of the page, and the page is
+    marked dirty if <dirty> is non-zero.  Fails with EBUSY if the page cannot be cached, because its
+    slot is pinned by another dirty page or because the dirty page limit has been reached.
+*/
+static s32 block_cache_page_store(const void * const obj, ku32 page, const void *buf, ku32 fill,
+                                  ku32 dirty)
+{
+    u32 slot;
+    block_descriptor_t *bd, *ld;
+    s32 ret;
+
+    if(!bc.nblocks)
+        return -EBUSY;
+
+    slot = block_cache_get_slot(obj, page, 0);
+    ld = block_cache_line(slot);
+
+    sem_acquire(&ld->sem);
+
+    bd = block_cache_find_page(obj, page, slot);
+    if(bd == NULL)
     {
-        /* Block should be zero-filled */
-        for(remaining = count; remaining--;)
+        bd = bc.descriptors + slot;
+
+        if(dirty && (bc.stats.dirty_pages >= (bc.nblocks / BC_DIRTY_PAGE_RATIO)))
         {
-            ret = block_write(dev, block++, NULL);
-            if(ret != SUCCESS)
-                return ret;
+            sem_release(&ld->sem);
+            return -EBUSY;
+        }
+
+        ret = block_cache_evict_range(slot, 0);
+        if(ret != SUCCESS)
+        {
+            sem_release(&ld->sem);
+            return ret;
         }
+
+        bd->dev = NULL;
+        bd->obj = obj;
+        bd->block = page;
+        bd->shift = 0;
+        bd->flags = BC_PAGE;
+    }
+    else if(fill)
+    {
+        /* The page is already cached, and the cached copy may be newer than <buf> */
+        sem_release(&ld->sem);
+        return SUCCESS;
     }
+    else if(dirty && !(bd->flags & BC_DIRTY)
+            && (bc.stats.dirty_pages >= (bc.nblocks / BC_DIRTY_PAGE_RATIO)))
+    {
+        /* Can't make the page dirty; discard it, as the caller will write the data through */
+        bd->obj = NULL;
+        bd->flags = 0;
 
-    return count;
+        sem_release(&ld->sem);
+        return -EBUSY;
+    }
+
+    memcpy(bc.cache + (slot * BLOCK_SIZE), buf, BLOCK_SIZE);
+
+    if(dirty && !(bd->flags & BC_DIRTY))
+    {
+        bd->flags |= BC_DIRTY;
+        ++bc.stats.dirty_pages;
+    }
+    else if(!dirty && (bd->flags & BC_DIRTY))
+    {
+        bd->flags &= ~BC_DIRTY;
+        --bc.stats.dirty_pages;
+    }
+
+    sem_release(&ld->sem);
+
+    return SUCCESS;
 }
 
 
 /*
-    block_cache_sync() - flush all dirty blocks.
+    block_cache_page_fill() - store <buf>, which has just been read from the backing store of
+    object <obj>, as page <page> of the object, unless the page is already cached.
 */
-s32 block_cache_sync()
+s32 block_cache_page_fill(const void * const obj, ku32 page, const void *buf)
+{
+    return block_cache_page_store(obj, page, buf, 1, 0);
+}
+
+
+/*
+    block_cache_page_write() - store <buf> as page <page> of object <obj>, replacing any cached copy.
+    If <dirty> is non-zero, the page is marked dirty; the caller must later write it back using
+    block_cache_page_flush().  If <dirty> is zero, the caller must already have written the data to
+    the object's backing store.  Fails with EBUSY if the page could not be cached; in this case, the
+    caller must write the data to the backing store itself.
+*/
+s32 block_cache_page_write(const void * const obj, ku32 page, const void *buf, ku32 dirty)
+{
+    return block_cache_page_store(obj, page, buf, 0, dirty);
+}
+
+
+/*
+    block_cache_page_flush() - write back all dirty pages of object <obj>.  Each dirty page is copied
+    into <buf>, which must be at least BLOCK_SIZE bytes long, and marked clean; <fn> is then called,
+    without any cache locks held, to write it back.  If <fn> fails, the page is marked dirty again
+    (if it is still cached) and the error is returned.
+*/
+s32 block_cache_page_flush(const void * const obj, block_cache_writeback_fn fn, void *arg,
+                           void *buf)
 {
-    block_descriptor_t *bd, * const end = bc.descriptors + bc.nblocks;
-    u32 one = 1;
+    u32 line, u;
     s32 ret;
 
-    for(bd = bc.descriptors; bd != end; ++bd)
+    for(line = 0; line < bc.nblocks; line += BC_LINE_UNITS)
     {
-        sem_acquire(&bd->sem);
+        block_descriptor_t * const ld = bc.descriptors + line;
 
-        if(bd->flags & BC_DIRTY)
+        for(u = line; u < line + BC_LINE_UNITS; ++u)
         {
-            void *data = bc.cache + ((bd - bc.descriptors) * BLOCK_SIZE);
-            ret = bd->dev->write(bd->dev, bd->block, &one, data);
+            block_descriptor_t * const bd = bc.descriptors + u;
+            u32 page;
+
+            if(!(bd->flags & BC_PAGE) || !(bd->flags & BC_DIRTY) || (bd->obj != obj))
+                continue;
+
+            sem_acquire(&ld->sem);
+
+            /* Re-check the descriptor now that the line is locked */
+            if(!(bd->flags & BC_PAGE) || !(bd->flags & BC_DIRTY) || (bd->obj != obj))
+            {
+                sem_release(&ld->sem);
+                continue;
+            }
+
+            page = bd->block;
+            memcpy(buf, bc.cache + (u * BLOCK_SIZE), BLOCK_SIZE);
+
+            bd->flags &= ~BC_DIRTY;
+            --bc.stats.dirty_pages;
+
+            sem_release(&ld->sem);
+
+            ret = fn(arg, page, buf);
             if(ret != SUCCESS)
+            {
+                block_cache_page_write(obj, page, buf, 1);
                 return ret;
+            }
 
-            bd->flags &= ~BC_DIRTY;
+            ++bc.stats.page_writebacks;
         }
-
-        sem_release(&bd->sem);
     }
 
     return SUCCESS;
 }
 
 
+/*
+    block_cache_page_invalidate() - discard all cached pages of object <obj> whose page number is
+    greater than or equal to <first_page>.  Dirty pages are discarded without being written back.
+*/
+void block_cache_page_invalidate(const void * const obj, ku32 first_page)
+{
+    u32 line, u;
+
+    for(line = 0; line < bc.nblocks; line += BC_LINE_UNITS)
+    {
+        block_descriptor_t * const ld = bc.descriptors + line;
+
+        sem_acquire(&ld->sem);
+
+        for(u = line; u < line + BC_LINE_UNITS; ++u)
+        {
+            block_descriptor_t * const bd = bc.descriptors + u;
+
+            if((bd->flags & BC_PAGE) && (bd->obj == obj) && (bd->block >= first_page))
+            {
+                if(bd->flags & BC_DIRTY)
+                    --bc.stats.dirty_pages;
+
+                bd->obj = NULL;
+                bd->flags = 0;
+            }
+        }
+
+        sem_release(&ld->sem);
+    }
+}
+
+
 /*
     block_cache_stats() - retrieve block cache statistics
 */
@@ -0,0 +1,284 @@
+/*
+    ioqueue.c: block device I/O request queue
+
+    Part of ayumos
+
+
+    (c) Stuart Wallace <stuartw@atom.net>, October 2026.
+
+
+    A request queue sits between the block cache and a block device driver.  Requests from all
+    processes are queued per-device, merged with queued requests for adjacent blocks, and passed to
+    the driver in C-LOOK order: ascending block order from the position of the last request, then
+    wrapping back to the lowest queued block.  To bound the time a request can be starved by the
+    sweep, each request carries a deadline; an expired request is dispatched ahead of the sweep.
+
+    The driver's dispatch function is called with pre-emption disabled, either by a submitting
+    process (if the queue is idle) or by the driver itself, via ioqueue_done(), when the previous
+    request completes.  A driver which starts a transfer and completes it later (e.g. in its IRQ
+    handler) returns -EINPROGRESS from its dispatch function and calls ioqueue_done() on
+    completion; any other return value is taken to be the final status of the request.  Submitting
+    processes sleep until their requests are completed.
+
+    Queue state is protected by disabling pre-emption.
+*/
+
+#include <kernel/include/device/ioqueue.h>
+#include <kernel/include/preempt.h>
+#include <kernel/include/tick.h>
+
+
+static void ioqueue_add(ioqueue_t * const q, ioreq_t * const req);
+static ioreq_t *ioqueue_next(ioqueue_t * const q);
+static void ioqueue_complete(ioqueue_t * const q, ioreq_t *req, ks32 status);
+static void ioqueue_start(ioqueue_t * const q);
+
+
+/*
+    ioqueue_init() - initialise a request queue for device <dev>.  <dispatch> is the driver function
+    which carries out requests; <max_blocks> is the largest number of blocks which the driver will
+    accept in a single (merged) request.
+*/
+s32 ioqueue_init(ioqueue_t * const q, dev_t * const dev, ioqueue_dispatch_fn dispatch,
+                 ku32 max_blocks)
+{
+    if(!max_blocks)
+        return -EINVAL;
+
+    list_init(&q->sorted);
+    list_init(&q->fifo);
+
+    q->dev          = dev;
+    q->dispatch     = dispatch;
+    q->max_blocks   = max_blocks;
+    q->head_pos     = 0;
+    q->current      = NULL;
+    q->stats        = (ioqueue_stats_t) {0};
+
+    return SUCCESS;
+}
+
+
+/*
+    ioqueue_add() - add a request to a queue, merging it with a queued request if possible.  Must be
+    called with pre-emption disabled.
+*/
+static void ioqueue_add(ioqueue_t * const q, ioreq_t * const req)
+{
+    ioreq_t *r;
+
+    if(++q->stats.depth > q->stats.max_depth)
+        q->stats.max_depth = q->stats.depth;
+
+    list_for_each_entry(r, &q->sorted, queue)
+    {
+        if((r->dir != req->dir) || ((r->nblocks + req->count) > q->max_blocks))
+            continue;
+
+        if((r->block + r->nblocks) == req->block)
+        {
+            /* Back merge: append the new request to the end of r's run */
+            ioreq_t *tail;
+
+            for(tail = r; tail->next_merged; tail = tail->next_merged)
+                ;
+
+            tail->next_merged = req;
+            r->nblocks += req->count;
+
+            if(req->deadline < r->deadline)
+                r->deadline = req->deadline;
+
+            ++q->stats.merges;
+            return;
+        }
+
+        if((req->block + req->count) == r->block)
+        {
+            /* Front merge: the new request heads the run, and takes over r's queue positions */
+            req->next_merged = r;
+            req->nblocks = req->count + r->nblocks;
+            req->deadline = r->deadline;
+
+            list_replace(&r->queue, &req->queue);
+            list_replace(&r->fifo, &req->fifo);
+
+            ++q->stats.merges;
+            return;
+        }
+
+        if(r->block > req->block)
+            break;
+    }
+
+    /* No merge possible: insert the request in block order, and at the tail of the FIFO */
+    list_for_each_entry(r, &q->sorted, queue)
+        if(r->block > req->block)
+            break;
+
+    list_insert(&req->queue, &r->queue);
+    list_insert(&req->fifo, &q->fifo);
+}
+
+
+/*
+    ioqueue_next() - remove the next request to be dispatched from the queue, and return it.  Return
+    NULL if the queue is empty.  Must be called with pre-emption disabled.
+*/
+static ioreq_t *ioqueue_next(ioqueue_t * const q)
+{
+    ioreq_t *req;
+
+    if(list_is_empty(&q->fifo))
+        return NULL;
+
+    /* Has the oldest request expired? */
+    req = list_first_entry(&q->fifo, ioreq_t, fifo);
+    if((s32) (get_ticks() - req->deadline) >= 0)
+        ++q->stats.expired;
+    else
+    {
+        /* C-LOOK: take the first request at or beyond the head position; otherwise wrap round */
+        list_for_each_entry(req, &q->sorted, queue)
+            if(req->block >= q->head_pos)
+                break;
+
+        if(&req->queue == &q->sorted)
+            req = list_first_entry(&q->sorted, ioreq_t, queue);
+    }
+
+    list_delete(&req->queue);
+    list_delete(&req->fifo);
+
+    q->head_pos = req->block + req->nblocks;
+    ++q->stats.dispatches;
+
+    return req;
+}
+
+
+/*
+    ioqueue_complete() - mark each request in a merged run as complete, with status <status>, and
+    wake the processes which submitted them.  Must be called with pre-emption disabled.
+*/
+static void ioqueue_complete(ioqueue_t * const q, ioreq_t *req, ks32 status)
+{
+    ku32 now = get_ticks();
+
+    while(req != NULL)
+    {
+        /* The request may cease to exist once its status is set, so read everything we need now */
+        ioreq_t * const next = req->next_merged;
+        proc_t * const proc = req->proc;
+        ku32 latency = now - req->submitted;
+
+        q->stats.total_latency += latency;
+        if(latency > q->stats.max_latency)
+            q->stats.max_latency = latency;
+
+        --q->stats.depth;
+
+        req->status = status;
+        proc_wake(proc);
+
+        req = next;
+    }
+}
+
+
+/*
+    ioqueue_start() - pass requests to the driver until one is in progress or the queue is empty.
+    Must be called with pre-emption disabled, when no request is in progress.
+*/
+static void ioqueue_start(ioqueue_t * const q)
+{
+    ioreq_t *req;
+
+    while((q->current == NULL) && ((req = ioqueue_next(q)) != NULL))
+    {
+        s32 ret;
+
+        q->current = req;
+
+        ret = q->dispatch(q->dev, req);
+        if(ret != -EINPROGRESS)
+        {
+            /* The driver carried out the request synchronously */
+            q->current = NULL;
+            ioqueue_complete(q, req, ret);
+        }
+    }
+}
+
+
+/*
+    ioqueue_done() - called by a driver to report the completion, with status <status>, of the
+    request in progress.  Starts the next request, if there is one.  Must be called with
+    pre-emption disabled; may be called from an IRQ handler.
+*/
+void ioqueue_done(ioqueue_t * const q, ks32 status)
+{
+    ioreq_t * const req = q->current;
+
+    if(req == NULL)
+        return;
+
+    q->current = NULL;
+    ioqueue_complete(q, req, status);
+
+    ioqueue_start(q);
+}
+
+
+/*
+    ioqueue_submit() - submit a request to transfer <count> blocks, starting at block <block>,
+    between device and <buf>, and wait for it to complete.  If <dir> is IOREQ_WRITE and <buf> is
+    NULL, the blocks are zero-filled.  Returns the status reported by the driver.
+*/
+s32 ioqueue_submit(ioqueue_t * const q, const ioreq_dir_t dir, ku32 block, ku32 count,
+                   const void * const buf)
+{
+    proc_t * const proc = proc_current();
+    ioreq_t req;
+
+    if(!count)
+        return SUCCESS;
+
+    req.next_merged = NULL;
+    req.dir         = dir;
+    req.block       = block;
+    req.count       = count;
+    req.nblocks     = count;
+    req.buf         = (void *) buf;
+    req.submitted   = get_ticks();
+    req.deadline    = req.submitted + ((dir == IOREQ_READ) ? IOQUEUE_READ_EXPIRE :
+                                                             IOQUEUE_WRITE_EXPIRE);
+    req.proc        = proc;
+    req.status      = -EINPROGRESS;
+
+    preempt_disable();
+
+    ++q->stats.requests;
+    ioqueue_add(q, &req);
+
+    if(q->current == NULL)
+        ioqueue_start(q);
+
+    /* Sleep until the request has been completed */
+    while(req.status == -EINPROGRESS)
+    {
+        proc->state = ps_sleeping;
+        preempt_enable();
+
+        if(req.status == -EINPROGRESS)
+            cpu_switch_process();
+        else
+            proc->state = ps_runnable;
+
+        preempt_disable();
+    }
+
+    preempt_enable();
+
+    return req.status;
+}
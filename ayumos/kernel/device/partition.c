@@ -40,59 +40,69 @@ s32 partition_init()
         if((dev->type != DEV_TYPE_BLOCK) || (dev->subtype != DEV_SUBTYPE_MASS_STORAGE))
             continue;
 
-        /*
-            Read sector 0.  If it contains a master boot record (MBR), enumerate its partition
-            table and create partition devices.
-        */
-        struct mbr m;
-        u16 part;
+        if(partition_scan(dev) == -ENFILE)
+            return -ENFILE;
+    }
+
+    return SUCCESS;
+}
+
+
+/*
+    partition_scan() - read sector 0 of a mass-storage device.  If it contains a master boot record
+    (MBR), enumerate its partition table and create partition devices.  Return -ENOENT if the device
+    does not contain a MBR.
+*/
+s32 partition_scan(dev_t *dev)
+{
+    struct mbr m;
+    u16 part;
+
+    if(block_read(dev, 0, &m) != SUCCESS)
+        return -EREAD;      /* Failed to read sector TODO: report error */
+
+    if(LE2N16(m.mbr_signature) != MBR_SIGNATURE)
+        return -ENOENT;     /* Sector is not a MBR */
+
+    for(part = 0; part < MBR_NUM_PARTITIONS; ++part)
+    {
+        struct mbr_partition * const p = &m.partition[part];
+        u32 bytes_per_sector = 0;
+        partition_data_t * data;
+        dev_t *part_dev;
+
+        if(part > DEVICE_MAX_SUBDEVICES)
+            return -ENFILE;
+
+        if(!p->num_sectors)
+            continue;       /* Skip zero-length partitions */
 
-        if(block_read(dev, 0, &m) != SUCCESS)
-            continue;       /* Failed to read sector TODO: report error */
+        if(dev->control(dev, dc_get_block_size, NULL, &bytes_per_sector) != SUCCESS)
+            continue;       /* TODO: report error */
 
-        if(LE2N16(m.mbr_signature) != MBR_SIGNATURE)
-            continue;       /* Sector is not a MBR */
+        data = CHECKED_KCALLOC(1, sizeof(partition_data_t));
 
-        for(part = 0; part < MBR_NUM_PARTITIONS; ++part)
+        if(dev_create(DEV_TYPE_BLOCK, DEV_SUBTYPE_PARTITION, dev->name, IRQL_NONE, NULL,
+                      &part_dev, "partition", dev, NULL) != SUCCESS)
         {
-            struct mbr_partition * const p = &m.partition[part];
-            u32 bytes_per_sector = 0;
-            partition_data_t * data;
-            dev_t *part_dev;
-
-            if(part > DEVICE_MAX_SUBDEVICES)
-                return -ENFILE;
-
-            if(!p->num_sectors)
-                continue;       /* Skip zero-length partitions */
-
-            if(dev->control(dev, dc_get_block_size, NULL, &bytes_per_sector) != SUCCESS)
-                continue;       /* TODO: report error */
-
-            data = CHECKED_KCALLOC(1, sizeof(partition_data_t));
-
-            if(dev_create(DEV_TYPE_BLOCK, DEV_SUBTYPE_PARTITION, dev->name, IRQL_NONE, NULL,
-                          &part_dev, "partition", dev, NULL) != SUCCESS)
-            {
-                kfree(data);
-                continue;
-            }
-
-            part_dev->read          = partition_read;
-            part_dev->write         = partition_write;
-            part_dev->control       = partition_control;
-            part_dev->shut_down     = partition_shut_down;
-            part_dev->block_size    = dev->block_size;
-            part_dev->len           = LE2N32(p->num_sectors);
-
-            data->device        = dev;
-            data->block_size    = bytes_per_sector;
-            data->offset        = LE2N32(p->first_sector_lba);
-            data->type          = p->type;
-            data->status        = p->status;
-
-            part_dev->data = data;
+            kfree(data);
+            continue;
         }
+
+        part_dev->read          = partition_read;
+        part_dev->write         = partition_write;
+        part_dev->control       = partition_control;
+        part_dev->shut_down     = partition_shut_down;
+        part_dev->block_size    = dev->block_size;
+        part_dev->len           = LE2N32(p->num_sectors);
+
+        data->device        = dev;
+        data->block_size    = bytes_per_sector;
+        data->offset        = LE2N32(p->first_sector_lba);
+        data->type          = p->type;
+        data->status        = p->status;
+
+        part_dev->data = data;
     }
 
     return SUCCESS;
@@ -222,6 +232,18 @@ s32 partition_control(dev_t *dev, const devctl_fn_t fn, const void *in, void *ou
             *((u32 *) out) = (pdata->status >= 0x80);
             break;
 
+        case dc_get_mem_base:
+        {
+            /* A partition of a memory-mapped device is mapped at its offset within the device */
+            u8 *base;
+            ks32 ret = pdata->device->control(pdata->device, dc_get_mem_base, NULL, &base);
+            if(ret != SUCCESS)
+                return ret;
+
+            *((u8 **) out) = base + (pdata->offset * pdata->block_size);
+            break;
+        }
+
         default:
             return -ENOSYS;
     }
@@ -0,0 +1,315 @@
+/*
+    RAM disk block device driver
+
+    Part of ayumos
+
+
+    (c) Stuart Wallace <stuartw@atom.net>, October 2026.
+
+
+    A RAM disk is a mass-storage block device whose contents are held in memory.  Its backing
+    store may be supplied by the caller (e.g. a memory extent reserved at boot time) or allocated
+    from the kernel heap, and may be preloaded from an image, e.g. a disk or romfs image in ROM.
+    Alternatively, an image in ROM may itself serve as a read-only disk, so that it can be mounted
+    without being copied.  RAM disks are created with subtype DEV_SUBTYPE_MASS_STORAGE, so an image
+    containing a master boot record can be partitioned with partition_init() / partition_scan().
+    The address of a disk's contents is reported through dc_get_mem_base, so that file system
+    drivers can access it directly.
+
+    RAM disks are intended for measuring the efficiency of the block cache and file system
+    drivers without the cost of real device I/O.  To model a real device, an artificial latency
+    can be applied to each request (see dc_ramdisk_set_latency).  The latency is implemented as a
+    busy-wait, as the CPU would be occupied for the duration of a PIO transfer from a real device.
+*/
+
+#ifdef WITH_DRV_MST_RAMDISK
+#ifndef WITH_MASS_STORAGE
+#error This driver requires kernel mass-storage support (build option WITH_MASS_STORAGE)
+#else
+
+#include <kernel/include/device/ramdisk.h>
+#include <kernel/include/error.h>
+#include <kernel/include/fs/romfs.h>
+#include <kernel/include/memory/kmalloc.h>
+#include <kernel/include/tick.h>
+#include <klibc/include/string.h>
+
+
+s32 ramdisk_read(dev_t *dev, ku32 offset, u32 *len, void *buf);
+s32 ramdisk_write(dev_t *dev, ku32 offset, u32 *len, const void *buf);
+s32 ramdisk_control(dev_t *dev, const devctl_fn_t fn, const void *in, void *out);
+s32 ramdisk_shut_down(dev_t *dev);
+
+static void ramdisk_calibrate_delay();
+static void ramdisk_delay(const ramdisk_latency_t * const latency, ku32 nblocks);
+
+
+/* Number of delay-loop iterations run between checks of the tick counter during calibration */
+#define RAMDISK_CAL_BATCH       (100)
+
+/* Number of iterations of the delay loop which take (approximately) one millisecond */
+static u32 ramdisk_loops_per_ms;
+
+
+/*
+    ramdisk_create() - create a RAM disk of <len> bytes (rounded down to a whole number of blocks).
+    If <mem> is non-NULL, it points to the backing store; otherwise the backing store is allocated
+    from the kernel heap.  If <image> is non-NULL, the first <image_len> bytes of the disk are
+    loaded from <image>.  If <image_len> is zero, <image> must point to a romfs superblock, and the
+    length of the romfs is used.  The remainder of the disk is zero-filled.
+
+    If <mem> and <image> are equal, the image is used in place as a read-only disk: nothing is
+    copied, and <len> may be zero, in which case the disk is sized to fit the image (rounded up to
+    a whole number of blocks).
+*/
+s32 ramdisk_create(void *mem, u32 len, const void *image, u32 image_len, dev_t **dev)
+{
+    ramdisk_state_t *state;
+    ku8 in_place = (mem != NULL) && (mem == image);
+    dev_t *d;
+    s32 ret;
+
+    if((len < RAMDISK_BLOCK_SIZE) && !(in_place && !len))
+        return -EINVAL;
+
+    if(image != NULL)
+    {
+#ifdef WITH_FS_ROMFS
+        if(!image_len)
+        {
+            const romfs_superblock_t * const sb = (const romfs_superblock_t *) image;
+
+            if(sb->magic != ROMFS_SUPERBLOCK_MAGIC)
+                return -EBADSBLK;
+
+            image_len = sb->len;
+        }
+#endif
+        if(in_place && !len)
+            len = (image_len + RAMDISK_BLOCK_SIZE - 1) & ~(RAMDISK_BLOCK_SIZE - 1);
+
+        if(!image_len || (image_len > len))
+            return -EINVAL;
+    }
+
+    state = (ramdisk_state_t *) CHECKED_KCALLOC(1, sizeof(ramdisk_state_t));
+
+    if(mem == NULL)
+    {
+        mem = kmalloc(len);
+        if(mem == NULL)
+        {
+            kfree(state);
+            return -ENOMEM;
+        }
+
+        state->owns_data = 1;
+    }
+
+    state->data = (u8 *) mem;
+
+    if(in_place)
+        state->read_only = 1;
+    else
+    {
+        if(image != NULL)
+            memcpy(state->data, image, image_len);
+        else
+            image_len = 0;
+
+        memset(state->data + image_len, 0, len - image_len);
+    }
+
+    ret = dev_create(DEV_TYPE_BLOCK, DEV_SUBTYPE_MASS_STORAGE, "ram", IRQL_NONE, NULL, &d,
+                     "RAM disk", NULL, NULL);
+    if(ret != SUCCESS)
+    {
+        if(state->owns_data)
+            kfree(state->data);
+
+        kfree(state);
+        return ret;
+    }
+
+    d->read         = ramdisk_read;
+    d->write        = ramdisk_write;
+    d->control      = ramdisk_control;
+    d->shut_down    = ramdisk_shut_down;
+    d->block_size   = RAMDISK_BLOCK_SIZE;
+    d->len          = len / RAMDISK_BLOCK_SIZE;
+    d->data         = state;
+
+    if(dev != NULL)
+        *dev = d;
+
+    return SUCCESS;
+}
+
+
+/*
+    ramdisk_read() - read <*len> blocks, starting at block <offset>, from a RAM disk.
+*/
+s32 ramdisk_read(dev_t *dev, ku32 offset, u32 *len, void *buf)
+{
+    ramdisk_state_t * const state = (ramdisk_state_t *) dev->data;
+
+    if((offset + *len < offset) || (offset + *len > dev->len))
+        return -EINVAL;
+
+    ramdisk_delay(&state->latency, *len);
+
+    memcpy(buf, state->data + (offset * RAMDISK_BLOCK_SIZE), *len * RAMDISK_BLOCK_SIZE);
+
+    ++state->stats.reads;
+    state->stats.blocks_read += *len;
+
+    return SUCCESS;
+}
+
+
+/*
+    ramdisk_write() - write <*len> blocks, starting at block <offset>, to a RAM disk.  If <buf> is
+    NULL, the blocks are zero-filled.
+*/
+s32 ramdisk_write(dev_t *dev, ku32 offset, u32 *len, const void *buf)
+{
+    ramdisk_state_t * const state = (ramdisk_state_t *) dev->data;
+    u8 * const p = state->data + (offset * RAMDISK_BLOCK_SIZE);
+
+    if((offset + *len < offset) || (offset + *len > dev->len))
+        return -EINVAL;
+
+    if(state->read_only)
+        return -EROFS;
+
+    ramdisk_delay(&state->latency, *len);
+
+    if(buf != NULL)
+        memcpy(p, buf, *len * RAMDISK_BLOCK_SIZE);
+    else
+        memset(p, 0, *len * RAMDISK_BLOCK_SIZE);
+
+    ++state->stats.writes;
+    state->stats.blocks_written += *len;
+
+    return SUCCESS;
+}
+
+
+/*
+    ramdisk_control() - devctl implementation for RAM disks.
+*/
+s32 ramdisk_control(dev_t *dev, const devctl_fn_t fn, const void *in, void *out)
+{
+    ramdisk_state_t * const state = (ramdisk_state_t *) dev->data;
+
+    switch(fn)
+    {
+        case dc_get_extent:
+            *((u32 *) out) = dev->len;
+            break;
+
+        case dc_get_block_size:
+            *((u32 *) out) = dev->block_size;
+            break;
+
+        case dc_get_bootable:
+            *((u32 *) out) = 0;
+            break;
+
+        case dc_get_model:
+            *((const char **) out) = "RAM disk";
+            break;
+
+        case dc_get_blockdev_stats:
+            *((blockdev_stats_t *) out) = state->stats;
+            break;
+
+        case dc_get_mem_base:
+            *((u8 **) out) = state->data;
+            break;
+
+        case dc_ramdisk_get_latency:
+            *((ramdisk_latency_t *) out) = state->latency;
+            break;
+
+        case dc_ramdisk_set_latency:
+            if(!ramdisk_loops_per_ms)
+                ramdisk_calibrate_delay();
+
+            state->latency = *((const ramdisk_latency_t *) in);
+            break;
+
+        default:
+            return -ENOSYS;
+    }
+
+    return SUCCESS;
+}
+
+
+/*
+    ramdisk_shut_down() - release the resources associated with a RAM disk.
+*/
+s32 ramdisk_shut_down(dev_t *dev)
+{
+    ramdisk_state_t * const state = (ramdisk_state_t *) dev->data;
+
+    if(state != NULL)
+    {
+        if(state->owns_data)
+            kfree(state->data);
+
+        kfree(state);
+        dev->data = NULL;
+    }
+
+    return SUCCESS;
+}
+
+
+/*
+    ramdisk_calibrate_delay() - measure the number of iterations of the delay loop which take one
+    millisecond.  This takes between one and two ticks, and requires the tick interrupt to be
+    running.
+*/
+static void ramdisk_calibrate_delay()
+{
+    u32 start, loops;
+
+    /* Synchronise with the start of a tick */
+    for(start = get_ticks(); get_ticks() == start;)
+        ;
+
+    /* Run the delay loop in batches, so that the cost of get_ticks() is small by comparison */
+    for(start = get_ticks(), loops = 0; get_ticks() == start; loops += RAMDISK_CAL_BATCH)
+    {
+        vu32 n = RAMDISK_CAL_BATCH;
+
+        while(n--)
+            ;
+    }
+
+    ramdisk_loops_per_ms = ((loops * TICK_RATE) / 1000) + 1;
+}
+
+
+/*
+    ramdisk_delay() - busy-wait for the latency associated with a request for <nblocks> blocks.
+*/
+static void ramdisk_delay(const ramdisk_latency_t * const latency, ku32 nblocks)
+{
+    ku32 us = latency->request_us + (latency->block_us * nblocks);
+    vu32 loops;
+
+    if(!us)
+        return;
+
+    loops = ((us / 1000) * ramdisk_loops_per_ms) + (((us % 1000) * ramdisk_loops_per_ms) / 1000);
+
+    while(loops--)
+        ;
+}
+
+#endif /* WITH_MASS_STORAGE */
+#endif /* WITH_DRV_MST_RAMDISK */
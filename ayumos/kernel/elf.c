@@ -10,24 +10,53 @@
 #include <kernel/include/byteorder.h>
 #include <kernel/include/elf.h>
 #include <kernel/include/error.h>
+#include <kernel/include/fs/path.h>
+#include <kernel/include/fs/vfs.h>
+#include <kernel/include/memory/kmalloc.h>
 #include <klibc/include/errno.h>
 #include <klibc/include/stdio.h>
 #include <klibc/include/string.h>
 #include <klibc/include/strings.h>
 
 
+/* Location in memory of the sections of an image being loaded */
+typedef struct elf_layout
+{
+    u32 ram_start;              /* Lowest vaddr of the sections copied into RAM             */
+    u8 *ram;                    /* Address of the copy of the section at ram_start          */
+    u32 rom_start;              /* Lowest vaddr of the sections executed in place           */
+    u32 rom_end;                /* Vaddr following the last section executed in place       */
+    ku8 *rom;                   /* Address corresponding to vaddr 0 in executed-in-place    */
+                                /* sections                                                 */
+} elf_layout_t;
+
+static u32 elf_is_xip_section(const Elf32_Shdr * const sh, ks8 * const name, ku32 flags);
+static u32 elf_translate(const elf_layout_t * const layout, ku32 vaddr);
+
+
 /*
     elf_load_exe() - load an executable ELF image.  buf should point to an in-memory copy of the
     executable file; len should specify buf's length.
+
+    Normally all program sections are copied into a single buffer in the user heap.  If <flags>
+    includes ELF_LOAD_XIP, the read-only sections (.text and .rodata) are instead executed in place,
+    so buf must remain valid, and unmodified, until the image is freed; only .got and .data are
+    copied, and .bss is zeroed.  As .text and .got are then not at a fixed distance from each other,
+    the executable must be compiled to address its GOT through a register (-msep-data), rather than
+    relative to the PC; the address of the GOT is returned in (*img)->got.  An executable which does
+    not declare that it was so compiled (see ELF_SEP_DATA_SECTION) is copied, even if ELF_LOAD_XIP
+    is specified; the caller can tell whether this happened by comparing (*img)->data with
+    (*img)->start.
 */
-s32 elf_load_exe(const void * const buf, ku32 len, exe_img_t **img)
+s32 elf_load_exe(const void * const buf, ku32 len, u32 flags, exe_img_t **img)
 {
     const Elf32_Ehdr *ehdr;
     const Elf32_Shdr *shdr, *sh;
     exe_img_t *image;
+    elf_layout_t layout;
     s8 *strtab;
-    u8 *imgbuf;
-    u32 vaddr_start, vaddr_end, size;
+    u8 *imgbuf, *got;
+    u32 vaddr_start, vaddr_end, size, rom_delta;
     u16 nshdr;
 
 
@@ -80,45 +109,97 @@ s32 elf_load_exe(const void * const buf, ku32 len, exe_img_t **img)
     if(strtab == NULL)
         return -EEXENOSECTION;      /* String table missing */
 
+    /* Only executables which address their GOT through a register can be executed in place */
+    if(flags & ELF_LOAD_XIP)
+    {
+        for(sh = shdr; sh < &shdr[nshdr]; ++sh)
+            if(!strcmp(strtab + BE2N32(sh->sh_name), ELF_SEP_DATA_SECTION))
+                break;
+
+        if(sh == &shdr[nshdr])
+            flags &= ~ELF_LOAD_XIP;
+    }
+
     /* Search the section headers for program sections */
-    vaddr_start = 0xffffffff;
-    vaddr_end = 0;
+    vaddr_start = layout.rom_start = 0xffffffff;
+    vaddr_end = layout.rom_end = rom_delta = 0;
 
     /* Pass 1: calculate extents of the memory region required for the program */
     for(sh = shdr; sh < &shdr[nshdr]; ++sh)
     {
         ks8 * const name = strtab + BE2N32(sh->sh_name);
-        if(((BE2N32(sh->sh_type) == SHT_PROGBITS) && elf_is_relevant_progbits_section(name))
+        ku32 addr = BE2N32(sh->sh_addr), end = addr + BE2N32(sh->sh_size);
+
+        if(elf_is_xip_section(sh, name, flags))
+        {
+            /* This section will be executed in place.  All such sections must have the same
+               vaddr-to-file offset mapping, i.e. must belong to the same segment. */
+            ku32 delta = BE2N32(sh->sh_offset) - addr;
+
+            if(((layout.rom_start <= layout.rom_end) && (delta != rom_delta))
+               || (BE2N32(sh->sh_offset) + BE2N32(sh->sh_size) > len))
+                return -EEXEBADSECTION;
+
+            rom_delta = delta;
+
+            if(addr < layout.rom_start)
+                layout.rom_start = addr;
+
+            if(end > layout.rom_end)
+                layout.rom_end = end;
+        }
+        else if(((BE2N32(sh->sh_type) == SHT_PROGBITS) && elf_is_relevant_progbits_section(name))
             || ((BE2N32(sh->sh_type) == SHT_NOBITS) && elf_is_relevant_nobits_section(name)))
         {
             /* This section will be loaded */
-            if(BE2N32(sh->sh_addr) < vaddr_start)
-                vaddr_start = BE2N32(sh->sh_addr);
+            if(addr < vaddr_start)
+                vaddr_start = addr;
 
-            if((BE2N32(sh->sh_addr) + BE2N32(sh->sh_size)) > vaddr_end)
-                vaddr_end = BE2N32(sh->sh_addr) + BE2N32(sh->sh_size);
+            if(end > vaddr_end)
+                vaddr_end = end;
         }
     }
 
-    size = vaddr_end - vaddr_start;
+    layout.rom = (ku8 *) buf + rom_delta;
 
-    imgbuf = (u8 *) umalloc(size);
-    if(!imgbuf)
-        return -ENOMEM;
+    /* MC680x0 requires instructions to be aligned to an even-numbered address */
+    if((layout.rom_start <= layout.rom_end) && ((u32) layout.rom & 1))
+        return -EEXEBADSECTION;
+
+    size = (vaddr_end > vaddr_start) ? vaddr_end - vaddr_start : 0;
+
+    imgbuf = NULL;
+    if(size)
+    {
+        imgbuf = (u8 *) umalloc(size);
+        if(!imgbuf)
+            return -ENOMEM;
+    }
 
     image = kmalloc(sizeof(exe_img_t));
     if(!image)
     {
-        ufree(imgbuf);
+        if(imgbuf)
+            ufree(imgbuf);
+
         return -ENOMEM;
     }
 
+    layout.ram_start = vaddr_start;
+    layout.ram = imgbuf;
+    got = NULL;
+
     /* Pass 2: copy segments into buffer; initialise as required */
     for(sh = shdr; sh < &shdr[nshdr]; ++sh)
     {
         ks8 * const name = strtab + BE2N32(sh->sh_name);
-        u8 * const sect_start_img = imgbuf + (BE2N32(sh->sh_addr) - vaddr_start),
-           * const sect_start_buf = (u8 *) buf + BE2N32(sh->sh_offset);
+        u8 *sect_start_img, *sect_start_buf;
+
+        if(elf_is_xip_section(sh, name, flags))
+            continue;
+
+        sect_start_img = imgbuf + (BE2N32(sh->sh_addr) - vaddr_start);
+        sect_start_buf = (u8 *) buf + BE2N32(sh->sh_offset);
 
         if((BE2N32(sh->sh_type) == SHT_PROGBITS) && elf_is_relevant_progbits_section(name))
         {
@@ -133,17 +214,30 @@ s32 elf_load_exe(const void * const buf, ku32 len, exe_img_t **img)
 
                 for(; got_entry < got_end; ++got_entry)
                     if(*got_entry)
-                        *got_entry = BE2N32(BE2N32(*got_entry) - vaddr_start + (u32) imgbuf);
+                        *got_entry = BE2N32(elf_translate(&layout, BE2N32(*got_entry)));
+
+                got = sect_start_img;
             }
         }
         else if((BE2N32(sh->sh_type) == SHT_NOBITS) && elf_is_relevant_nobits_section(name))
             bzero(sect_start_img, BE2N32(sh->sh_size)); /* Zero-init NOBITS sections (eg. .bss) */
     }
 
+    if(layout.rom_start <= layout.rom_end)
+    {
+        image->start = (void *) (layout.rom + layout.rom_start);
+        image->len = layout.rom_end - layout.rom_start;
+    }
+    else
+    {
+        image->start = imgbuf;
+        image->len = size;
+    }
 
-    image->start = imgbuf;
-    image->len = size;
-    image->entry_point = (proc_entry_fn_t) (imgbuf + (BE2N32(ehdr->e_entry) - vaddr_start));
+    image->entry_point = (proc_entry_fn_t) elf_translate(&layout, BE2N32(ehdr->e_entry));
+    image->data = imgbuf;
+    image->got = got;
+    image->node = NULL;
 
     *img = image;
 
@@ -151,6 +245,99 @@ s32 elf_load_exe(const void * const buf, ku32 len, exe_img_t **img)
 }
 
 
+/*
+    elf_load_file() - load the executable ELF file at <path>.  If the contents of the file are
+    directly addressable, e.g. because it lives in a romfs image in ROM, the image is loaded
+    straight from the file system, and executed in place if it was built to allow this (see
+    elf_load_exe()).  An image executed in place holds a reference to the file's node until it is
+    freed, so the file system cannot be unmounted (vfs_unmount() fails with -EBUSY) while the image
+    is in use.  Otherwise the file is read into a temporary buffer, and loaded from there.
+*/
+s32 elf_load_file(ks8 * const path, exe_img_t **img)
+{
+    vfs_t *vfs;
+    fs_node_t *node;
+    const void *addr;
+    void *buf;
+    s32 ret;
+
+    ret = path_open(path, &vfs, &node);
+    if(ret != SUCCESS)
+        return ret;
+
+    if(node->type != FSNODE_TYPE_FILE)
+        ret = -EISDIR;
+    else if(vfs_map(vfs, node, &addr) == SUCCESS)
+    {
+        ret = elf_load_exe(addr, node->size, ELF_LOAD_XIP, img);
+
+        /* If the image is executed in place, it takes over the reference to the node */
+        if((ret == SUCCESS) && ((*img)->start != (*img)->data))
+        {
+            (*img)->node = node;
+            return SUCCESS;
+        }
+    }
+    else
+    {
+        buf = kmalloc(node->size);
+        if(buf != NULL)
+        {
+            ret = vfs_read(vfs, node, buf, 0, node->size);
+            if(ret >= 0)
+                ret = ((u32) ret == node->size) ? elf_load_exe(buf, node->size, 0, img) : -EREAD;
+
+            kfree(buf);
+        }
+        else
+            ret = -ENOMEM;
+    }
+
+    fs_node_put(node);
+
+    return ret;
+}
+
+
+/*
+    exe_img_free() - release an executable image loaded by elf_load_exe().
+*/
+void exe_img_free(exe_img_t *img)
+{
+    if(img->data != NULL)
+        ufree(img->data);
+
+    if(img->node != NULL)
+        fs_node_put(img->node);
+
+    kfree(img);
+}
+
+
+/*
+    elf_is_xip_section() - return true if the section described by <sh>, whose name is <name>, is
+    to be executed in place when loading with the specified <flags>; return false otherwise.
+*/
+static u32 elf_is_xip_section(const Elf32_Shdr * const sh, ks8 * const name, ku32 flags)
+{
+    return (flags & ELF_LOAD_XIP) && (BE2N32(sh->sh_type) == SHT_PROGBITS)
+            && (!strcmp(name, ".text") || !strcmp(name, ".rodata"));
+}
+
+
+/*
+    elf_translate() - translate a virtual address in an image into the address at which it has been
+    loaded.
+*/
+static u32 elf_translate(const elf_layout_t * const layout, ku32 vaddr)
+{
+    if((vaddr >= layout->rom_start) && (vaddr < layout->rom_end))
+        return (u32) (layout->rom + vaddr);
+
+    return (u32) (layout->ram + (vaddr - layout->ram_start));
+}
+
+
 /*
     elf_is_relevant_progbits_section() - given the name of a section, return true if it is a
     populated program section that needs to be processed; return false otherwise.
@@ -17,6 +17,7 @@
 #include <kernel/include/device/block.h>
 #include <kernel/include/device/memconsole.h>
 #include <kernel/include/device/partition.h>
+#include <kernel/include/device/ramdisk.h>
 #include <kernel/include/fs/vfs.h>
 #include <kernel/include/platform.h>
 #include <kernel/include/preempt.h>
@@ -39,6 +40,9 @@ const char * const g_warmup_message = "\n  \\   ayumos"
 void _main()
 {
     mem_extent_t *ramext;
+#if defined(WITH_DRV_MST_RAMDISK) && defined(RAMDISK_RESERVED_MEM)
+    void *ramdisk_mem;
+#endif
     u8 sn[6];
     u32 cpu_clk_hz = 0;
     rtc_time_t tm;
@@ -70,7 +74,13 @@ void _main()
 
     /* Initialise user heap.  Place it in the largest user RAM extent. */
     ramext = mem_get_largest_extent(MEM_EXTENT_USER | MEM_EXTENT_RAM);
+#if defined(WITH_DRV_MST_RAMDISK) && defined(RAMDISK_RESERVED_MEM)
+    /* Reserve the top of the extent for the boot-time RAM disk */
+    ramdisk_mem = (u8 *) ramext->base + ramext->len - RAMDISK_RESERVED_MEM;
+    umeminit(ramext->base, ramdisk_mem);
+#else
     umeminit(ramext->base, ramext->base + ramext->len);
+#endif
 
     /* By default, all exceptions cause a context-dump followed by a halt. */
     cpu_irq_init_table();
@@ -133,9 +143,20 @@ void _main()
     puts("done");
 */
 
+    /*
+        Initialise the tick handler before any mass-storage I/O: device drivers' command timeouts
+        are measured in ticks.
+    */
+    tick_init();
+
     /* Initialise the block cache, then scan mass-storage devices for partitions */
     block_cache_init(2039);
 
+#if defined(WITH_DRV_MST_RAMDISK) && defined(RAMDISK_RESERVED_MEM)
+    if(ramdisk_create(ramdisk_mem, RAMDISK_RESERVED_MEM, NULL, 0, NULL) != SUCCESS)
+        puts("ramdisk: init failed");
+#endif
+
 #ifdef WITH_DRV_MST_PARTITION
     partition_init();
 #endif /* WITH_DRV_MST_PARTITION */
@@ -160,9 +181,6 @@ void _main()
     if(plat_get_cpu_clock(&cpu_clk_hz) == SUCCESS)
         printf("\nCPU fclk ~%2u.%uMHz\n", cpu_clk_hz / 1000000, (cpu_clk_hz % 1000000) / 100000);
 
-    /* Initialise tick handler */
-    tick_init();
-
     /* Display memory information */
     printf("%u bytes of kernel heap memory available\n"
            "%u bytes of user memory available\n", kfreemem(), ufreemem());
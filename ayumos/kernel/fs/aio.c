@@ -0,0 +1,308 @@
+/*
+    Asynchronous file I/O
+
+    Part of ayumos
+
+
+    (c) Stuart Wallace <stuartw@atom.net>, October 2026.
+
+
+    Submitted requests are placed on a single work queue, which is serviced in arrival order by a
+    pool of AIO_WORKERS kernel processes.  A worker carries out a request with a synchronous call to
+    vfs_read() or vfs_write(), sleeping in the block device's request queue as necessary, so with
+    more than one worker, several requests can be in progress at once.  The submitting process holds
+    a reference to the file's node for the lifetime of each request, so a file descriptor may be
+    closed while requests on it are outstanding.
+
+    The work queue, the completion queues and the workers' state are protected by disabling
+    pre-emption.
+*/
+
+#include <kernel/include/fs/aio.h>
+#include <kernel/include/fs/fd.h>
+#include <kernel/include/memory/slab.h>
+#include <kernel/include/preempt.h>
+
+
+static LINKED_LIST(g_aio_queue);                /* Requests awaiting a worker               */
+static proc_t *g_aio_workers[AIO_WORKERS];      /* Worker processes, once they have started */
+static aio_req_t *g_aio_current[AIO_WORKERS];   /* Request being carried out by each worker */
+
+static void aio_worker(void *arg);
+static void aio_sleep(proc_t * const proc);
+static s32 aio_in_progress(const aio_ctx_t * const ctx);
+
+
+/*
+    aio_init() - start the asynchronous I/O worker processes.
+*/
+s32 aio_init()
+{
+    u32 u;
+    s32 ret;
+
+    for(u = 0; u < AIO_WORKERS; ++u)
+    {
+        ret = proc_create(0, 0, "[aio]", NULL, aio_worker, (void *) u, 0, PROC_TYPE_KERNEL,
+                          PROC_DEFAULT_WD, NULL, NULL);
+        if(ret != SUCCESS)
+            return ret;
+    }
+
+    return SUCCESS;
+}
+
+
+/*
+    aio_sleep() - put the current process, <proc>, to sleep until it is woken.  Must be called with
+    pre-emption disabled; pre-emption is enabled while the process sleeps, so the caller must
+    re-check the condition for which it is waiting.
+*/
+static void aio_sleep(proc_t * const proc)
+{
+    proc->state = ps_sleeping;
+    preempt_enable();
+
+    cpu_switch_process();
+
+    preempt_disable();
+}
+
+
+/*
+    aio_in_progress() - return non-zero if a worker is carrying out a request submitted by the
+    process owning <ctx>.  Must be called with pre-emption disabled.
+*/
+static s32 aio_in_progress(const aio_ctx_t * const ctx)
+{
+    u32 u;
+
+    for(u = 0; u < AIO_WORKERS; ++u)
+        if((g_aio_current[u] != NULL) && (g_aio_current[u]->ctx == ctx))
+            return 1;
+
+    return 0;
+}
+
+
+/*
+    aio_worker() - kernel process which carries out queued requests.  <arg> is the worker's index.
+*/
+static void aio_worker(void *arg)
+{
+    ku32 index = (u32) arg;
+    proc_t * const self = proc_current();
+
+    preempt_disable();
+    g_aio_workers[index] = self;
+
+    while(1)
+    {
+        aio_req_t *req;
+        aio_ctx_t *ctx;
+        s32 ret;
+
+        while(list_is_empty(&g_aio_queue))
+            aio_sleep(self);
+
+        req = list_first_entry(&g_aio_queue, aio_req_t, queue);
+        list_delete(&req->queue);
+        g_aio_current[index] = req;
+
+        preempt_enable();
+
+        if(req->op == AIO_READ)
+            ret = vfs_read(req->vfs, req->node, req->buf, req->offset, req->count);
+        else
+            ret = vfs_write(req->vfs, req->node, req->buf, req->offset, req->count);
+
+        fs_node_put(req->node);
+
+        /* Move the request to its submitter's completion queue, and wake the submitter if needed */
+        preempt_disable();
+
+        g_aio_current[index] = NULL;
+        req->status = ret;
+
+        ctx = req->ctx;
+        list_insert(&req->queue, &ctx->done);
+        if(ctx->waiting)
+            proc_wake(ctx->proc);
+    }
+}
+
+
+/*
+    aio_submit() - queue the read or write request described by <cb> for a worker, and return
+    without waiting for it to be carried out.  The file descriptor must have been opened for reading
+    or writing, as appropriate.  Returns -EAGAIN if the current process already has
+    AIO_MAX_OUTSTANDING requests outstanding.
+*/
+s32 aio_submit(const aio_cb_t * const cb)
+{
+    proc_t * const proc = proc_current();
+    file_handle_t *fh;
+    aio_ctx_t *ctx;
+    aio_req_t *req;
+    u32 u;
+
+    if((cb == NULL) || (cb->buf == NULL))
+        return -EINVAL;
+
+    fh = fd_get(proc, cb->fd);
+    if(fh == NULL)
+        return -EBADF;
+
+    if(cb->op == AIO_READ)
+    {
+        if(!(fh->flags & O_RD))
+            return -EBADF;
+    }
+    else if(cb->op == AIO_WRITE)
+    {
+        if(!(fh->flags & O_WR))
+            return -EBADF;
+    }
+    else
+        return -EINVAL;
+
+    /* Allocate the process' asynchronous I/O state on its first request */
+    ctx = proc->aio;
+    if(ctx == NULL)
+    {
+        ctx = (aio_ctx_t *) slab_alloc(sizeof(aio_ctx_t));
+        if(ctx == NULL)
+            return -ENOMEM;
+
+        list_init(&ctx->done);
+        ctx->outstanding = 0;
+        ctx->proc = proc;
+        ctx->waiting = 0;
+
+        proc->aio = ctx;
+    }
+
+    if(ctx->outstanding >= AIO_MAX_OUTSTANDING)
+        return -EAGAIN;
+
+    req = (aio_req_t *) slab_alloc(sizeof(aio_req_t));
+    if(req == NULL)
+        return -ENOMEM;
+
+    req->vfs    = fh->vfs;
+    req->node   = fh->node;
+    req->buf    = cb->buf;
+    req->offset = cb->offset;
+    req->count  = cb->count;
+    req->tag    = cb->tag;
+    req->ctx    = ctx;
+    req->status = -EINPROGRESS;
+    req->op     = (aio_op_t) cb->op;
+
+    fs_node_ref(req->node);
+
+    preempt_disable();
+
+    ++ctx->outstanding;
+    list_insert(&req->queue, &g_aio_queue);
+
+    /* Wake any idle workers; proc_wake() ignores those which are not sleeping */
+    for(u = 0; u < AIO_WORKERS; ++u)
+        if(g_aio_workers[u] != NULL)
+            proc_wake(g_aio_workers[u]);
+
+    preempt_enable();
+
+    return SUCCESS;
+}
+
+
+/*
+    aio_reap() - remove the oldest completion from the current process' completion queue and return
+    it through <ev>.  If no request has completed, return -EAGAIN, or, if <flags> includes AIO_WAIT,
+    sleep until one does.  Return -ENOENT if the process has no requests outstanding.
+*/
+s32 aio_reap(aio_event_t * const ev, ku32 flags)
+{
+    proc_t * const proc = proc_current();
+    aio_ctx_t * const ctx = proc->aio;
+    aio_req_t *req;
+
+    if(ev == NULL)
+        return -EINVAL;
+
+    if(ctx == NULL)
+        return -ENOENT;
+
+    preempt_disable();
+
+    while(list_is_empty(&ctx->done))
+    {
+        if(!ctx->outstanding || !(flags & AIO_WAIT))
+        {
+            preempt_enable();
+            return ctx->outstanding ? -EAGAIN : -ENOENT;
+        }
+
+        ctx->waiting = 1;
+        aio_sleep(proc);
+        ctx->waiting = 0;
+    }
+
+    req = list_first_entry(&ctx->done, aio_req_t, queue);
+    list_delete(&req->queue);
+    --ctx->outstanding;
+
+    preempt_enable();
+
+    ev->tag = req->tag;
+    ev->status = req->status;
+
+    slab_free(req);
+
+    return SUCCESS;
+}
+
+
+/*
+    aio_proc_exit() - called by proc_destroy() on behalf of the exiting process <proc>, which must
+    be the current process.  Queued requests are cancelled; requests already being carried out
+    are waited for, because they may refer to the process' memory.  Unreaped completions are then
+    discarded.
+*/
+void aio_proc_exit(proc_t * const proc)
+{
+    aio_ctx_t * const ctx = proc->aio;
+    aio_req_t *req, *tmp;
+    LINKED_LIST(cancelled);
+
+    if(ctx == NULL)
+        return;
+
+    preempt_disable();
+
+    list_for_each_entry_safe(req, tmp, &g_aio_queue, queue)
+        if(req->ctx == ctx)
+            list_move_append(&req->queue, &cancelled);
+
+    while(aio_in_progress(ctx))
+    {
+        ctx->waiting = 1;
+        aio_sleep(proc);
+        ctx->waiting = 0;
+    }
+
+    preempt_enable();
+
+    list_for_each_entry_safe(req, tmp, &cancelled, queue)
+    {
+        fs_node_put(req->node);
+        slab_free(req);
+    }
+
+    list_for_each_entry_safe(req, tmp, &ctx->done, queue)
+        slab_free(req);
+
+    slab_free(ctx);
+    proc->aio = NULL;
+}
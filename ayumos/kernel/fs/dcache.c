@@ -0,0 +1,330 @@
+/*
+    Directory entry cache
+
+    Part of ayumos
+
+
+    (c) Stuart Wallace <stuartw@atom.net>, October 2026.
+
+
+    The directory entry cache holds the results of recent name lookups, so that walking a path does
+    not require each directory along the path to be opened and searched.  Each entry is keyed on
+    (VFS, first block of parent directory, child name) and holds a copy of the child node; negative
+    entries record names which were found not to exist.  Directories are identified by their first
+    block, rather than by node pointer, because an unreferenced node may be evicted from the node
+    cache and later re-read into a different node.
+
+    Entries are allocated from a fixed-size pool.  When the pool is exhausted, the least-recently
+    used entry is recycled.  Names longer than DCACHE_NAME_LEN characters are not cached.  Names are
+    stored in the entries themselves, so that no memory is allocated or freed while the cache is
+    locked; nodes returned by lookups are allocated after the cache has been unlocked.
+
+    Entries are invalidated when the corresponding node is written, and all entries belonging to a
+    VFS are invalidated when a file system is mounted on it or when it is unmounted.  To find the
+    entries referring to a node, positive entries are also hashed on (VFS, first block of child).
+    Nodes whose first block is zero (e.g. empty files on FAT volumes, which have no clusters) cannot
+    be told apart by first block, so positive entries are not created for them.
+
+    Cache state is protected by disabling pre-emption.
+*/
+
+#include <kernel/include/fs/dcache.h>
+#include <kernel/include/memory/kmalloc.h>
+#include <kernel/include/preempt.h>
+#include <kernel/util/kutil.h>
+#include <klibc/include/string.h>
+
+
+static dcache_ent_t *g_dcache;
+static list_t g_dcache_buckets[DCACHE_BUCKETS];
+static list_t g_dcache_node_buckets[DCACHE_BUCKETS];
+static list_t g_dcache_lru;                 /* In-use entries, least-recently used first */
+static list_t g_dcache_free;                /* Unused entries                            */
+static dcache_stats_t g_dcache_stats;
+
+static u32 dcache_hash(const vfs_t * const vfs, ku32 parent, const char *name);
+static list_t *dcache_node_bucket(const vfs_t * const vfs, ku32 first_block);
+static dcache_ent_t *dcache_find(const vfs_t * const vfs, ku32 parent, const char * const name,
+                                 ku32 hash);
+static void dcache_release(dcache_ent_t * const ent);
+
+
+/*
+    dcache_init() - allocate and initialise the directory entry cache.
+*/
+s32 dcache_init()
+{
+    u32 u;
+
+    g_dcache = (dcache_ent_t *) kcalloc(DCACHE_ENTRIES, sizeof(dcache_ent_t));
+    if(g_dcache == NULL)
+        return -ENOMEM;
+
+    for(u = 0; u < DCACHE_BUCKETS; ++u)
+    {
+        list_init(&g_dcache_buckets[u]);
+        list_init(&g_dcache_node_buckets[u]);
+    }
+
+    list_init(&g_dcache_lru);
+    list_init(&g_dcache_free);
+
+    for(u = 0; u < DCACHE_ENTRIES; ++u)
+        list_insert(&g_dcache[u].hash, &g_dcache_free);
+
+    return SUCCESS;
+}
+
+
+/*
+    dcache_hash() - compute the hash of a (vfs, parent, name) key.
+*/
+static u32 dcache_hash(const vfs_t * const vfs, ku32 parent, const char *name)
+{
+    ku32 hash = fnv1a32(name, strlen(name)) ^ ((u32) vfs) ^ parent;
+
+    return hash ^ (hash >> 16);
+}
+
+
+/*
+    dcache_node_bucket() - return the node hash bucket for the node whose first block is
+    <first_block>, on <vfs>.
+*/
+static list_t *dcache_node_bucket(const vfs_t * const vfs, ku32 first_block)
+{
+    ku32 hash = ((u32) vfs) ^ first_block;
+
+    return &g_dcache_node_buckets[(hash ^ (hash >> 16)) & (DCACHE_BUCKETS - 1)];
+}
+
+
+/*
+    dcache_find() - find the entry matching a key, or return NULL if no entry matches.  Must be
+    called with pre-emption disabled.
+*/
+static dcache_ent_t *dcache_find(const vfs_t * const vfs, ku32 parent, const char * const name,
+                                 ku32 hash)
+{
+    dcache_ent_t *ent;
+
+    list_for_each_entry(ent, &g_dcache_buckets[hash & (DCACHE_BUCKETS - 1)], hash)
+        if((ent->name_hash == hash) && (ent->vfs == vfs) && (ent->parent == parent)
+           && !strcmp(ent->name, name))
+            return ent;
+
+    return NULL;
+}
+
+
+/*
+    dcache_release() - remove an entry from the cache and return it to the free list.  Must be
+    called with pre-emption disabled.
+*/
+static void dcache_release(dcache_ent_t * const ent)
+{
+    if(!ent->negative)
+        list_delete(&ent->node_hash);
+
+    list_delete(&ent->hash);
+    list_delete(&ent->lru);
+    list_insert(&ent->hash, &g_dcache_free);
+
+    --g_dcache_stats.entries;
+}
+
+
+/*
+    dcache_lookup() - look up <name> in the directory whose first block is <parent>, on <vfs>.  If a
+    positive entry is found, allocate a copy of the cached node and return it through <*node>.
+    Return -ENOENT if a negative entry is found, or -ENODATA if the name is not in the cache.
+*/
+s32 dcache_lookup(const vfs_t * const vfs, ku32 parent, const char * const name,
+                  fs_node_t ** const node)
+{
+    ku32 hash = dcache_hash(vfs, parent, name);
+    char node_name[DCACHE_NAME_LEN + 1];
+    dcache_ent_t *ent;
+    fs_node_t *node_, copy;
+    s32 ret;
+
+    if(g_dcache == NULL)
+        return -ENODATA;
+
+    preempt_disable();
+
+    ++g_dcache_stats.lookups;
+
+    ent = dcache_find(vfs, parent, name, hash);
+    if(ent == NULL)
+    {
+        ++g_dcache_stats.misses;
+        preempt_enable();
+        return -ENODATA;
+    }
+
+    /* Move the entry to the most-recently-used end of the LRU list */
+    list_delete(&ent->lru);
+    list_insert(&ent->lru, &g_dcache_lru);
+
+    if(ent->negative)
+    {
+        ++g_dcache_stats.negative_hits;
+        preempt_enable();
+        return -ENOENT;
+    }
+
+    ++g_dcache_stats.hits;
+
+    copy = ent->node;
+    strcpy(node_name, ent->node_name);
+
+    preempt_enable();
+
+    ret = fs_node_alloc(&node_);
+    if(ret != SUCCESS)
+        return ret;
+
+    *node_ = copy;
+    node_->name = NULL;
+
+    ret = fs_node_set_name(node_, node_name);
+    if(ret != SUCCESS)
+    {
+        fs_node_free(node_);
+        return ret;
+    }
+
+    *node = node_;
+
+    return SUCCESS;
+}
+
+
+/*
+    dcache_add() - add an entry to the cache, recording the result of looking up <name> in the
+    directory whose first block is <parent>, on <vfs>.  If <node> is NULL, a negative entry is
+    created.  Any existing entry for the same key is removed, and replaced unless <node> has first
+    block zero or a name too long to be cached.  Failure to add an entry is not an error; the lookup
+    will simply miss next time.
+*/
+void dcache_add(vfs_t * const vfs, ku32 parent, const char * const name,
+                const fs_node_t * const node)
+{
+    ku32 hash = dcache_hash(vfs, parent, name);
+    dcache_ent_t *ent;
+
+    if((g_dcache == NULL) || (strlen(name) > DCACHE_NAME_LEN))
+        return;
+
+    preempt_disable();
+
+    ent = dcache_find(vfs, parent, name, hash);
+    if(ent != NULL)
+        dcache_release(ent);
+
+    if((node != NULL) && (!node->first_block || (strlen(node->name) > DCACHE_NAME_LEN)))
+    {
+        preempt_enable();
+        return;
+    }
+
+    if(!list_is_empty(&g_dcache_free))
+        ent = list_first_entry(&g_dcache_free, dcache_ent_t, hash);
+    else
+    {
+        /* Recycle the least-recently-used entry */
+        ent = list_first_entry(&g_dcache_lru, dcache_ent_t, lru);
+        dcache_release(ent);
+        ++g_dcache_stats.evictions;
+    }
+
+    list_delete(&ent->hash);
+
+    ent->vfs = vfs;
+    ent->parent = parent;
+    ent->name_hash = hash;
+    strcpy(ent->name, name);
+
+    if(node != NULL)
+    {
+        ent->negative = 0;
+        ent->node = *node;
+        ent->node.name = NULL;
+        strcpy(ent->node_name, node->name);
+
+        list_insert(&ent->node_hash, dcache_node_bucket(vfs, node->first_block));
+    }
+    else
+        ent->negative = 1;
+
+    list_insert(&ent->hash, &g_dcache_buckets[hash & (DCACHE_BUCKETS - 1)]);
+    list_insert(&ent->lru, &g_dcache_lru);
+
+    ++g_dcache_stats.entries;
+
+    preempt_enable();
+}
+
+
+/*
+    dcache_invalidate_node() - remove all positive entries which refer to <node> on <vfs>.  This is
+    called when a node's metadata (e.g. its size) may have changed.  Only the node's hash bucket is
+    searched.
+*/
+void dcache_invalidate_node(const vfs_t * const vfs, const fs_node_t * const node)
+{
+    dcache_ent_t *ent, *tmp;
+
+    /* Nodes whose first block is zero are never cached */
+    if((g_dcache == NULL) || !node->first_block)
+        return;
+
+    preempt_disable();
+
+    list_for_each_entry_safe(ent, tmp, dcache_node_bucket(vfs, node->first_block), node_hash)
+    {
+        if((ent->vfs == vfs) && (ent->node.first_block == node->first_block))
+        {
+            dcache_release(ent);
+            ++g_dcache_stats.invalidations;
+        }
+    }
+
+    preempt_enable();
+}
+
+
+/*
+    dcache_invalidate_vfs() - remove all entries belonging to <vfs>.  If <vfs> is NULL, remove all
+    entries.
+*/
+void dcache_invalidate_vfs(const vfs_t * const vfs)
+{
+    dcache_ent_t *ent, *tmp;
+
+    if(g_dcache == NULL)
+        return;
+
+    preempt_disable();
+
+    list_for_each_entry_safe(ent, tmp, &g_dcache_lru, lru)
+    {
+        if((vfs == NULL) || (ent->vfs == vfs))
+        {
+            dcache_release(ent);
+            ++g_dcache_stats.invalidations;
+        }
+    }
+
+    preempt_enable();
+}
+
+
+/*
+    dcache_stats() - return a pointer to the directory entry cache statistics.
+*/
+const dcache_stats_t *dcache_stats()
+{
+    return &g_dcache_stats;
+}
@@ -0,0 +1,707 @@
+/*
+    ext2 block and inode allocation
+
+    Part of ayumos
+
+
+    (c) Stuart Wallace <stuartw@atom.net>, October 2026.
+
+
+    Blocks and inodes are allocated from the per-group bitmaps.  The most recently used block and
+    inode bitmaps are held in memory and written back lazily, along with the block group descriptor
+    table and the superblock's free counts, by ext2_alloc_sync().  See ext2.h for a description of
+    the block placement policy.
+*/
+
+#ifdef WITH_FS_EXT2
+
+#include <kernel/include/device/block.h>
+#include <kernel/fs/ext2/ext2.h>
+
+
+#define EXT2_BIT_IS_SET(buf, bit)   ((buf)[(bit) >> 3] & (1 << ((bit) & 7)))
+#define EXT2_BIT_SET(buf, bit)      ((buf)[(bit) >> 3] |= (1 << ((bit) & 7)))
+#define EXT2_BIT_CLEAR(buf, bit)    ((buf)[(bit) >> 3] &= ~(1 << ((bit) & 7)))
+
+
+static s32 ext2_bitmap_flush(vfs_t * const vfs, ext2_bitmap_t * const bm);
+static s32 ext2_bitmap_load(vfs_t * const vfs, ext2_bitmap_t * const bm, ku32 group,
+                            ku32 inodes);
+static u32 ext2_group_first_block(const ext2_fs_t * const fs, ku32 group);
+static u32 ext2_group_nblocks(const ext2_fs_t * const fs, ku32 group);
+static void ext2_bgd_mark_dirty(ext2_fs_t * const fs, ku32 group);
+static ext2_prealloc_t *ext2_prealloc_find(ext2_alloc_t * const alloc, ku32 inum);
+static u32 ext2_prealloc_reserved(ext2_alloc_t * const alloc, ku32 block, ku32 inum);
+static u32 ext2_find_free_run(ext2_fs_t * const fs, ku32 group, u32 bit, ku32 min_run,
+                              ku32 max_run, ku32 inum, u32 * const len);
+static void ext2_mark_blocks(ext2_fs_t * const fs, ku32 group, ku32 bit, ku32 count);
+
+
+/*
+    ext2_alloc_init() - allocate and initialise the allocator state for the file system <vfs>.
+*/
+s32 ext2_alloc_init(vfs_t *vfs)
+{
+    ext2_fs_t * const fs = (ext2_fs_t *) vfs->data;
+    ext2_alloc_t *alloc;
+    u32 u;
+
+    alloc = (ext2_alloc_t *) CHECKED_KCALLOC(1, sizeof(ext2_alloc_t));
+
+    alloc->blocks.buf = (u8 *) kmalloc(fs->block_size);
+    alloc->inodes.buf = (u8 *) kmalloc(fs->block_size);
+    alloc->bgd_dirty = (u8 *) kcalloc(fs->bgd_units, sizeof(u8));
+
+    if((alloc->blocks.buf == NULL) || (alloc->inodes.buf == NULL) || (alloc->bgd_dirty == NULL))
+    {
+        kfree(alloc->blocks.buf);
+        kfree(alloc->inodes.buf);
+        kfree(alloc->bgd_dirty);
+        kfree(alloc);
+        return -ENOMEM;
+    }
+
+    alloc->blocks.group = EXT2_NO_GROUP;
+    alloc->inodes.group = EXT2_NO_GROUP;
+
+    sem_init(&alloc->lock);
+    list_init(&alloc->lru);
+
+    for(u = 0; u < EXT2_PREALLOC_WINDOWS; ++u)
+        list_insert(&alloc->windows[u].lru, &alloc->lru);
+
+    fs->alloc = alloc;
+
+    return SUCCESS;
+}
+
+
+/*
+    ext2_alloc_destroy() - release the allocator state belonging to <fs>.  Call ext2_alloc_sync()
+    first to write back any changes.
+*/
+void ext2_alloc_destroy(ext2_fs_t *fs)
+{
+    if(fs->alloc != NULL)
+    {
+        kfree(fs->alloc->blocks.buf);
+        kfree(fs->alloc->inodes.buf);
+        kfree(fs->alloc->bgd_dirty);
+        kfree(fs->alloc);
+        fs->alloc = NULL;
+    }
+}
+
+
+/*
+    ext2_group_first_block() - return the number of the first block in block group <group>.
+*/
+static u32 ext2_group_first_block(const ext2_fs_t * const fs, ku32 group)
+{
+    return fs->first_data_block + (group * fs->blocks_per_group);
+}
+
+
+/*
+    ext2_group_nblocks() - return the number of blocks in block group <group>.  The last group may
+    be smaller than the others.
+*/
+static u32 ext2_group_nblocks(const ext2_fs_t * const fs, ku32 group)
+{
+    ku32 first = ext2_group_first_block(fs, group);
+
+    return MIN(fs->blocks_per_group, fs->blocks_count - first);
+}
+
+
+/*
+    ext2_bgd_mark_dirty() - note that the descriptor of block group <group> has been modified.
+*/
+static void ext2_bgd_mark_dirty(ext2_fs_t * const fs, ku32 group)
+{
+    fs->alloc->bgd_dirty[(group << EXT2_LOG_BGD_SIZE) >> LOG_BLOCK_SIZE] = 1;
+    fs->bgd_table_clean = 0;
+    fs->alloc->sblk_dirty = 1;
+}
+
+
+/*
+    ext2_bitmap_flush() - write the in-memory bitmap <bm> back through the block cache, if it has
+    been modified.
+*/
+static s32 ext2_bitmap_flush(vfs_t * const vfs, ext2_bitmap_t * const bm)
+{
+    const ext2_fs_t * const fs = (const ext2_fs_t *) vfs->data;
+    ks32 ret = bm->dirty ? block_write_multi(vfs->dev,
+                                             bm->block << (fs->log_block_size - LOG_BLOCK_SIZE),
+                                             fs->block_size >> LOG_BLOCK_SIZE, bm->buf)
+                         : SUCCESS;
+    if(ret < 0)
+        return ret;
+
+    bm->dirty = 0;
+
+    return SUCCESS;
+}
+
+
+/*
+    ext2_bitmap_load() - make <bm> hold the block bitmap (or, if <inodes> is non-zero, the inode
+    bitmap) of block group <group>, writing back the bitmap it currently holds if necessary.
+*/
+static s32 ext2_bitmap_load(vfs_t * const vfs, ext2_bitmap_t * const bm, ku32 group,
+                            ku32 inodes)
+{
+    const ext2_fs_t * const fs = (const ext2_fs_t *) vfs->data;
+    u32 block;
+    s32 ret;
+
+    if(bm->group == group)
+        return SUCCESS;
+
+    ret = ext2_bitmap_flush(vfs, bm);
+    if(ret != SUCCESS)
+        return ret;
+
+    block = LE2N32(inodes ? fs->bgd[group].bg_inode_bitmap : fs->bgd[group].bg_block_bitmap);
+
+    ret = block_read_multi(vfs->dev, block << (fs->log_block_size - LOG_BLOCK_SIZE),
+                           fs->block_size >> LOG_BLOCK_SIZE, bm->buf);
+    if(ret < 0)
+    {
+        bm->group = EXT2_NO_GROUP;
+        return ret;
+    }
+
+    bm->group = group;
+    bm->block = block;
+
+    return SUCCESS;
+}
+
+
+/*
+    ext2_prealloc_find() - return the preallocation window belonging to inode <inum>, or NULL.
+*/
+static ext2_prealloc_t *ext2_prealloc_find(ext2_alloc_t * const alloc, ku32 inum)
+{
+    ext2_prealloc_t *win;
+
+    list_for_each_entry(win, &alloc->lru, lru)
+        if(win->inum == inum)
+            return win;
+
+    return NULL;
+}
+
+
+/*
+    ext2_prealloc_reserved() - if <block> lies in a preallocation window belonging to an inode other
+    than <inum>, return the block following the window; otherwise return 0.
+*/
+static u32 ext2_prealloc_reserved(ext2_alloc_t * const alloc, ku32 block, ku32 inum)
+{
+    ext2_prealloc_t *win;
+
+    list_for_each_entry(win, &alloc->lru, lru)
+        if(win->inum && (win->inum != inum) && (block >= win->start) && (block < win->end))
+            return win->end;
+
+    return 0;
+}
+
+
+/*
+    ext2_prealloc_discard() - discard the preallocation window belonging to inode <inum>, if any.
+*/
+void ext2_prealloc_discard(vfs_t *vfs, ku32 inum)
+{
+    ext2_alloc_t * const alloc = ((ext2_fs_t *) vfs->data)->alloc;
+    ext2_prealloc_t *win;
+
+    sem_acquire(&alloc->lock);
+
+    win = ext2_prealloc_find(alloc, inum);
+    if(win != NULL)
+        win->inum = 0;
+
+    sem_release(&alloc->lock);
+}
+
+
+/*
+    ext2_find_free_run() - search the block bitmap of <group>, which must be loaded, for a run of at
+    least <min_run> free blocks starting at or after bit <bit>.  Blocks in other inodes' preallocation
+    windows are treated as allocated.  On success, returns the number of the first block in the run
+    and stores the length of the run, up to <max_run>, in <len>.  Returns 0 if no suitable run
+    exists.
+*/
+static u32 ext2_find_free_run(ext2_fs_t * const fs, ku32 group, u32 bit, ku32 min_run,
+                              ku32 max_run, ku32 inum, u32 * const len)
+{
+    const u8 * const map = fs->alloc->blocks.buf;
+    ku32 first = ext2_group_first_block(fs, group), nbits = ext2_group_nblocks(fs, group);
+
+    while(bit < nbits)
+    {
+        u32 run, skip;
+
+        /* Skip quickly over fully-allocated bytes */
+        if(!(bit & 7) && (map[bit >> 3] == 0xff))
+        {
+            bit += 8;
+            continue;
+        }
+
+        if(EXT2_BIT_IS_SET(map, bit))
+        {
+            ++bit;
+            continue;
+        }
+
+        skip = ext2_prealloc_reserved(fs->alloc, first + bit, inum);
+        if(skip)
+        {
+            bit = skip - first;
+            continue;
+        }
+
+        /* Found a free block; measure the run which starts here */
+        for(run = 1; (run < max_run) && (bit + run < nbits) && !EXT2_BIT_IS_SET(map, bit + run)
+                     && !ext2_prealloc_reserved(fs->alloc, first + bit + run, inum); ++run)
+            ;
+
+        if(run >= min_run)
+        {
+            *len = run;
+            return first + bit;
+        }
+
+        bit += run;
+    }
+
+    return 0;
+}
+
+
+/*
+    ext2_mark_blocks() - mark <count> blocks, starting at bit <bit> of the (loaded) bitmap of block
+    group <group>, as allocated, and update the free block counts.
+*/
+static void ext2_mark_blocks(ext2_fs_t * const fs, ku32 group, ku32 bit, ku32 count)
+{
+    ext2_bgd_t * const bgd = &fs->bgd[group];
+    u32 u;
+
+    for(u = 0; u < count; ++u)
+        EXT2_BIT_SET(fs->alloc->blocks.buf, bit + u);
+
+    fs->alloc->blocks.dirty = 1;
+
+    bgd->bg_free_blocks_count = N2LE16(LE2N16(bgd->bg_free_blocks_count) - count);
+    fs->sblk->s_free_blocks_count = N2LE32(LE2N32(fs->sblk->s_free_blocks_count) - count);
+    ext2_bgd_mark_dirty(fs, group);
+}
+
+
+/*
+    ext2_alloc_blocks() - allocate up to <want> contiguous blocks for inode <inum>, as close as
+    possible to block <goal>.  If <goal> is zero, the search starts at the beginning of the inode's
+    block group.  If <goal> is the next block in the inode's preallocation window, blocks are taken
+    from the window.  Returns the number of the first block allocated, storing the number of blocks
+    allocated in <got>, or a negative error code.
+*/
+s32 ext2_alloc_blocks(vfs_t *vfs, ku32 inum, u32 goal, ku32 want, u32 *got)
+{
+    ext2_fs_t * const fs = (ext2_fs_t *) vfs->data;
+    ext2_alloc_t * const alloc = fs->alloc;
+    ext2_prealloc_t *win;
+    u32 group, goal_group, first = 0, len = 0, win_size = EXT2_PREALLOC_BLOCKS, pass, i;
+    s32 ret;
+
+    if(!want)
+        return -EINVAL;
+
+    sem_acquire(&alloc->lock);
+
+    win = inum ? ext2_prealloc_find(alloc, inum) : NULL;
+
+    if((goal < fs->first_data_block) || (goal >= fs->blocks_count))
+        goal = 0;
+
+    /* A file which is being extended past the end of its window gets a larger window next time */
+    if((win != NULL) && goal && (goal == win->start))
+        win_size = MIN(win->size << 1, (u32) EXT2_PREALLOC_MAX);
+
+    /* Try to extend the file from its preallocation window */
+    if((win != NULL) && goal && (goal == win->start) && (win->start < win->end))
+    {
+        group = (goal - fs->first_data_block) / fs->blocks_per_group;
+
+        ret = ext2_bitmap_load(vfs, &alloc->blocks, group, 0);
+        if(ret != SUCCESS)
+        {
+            sem_release(&alloc->lock);
+            return ret;
+        }
+
+        for(len = 0; (len < want) && (goal + len < win->end)
+                     && !EXT2_BIT_IS_SET(alloc->blocks.buf,
+                                         goal + len - ext2_group_first_block(fs, group)); ++len)
+            ;
+
+        if(len)
+        {
+            first = goal;
+            ext2_mark_blocks(fs, group, first - ext2_group_first_block(fs, group), len);
+            win->start += len;
+            list_move_insert(&win->lru, &alloc->lru);
+        }
+    }
+
+    if(!len)
+    {
+        if(!goal)
+            goal = ext2_group_first_block(fs, inum ? (inum - 1) / fs->inodes_per_group : 0);
+
+        goal_group = (goal - fs->first_data_block) / fs->blocks_per_group;
+
+        /* Prefer the goal block itself, so that the file remains contiguous */
+        ret = ext2_bitmap_load(vfs, &alloc->blocks, goal_group, 0);
+        if(ret != SUCCESS)
+        {
+            sem_release(&alloc->lock);
+            return ret;
+        }
+
+        group = goal_group;
+        first = ext2_find_free_run(fs, group, goal - ext2_group_first_block(fs, group), 1,
+                                   win_size + 1, inum, &len);
+        if(first != goal)
+            first = 0;
+
+        /*
+            Search the block groups, starting at the goal block, for a run of free blocks large
+            enough to serve as a preallocation window.  If there is no such run, search again for
+            any free block; if there is none, other files' preallocation windows are given up, and
+            the search is repeated.  The goal group is searched from the goal block first, and
+            finally from its start.
+        */
+        for(pass = 0; !first && (pass < 3); ++pass)
+        {
+            ku32 min_run = pass ? 1 : MIN(want, (u32) EXT2_PREALLOC_BLOCKS);
+
+            if(pass == 2)
+            {
+                ext2_prealloc_t *w;
+
+                list_for_each_entry(w, &alloc->lru, lru)
+                    if(w != win)
+                        w->inum = 0;
+            }
+
+            for(i = 0; i <= fs->num_block_groups; ++i)
+            {
+                group = (goal_group + i) % fs->num_block_groups;
+
+                if(!fs->bgd[group].bg_free_blocks_count)
+                    continue;
+
+                ret = ext2_bitmap_load(vfs, &alloc->blocks, group, 0);
+                if(ret != SUCCESS)
+                {
+                    sem_release(&alloc->lock);
+                    return ret;
+                }
+
+                first = ext2_find_free_run(fs, group,
+                                           i ? 0 : goal - ext2_group_first_block(fs, group),
+                                           min_run, win_size + min_run, inum, &len);
+                if(first)
+                    break;
+            }
+        }
+
+        if(!first)
+        {
+            sem_release(&alloc->lock);
+            return -ENOSPC;
+        }
+
+        ext2_mark_blocks(fs, group, first - ext2_group_first_block(fs, group), MIN(len, want));
+
+        /* Reserve the remainder of the run as the file's preallocation window */
+        if(inum)
+        {
+            if(win == NULL)
+                win = list_first_entry(&alloc->lru, ext2_prealloc_t, lru);
+
+            win->inum = inum;
+            win->start = first + MIN(len, want);
+            win->end = first + len;
+            win->size = win_size;
+            list_move_insert(&win->lru, &alloc->lru);
+        }
+
+        len = MIN(len, want);
+    }
+
+    sem_release(&alloc->lock);
+
+    *got = len;
+
+    return first;
+}
+
+
+/*
+    ext2_free_blocks() - release the <count> blocks starting at <first>.  The blocks must all lie in
+    the same block group.
+*/
+s32 ext2_free_blocks(vfs_t *vfs, ku32 first, ku32 count)
+{
+    ext2_fs_t * const fs = (ext2_fs_t *) vfs->data;
+    ext2_alloc_t * const alloc = fs->alloc;
+    u32 group, bit, u;
+    ext2_bgd_t *bgd;
+    s32 ret;
+
+    if((first < fs->first_data_block) || (first + count > fs->blocks_count))
+        return -EINVAL;
+
+    group = (first - fs->first_data_block) / fs->blocks_per_group;
+    bit = first - ext2_group_first_block(fs, group);
+
+    if(bit + count > ext2_group_nblocks(fs, group))
+        return -EINVAL;
+
+    sem_acquire(&alloc->lock);
+
+    ret = ext2_bitmap_load(vfs, &alloc->blocks, group, 0);
+    if(ret != SUCCESS)
+    {
+        sem_release(&alloc->lock);
+        return ret;
+    }
+
+    for(u = 0; u < count; ++u)
+        EXT2_BIT_CLEAR(alloc->blocks.buf, bit + u);
+
+    alloc->blocks.dirty = 1;
+
+    bgd = &fs->bgd[group];
+    bgd->bg_free_blocks_count = N2LE16(LE2N16(bgd->bg_free_blocks_count) + count);
+    fs->sblk->s_free_blocks_count = N2LE32(LE2N32(fs->sblk->s_free_blocks_count) + count);
+    ext2_bgd_mark_dirty(fs, group);
+
+    sem_release(&alloc->lock);
+
+    return SUCCESS;
+}
+
+
+/*
+    ext2_alloc_inode() - allocate an inode for a new file (or, if <is_dir> is non-zero, directory)
+    whose parent directory is <parent>.  Files are placed in their parent's block group if possible.
+    Directories are spread across the file system: each goes in the group with the most free blocks
+    among those with an above-average number of free inodes.  Returns the new inode number, or a
+    negative error code.
+*/
+s32 ext2_alloc_inode(vfs_t *vfs, ku32 parent, ku32 is_dir)
+{
+    ext2_fs_t * const fs = (ext2_fs_t *) vfs->data;
+    ext2_alloc_t * const alloc = fs->alloc;
+    ku32 ngroups = fs->num_block_groups, parent_group = (parent - 1) / fs->inodes_per_group;
+    u32 group = EXT2_NO_GROUP, g, bit, first_bit;
+    ext2_bgd_t *bgd;
+    s32 ret;
+
+    sem_acquire(&alloc->lock);
+
+    if(is_dir)
+    {
+        ku32 avg_free = LE2N32(fs->sblk->s_free_inodes_count) / ngroups;
+        u32 best_free_blocks = 0;
+
+        for(g = 0; g < ngroups; ++g)
+        {
+            ku32 free_inodes = LE2N16(fs->bgd[g].bg_free_inodes_count),
+                 free_blocks = LE2N16(fs->bgd[g].bg_free_blocks_count);
+
+            if(free_inodes && (free_inodes >= avg_free)
+               && ((group == EXT2_NO_GROUP) || (free_blocks > best_free_blocks)))
+            {
+                group = g;
+                best_free_blocks = free_blocks;
+            }
+        }
+    }
+    else
+    {
+        /* Prefer a group with free blocks as well as free inodes */
+        for(g = 0; (group == EXT2_NO_GROUP) && (g < ngroups); ++g)
+        {
+            const ext2_bgd_t * const b = &fs->bgd[(parent_group + g) % ngroups];
+
+            if(b->bg_free_inodes_count && b->bg_free_blocks_count)
+                group = (parent_group + g) % ngroups;
+        }
+    }
+
+    for(g = 0; (group == EXT2_NO_GROUP) && (g < ngroups); ++g)
+        if(fs->bgd[(parent_group + g) % ngroups].bg_free_inodes_count)
+            group = (parent_group + g) % ngroups;
+
+    if(group == EXT2_NO_GROUP)
+    {
+        sem_release(&alloc->lock);
+        return -ENOSPC;
+    }
+
+    ret = ext2_bitmap_load(vfs, &alloc->inodes, group, 1);
+    if(ret != SUCCESS)
+    {
+        sem_release(&alloc->lock);
+        return ret;
+    }
+
+    /* Never allocate the reserved inodes at the start of the first group */
+    first_bit = group ? 0 : (LE2N32(fs->sblk->s_rev_level) ? LE2N32(fs->sblk->s_first_ino) - 1
+                                                            : EXT2_UNDEL_DIR_INO + 4);
+
+    for(bit = first_bit; (bit < fs->inodes_per_group) && EXT2_BIT_IS_SET(alloc->inodes.buf, bit);
+        ++bit)
+        ;
+
+    if(bit == fs->inodes_per_group)
+    {
+        /* The bitmap disagrees with the group descriptor's free count */
+        sem_release(&alloc->lock);
+        return -EINVAL;
+    }
+
+    EXT2_BIT_SET(alloc->inodes.buf, bit);
+    alloc->inodes.dirty = 1;
+
+    bgd = &fs->bgd[group];
+    bgd->bg_free_inodes_count = N2LE16(LE2N16(bgd->bg_free_inodes_count) - 1);
+    if(is_dir)
+        bgd->bg_used_dirs_count = N2LE16(LE2N16(bgd->bg_used_dirs_count) + 1);
+
+    fs->sblk->s_free_inodes_count = N2LE32(LE2N32(fs->sblk->s_free_inodes_count) - 1);
+    ext2_bgd_mark_dirty(fs, group);
+
+    sem_release(&alloc->lock);
+
+    return (group * fs->inodes_per_group) + bit + 1;
+}
+
+
+/*
+    ext2_free_inode() - release inode <inum>.  <is_dir> must be non-zero if the inode was allocated
+    for a directory.
+*/
+s32 ext2_free_inode(vfs_t *vfs, ku32 inum, ku32 is_dir)
+{
+    ext2_fs_t * const fs = (ext2_fs_t *) vfs->data;
+    ext2_alloc_t * const alloc = fs->alloc;
+    ku32 group = (inum - 1) / fs->inodes_per_group, bit = (inum - 1) % fs->inodes_per_group;
+    ext2_bgd_t *bgd;
+    s32 ret;
+
+    if(!inum || (inum > LE2N32(fs->sblk->s_inodes_count)))
+        return -EINVAL;
+
+    sem_acquire(&alloc->lock);
+
+    ret = ext2_bitmap_load(vfs, &alloc->inodes, group, 1);
+    if(ret != SUCCESS)
+    {
+        sem_release(&alloc->lock);
+        return ret;
+    }
+
+    EXT2_BIT_CLEAR(alloc->inodes.buf, bit);
+    alloc->inodes.dirty = 1;
+
+    bgd = &fs->bgd[group];
+    bgd->bg_free_inodes_count = N2LE16(LE2N16(bgd->bg_free_inodes_count) + 1);
+    if(is_dir)
+        bgd->bg_used_dirs_count = N2LE16(LE2N16(bgd->bg_used_dirs_count) - 1);
+
+    fs->sblk->s_free_inodes_count = N2LE32(LE2N32(fs->sblk->s_free_inodes_count) + 1);
+    ext2_bgd_mark_dirty(fs, group);
+
+    sem_release(&alloc->lock);
+
+    return SUCCESS;
+}
+
+
+/*
+    ext2_alloc_sync() - write back the in-memory bitmaps, the modified parts of the block group
+    descriptor table, and the superblock, through the block cache.
+*/
+s32 ext2_alloc_sync(vfs_t *vfs)
+{
+    ext2_fs_t * const fs = (ext2_fs_t *) vfs->data;
+    ext2_alloc_t * const alloc = fs->alloc;
+    ku32 bgd_unit = (fs->first_data_block + 1) << (fs->log_block_size - LOG_BLOCK_SIZE);
+    u32 u;
+    s32 ret;
+
+    sem_acquire(&alloc->lock);
+
+    ret = ext2_bitmap_flush(vfs, &alloc->blocks);
+    if(ret == SUCCESS)
+        ret = ext2_bitmap_flush(vfs, &alloc->inodes);
+
+    /* Write back the dirty parts of the block group descriptor table */
+    for(u = 0; (ret == SUCCESS) && !fs->bgd_table_clean && (u < fs->bgd_units); ++u)
+    {
+        if(alloc->bgd_dirty[u])
+        {
+            ret = block_write(vfs->dev, bgd_unit + u, (u8 *) fs->bgd + (u << LOG_BLOCK_SIZE));
+            if(ret == SUCCESS)
+                alloc->bgd_dirty[u] = 0;
+        }
+    }
+
+    if(ret == SUCCESS)
+        fs->bgd_table_clean = 1;
+
+    /* Write back the superblock, preserving the part of it which is not held in memory */
+    if((ret == SUCCESS) && alloc->sblk_dirty)
+    {
+        ku32 nunits = EXT2_SUPERBLOCK_SIZE >> LOG_BLOCK_SIZE;
+        u8 * const buf = (u8 *) kmalloc(EXT2_SUPERBLOCK_SIZE);
+
+        if(buf == NULL)
+            ret = -ENOMEM;
+        else
+        {
+            ret = block_read_multi(vfs->dev, EXT2_SUPERBLOCK_OFFSET >> LOG_BLOCK_SIZE, nunits,
+                                   buf);
+            if(ret >= 0)
+            {
+                memcpy(buf, fs->sblk, sizeof(ext2_superblock_t));
+                ret = block_write_multi(vfs->dev, EXT2_SUPERBLOCK_OFFSET >> LOG_BLOCK_SIZE,
+                                        nunits, buf);
+            }
+
+            if(ret >= 0)
+            {
+                alloc->sblk_dirty = 0;
+                ret = SUCCESS;
+            }
+
+            kfree(buf);
+        }
+    }
+
+    sem_release(&alloc->lock);
+
+    return ret;
+}
+
+#endif /* WITH_FS_EXT2 */
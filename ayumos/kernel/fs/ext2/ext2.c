@@ -38,6 +38,7 @@
 #ifdef WITH_FS_EXT2
 
 #include <kernel/include/device/block.h>
+#include <kernel/include/preempt.h>
 #include <kernel/fs/ext2/ext2.h>
 #include <klibc/include/strings.h>
 
@@ -49,7 +50,55 @@ s32 ext2_get_root_node(vfs_t *vfs, fs_node_t **node);
 s32 ext2_open_dir(vfs_t *vfs, u32 node, void **ctx);
 s32 ext2_read_dir(vfs_t *vfs, void *ctx, ks8* const name, fs_node_t *node);
 s32 ext2_close_dir(vfs_t *vfs, void *ctx);
+s32 ext2_read_dir_multi(vfs_t *vfs, void *ctx, vfs_dirent_t *buf, ku32 len);
+s32 ext2_tell_dir(vfs_t *vfs, void *ctx, u32 *pos);
+s32 ext2_seek_dir(vfs_t *vfs, void *ctx, ku32 pos);
+s32 ext2_read(vfs_t * const vfs, fs_node_t * const node, void * const buffer, u32 offset,
+              ks32 count);
+s32 ext2_write(vfs_t * const vfs, fs_node_t * const node, const void * const buffer, u32 offset,
+               ks32 count);
+s32 ext2_reallocate(vfs_t * const vfs, fs_node_t * const node, ks32 new_len);
 s32 ext2_stat(vfs_t *vfs, fs_stat_t *st);
+s32 ext2_write_node(vfs_t * const vfs, fs_node_t * const node);
+
+static s32 ext2_icache_init(ext2_fs_t * const fs);
+static void ext2_icache_destroy(ext2_fs_t * const fs);
+static s32 ext2_icache_lookup(ext2_fs_t * const fs, ku32 inum, ext2_inode_t * const inode);
+static void ext2_icache_add(ext2_fs_t * const fs, ku32 inum, const ext2_inode_t * const inode);
+static s32 ext2_bmap_cache_init(ext2_fs_t * const fs);
+static void ext2_bmap_cache_destroy(ext2_fs_t * const fs);
+static ext2_bmap_t *ext2_bmap_get(ext2_bmap_cache_t * const cache, ku32 inum);
+static s32 ext2_bmap_lookup(vfs_t * const vfs, ext2_bmap_t * const map,
+                            const ext2_inode_t * const inode, ku32 logical, ku32 count,
+                            ku32 nblocks, ext2_extent_t * const ext);
+static s32 ext2_bmap_translate(vfs_t * const vfs, const ext2_inode_t * const inode, ku32 logical,
+                               ku32 count, ext2_extent_t * const ext);
+static s32 ext2_bmap_read_table(vfs_t * const vfs, ku32 block);
+static s32 ext2_bmap_write_table(vfs_t * const vfs, ku32 block);
+static s32 ext2_bmap_alloc(vfs_t * const vfs, ku32 inum, ext2_inode_t * const inode, ku32 logical,
+                           ku32 count, u32 goal, ext2_extent_t * const ext);
+static void ext2_bmap_invalidate(ext2_fs_t * const fs, ku32 inum, ku32 logical);
+static s32 ext2_truncate_table(vfs_t * const vfs, ext2_inode_t * const inode, u32 * const ptr,
+                               ku32 level, ku32 base, ku32 keep);
+static void ext2_inode_location(const ext2_fs_t * const fs, ku32 inum, u32 * const block,
+                                u32 * const offset);
+static void ext2_inode_add_blocks(const ext2_fs_t * const fs, ext2_inode_t * const inode,
+                                  ks32 nblocks);
+static s32 ext2_free_block_list(vfs_t * const vfs, ext2_inode_t * const inode, u32 * const ptrs,
+                                ku32 n);
+static s32 ext2_dir_add_entry(vfs_t * const vfs, ku32 dir, ks8 * const name, ku32 inum,
+                              ku8 file_type);
+static void ext2_inode_to_node(const ext2_inode_t * const inode, fs_node_t * const node);
+static s32 ext2_dir_read_block(vfs_t * const vfs, ext2_dir_ctx_t * const dir_ctx);
+static s32 ext2_dir_scan_block(ext2_dir_ctx_t * const dir_ctx, ks8 * const name,
+                               const ext2_node_t ** const de);
+static s32 ext2_dir_find(vfs_t * const vfs, ext2_dir_ctx_t * const dir_ctx, ks8 * const name,
+                         const ext2_node_t ** const de);
+
+/* Non-zero if extent <b> immediately follows extent <a>, both logically and physically */
+#define EXT2_EXTENT_FOLLOWS(a, b)                                                                \
+    (((a)->logical + (a)->len == (b)->logical)                                                  \
+     && ((a)->physical ? ((a)->physical + (a)->len == (b)->physical) : !(b)->physical))
 
 
 vfs_driver_t g_ext2_ops =
@@ -62,7 +111,15 @@ vfs_driver_t g_ext2_ops =
     .open_dir = ext2_open_dir,
     .read_dir = ext2_read_dir,
     .close_dir = ext2_close_dir,
-    .stat = ext2_stat
+    .read_dir_multi = ext2_read_dir_multi,
+    .tell_dir = ext2_tell_dir,
+    .seek_dir = ext2_seek_dir,
+    .read = ext2_read,
+    .write = ext2_write,
+    .reallocate = ext2_reallocate,
+    .stat = ext2_stat,
+    .write_node = ext2_write_node,
+    .create_node = ext2_create_node
 };
 
 
@@ -83,7 +140,8 @@ s32 ext2_init()
 s32 ext2_mount(vfs_t *vfs)
 {
     ext2_fs_t *fs;
-    u32 ret, buf_size, num_block_groups;
+    u32 buf_size, num_block_groups, cache_block_size;
+    s32 ret;
     u8 *buf;
     ku32 sblk_nblocks = (sizeof(ext2_superblock_t) + BLOCK_SIZE - 1) / BLOCK_SIZE;
 
@@ -94,7 +152,7 @@ s32 ext2_mount(vfs_t *vfs)
 
     ret = block_read_multi(vfs->dev, 1024 / BLOCK_SIZE, sblk_nblocks, buf);
 
-    if(ret != SUCCESS)
+    if(ret < 0)
     {
         kfree(buf);
         return ret;
@@ -133,13 +191,48 @@ s32 ext2_mount(vfs_t *vfs)
     /* TODO: more superblock validation */
     /* TODO: check compat/incompat flags */
 
+    /* Only write to file systems which use no features beyond those this driver maintains */
+    fs->writable = !(LE2N32(fs->sblk->s_feature_incompat) & ~EXT2_FEATURE_INCOMPAT_FILETYPE)
+                   && !(LE2N32(fs->sblk->s_feature_ro_compat)
+                        & ~(EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER | EXT2_FEATURE_RO_COMPAT_LARGE_FILE
+                            | EXT2_FEATURE_RO_COMPAT_BTREE_DIR));
+
+    fs->log_block_size = 10 + LE2N32(fs->sblk->s_log_block_size);
+    fs->block_size = 1 << fs->log_block_size;
+    fs->inodes_per_group = LE2N32(fs->sblk->s_inodes_per_group);
+    fs->blocks_per_group = LE2N32(fs->sblk->s_blocks_per_group);
+    fs->first_data_block = LE2N32(fs->sblk->s_first_data_block);
+    fs->blocks_count = LE2N32(fs->sblk->s_blocks_count);
+    fs->inode_size = LE2N32(fs->sblk->s_rev_level) ? LE2N16(fs->sblk->s_inode_size)
+                                                    : EXT2_INODE_SIZE;
+
+    /* Inodes must be a power-of-two size no larger than a block, so that no inode straddles a
+       BLOCK_SIZE-byte boundary */
+    if(!fs->inodes_per_group || !fs->blocks_per_group || (fs->inode_size < EXT2_INODE_SIZE)
+       || (fs->inode_size > BLOCK_SIZE) || (fs->inode_size & (fs->inode_size - 1)))
+    {
+        kfree(fs->sblk);
+        kfree(fs);
+        return -EBADSBLK;
+    }
+
+    /* Cache the device in file system-sized blocks, up to the largest size the cache supports */
+    cache_block_size = MIN(fs->block_size, (u32) (BLOCK_SIZE << BC_MAX_SHIFT));
+
+    ret = block_cache_set_block_size(vfs->dev, cache_block_size);
+    if(ret != SUCCESS)
+    {
+        kfree(fs->sblk);
+        kfree(fs);
+        return ret;
+    }
+
     /*
         Read the block group descriptor table
     */
 
-    dump_hex(fs->sblk, 1, 0, sizeof(ext2_superblock_t));
-
-    num_block_groups = LE2N32(fs->sblk->s_inodes_count) / LE2N32(fs->sblk->s_inodes_per_group);
+    num_block_groups = LE2N32(fs->sblk->s_inodes_count) / fs->inodes_per_group;
+    fs->num_block_groups = num_block_groups;
 
     /* Calculate the size of a buffer to hold the BGD table, rounding up to the nearest block */
     buf_size = ((num_block_groups * EXT2_BGD_SIZE) + BLOCK_SIZE - 1) & ~(BLOCK_SIZE - 1);
@@ -151,12 +244,14 @@ s32 ext2_mount(vfs_t *vfs)
         return -ENOMEM;
     }
 
+    /* The BGD table occupies the block(s) following the one containing the superblock */
     ret = block_read_multi(vfs->dev,
-                           (1024 << LE2N32(fs->sblk->s_log_block_size)) >> LOG_BLOCK_SIZE,
+                           (LE2N32(fs->sblk->s_first_data_block) + 1)
+                                << (fs->log_block_size - LOG_BLOCK_SIZE),
                            buf_size >> LOG_BLOCK_SIZE,
                            buf);
 
-    if(ret)
+    if(ret < 0)
     {
         kfree(buf);
         kfree(fs->sblk);
@@ -166,9 +261,32 @@ s32 ext2_mount(vfs_t *vfs)
 
     fs->bgd = (struct ext2_bgd *) buf;
     fs->bgd_table_clean = 1;
+    fs->bgd_units = buf_size >> LOG_BLOCK_SIZE;
+    fs->icache = NULL;
+    fs->bmaps = NULL;
+    fs->alloc = NULL;
 
     vfs->data = fs;
 
+    ret = ext2_icache_init(fs);
+    if(ret == SUCCESS)
+        ret = ext2_bmap_cache_init(fs);
+    if(ret == SUCCESS)
+        ret = ext2_alloc_init(vfs);
+
+    if(ret != SUCCESS)
+    {
+        ext2_bmap_cache_destroy(fs);
+        ext2_icache_destroy(fs);
+        kfree(buf);
+        kfree(fs->sblk);
+        kfree(fs);
+        vfs->data = NULL;
+        return ret;
+    }
+
+    vfs->root_block = EXT2_ROOT_INO;
+
     return SUCCESS;
 }
 
@@ -179,434 +297,1916 @@ s32 ext2_mount(vfs_t *vfs)
  */
 s32 ext2_unmount(vfs_t *vfs)
 {
-    /* TODO */
-    UNUSED(vfs);
+    ext2_fs_t * const fs = (ext2_fs_t *) vfs->data;
+    s32 ret;
 
-    return SUCCESS;
+    /* Write back the bitmaps, BGD table and superblock */
+    ret = ext2_alloc_sync(vfs);
+    if(ret != SUCCESS)
+        return ret;
+
+    ext2_alloc_destroy(fs);
+    ext2_bmap_cache_destroy(fs);
+    ext2_icache_destroy(fs);
+    kfree(fs->bgd);
+    kfree(fs->sblk);
+    kfree(fs);
+
+    return block_cache_set_block_size(vfs->dev, BLOCK_SIZE);
 }
 
 
-s32 ext2_open_dir(vfs_t *vfs, u32 node, void **ctx)
+/*
+    ext2_open_dir() - prepare to iterate over the directory whose inode number is <inum>.
+*/
+s32 ext2_open_dir(vfs_t *vfs, u32 inum, void **ctx)
 {
-    /* TODO */
-    UNUSED(vfs);
-    UNUSED(node);
-    UNUSED(ctx);
+    const ext2_fs_t * const fs = (const ext2_fs_t *) vfs->data;
+    ext2_dir_ctx_t *dir_ctx;
+    s32 ret;
 
-    return SUCCESS;
-}
+    dir_ctx = (ext2_dir_ctx_t *) CHECKED_KCALLOC(1, sizeof(ext2_dir_ctx_t));
 
+    ret = ext2_read_inode(vfs, inum, &dir_ctx->inode);
+    if(ret != SUCCESS)
+    {
+        kfree(dir_ctx);
+        return ret;
+    }
 
-s32 ext2_read_dir(vfs_t *vfs, void *ctx, ks8* const name, fs_node_t *node)
-{
-    /* TODO */
-    UNUSED(vfs);
-    UNUSED(ctx);
-    UNUSED(node);
-    UNUSED(name);
+    if((LE2N16(dir_ctx->inode.i_mode) & 0xf000) != EXT2_S_IFDIR)
+    {
+        kfree(dir_ctx);
+        return -ENOTDIR;
+    }
 
-    return SUCCESS;
-}
+    dir_ctx->buf = (u8 *) kmalloc(fs->block_size);
+    if(dir_ctx->buf == NULL)
+    {
+        kfree(dir_ctx);
+        return -ENOMEM;
+    }
 
+    dir_ctx->inum = inum;
 
-s32 ext2_close_dir(vfs_t *vfs, void *ctx)
-{
-    UNUSED(vfs);
-    UNUSED(ctx);
+    *ctx = dir_ctx;
 
-    /* TODO */
     return SUCCESS;
 }
 
 
-s32 ext2_stat(vfs_t *vfs, fs_stat_t *st)
+/*
+    ext2_read_file_block() - read logical block <logical> of the file <inum>, whose inode is
+    <inode>, into <buf>, which must be large enough to hold one file system block.  Returns -ENOENT
+    if the block lies beyond the end of the file, or -ENODATA if it is a hole.
+*/
+s32 ext2_read_file_block(vfs_t *vfs, ku32 inum, const ext2_inode_t *inode, ku32 logical,
+                         void *buf)
 {
-    /* TODO */
-    UNUSED(vfs);
-    UNUSED(st);
+    const ext2_fs_t * const fs = (const ext2_fs_t *) vfs->data;
+    ext2_extent_t ext;
+    s32 ret;
 
-    return SUCCESS;
+    ret = ext2_bmap_range(vfs, inum, inode, logical, 1, &ext, 1);
+    if(ret <= 0)
+        return ret ? ret : -ENOENT;
+
+    if(!ext.physical)
+        return -ENODATA;
+
+    ret = block_read_multi(vfs->dev, ext.physical << (fs->log_block_size - LOG_BLOCK_SIZE),
+                           fs->block_size >> LOG_BLOCK_SIZE, buf);
+
+    return (ret < 0) ? ret : SUCCESS;
 }
 
 
 /*
-    Return nonzero if the specified block group should contain a superblock backup.
+    ext2_dir_read_block() - read the next allocated block of a directory into the context's buffer.
+    Returns -ENOENT at the end of the directory.
 */
-u32 block_group_contains_superblock(const ext2_fs_t *fs, ku32 block_group)
+static s32 ext2_dir_read_block(vfs_t * const vfs, ext2_dir_ctx_t * const dir_ctx)
 {
-    /* Originally superblock backups were stored in every block group.  The "sparse superblock"
-       feature saves space by storing backups in block groups 0, 1, and powers of 3, 5 and 7. */
-    if(LE2N32(fs->sblk->s_feature_ro_compat) & EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER)
-    {
-        /* This file system has the "sparse superblock" feature */
-
-        /* Trivial case: backups are stored in block groups 0 and 1 */
-        if(block_group < 2)
-        {
-            return 1;
-        }
-        else
-        {
-            /* The limits[] array contains the highest powers of 3, 5 and 7 that are representable in a
-               32-bit uint.  e.g. limits[0] = 20, meaning that 3^20 fits in 32 bits but 3^21 does not. */
-            u32 limits[3] = {20, 13, 11}, i;
+    const ext2_fs_t * const fs = (const ext2_fs_t *) vfs->data;
+    s32 ret;
 
-            /* Check for powers of 3, 5 and 7. */
-            for(i = 0; i < (sizeof(limits) / sizeof(limits[0])); ++i)
-            {
-                ku32 base = (i << 1) + 1;   /* base = {3, 5, 7} */
-                u32 mult;
+    do
+    {
+        ret = ext2_read_file_block(vfs, dir_ctx->inum, &dir_ctx->inode, dir_ctx->logical++,
+                                   dir_ctx->buf);
+    } while(ret == -ENODATA);   /* Skip holes */
 
-                for(mult = base; (mult < block_group) && limits[i]--; mult *= base)
-                    ;   /* nothing */
+    if(ret != SUCCESS)
+        return ret;
 
-                if(mult == block_group)
-                {
-                    return 1;
-                }
-            }
-        }
+    dir_ctx->pos = 0;
+    dir_ctx->len = fs->block_size;
 
-        return 0;
-    }
-    else
-    {
-        /* This file system does not have the "sparse superblock" feature.  Every block group has
-           a superblock backup. */
-        return 1;
-    }
+    return SUCCESS;
 }
 
 
 /*
-    Read a block into the buffer at *ppbuf.  If *ppbuf is NULL, allocate a new buffer and store
-    a pointer to it in *ppbuf.
-
-    ************************ TODO - deprecate this function ******************************
+    ext2_dir_scan_block() - search the remainder of the directory block in the context's buffer for
+    an entry named <name>, or for the next entry if <name> is NULL.  On success, points <de> at the
+    entry.  Returns -ENOENT if the end of the block is reached.
 */
-u32 ext2_read_block(vfs_t *vfs, ku32 block, void **ppbuf)
+static s32 ext2_dir_scan_block(ext2_dir_ctx_t * const dir_ctx, ks8 * const name,
+                               const ext2_node_t ** const de)
 {
-    u32 ret;
-    u8 *buf;
-    u32 len;
+    ku32 len = (name != NULL) ? strlen(name) : 0;
 
-    const ext2_fs_t *fs = (const ext2_fs_t *) vfs->data;
-
-    /* allocate a new buffer if needed */
-    if(*ppbuf == NULL)
-    {
-        buf = kmalloc(1024 << fs->sblk->s_log_block_size);
-        if(buf == NULL)
-        {
-            return -ENOMEM;
-        }
-    }
-    else
+    while(dir_ctx->pos < dir_ctx->len)
     {
-        buf = *ppbuf;
-    }
+        const ext2_node_t * const ent = (const ext2_node_t *) (dir_ctx->buf + dir_ctx->pos);
+        ku32 rec_len = LE2N16(ent->rec_len), name_len = ent->name_len;
 
-printf("[read block %u]\n", block);
-    len = (1024 << fs->sblk->s_log_block_size) >> LOG_BLOCK_SIZE;
-    ret = vfs->dev->read(vfs->dev, (block << (10 + fs->sblk->s_log_block_size)) >> LOG_BLOCK_SIZE,
-                            &len, buf);
+        /* Guard against corrupt entries, which would otherwise cause an infinite loop */
+        if((rec_len < sizeof(ext2_node_t)) || (rec_len & 3)
+           || (dir_ctx->pos + rec_len > dir_ctx->len) || (name_len + sizeof(ext2_node_t) > rec_len))
+            return -EINVAL;
 
-    /* TODO - check for short read */
-    if(ret)
-    {
-        /* block read failed */
-        kfree(buf);
-    }
-    else
-    {
-        *ppbuf = buf;
+        dir_ctx->pos += rec_len;
+
+        if(!ent->inode)
+            continue;       /* Unused entry */
+
+        if((name == NULL) || ((len == name_len) && !memcmp(ent->name, name, name_len)))
+        {
+            *de = ent;
+            return SUCCESS;
+        }
     }
 
-    return ret;
+    return -ENOENT;
 }
 
 
 /*
-    Read the specified inode
+    ext2_dir_find() - find the next entry in a directory, or the entry named <name> if <name> is
+    non-NULL, and point <de> at it.  Named lookups in an indexed directory search only the leaf
+    block(s) identified by the index; other lookups scan the directory linearly.
 */
-u32 ext2_read_inode(vfs_t *vfs, u32 inum, ext2_inode_t *inode)
+static s32 ext2_dir_find(vfs_t * const vfs, ext2_dir_ctx_t * const dir_ctx, ks8 * const name,
+                         const ext2_node_t ** const de)
 {
-    const ext2_fs_t *fs = (const ext2_fs_t *) vfs->data;
-    u32 one = 1;
+    s32 ret;
 
-    if(inum < fs->sblk->s_inodes_count)
+    /* "." and ".." are not indexed; they always live in the first block of the directory */
+    if((name != NULL) && !dir_ctx->logical && strcmp(name, ".") && strcmp(name, ".."))
     {
-        u32 block, offset, ret;
-        u8 *buf;
+        u32 leaves[EXT2_DX_MAX_LEAVES];
+        s32 nleaves, i;
 
-        if(!(buf = kmalloc(BLOCK_SIZE)))
-            return -ENOMEM;
-
-        --inum; /* because the first inode in the first block group is 1, not 0 */
+        nleaves = ext2_dx_lookup(vfs, dir_ctx->inum, &dir_ctx->inode, name, strlen(name), leaves,
+                                 EXT2_DX_MAX_LEAVES);
+        if(nleaves != -ENOSYS)
+        {
+            if(nleaves < 0)
+                return nleaves;
 
-        /* offset = offset of this inode from the start of the group */
-        offset = (inum % fs->sblk->s_inodes_per_group) << EXT2_LOG_INODE_SIZE;
+            for(i = 0; i < nleaves; ++i)
+            {
+                dir_ctx->logical = leaves[i];
 
-        /* block = first block of the block group containing the inode + offset of the block
-           containing the inode */
-        block = (fs->bgd[inum / fs->sblk->s_inodes_per_group].bg_inode_table
-                    << (10 + fs->sblk->s_log_block_size - LOG_BLOCK_SIZE))
-                + (offset >> LOG_BLOCK_SIZE);
+                ret = ext2_dir_read_block(vfs, dir_ctx);
+                if(ret == SUCCESS)
+                    ret = ext2_dir_scan_block(dir_ctx, name, de);
 
-        /* inum_ = offset of this inode from the start of the block */
-        offset &= BLOCK_SIZE - 1;
+                if(ret != -ENOENT)
+                    return ret;
+            }
 
-        ret = vfs->dev->read(vfs->dev, block, &one, buf);
-        if(ret)
-            return ret;
+            return -ENOENT;
+        }
+    }
 
-        memcpy(inode, buf + offset, sizeof(ext2_inode_t));
-        kfree(buf);
+    while(1)
+    {
+        if(dir_ctx->pos >= dir_ctx->len)
+        {
+            ret = ext2_dir_read_block(vfs, dir_ctx);
+            if(ret != SUCCESS)
+                return ret;
+        }
 
-        return SUCCESS;
+        ret = ext2_dir_scan_block(dir_ctx, name, de);
+        if(ret != -ENOENT)
+            return ret;
     }
-
-    return -EINVAL;     /* inum is out of bounds */
 }
 
 
 /*
-    Return the block ID of the num'th block of an inode
-    XXX UNTESTED
+    ext2_read_dir() - if name is NULL, read the next entry from a directory and populate node with
+    its details.  If name is non-NULL, search for an entry matching name and populate the node.
 */
-u32 ext2_inode_get_block(vfs_t *vfs, const ext2_inode_t *inode, u32 num, u32 *block)
+s32 ext2_read_dir(vfs_t *vfs, void *ctx, ks8* const name, fs_node_t *node)
 {
-    u32 ret, block_id = 0;
-    u32 *buf = NULL;
-
-    ext2_fs_t *fs = (ext2_fs_t *) vfs->data;
+    ext2_dir_ctx_t * const dir_ctx = (ext2_dir_ctx_t *) ctx;
+    const ext2_node_t *de;
+    ext2_inode_t inode;
+    char entry_name[NAME_MAX_LEN + 1];
+    u32 name_len;
+    s32 ret;
 
-    /* Each indirect block stores some number of block IDs.  The size of a block ID is fixed (4
-       bytes) so the number stored per block is proportional to the size of the block.  In order
-       to "dereference" indirect block IDs, it is necessary to calculate a mask that can be used
-       when bit-shifting the block ID.  The mask is:
+    ret = ext2_dir_find(vfs, dir_ctx, name, &de);
+    if(ret != SUCCESS)
+        return ret;
 
-            block_mask = (block_size / sizeof(block ID)) - 1
+    /* If node is NULL, the caller only wanted to know whether or not the entry exists */
+    if(node == NULL)
+        return SUCCESS;
 
-        i.e.
-    */
-    ku32 block_mask = ((1024 << fs->sblk->s_log_block_size) >> 2) - 1;
+    ret = ext2_read_inode(vfs, LE2N32(de->inode), &inode);
+    if(ret != SUCCESS)
+        return ret;
 
-    /*
-        It is also necessary to calculate how many bits to shift an indirect block ID in order to
-        obtain its position in a block table.  This number is:
+    name_len = MIN((u32) de->name_len, (u32) NAME_MAX_LEN);
+    memcpy(entry_name, de->name, name_len);
+    entry_name[name_len] = '\0';
 
-            block_shift = log2(block_size / sizeof(block ID))
+    ret = fs_node_set_name(node, entry_name);
+    if(ret != SUCCESS)
+        return ret;
 
-        Fortunately log2(block_size) is already available in the superblock field s_log_block_size.
-        sizeof(block ID) is fixed at 4, so:
+    ext2_inode_to_node(&inode, node);
+    node->first_block = LE2N32(de->inode);
 
-            block_shift = log2(block_size) - log2(4)
-                        = log2(block_size) - 2
-    */
-    ku32 block_shift = (fs->sblk->s_log_block_size + 10) - 2;
+    return SUCCESS;
+}
 
-    if(num < 12)                /* direct blocks */
-    {
-        *block = inode->i_block[num];
-        return SUCCESS;
-    }
-    else if(num >= (16777216 + 65536 + 256))
-    {
-        return -EINVAL;     /* block ID out of range */
-    }
 
-    /* indirect blocks */
-    num -= 12;
+/*
+    ext2_read_dir_multi() - read as many directory entries as will fit into the <len>-byte buffer
+    <buf>.  Return the number of bytes used, or zero at the end of the directory.  An entry which
+    does not fit is left in the directory block buffer, to be returned by the next call.
+*/
+s32 ext2_read_dir_multi(vfs_t *vfs, void *ctx, vfs_dirent_t *buf, ku32 len)
+{
+    ext2_dir_ctx_t * const dir_ctx = (ext2_dir_ctx_t *) ctx;
+    vfs_dirent_t *ent = buf;
+    u32 used = 0;
+    s32 ret;
 
-    if(num >= (65536 + 256))    /* triply-indirect blocks */
+    while(1)
     {
-        block_id = inode->i_block[14];
+        const ext2_node_t *de;
+        ext2_inode_t inode;
+        fs_node_t node;
+        u32 name_len, rec_len;
 
-        num -= (65536 + 256);   /* adjust num to the range [0, 16777215] */
+        ret = ext2_dir_find(vfs, dir_ctx, NULL, &de);
+        if(ret != SUCCESS)
+            break;
 
-        if(!block_id)
-            return -EINVAL;     /* past EOF */
+        name_len = MIN((u32) de->name_len, (u32) NAME_MAX_LEN);
+        rec_len = VFS_DIRENT_LEN(name_len);
 
-        ret = ext2_read_block(vfs, block_id, (void **) &buf);
-        if(ret)
+        if(used + rec_len > len)
         {
-            kfree(buf);
-            return ret;
+            /* Rewind to this entry; it remains in the buffer for the next call */
+            dir_ctx->pos = (const u8 *) de - dir_ctx->buf;
+            ret = -EINVAL;
+            break;
         }
 
-        /* dereference to doubly-indirect block num */
-        block_id = buf[(num >> (2 * block_shift)) & block_mask];
-        num &= block_mask | (block_mask << block_shift);
-
-        if(!block_id)
+        ret = ext2_read_inode(vfs, LE2N32(de->inode), &inode);
+        if(ret != SUCCESS)
         {
-            kfree(buf);
-            return -EINVAL;     /* past EOF */
+            dir_ctx->pos = (const u8 *) de - dir_ctx->buf;
+            break;
         }
+
+        ext2_inode_to_node(&inode, &node);
+
+        ent->len = rec_len;
+        ent->type = node.type;
+        ent->name_len = name_len;
+        ent->permissions = node.permissions;
+        ent->flags = node.flags;
+        ent->size = node.size;
+        ent->mtime = node.mtime;
+        ent->first_block = LE2N32(de->inode);
+        memcpy(ent->name, de->name, name_len);
+        ent->name[name_len] = '\0';
+
+        used += rec_len;
+        ent = VFS_DIRENT_NEXT(ent);
     }
 
-    if(num >= 256)              /* doubly-indirect blocks */
-    {
-        /* At this point block_id will point to a block containing doubly-indirect block IDs (if
-           the requested block was triply indirect and the code above has dereferenced it), or will
-           be zero (if the requested block was doubly indirect).  In the latter case, obtain the
-           block table pointer from the inode in the usual way. */
-        if(!block_id)
-            block_id = inode->i_block[13];
+    /* Report the end of the directory, or an error, only if no entries were read */
+    if(used || (ret == -ENOENT))
+        return used;
 
-        num -= 256;     /* adjust num to the range [0, 65535] */
+    return ret;
+}
 
-        if(!block_id)
-        {
-            kfree(buf);
-            return -EINVAL;     /* past EOF */
-        }
 
-        ret = ext2_read_block(vfs, block_id, (void **) &buf);
-        if(ret)
-        {
-            kfree(buf);
-            return ret;
-        }
+/*
+    ext2_tell_dir() - store in <*pos> the byte offset, within the directory, of the next entry to be
+    read.
+*/
+s32 ext2_tell_dir(vfs_t *vfs, void *ctx, u32 *pos)
+{
+    const ext2_fs_t * const fs = (const ext2_fs_t *) vfs->data;
+    const ext2_dir_ctx_t * const dir_ctx = (const ext2_dir_ctx_t *) ctx;
 
-        /* dereference to singly-indirect block num */
-        block_id = buf[(num >> block_shift) & block_mask];
-        num &= block_mask << block_shift;
+    /* dir_ctx->logical is the block after the one in the buffer, if there is one */
+    if(dir_ctx->len)
+        *pos = ((dir_ctx->logical - 1) * fs->block_size) + dir_ctx->pos;
+    else
+        *pos = dir_ctx->logical * fs->block_size;
 
-        if(!block_id)
-        {
-            kfree(buf);
-            return -EINVAL;     /* past EOF */
-        }
+    return SUCCESS;
+}
 
-    }
 
-    /* singly-indirect blocks */
+/*
+    ext2_seek_dir() - move to the entry at byte offset <pos> within the directory, as returned by
+    ext2_tell_dir().  The block containing the entry is read immediately, unless the entry is at the
+    start of a block.
+*/
+s32 ext2_seek_dir(vfs_t *vfs, void *ctx, ku32 pos)
+{
+    const ext2_fs_t * const fs = (const ext2_fs_t *) vfs->data;
+    ext2_dir_ctx_t * const dir_ctx = (ext2_dir_ctx_t *) ctx;
+    ku32 offset = pos & (fs->block_size - 1);
+    s32 ret;
+
+    /* Entries start on four-byte boundaries */
+    if(offset & 3)
+        return -EINVAL;
 
-    /* At this point block_id will point to a block containing singly-indirect block IDs (if any
-       dereferencing has been done by the code above) or zero (if the requested block was singly
-       indirect).  In the latter case, obtain the block table pointer from the inode in the usual
-       way. */
-    if(!block_id)
-        block_id = inode->i_block[12];
+    dir_ctx->logical = pos >> fs->log_block_size;
+    dir_ctx->pos = 0;
+    dir_ctx->len = 0;
 
-    ret = ext2_read_block(vfs, block_id, (void **) &buf);
-    if(ret)
-    {
-        kfree(buf);
+    if(!offset)
+        return SUCCESS;
+
+    ret = ext2_dir_read_block(vfs, dir_ctx);
+    if(ret == -ENOENT)
+        return SUCCESS;         /* Beyond the end of the directory */
+    else if(ret != SUCCESS)
         return ret;
-    }
 
-    *block = buf[num];
-    kfree(buf);
+    /* If the block has become a hole, start at the beginning of the next allocated block */
+    if(dir_ctx->logical - 1 == (pos >> fs->log_block_size))
+        dir_ctx->pos = offset;
 
     return SUCCESS;
 }
 
 
 /*
-    Find the inode containing the file at the specified (absolute) path and return its number.
+    ext2_close_dir() - clean up after iterating over a directory.
 */
-u32 ext2_parse_path(vfs_t *vfs, ks8 *path, inum_t *inum)
+s32 ext2_close_dir(vfs_t *vfs, void *ctx)
 {
-    ks8 *end;
-    u8 *buf = NULL;
-    ext2_inode_t inode;
-    inum_t in = EXT2_ROOT_INO;
-    u8 name[NAME_MAX_LEN + 1];
-
-    ext2_fs_t *fs = (ext2_fs_t *) vfs->data;
+    UNUSED(vfs);
 
-    /* Fail if the first character of the path is anything other than a directory separator (/).
-       e.g. the path is non-absolute, or is empty */
-    if(*path != DIR_SEPARATOR)
-    {
-        return -ENOENT;
-    }
+    kfree(((ext2_dir_ctx_t *) ctx)->buf);
+    kfree(ctx);
 
-    for(; *path; path = end)
-    {
-        u32 data_block, block_index, ret;
+    return SUCCESS;
+}
 
-        /* find the next dir sep or \0 */
-        for(end = ++path; *end && (*end != DIR_SEPARATOR); ++end)
-            ;
 
-        if(path != end)
+/*
+    ext2_dir_add_entry() - add an entry named <name>, referring to inode <inum>, to the directory
+    <dir>.  The entry is placed in the first unused entry, or the slack space following an entry,
+    which is large enough to hold it; if there is none, a block is appended to the directory.  The
+    hashed-tree index of an indexed directory is not maintained: the directory's index flag is
+    cleared, and it is searched linearly thereafter.
+*/
+static s32 ext2_dir_add_entry(vfs_t * const vfs, ku32 dir, ks8 * const name, ku32 inum,
+                              ku8 file_type)
+{
+    ext2_fs_t * const fs = (ext2_fs_t *) vfs->data;
+    ku32 name_len = strlen(name), needed = EXT2_DIR_REC_LEN(name_len);
+    ext2_dir_ctx_t *dir_ctx;
+    ext2_node_t *de = NULL;
+    ext2_extent_t ext;
+    u32 inode_dirty = 0;
+    s32 ret;
+
+    ret = ext2_open_dir(vfs, dir, (void **) &dir_ctx);
+    if(ret != SUCCESS)
+        return ret;
+
+    while((de == NULL) && ((ret = ext2_dir_read_block(vfs, dir_ctx)) == SUCCESS))
+    {
+        while(dir_ctx->pos < dir_ctx->len)
+        {
+            ext2_node_t * const ent = (ext2_node_t *) (dir_ctx->buf + dir_ctx->pos);
+            ku32 rec_len = LE2N16(ent->rec_len),
+                 used = ent->inode ? EXT2_DIR_REC_LEN(ent->name_len) : 0;
+
+            if((rec_len < sizeof(ext2_node_t)) || (rec_len & 3)
+               || (dir_ctx->pos + rec_len > dir_ctx->len) || (used > rec_len))
+            {
+                ret = -EINVAL;
+                break;
+            }
+
+            if(rec_len - used >= needed)
+            {
+                /* Split the entry, giving its slack space to the new entry */
+                if(used)
+                {
+                    ent->rec_len = N2LE16(used);
+                    de = (ext2_node_t *) ((u8 *) ent + used);
+                    de->rec_len = N2LE16(rec_len - used);
+                }
+                else
+                    de = ent;
+
+                break;
+            }
+
+            dir_ctx->pos += rec_len;
+        }
+
+        if(ret != SUCCESS)
+            break;
+    }
+
+    if(ret == -ENOENT)
+    {
+        /* There is no room in the existing blocks; append a block to the directory */
+        ku32 logical = LE2N32(dir_ctx->inode.i_size) >> fs->log_block_size;
+        u32 goal = 0;
+
+        sem_acquire(&fs->bmaps->lock);
+
+        if(logical && (ext2_bmap_translate(vfs, &dir_ctx->inode, logical - 1, 1, &ext) == SUCCESS)
+           && ext.physical)
+            goal = ext.physical + 1;
+
+        ret = ext2_bmap_alloc(vfs, dir, &dir_ctx->inode, logical, 1, goal, &ext);
+        if(ret == SUCCESS)
+            ext2_bmap_invalidate(fs, dir, logical);
+
+        sem_release(&fs->bmaps->lock);
+
+        /* Directories grow a block at a time; don't hold a preallocation window for them */
+        ext2_prealloc_discard(vfs, dir);
+
+        if(ret == SUCCESS)
+        {
+            bzero(dir_ctx->buf, fs->block_size);
+
+            de = (ext2_node_t *) dir_ctx->buf;
+            de->rec_len = N2LE16(fs->block_size);
+
+            dir_ctx->logical = logical + 1;
+            dir_ctx->inode.i_size = N2LE32((logical + 1) << fs->log_block_size);
+        }
+
+        inode_dirty = 1;
+    }
+    else if(ret == SUCCESS)
+        ret = (ext2_bmap_range(vfs, dir, &dir_ctx->inode, dir_ctx->logical - 1, 1, &ext, 1) == 1)
+                ? SUCCESS : -EINVAL;
+
+    if(ret == SUCCESS)
+    {
+        de->inode = N2LE32(inum);
+        de->name_len = name_len;
+        de->file_type = file_type;
+        memcpy(de->name, name, name_len);
+
+        ret = block_write_multi(vfs->dev, ext.physical << (fs->log_block_size - LOG_BLOCK_SIZE),
+                                fs->block_size >> LOG_BLOCK_SIZE, dir_ctx->buf);
+        if(ret >= 0)
+            ret = SUCCESS;
+    }
+
+    if(LE2N32(dir_ctx->inode.i_flags) & EXT2_INDEX_FL)
+    {
+        dir_ctx->inode.i_flags = N2LE32(LE2N32(dir_ctx->inode.i_flags) & ~EXT2_INDEX_FL);
+        inode_dirty = 1;
+    }
+
+    if(inode_dirty)
+    {
+        ks32 ret_inode = ext2_write_inode(vfs, dir, &dir_ctx->inode);
+        if(ret == SUCCESS)
+            ret = ret_inode;
+    }
+
+    ext2_close_dir(vfs, dir_ctx);
+
+    return ret;
+}
+
+
+/*
+    ext2_create_node() - create a new file or directory, described by <node>, in the directory whose
+    inode number is <parent>.  A new directory is given a block containing its "." and ".." entries.
+    On success, the new inode number is stored in node->first_block.
+*/
+s32 ext2_create_node(vfs_t *vfs, ku32 parent, fs_node_t *node)
+{
+    ext2_fs_t * const fs = (ext2_fs_t *) vfs->data;
+    ku32 is_dir = (node->type == FSNODE_TYPE_DIR), name_len = strlen(node->name),
+         filetype = LE2N32(fs->sblk->s_feature_incompat) & EXT2_FEATURE_INCOMPAT_FILETYPE;
+    ext2_extent_t ext = {0, 0, 0};
+    ext2_inode_t inode, dir;
+    void *ctx;
+    s32 inum, ret;
+
+    if(!fs->writable)
+        return -EROFS;
+
+    if(!name_len || (name_len > EXT2_NAME_LEN))
+        return -ENAMETOOLONG;
+
+    /* Fail if the name is already in use */
+    ret = ext2_open_dir(vfs, parent, &ctx);
+    if(ret != SUCCESS)
+        return ret;
+
+    ret = ext2_read_dir(vfs, ctx, node->name, NULL);
+    ext2_close_dir(vfs, ctx);
+
+    if(ret == SUCCESS)
+        return -EEXIST;
+    else if(ret != -ENOENT)
+        return ret;
+
+    inum = ext2_alloc_inode(vfs, parent, is_dir);
+    if(inum < 0)
+        return inum;
+
+    ret = SUCCESS;
+    bzero(&inode, sizeof(inode));
+
+    /* Nodes store rwxt for each of user, group and other; ext2 stores rwx */
+    inode.i_mode = N2LE16((is_dir ? EXT2_S_IFDIR : EXT2_S_IFREG)
+                          | (((node->permissions >> (FS_PERM_SHIFT_U + 1)) & 7) << 6)
+                          | (((node->permissions >> (FS_PERM_SHIFT_G + 1)) & 7) << 3)
+                          | ((node->permissions >> (FS_PERM_SHIFT_O + 1)) & 7));
+    inode.i_uid = N2LE16(node->uid);
+    inode.i_gid = N2LE16(node->gid);
+    inode.i_atime = N2LE32(node->atime);
+    inode.i_ctime = N2LE32(node->ctime);
+    inode.i_mtime = N2LE32(node->mtime);
+    inode.i_links_count = N2LE16(is_dir ? 2 : 1);
+
+    if(is_dir)
+    {
+        u8 * const buf = (u8 *) kcalloc(1, fs->block_size);
+
+        if(buf == NULL)
+            ret = -ENOMEM;
+        else
+        {
+            ext2_node_t *de = (ext2_node_t *) buf;
+
+            de->inode = N2LE32(inum);
+            de->rec_len = N2LE16(EXT2_DIR_REC_LEN(1));
+            de->name_len = 1;
+            de->file_type = filetype ? EXT2_FT_DIR : EXT2_FT_UNKNOWN;
+            de->name[0] = '.';
+
+            de = (ext2_node_t *) (buf + EXT2_DIR_REC_LEN(1));
+            de->inode = N2LE32(parent);
+            de->rec_len = N2LE16(fs->block_size - EXT2_DIR_REC_LEN(1));
+            de->name_len = 2;
+            de->file_type = filetype ? EXT2_FT_DIR : EXT2_FT_UNKNOWN;
+            de->name[0] = de->name[1] = '.';
+
+            sem_acquire(&fs->bmaps->lock);
+            ret = ext2_bmap_alloc(vfs, inum, &inode, 0, 1, 0, &ext);
+            sem_release(&fs->bmaps->lock);
+
+            ext2_prealloc_discard(vfs, inum);
+
+            if(ret == SUCCESS)
+            {
+                ret = block_write_multi(vfs->dev,
+                                        ext.physical << (fs->log_block_size - LOG_BLOCK_SIZE),
+                                        fs->block_size >> LOG_BLOCK_SIZE, buf);
+                if(ret >= 0)
+                    ret = SUCCESS;
+            }
+
+            inode.i_size = N2LE32(fs->block_size);
+            kfree(buf);
+        }
+    }
+
+    if(ret == SUCCESS)
+        ret = ext2_write_inode(vfs, inum, &inode);
+
+    if(ret == SUCCESS)
+        ret = ext2_dir_add_entry(vfs, parent, node->name, inum,
+                                 !filetype ? EXT2_FT_UNKNOWN
+                                           : (is_dir ? EXT2_FT_DIR : EXT2_FT_REG_FILE));
+
+    if(ret != SUCCESS)
+    {
+        /* Release the new inode and its block, if any */
+        if(ext.physical)
+            ext2_free_blocks(vfs, ext.physical, ext.len);
+
+        ext2_free_inode(vfs, inum, is_dir);
+        ext2_alloc_sync(vfs);
+
+        return ret;
+    }
+
+    node->first_block = inum;
+    node->size = LE2N32(inode.i_size);
+
+    /* Update the parent's timestamps; a new directory's ".." entry is also a link to its parent */
+    ret = ext2_read_inode(vfs, parent, &dir);
+    if(ret == SUCCESS)
+    {
+        if(is_dir)
+            dir.i_links_count = N2LE16(LE2N16(dir.i_links_count) + 1);
+
+        dir.i_ctime = inode.i_ctime;
+        dir.i_mtime = inode.i_mtime;
+
+        ret = ext2_write_inode(vfs, parent, &dir);
+    }
+
+    if(ret != SUCCESS)
+        return ret;
+
+    return ext2_alloc_sync(vfs);
+}
+
+
+/*
+    ext2_inode_to_node() - populate the metadata fields of <node> from the on-disk inode <inode>.
+*/
+static void ext2_inode_to_node(const ext2_inode_t * const inode, fs_node_t * const node)
+{
+    ku16 mode = LE2N16(inode->i_mode);
+
+    node->type = ((mode & 0xf000) == EXT2_S_IFDIR) ? FSNODE_TYPE_DIR : FSNODE_TYPE_FILE;
+
+    /* ext2 stores rwx bits for each of user, group and other; nodes store rwxt */
+    node->permissions = (((mode >> 6) & 7) << (FS_PERM_SHIFT_U + 1))
+                        | (((mode >> 3) & 7) << (FS_PERM_SHIFT_G + 1))
+                        | ((mode & 7) << (FS_PERM_SHIFT_O + 1));
+
+    node->flags = 0;
+    node->uid = LE2N16(inode->i_uid);
+    node->gid = LE2N16(inode->i_gid);
+    node->size = LE2N32(inode->i_size);
+    node->atime = LE2N32(inode->i_atime);
+    node->ctime = LE2N32(inode->i_ctime);
+    node->mtime = LE2N32(inode->i_mtime);
+}
+
+
+/*
+    ext2_read() - read <count> blocks, starting from block <offset>, into <buffer> from the file
+    indicated by <node>.  Block numbers and counts are in units of BLOCK_SIZE bytes, which may be
+    smaller than the file system block size.  The file's block map is translated into extents, and
+    each physically-contiguous extent is read with a single request; holes are zero-filled.
+*/
+s32 ext2_read(vfs_t * const vfs, fs_node_t * const node, void * const buffer, u32 offset,
+              ks32 count)
+{
+    const ext2_fs_t * const fs = (const ext2_fs_t *) vfs->data;
+    ku32 shift = fs->log_block_size - LOG_BLOCK_SIZE, mask = (1 << shift) - 1;
+    ext2_extent_t ext[EXT2_READ_EXTENTS];
+    ext2_inode_t inode;
+    u8 *buffer_ = (u8 *) buffer;
+    u32 remaining, nunits;
+    s32 ret;
+
+    if(count < 0)
+        return -EINVAL;
+
+    ret = ext2_read_inode(vfs, node->first_block, &inode);
+    if(ret != SUCCESS)
+        return ret;
+
+    /* Don't read beyond the end of the file */
+    nunits = (LE2N32(inode.i_size) + BLOCK_SIZE - 1) >> LOG_BLOCK_SIZE;
+    if(offset >= nunits)
+        return 0;
+
+    remaining = MIN((u32) count, nunits - offset);
+
+    while(remaining)
+    {
+        s32 i, next;
+
+        /* Translate the file system blocks spanned by the rest of the request */
+        next = ext2_bmap_range(vfs, node->first_block, &inode, offset >> shift,
+                               ((offset & mask) + remaining + mask) >> shift, ext,
+                               EXT2_READ_EXTENTS);
+        if(next <= 0)
+        {
+            ret = next ? next : -EINVAL;
+            break;
+        }
+
+        for(i = 0; (i < next) && remaining; ++i)
+        {
+            ku32 skip = offset - (ext[i].logical << shift),
+                 len = MIN((ext[i].len << shift) - skip, remaining);
+
+            if(ext[i].physical)
+            {
+                ret = block_read_multi(vfs->dev, (ext[i].physical << shift) + skip, len, buffer_);
+                if(ret < 0)
+                    break;
+            }
+            else
+                bzero(buffer_, len * BLOCK_SIZE);       /* Hole */
+
+            buffer_ += len * BLOCK_SIZE;
+            offset += len;
+            remaining -= len;
+        }
+
+        if(ret < 0)
+            break;
+    }
+
+    /* Report a partial read, or an error if nothing was read */
+    if(remaining == (u32) count)
+        return ret;
+
+    return count - remaining;
+}
+
+
+/*
+    ext2_write() - write <count> blocks, starting from block <offset>, from <buffer> to the file
+    indicated by <node>.  Block numbers and counts are in units of BLOCK_SIZE bytes.  Blocks are
+    allocated for any holes in the range written, including the range beyond the end of the file,
+    and each physically-contiguous extent is written with a single request.  The parts of newly
+    allocated file system blocks not covered by the request are zeroed.  The file's size is
+    extended to cover the blocks written; write_node() later sets its exact length.
+*/
+s32 ext2_write(vfs_t * const vfs, fs_node_t * const node, const void * const buffer, u32 offset,
+               ks32 count)
+{
+    ext2_fs_t * const fs = (ext2_fs_t *) vfs->data;
+    ku32 shift = fs->log_block_size - LOG_BLOCK_SIZE, mask = (1 << shift) - 1,
+         inum = node->first_block;
+    const u8 *buffer_ = (const u8 *) buffer;
+    u32 remaining, goal = 0, inode_dirty = 0;
+    u8 *zero = NULL;
+    ext2_inode_t inode;
+    s32 ret;
+
+    if(count < 0)
+        return -EINVAL;
+
+    if(!fs->writable)
+        return -EROFS;
+
+    ret = ext2_read_inode(vfs, inum, &inode);
+    if(ret != SUCCESS)
+        return ret;
+
+    if((LE2N16(inode.i_mode) & 0xf000) != EXT2_S_IFREG)
+        return ((LE2N16(inode.i_mode) & 0xf000) == EXT2_S_IFDIR) ? -EISDIR : -EINVAL;
+
+    for(remaining = count; remaining;)
+    {
+        ext2_extent_t ext;
+        u32 skip, len, u, fresh = 0;
+
+        sem_acquire(&fs->bmaps->lock);
+
+        ret = ext2_bmap_translate(vfs, &inode, offset >> shift,
+                                  ((offset & mask) + remaining + mask) >> shift, &ext);
+        if((ret == SUCCESS) && !ext.physical)
+        {
+            /* Place the new blocks immediately after the block which precedes them in the file */
+            if(!goal && ext.logical)
+            {
+                ext2_extent_t prev;
+
+                if((ext2_bmap_translate(vfs, &inode, ext.logical - 1, 1, &prev) == SUCCESS)
+                   && prev.physical)
+                    goal = prev.physical + 1;
+            }
+
+            ret = ext2_bmap_alloc(vfs, inum, &inode, ext.logical, ext.len, goal, &ext);
+            if(ret == SUCCESS)
+            {
+                ext2_bmap_invalidate(fs, inum, ext.logical);
+                fresh = 1;
+            }
+
+            inode_dirty = 1;
+        }
+
+        sem_release(&fs->bmaps->lock);
+
+        if(ret != SUCCESS)
+            break;
+
+        goal = ext.physical + ext.len;
+        skip = offset - (ext.logical << shift);
+        len = MIN((ext.len << shift) - skip, remaining);
+
+        /* Zero the parts of new blocks which precede and follow the data */
+        if(fresh && (skip || (skip + len < (ext.len << shift))))
+        {
+            if(zero == NULL)
+            {
+                zero = (u8 *) kcalloc(1, BLOCK_SIZE);
+                if(zero == NULL)
+                {
+                    ret = -ENOMEM;
+                    break;
+                }
+            }
+
+            for(u = 0; (ret == SUCCESS) && (u < (ext.len << shift)); ++u)
+                if((u < skip) || (u >= skip + len))
+                    ret = block_write(vfs->dev, (ext.physical << shift) + u, zero);
+
+            if(ret != SUCCESS)
+                break;
+        }
+
+        ret = block_write_multi(vfs->dev, (ext.physical << shift) + skip, len, buffer_);
+        if(ret < 0)
+            break;
+
+        ret = SUCCESS;
+        buffer_ += len * BLOCK_SIZE;
+        offset += len;
+        remaining -= len;
+    }
+
+    kfree(zero);
+
+    if((offset << LOG_BLOCK_SIZE) > LE2N32(inode.i_size))
+    {
+        inode.i_size = N2LE32(offset << LOG_BLOCK_SIZE);
+        inode_dirty = 1;
+    }
+
+    if(inode_dirty)
+    {
+        ks32 ret_inode = ext2_write_inode(vfs, inum, &inode);
+        if(ret_inode != SUCCESS)
+            return ret_inode;
+    }
+
+    /* Report a partial write, or an error if nothing was written */
+    if(remaining == (u32) count)
+        return ret;
+
+    return count - remaining;
+}
+
+
+/*
+    ext2_reallocate() - change the space allocated to a file.  If the file is truncated to
+    <new_len> bytes, the blocks beyond the new end of the file, and any indirect blocks which no
+    longer map anything, are released.  Extending a file is a no-op: the file becomes sparse, and
+    blocks are allocated when they are written.
+*/
+s32 ext2_reallocate(vfs_t * const vfs, fs_node_t * const node, ks32 new_len)
+{
+    ext2_fs_t * const fs = (ext2_fs_t *) vfs->data;
+    ku32 ptr_shift = fs->log_block_size - 2, inum = node->first_block;
+    u32 i_block[EXT2_N_BLOCKS], keep, base, level;
+    ext2_inode_t inode;
+    s32 ret, ret_inode;
+
+    if(new_len < 0)
+        return -EINVAL;
+
+    if(!fs->writable)
+        return -EROFS;
+
+    ret = ext2_read_inode(vfs, inum, &inode);
+    if(ret != SUCCESS)
+        return ret;
+
+    if((u32) new_len >= LE2N32(inode.i_size))
+        return SUCCESS;
+
+    keep = (new_len + fs->block_size - 1) >> fs->log_block_size;
+
+    /* Copy the block pointers, as the (packed) inode may not be suitably aligned */
+    memcpy(i_block, inode.i_block, sizeof(i_block));
+
+    sem_acquire(&fs->bmaps->lock);
+
+    ret = (keep < EXT2_NDIR_BLOCKS)
+            ? ext2_free_block_list(vfs, &inode, i_block + keep, EXT2_NDIR_BLOCKS - keep) : SUCCESS;
+
+    for(level = 1, base = EXT2_NDIR_BLOCKS; (ret == SUCCESS) && (level <= 3);
+        base += 1 << (level * ptr_shift), ++level)
+        ret = ext2_truncate_table(vfs, &inode, &i_block[EXT2_IND_BLOCK + level - 1], level, base,
+                                  keep);
+
+    ext2_bmap_invalidate(fs, inum, keep);
+
+    sem_release(&fs->bmaps->lock);
+
+    ext2_prealloc_discard(vfs, inum);
+
+    memcpy(inode.i_block, i_block, sizeof(i_block));
+    inode.i_size = N2LE32(new_len);
+
+    ret_inode = ext2_write_inode(vfs, inum, &inode);
+
+    return (ret == SUCCESS) ? ret_inode : ret;
+}
+
+
+/*
+    ext2_write_node() - write the metadata of <node> back to its inode, and write back the
+    allocator's bitmaps, block group descriptors and superblock.
+*/
+s32 ext2_write_node(vfs_t * const vfs, fs_node_t * const node)
+{
+    const ext2_fs_t * const fs = (const ext2_fs_t *) vfs->data;
+    ext2_inode_t inode;
+    u16 mode;
+    s32 ret;
+
+    if(!fs->writable)
+        return -EROFS;
+
+    ret = ext2_read_inode(vfs, node->first_block, &inode);
+    if(ret != SUCCESS)
+        return ret;
+
+    /* Nodes store rwxt for each of user, group and other; ext2 stores rwx */
+    mode = (LE2N16(inode.i_mode) & ~0777)
+           | (((node->permissions >> (FS_PERM_SHIFT_U + 1)) & 7) << 6)
+           | (((node->permissions >> (FS_PERM_SHIFT_G + 1)) & 7) << 3)
+           | ((node->permissions >> (FS_PERM_SHIFT_O + 1)) & 7);
+
+    inode.i_mode = N2LE16(mode);
+    inode.i_uid = N2LE16(node->uid);
+    inode.i_gid = N2LE16(node->gid);
+    inode.i_size = N2LE32(node->size);
+    inode.i_atime = N2LE32(node->atime);
+    inode.i_ctime = N2LE32(node->ctime);
+    inode.i_mtime = N2LE32(node->mtime);
+
+    ret = ext2_write_inode(vfs, node->first_block, &inode);
+    if(ret != SUCCESS)
+        return ret;
+
+    return ext2_alloc_sync(vfs);
+}
+
+
+/*
+    ext2_stat() - return information about an ext2 file system.
+*/
+s32 ext2_stat(vfs_t *vfs, fs_stat_t *st)
+{
+    const ext2_fs_t * const fs = (const ext2_fs_t *) vfs->data;
+    ku32 shift = fs->log_block_size - LOG_BLOCK_SIZE;
+
+    st->total_blocks = LE2N32(fs->sblk->s_blocks_count) << shift;
+    st->free_blocks = LE2N32(fs->sblk->s_free_blocks_count) << shift;
+    st->label = NULL;
+
+    return SUCCESS;
+}
+
+
+/*
+    Return nonzero if the specified block group should contain a superblock backup.
+*/
+u32 block_group_contains_superblock(const ext2_fs_t *fs, ku32 block_group)
+{
+    /* Originally superblock backups were stored in every block group.  The "sparse superblock"
+       feature saves space by storing backups in block groups 0, 1, and powers of 3, 5 and 7. */
+    if(LE2N32(fs->sblk->s_feature_ro_compat) & EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER)
+    {
+        /* This file system has the "sparse superblock" feature */
+
+        /* Trivial case: backups are stored in block groups 0 and 1 */
+        if(block_group < 2)
+        {
+            return 1;
+        }
+        else
+        {
+            /* The limits[] array contains the highest powers of 3, 5 and 7 that are representable in a
+               32-bit uint.  e.g. limits[0] = 20, meaning that 3^20 fits in 32 bits but 3^21 does not. */
+            u32 limits[3] = {20, 13, 11}, i;
+
+            /* Check for powers of 3, 5 and 7. */
+            for(i = 0; i < (sizeof(limits) / sizeof(limits[0])); ++i)
+            {
+                ku32 base = (i << 1) + 1;   /* base = {3, 5, 7} */
+                u32 mult;
+
+                for(mult = base; (mult < block_group) && limits[i]--; mult *= base)
+                    ;   /* nothing */
+
+                if(mult == block_group)
+                {
+                    return 1;
+                }
+            }
+        }
+
+        return 0;
+    }
+    else
+    {
+        /* This file system does not have the "sparse superblock" feature.  Every block group has
+           a superblock backup. */
+        return 1;
+    }
+}
+
+
+/*
+    Read a block into the buffer at *ppbuf.  If *ppbuf is NULL, allocate a new buffer and store
+    a pointer to it in *ppbuf.
+
+    ************************ TODO - deprecate this function ******************************
+*/
+u32 ext2_read_block(vfs_t *vfs, ku32 block, void **ppbuf)
+{
+    s32 ret;
+    u8 *buf;
+    u32 len;
+
+    const ext2_fs_t *fs = (const ext2_fs_t *) vfs->data;
+
+    /* allocate a new buffer if needed */
+    if(*ppbuf == NULL)
+    {
+        buf = kmalloc(fs->block_size);
+        if(buf == NULL)
+        {
+            return -ENOMEM;
+        }
+    }
+    else
+    {
+        buf = *ppbuf;
+    }
+
+    len = fs->block_size >> LOG_BLOCK_SIZE;
+    ret = block_read_multi(vfs->dev, block << (fs->log_block_size - LOG_BLOCK_SIZE), len, buf);
+
+    if(ret < 0)
+    {
+        /* block read failed */
+        if(*ppbuf == NULL)
+            kfree(buf);
+
+        return ret;
+    }
+
+    *ppbuf = buf;
+
+    return SUCCESS;
+}
+
+
+/*
+    ext2_icache_init() - allocate and initialise the inode cache for <fs>.  The number of entries is
+    proportional to the number of inodes per block group.
+*/
+static s32 ext2_icache_init(ext2_fs_t * const fs)
+{
+    ext2_icache_t *cache;
+    u32 u, nentries;
+
+    nentries = fs->inodes_per_group / EXT2_ICACHE_RATIO;
+    if(nentries < EXT2_ICACHE_MIN)
+        nentries = EXT2_ICACHE_MIN;
+    else if(nentries > EXT2_ICACHE_MAX)
+        nentries = EXT2_ICACHE_MAX;
+
+    cache = (ext2_icache_t *) CHECKED_KCALLOC(1, sizeof(ext2_icache_t));
+
+    cache->ents = (ext2_icache_ent_t *) kcalloc(nentries, sizeof(ext2_icache_ent_t));
+    if(cache->ents == NULL)
+    {
+        kfree(cache);
+        return -ENOMEM;
+    }
+
+    cache->nentries = nentries;
+    list_init(&cache->lru);
+
+    for(u = 0; u < EXT2_ICACHE_BUCKETS; ++u)
+        list_init(&cache->buckets[u]);
+
+    for(u = 0; u < nentries; ++u)
+    {
+        list_init(&cache->ents[u].hash);
+        list_insert(&cache->ents[u].lru, &cache->lru);
+    }
+
+    fs->icache = cache;
+
+    return SUCCESS;
+}
+
+
+/*
+    ext2_icache_destroy() - release the inode cache belonging to <fs>.
+*/
+static void ext2_icache_destroy(ext2_fs_t * const fs)
+{
+    if(fs->icache != NULL)
+    {
+        kfree(fs->icache->ents);
+        kfree(fs->icache);
+        fs->icache = NULL;
+    }
+}
+
+
+/*
+    ext2_icache_lookup() - look up inode <inum> in the inode cache.  If it is present, copy it to
+    <*inode>, make it the most-recently-used entry and return SUCCESS; otherwise return -ENODATA.
+*/
+static s32 ext2_icache_lookup(ext2_fs_t * const fs, ku32 inum, ext2_inode_t * const inode)
+{
+    ext2_icache_t * const cache = fs->icache;
+    ext2_icache_ent_t *ent;
+
+    preempt_disable();
+
+    list_for_each_entry(ent, &cache->buckets[inum & (EXT2_ICACHE_BUCKETS - 1)], hash)
+    {
+        if(ent->inum == inum)
+        {
+            *inode = ent->inode;
+            list_move_insert(&ent->lru, &cache->lru);
+            ++cache->hits;
+
+            preempt_enable();
+            return SUCCESS;
+        }
+    }
+
+    ++cache->misses;
+    preempt_enable();
+
+    return -ENODATA;
+}
+
+
+/*
+    ext2_icache_add() - add a copy of inode <inum> to the inode cache, replacing any existing copy.
+    If the cache is full, the least-recently-used entry is recycled.
+*/
+static void ext2_icache_add(ext2_fs_t * const fs, ku32 inum, const ext2_inode_t * const inode)
+{
+    ext2_icache_t * const cache = fs->icache;
+    list_t * const bucket = &cache->buckets[inum & (EXT2_ICACHE_BUCKETS - 1)];
+    ext2_icache_ent_t *ent;
+
+    preempt_disable();
+
+    list_for_each_entry(ent, bucket, hash)
+        if(ent->inum == inum)
+            break;
+
+    if(&ent->hash == bucket)
+    {
+        /* Not present; recycle the least-recently-used entry */
+        ent = list_first_entry(&cache->lru, ext2_icache_ent_t, lru);
+
+        list_delete(&ent->hash);
+        list_insert(&ent->hash, bucket);
+        ent->inum = inum;
+    }
+
+    ent->inode = *inode;
+    list_move_insert(&ent->lru, &cache->lru);
+
+    preempt_enable();
+}
+
+
+/*
+    ext2_read_inode() - read inode <inum> into <*inode>.  Inodes are served from the inode cache if
+    possible; otherwise the BLOCK_SIZE-byte unit of the inode table containing the inode is read
+    through the block cache.  The inode is returned in on-disk (little-endian) byte order.
+*/
+u32 ext2_read_inode(vfs_t *vfs, u32 inum, ext2_inode_t *inode)
+{
+    ext2_fs_t * const fs = (ext2_fs_t *) vfs->data;
+    u32 block, offset;
+    s32 ret;
+    u8 *buf;
+
+    if(!inum || (inum > LE2N32(fs->sblk->s_inodes_count)))
+        return -EINVAL;     /* inum is out of bounds */
+
+    if(ext2_icache_lookup(fs, inum, inode) == SUCCESS)
+        return SUCCESS;
+
+    ext2_inode_location(fs, inum, &block, &offset);
+
+    buf = kmalloc(BLOCK_SIZE);
+    if(buf == NULL)
+        return -ENOMEM;
+
+    ret = block_read(vfs->dev, block, buf);
+    if(ret == SUCCESS)
+    {
+        memcpy(inode, buf + offset, sizeof(ext2_inode_t));
+        ext2_icache_add(fs, inum, inode);
+    }
+
+    kfree(buf);
+
+    return ret;
+}
+
+
+/*
+    ext2_write_inode() - write <*inode> to the on-disk inode <inum>, and update the inode cache.
+    Only the fields described by ext2_inode_t are written; any extra space in a larger on-disk
+    inode is preserved.
+*/
+s32 ext2_write_inode(vfs_t *vfs, ku32 inum, const ext2_inode_t *inode)
+{
+    ext2_fs_t * const fs = (ext2_fs_t *) vfs->data;
+    u32 block, offset;
+    s32 ret;
+    u8 *buf;
+
+    if(!inum || (inum > LE2N32(fs->sblk->s_inodes_count)))
+        return -EINVAL;     /* inum is out of bounds */
+
+    ext2_inode_location(fs, inum, &block, &offset);
+
+    buf = kmalloc(BLOCK_SIZE);
+    if(buf == NULL)
+        return -ENOMEM;
+
+    ret = block_read(vfs->dev, block, buf);
+    if(ret == SUCCESS)
+    {
+        memcpy(buf + offset, inode, sizeof(ext2_inode_t));
+
+        ret = block_write(vfs->dev, block, buf);
+        if(ret == SUCCESS)
+            ext2_icache_add(fs, inum, inode);
+    }
+
+    kfree(buf);
+
+    return ret;
+}
+
+
+/*
+    ext2_inode_location() - find inode <inum> on disk: <*block> receives the number of the
+    BLOCK_SIZE-byte unit of the device containing the inode, and <*offset> the inode's byte offset
+    within that unit.
+*/
+static void ext2_inode_location(const ext2_fs_t * const fs, ku32 inum, u32 * const block,
+                                u32 * const offset)
+{
+    /* Inode numbers start at 1, not 0 */
+    ku32 group = (inum - 1) / fs->inodes_per_group, index = (inum - 1) % fs->inodes_per_group;
+
+    /* Byte offset of the inode from the start of the group's inode table */
+    ku32 table_offset = index * fs->inode_size;
+
+    *block = (LE2N32(fs->bgd[group].bg_inode_table) << (fs->log_block_size - LOG_BLOCK_SIZE))
+             + (table_offset >> LOG_BLOCK_SIZE);
+    *offset = table_offset & (BLOCK_SIZE - 1);
+}
+
+
+/*
+    ext2_inode_add_blocks() - adjust the count of blocks held by <inode> by <nblocks> file system
+    blocks.  The on-disk count is kept in units of 512 bytes.
+*/
+static void ext2_inode_add_blocks(const ext2_fs_t * const fs, ext2_inode_t * const inode,
+                                  ks32 nblocks)
+{
+    inode->i_blocks = N2LE32(LE2N32(inode->i_blocks)
+                             + (nblocks * (s32) (fs->block_size >> LOG_BLOCK_SIZE)));
+}
+
+
+/*
+    ext2_bmap_cache_init() - allocate and initialise the block-map cache for <fs>.
+*/
+static s32 ext2_bmap_cache_init(ext2_fs_t * const fs)
+{
+    ext2_bmap_cache_t *cache;
+    u32 u;
+
+    cache = (ext2_bmap_cache_t *) CHECKED_KCALLOC(1, sizeof(ext2_bmap_cache_t));
+
+    cache->buf = (u32 *) kmalloc(fs->block_size);
+    if(cache->buf == NULL)
+    {
+        kfree(cache);
+        return -ENOMEM;
+    }
+
+    sem_init(&cache->lock);
+    list_init(&cache->lru);
+
+    for(u = 0; u < EXT2_BMAP_CACHE_FILES; ++u)
+        list_insert(&cache->maps[u].lru, &cache->lru);
+
+    fs->bmaps = cache;
+
+    return SUCCESS;
+}
+
+
+/*
+    ext2_bmap_cache_destroy() - release the block-map cache belonging to <fs>.
+*/
+static void ext2_bmap_cache_destroy(ext2_fs_t * const fs)
+{
+    if(fs->bmaps != NULL)
+    {
+        sem_destroy(&fs->bmaps->lock);
+        kfree(fs->bmaps->buf);
+        kfree(fs->bmaps);
+        fs->bmaps = NULL;
+    }
+}
+
+
+/*
+    ext2_bmap_get() - return the block map for inode <inum>, recycling the least-recently-used map
+    if the inode has none.  Must be called with the cache lock held.
+*/
+static ext2_bmap_t *ext2_bmap_get(ext2_bmap_cache_t * const cache, ku32 inum)
+{
+    ext2_bmap_t *map;
+
+    list_for_each_entry(map, &cache->lru, lru)
+        if(map->inum == inum)
+            break;
+
+    if(&map->lru == &cache->lru)
+    {
+        map = list_first_entry(&cache->lru, ext2_bmap_t, lru);
+
+        map->inum = inum;
+        map->mapped = 0;
+        map->nruns = 0;
+    }
+
+    list_move_insert(&map->lru, &cache->lru);
+
+    return map;
+}
+
+
+/*
+    ext2_bmap_read_table() - read the indirect block <block> into the block-map cache's buffer.  Must
+    be called with the cache lock held.
+*/
+static s32 ext2_bmap_read_table(vfs_t * const vfs, ku32 block)
+{
+    const ext2_fs_t * const fs = (const ext2_fs_t *) vfs->data;
+    ks32 ret = block_read_multi(vfs->dev, block << (fs->log_block_size - LOG_BLOCK_SIZE),
+                                fs->block_size >> LOG_BLOCK_SIZE, fs->bmaps->buf);
+
+    return (ret < 0) ? ret : SUCCESS;
+}
+
+
+/*
+    ext2_bmap_write_table() - write the block-map cache's buffer to the indirect block <block>.  Must
+    be called with the cache lock held.
+*/
+static s32 ext2_bmap_write_table(vfs_t * const vfs, ku32 block)
+{
+    const ext2_fs_t * const fs = (const ext2_fs_t *) vfs->data;
+    ks32 ret = block_write_multi(vfs->dev, block << (fs->log_block_size - LOG_BLOCK_SIZE),
+                                 fs->block_size >> LOG_BLOCK_SIZE, fs->bmaps->buf);
+
+    return (ret < 0) ? ret : SUCCESS;
+}
+
+
+/*
+    ext2_bmap_translate() - translate logical block <logical> of <inode> into a physical block,
+    returning the result in <*ext>.  The extent is extended to cover as many of the following
+    blocks (up to a total of <count>) as are physically contiguous, or are all holes, and whose
+    pointers are held in the same block table.  Must be called with the block-map cache lock held.
+*/
+static s32 ext2_bmap_translate(vfs_t * const vfs, const ext2_inode_t * const inode, ku32 logical,
+                               ku32 count, ext2_extent_t * const ext)
+{
+    const ext2_fs_t * const fs = (const ext2_fs_t *) vfs->data;
+
+    /* Each indirect block holds (block_size / 4) block pointers */
+    ku32 ptr_shift = fs->log_block_size - 2, ptr_mask = (1 << ptr_shift) - 1;
+    u32 direct[EXT2_NDIR_BLOCKS], index, nentries, first, len;
+    const u32 *table;
+    s32 ret;
+
+    if(logical < EXT2_NDIR_BLOCKS)
+    {
+        /* Copy the direct pointers, as the (packed) inode may not be suitably aligned */
+        memcpy(direct, inode->i_block, sizeof(direct));
+        table = direct;
+        index = logical;
+        nentries = EXT2_NDIR_BLOCKS;
+    }
+    else
+    {
+        u32 n = logical - EXT2_NDIR_BLOCKS, level, block;
+
+        if(n < (1U << ptr_shift))
         {
-            const s32 len = end - path;
+            level = 1;
+            block = inode->i_block[EXT2_IND_BLOCK];
+        }
+        else if((n -= (1 << ptr_shift)) < (1U << (2 * ptr_shift)))
+        {
+            level = 2;
+            block = inode->i_block[EXT2_DIND_BLOCK];
+        }
+        else
+        {
+            n -= 1 << (2 * ptr_shift);
+            if(n >> (3 * ptr_shift))
+                return -EINVAL;     /* block number out of range */
 
-            if(len > NAME_MAX_LEN)
+            level = 3;
+            block = inode->i_block[EXT2_TIND_BLOCK];
+        }
+
+        /* Walk down the tree of indirect blocks to the table holding the pointer to the block */
+        for(block = LE2N32(block); block && (level > 1); --level)
+        {
+            ret = ext2_bmap_read_table(vfs, block);
+            if(ret != SUCCESS)
+                return ret;
+
+            block = LE2N32(fs->bmaps->buf[(n >> ((level - 1) * ptr_shift)) & ptr_mask]);
+        }
+
+        index = n & ptr_mask;
+        nentries = 1 << ptr_shift;
+
+        if(!block)
+        {
+            /* A missing indirect block: every block it would map is a hole */
+            ext->logical = logical;
+            ext->physical = 0;
+            ext->len = MIN(count, nentries - index);
+            return SUCCESS;
+        }
+
+        ret = ext2_bmap_read_table(vfs, block);
+        if(ret != SUCCESS)
+            return ret;
+
+        table = fs->bmaps->buf;
+    }
+
+    first = LE2N32(table[index]);
+
+    for(len = 1; (len < count) && (index + len < nentries); ++len)
+    {
+        ku32 next = LE2N32(table[index + len]);
+
+        if(first ? (next != first + len) : (next != 0))
+            break;
+    }
+
+    ext->logical = logical;
+    ext->physical = first;
+    ext->len = len;
+
+    return SUCCESS;
+}
+
+
+/*
+    ext2_bmap_lookup() - translate logical block <logical> using the block map <map>, extending the
+    map if necessary.  <nblocks> is the length of the file in blocks.  The extent returned in <*ext>
+    is limited to <count> blocks.  Must be called with the block-map cache lock held.
+*/
+static s32 ext2_bmap_lookup(vfs_t * const vfs, ext2_bmap_t * const map,
+                            const ext2_inode_t * const inode, ku32 logical, ku32 count,
+                            ku32 nblocks, ext2_extent_t * const ext)
+{
+    const ext2_extent_t *run;
+    u32 lo, hi, offset;
+
+    while(logical >= map->mapped)
+    {
+        ext2_extent_t new_run;
+        s32 ret;
+
+        if(map->nruns == EXT2_BMAP_MAX_RUNS)
+            return ext2_bmap_translate(vfs, inode, logical, count, ext);
+
+        ret = ext2_bmap_translate(vfs, inode, map->mapped, nblocks - map->mapped, &new_run);
+        if(ret != SUCCESS)
+            return ret;
+
+        if(map->nruns && EXT2_EXTENT_FOLLOWS(&map->runs[map->nruns - 1], &new_run))
+            map->runs[map->nruns - 1].len += new_run.len;
+        else
+            map->runs[map->nruns++] = new_run;
+
+        map->mapped += new_run.len;
+    }
+
+    /* Binary search for the last run starting at or before the requested block */
+    for(lo = 0, hi = map->nruns - 1; lo < hi;)
+    {
+        ku32 mid = (lo + hi + 1) >> 1;
+
+        if(map->runs[mid].logical <= logical)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    run = &map->runs[lo];
+    offset = logical - run->logical;
+
+    ext->logical = logical;
+    ext->physical = run->physical ? run->physical + offset : 0;
+    ext->len = MIN(run->len - offset, count);
+
+    return SUCCESS;
+}
+
+
+/*
+    ext2_bmap_range() - translate up to <count> logical blocks of the file described by <inode>,
+    starting at block <first>, into at most <max_ext> extents, which are written to <ext>.  The
+    translation stops at the end of the file.  Returns the number of extents written, or a negative
+    error code.  If <inum> is non-zero, the translation is cached in the inode's block map.
+*/
+s32 ext2_bmap_range(vfs_t *vfs, ku32 inum, const ext2_inode_t *inode, ku32 first, u32 count,
+                    ext2_extent_t *ext, ku32 max_ext)
+{
+    ext2_fs_t * const fs = (ext2_fs_t *) vfs->data;
+    ku32 nblocks = (LE2N32(inode->i_size) + fs->block_size - 1) >> fs->log_block_size;
+    ext2_bmap_t *map;
+    u32 n, logical;
+    s32 ret = SUCCESS;
+
+    if(first >= nblocks)
+        return 0;
+
+    count = MIN(count, nblocks - first);
+
+    sem_acquire(&fs->bmaps->lock);
+
+    map = inum ? ext2_bmap_get(fs->bmaps, inum) : NULL;
+
+    for(n = 0, logical = first; count && (n < max_ext);)
+    {
+        ext2_extent_t * const e = &ext[n];
+
+        ret = map ? ext2_bmap_lookup(vfs, map, inode, logical, count, nblocks, e)
+                  : ext2_bmap_translate(vfs, inode, logical, count, e);
+        if(ret != SUCCESS)
+            break;
+
+        logical += e->len;
+        count -= e->len;
+
+        /* Merge with the previous extent if possible */
+        if(n && EXT2_EXTENT_FOLLOWS(&ext[n - 1], e))
+            ext[n - 1].len += e->len;
+        else
+            ++n;
+    }
+
+    sem_release(&fs->bmaps->lock);
+
+    return (ret == SUCCESS) ? (s32) n : ret;
+}
+
+
+/*
+    ext2_bmap_alloc() - allocate blocks for a hole in the file <inum>, whose inode is <inode>,
+    starting at logical block <logical>.  Up to <count> blocks are allocated, as close as possible
+    to block <goal>, but no more than fit in the block table holding the pointer to <logical>.  Any
+    missing indirect blocks on the path to that table are allocated first, in front of the data.
+    The new blocks are described by <*ext>.  <inode> is updated but not written back.  Must be
+    called with the block-map cache lock held.
+*/
+static s32 ext2_bmap_alloc(vfs_t * const vfs, ku32 inum, ext2_inode_t * const inode, ku32 logical,
+                           ku32 count, u32 goal, ext2_extent_t * const ext)
+{
+    const ext2_fs_t * const fs = (const ext2_fs_t *) vfs->data;
+    ku32 ptr_shift = fs->log_block_size - 2, ptr_mask = (1 << ptr_shift) - 1;
+    u32 i_block[EXT2_N_BLOCKS], *table, index, nentries, got, u, table_block = 0, nalloc = 0;
+    s32 ret;
+
+    /* Work on a copy of the block pointers, as the (packed) inode may not be suitably aligned */
+    memcpy(i_block, inode->i_block, sizeof(i_block));
+
+    if(logical < EXT2_NDIR_BLOCKS)
+    {
+        table = i_block;
+        index = logical;
+        nentries = EXT2_NDIR_BLOCKS;
+    }
+    else
+    {
+        u32 n = logical - EXT2_NDIR_BLOCKS, level, *ptr;
+
+        if(n < (1U << ptr_shift))
+        {
+            level = 1;
+            ptr = &i_block[EXT2_IND_BLOCK];
+        }
+        else if((n -= (1 << ptr_shift)) < (1U << (2 * ptr_shift)))
+        {
+            level = 2;
+            ptr = &i_block[EXT2_DIND_BLOCK];
+        }
+        else
+        {
+            n -= 1 << (2 * ptr_shift);
+            if(n >> (3 * ptr_shift))
+                return -EFBIG;      /* block number out of range */
+
+            level = 3;
+            ptr = &i_block[EXT2_TIND_BLOCK];
+        }
+
+        /*
+            Walk down the tree of indirect blocks, allocating any which are missing.  When a table
+            is allocated, the pointer to it is written into its parent - held in the cache buffer,
+            unless the parent is the inode - before the buffer is reused for the new, empty table.
+        */
+        for(;; --level)
+        {
+            u32 block = LE2N32(*ptr);
+
+            if(!block)
             {
-                kfree(buf);
-                return -ENAMETOOLONG;
+                ret = ext2_alloc_blocks(vfs, inum, goal, 1, &got);
+                if(ret < 0)
+                    goto done;
+
+                block = ret;
+                goal = block + 1;
+                ++nalloc;
+
+                *ptr = N2LE32(block);
+                if(table_block)
+                {
+                    ret = ext2_bmap_write_table(vfs, table_block);
+                    if(ret != SUCCESS)
+                        goto done;
+                }
+
+                bzero(fs->bmaps->buf, fs->block_size);
+                ret = ext2_bmap_write_table(vfs, block);
             }
+            else
+                ret = ext2_bmap_read_table(vfs, block);
 
-            /* FIXME remove */
-            memcpy(name, path, len);
-            name[end - path] = '\0';
+            if(ret != SUCCESS)
+                goto done;
 
-            ret = ext2_read_inode(vfs, in, &inode);
-            if(ret)
+            table_block = block;
+            if(level == 1)
+                break;
+
+            ptr = &fs->bmaps->buf[(n >> ((level - 1) * ptr_shift)) & ptr_mask];
+        }
+
+        table = fs->bmaps->buf;
+        index = n & ptr_mask;
+        nentries = 1 << ptr_shift;
+    }
+
+    ret = ext2_alloc_blocks(vfs, inum, goal, MIN(count, nentries - index), &got);
+    if(ret < 0)
+        goto done;
+
+    ext->logical = logical;
+    ext->physical = ret;
+    ext->len = got;
+
+    for(u = 0; u < got; ++u)
+        table[index + u] = N2LE32(ext->physical + u);
+
+    nalloc += got;
+    ret = table_block ? ext2_bmap_write_table(vfs, table_block) : SUCCESS;
+
+done:
+    memcpy(inode->i_block, i_block, sizeof(i_block));
+    ext2_inode_add_blocks(fs, inode, nalloc);
+
+    return ret;
+}
+
+
+/*
+    ext2_bmap_invalidate() - discard the part of the cached block map of inode <inum> which lies at
+    or beyond logical block <logical>, after blocks have been allocated or released there.  Must be
+    called with the block-map cache lock held.
+*/
+static void ext2_bmap_invalidate(ext2_fs_t * const fs, ku32 inum, ku32 logical)
+{
+    ext2_bmap_t *map;
+
+    list_for_each_entry(map, &fs->bmaps->lru, lru)
+    {
+        if((map->inum == inum) && (logical < map->mapped))
+        {
+            while(map->nruns && (map->runs[map->nruns - 1].logical >= logical))
+                --map->nruns;
+
+            if(map->nruns)
             {
-                kfree(buf);
-                return ret;
+                ext2_extent_t * const run = &map->runs[map->nruns - 1];
+
+                if(run->logical + run->len > logical)
+                    run->len = logical - run->logical;
             }
 
-            u8 found = 0;
-            for(block_index = 0; !found;)
-            {
-                const ext2_node_t *d_ent;
+            map->mapped = logical;
+        }
+    }
+}
 
-                ret = ext2_inode_get_block(vfs, &inode, block_index++, &data_block);
-                if(ret)
-                {
-                    kfree(buf);
-                    return ret;
-                }
 
-                if(!data_block)
-                {
-                    break;
-                }
+/*
+    ext2_free_block_list() - release the blocks referenced by the <n> block pointers at <ptrs>, and
+    clear the pointers.  Runs of physically-contiguous blocks within a block group are released
+    together.  The block count of <inode> is updated.
+*/
+static s32 ext2_free_block_list(vfs_t * const vfs, ext2_inode_t * const inode, u32 * const ptrs,
+                                ku32 n)
+{
+    const ext2_fs_t * const fs = (const ext2_fs_t *) vfs->data;
+    u32 i, start = 0, len = 0;
+    s32 ret = SUCCESS;
 
-                ret = ext2_read_block(vfs, data_block, (void **) &buf);
-                if(ret)
-                {
-                    kfree(buf);
-                    return ret;
-                }
+    for(i = 0; (ret == SUCCESS) && (i <= n); ++i)
+    {
+        ku32 block = (i < n) ? LE2N32(ptrs[i]) : 0;
 
-                /* search the directory for the path component */
-                for(d_ent = (ext2_node_t *) buf;
-                        (u8 *) d_ent < (buf + (1024 << fs->sblk->s_log_block_size));
-                        d_ent = (ext2_node_t *) ((u8 *) d_ent + d_ent->rec_len))
-                {
-                    if(!memcmp(d_ent->name, name, len) && !d_ent->name[len])
-                    {
-                        if(*end && (d_ent->file_type != EXT2_FT_DIR))
-                        {
-                            kfree(buf);
-                            return -ENOTDIR;
-                        }
-
-                        in = d_ent->inode;
-                        found = 1;  /* ugh */
-                        break;
-                    }
-                }
+        if(block)
+            ptrs[i] = 0;
+
+        /* Extend the current run if the block follows it in the same block group */
+        if(len && (block == start + len) && ((block - fs->first_data_block) % fs->blocks_per_group))
+        {
+            ++len;
+            continue;
+        }
+
+        if(len)
+        {
+            ret = ext2_free_blocks(vfs, start, len);
+            if(ret == SUCCESS)
+                ext2_inode_add_blocks(fs, inode, -(s32) len);
+        }
+
+        start = block;
+        len = block ? 1 : 0;
+    }
+
+    return ret;
+}
+
+
+/*
+    ext2_truncate_table() - release the blocks at or beyond logical block <keep> which are mapped
+    through the block table whose pointer is at <ptr>.  <level> is the table's level of indirection
+    and <base> the first logical block it maps.  If the table maps no blocks below <keep>, the table
+    itself is released and <*ptr> cleared.  The block count of <inode> is updated.
+*/
+static s32 ext2_truncate_table(vfs_t * const vfs, ext2_inode_t * const inode, u32 * const ptr,
+                               ku32 level, ku32 base, ku32 keep)
+{
+    const ext2_fs_t * const fs = (const ext2_fs_t *) vfs->data;
+    ku32 ptr_shift = fs->log_block_size - 2, nentries = 1 << ptr_shift,
+         child_span = 1 << ((level - 1) * ptr_shift), block = LE2N32(*ptr),
+         shift = fs->log_block_size - LOG_BLOCK_SIZE;
+    u32 *table, first, i;
+    s32 ret;
+
+    if(!block || (base + (nentries * child_span) <= keep))
+        return SUCCESS;
+
+    table = (u32 *) kmalloc(fs->block_size);
+    if(table == NULL)
+        return -ENOMEM;
+
+    ret = block_read_multi(vfs->dev, block << shift, fs->block_size >> LOG_BLOCK_SIZE, table);
+    if(ret >= 0)
+    {
+        first = (keep > base) ? (keep - base) / child_span : 0;
+
+        if(level == 1)
+            ret = ext2_free_block_list(vfs, inode, table + first, nentries - first);
+        else
+            for(ret = SUCCESS, i = first; (ret == SUCCESS) && (i < nentries); ++i)
+                ret = ext2_truncate_table(vfs, inode, &table[i], level - 1, base + (i * child_span),
+                                          keep);
+    }
+
+    if(ret >= 0)
+    {
+        if(base >= keep)
+        {
+            ret = ext2_free_blocks(vfs, block, 1);
+            if(ret == SUCCESS)
+            {
+                *ptr = 0;
+                ext2_inode_add_blocks(fs, inode, -1);
             }
+        }
+        else
+        {
+            ret = block_write_multi(vfs->dev, block << shift, fs->block_size >> LOG_BLOCK_SIZE,
+                                    table);
+            if(ret >= 0)
+                ret = SUCCESS;
+        }
+    }
+
+    kfree(table);
+
+    return ret;
+}
+
+
+/*
+    Find the inode containing the file at the specified (absolute) path and return its number.
+*/
+u32 ext2_parse_path(vfs_t *vfs, ks8 *path, inum_t *inum)
+{
+    ks8 *end;
+    inum_t in = EXT2_ROOT_INO;
+    s8 name[NAME_MAX_LEN + 1];
+
+    /* Fail if the first character of the path is anything other than a directory separator (/).
+       e.g. the path is non-absolute, or is empty */
+    if(*path != DIR_SEPARATOR)
+    {
+        return -ENOENT;
+    }
+
+    for(; *path; path = end)
+    {
+        /* find the next dir sep or \0 */
+        for(end = ++path; *end && (*end != DIR_SEPARATOR); ++end)
+            ;
+
+        if(path != end)
+        {
+            const ext2_node_t *de;
+            void *ctx;
+            s32 ret;
+            const s32 len = end - path;
+
+            if(len > NAME_MAX_LEN)
+                return -ENAMETOOLONG;
+
+            memcpy(name, path, len);
+            name[len] = '\0';
 
-            if(!found)
+            ret = ext2_open_dir(vfs, in, &ctx);
+            if(ret != SUCCESS)
+                return ret;
+
+            ret = ext2_dir_find(vfs, (ext2_dir_ctx_t *) ctx, name, &de);
+            if(ret == SUCCESS)
             {
-                kfree(buf);
-                return -ENOENT;
+                if(*end && (de->file_type != EXT2_FT_DIR))
+                    ret = -ENOTDIR;
+                else
+                    in = LE2N32(de->inode);
             }
+
+            ext2_close_dir(vfs, ctx);
+
+            if(ret != SUCCESS)
+                return ret;
         }
     }
 
-    kfree(buf);
     *inum = in;
 
     return SUCCESS;
@@ -615,10 +2215,14 @@ u32 ext2_parse_path(vfs_t *vfs, ks8 *path, inum_t *inum)
 
 s32 ext2_get_root_node(vfs_t *vfs, fs_node_t **node)
 {
-    const ext2_fs_t * const fs = (const ext2_fs_t *) vfs->data;
     fs_node_t *root_node;
+    ext2_inode_t inode;
     s32 ret;
 
+    ret = ext2_read_inode(vfs, EXT2_ROOT_INO, &inode);
+    if(ret != SUCCESS)
+        return ret;
+
     ret = fs_node_alloc(&root_node);
     if(ret != SUCCESS)
         return ret;
@@ -633,11 +2237,7 @@ s32 ext2_get_root_node(vfs_t *vfs, fs_node_t **node)
         return ret;
     }
 
-    root_node->type = FSNODE_TYPE_DIR;
-    root_node->permissions = FS_PERM_UGORWX;            /* FIXME - read this */
-
-    /* FIXME - 32 bit overflow */
-    root_node->size = LE2N32(fs->sblk->s_blocks_count) << (LE2N32(fs->sblk->s_log_block_size) + 9);
+    ext2_inode_to_node(&inode, root_node);
     root_node->first_block = EXT2_ROOT_INO;
 
     *node = root_node;
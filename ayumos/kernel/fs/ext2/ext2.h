@@ -11,8 +11,11 @@
 
 #ifdef WITH_FS_EXT2
 
+#include <kernel/include/byteorder.h>
 #include <kernel/include/defs.h>
 #include <kernel/include/fs/vfs.h>
+#include <kernel/include/list.h>
+#include <kernel/include/semaphore.h>
 #include <kernel/include/types.h>
 #include <kernel/include/memory/kmalloc.h>
 #include <kernel/util/kutil.h>
@@ -23,6 +26,7 @@
 
 #define EXT2_SUPER_MAGIC        (0xef53)
 #define EXT2_SUPERBLOCK_OFFSET  (1024)
+#define EXT2_SUPERBLOCK_SIZE    (1024)
 
 #define EXT2_BAD_INO                        (1)         /* Bad blocks inode                     */
 #define EXT2_ROOT_INO                       (2)         /* Root directory inode                 */
@@ -51,10 +55,19 @@
 #define EXT2_S_IWOTH                        (0x0002)    /* others write                         */
 #define EXT2_S_IXOTH                        (0x0001)    /* others execute                       */
 
+#define EXT2_FEATURE_COMPAT_DIR_INDEX       (0x0020)    /* Hashed-tree directory indexes        */
+
+#define EXT2_FEATURE_INCOMPAT_FILETYPE      (0x0002)    /* Directory entries record file type   */
+
 #define EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER (0x0001)    /* Sparse superblock backups            */
 #define EXT2_FEATURE_RO_COMPAT_LARGE_FILE   (0x0002)    /* Large file support                   */
 #define EXT2_FEATURE_RO_COMPAT_BTREE_DIR    (0x0004)    /* Binary tree sorted directory files   */
 
+#define EXT2_FLAGS_SIGNED_HASH              (0x0001)    /* Directory hashes use signed chars    */
+#define EXT2_FLAGS_UNSIGNED_HASH            (0x0002)    /* Directory hashes use unsigned chars  */
+
+#define EXT2_INDEX_FL                       (0x1000)    /* Directory has a hashed-tree index    */
+
 #define EXT2_FT_UNKNOWN                     (0)         /* Unknown file type                    */
 #define EXT2_FT_REG_FILE                    (1)         /* Regular file                         */
 #define EXT2_FT_DIR                         (2)         /* Directory file                       */
@@ -123,6 +136,16 @@ struct ext2_superblock
     /* Other options */
     u32 s_default_mount_options;
     u32 s_first_meta_bg;
+    u32 s_mkfs_time;                /* timestamp of file system creation                        */
+    u32 s_jnl_blocks[17];           /* backup of the journal inode's i_block[] and i_size       */
+
+    /* Fields introduced by ext4; s_flags is also used by ext2 implementations */
+    u32 s_blocks_count_hi;
+    u32 s_r_blocks_count_hi;
+    u32 s_free_blocks_count_hi;
+    u16 s_min_extra_isize;
+    u16 s_want_extra_isize;
+    u32 s_flags;                    /* EXT2_FLAGS_*                                             */
 } __attribute__((packed));
 
 
@@ -143,6 +166,12 @@ struct ext2_bgd
 #define EXT2_LOG_BGD_SIZE   (5)
 
 
+#define EXT2_NDIR_BLOCKS    (12)                    /* Number of direct block pointers      */
+#define EXT2_IND_BLOCK      (EXT2_NDIR_BLOCKS)      /* Singly-indirect block pointer        */
+#define EXT2_DIND_BLOCK     (EXT2_IND_BLOCK + 1)    /* Doubly-indirect block pointer        */
+#define EXT2_TIND_BLOCK     (EXT2_DIND_BLOCK + 1)   /* Triply-indirect block pointer        */
+#define EXT2_N_BLOCKS       (EXT2_TIND_BLOCK + 1)
+
 struct ext2_inode
 {
     u16 i_mode;
@@ -157,7 +186,7 @@ struct ext2_inode
     u32 i_blocks;
     u32 i_flags;
     u32 i_osd1;
-    u32 i_block[15];
+    u32 i_block[EXT2_N_BLOCKS];
     u32 i_generation;
     u32 i_file_acl;
     u32 i_dir_acl;
@@ -178,18 +207,213 @@ struct ext2_node
     u8 name[];
 } __attribute__((packed));
 
+#define EXT2_NAME_LEN       (255)
+
+/* Length of a directory entry holding a name of length <n>, rounded up to a multiple of 4 bytes */
+#define EXT2_DIR_REC_LEN(n) (((n) + sizeof(struct ext2_node) + 3) & ~3)
+
+
+/*
+    Hashed-tree directory indexes.  The first block of an indexed directory holds the "." and ".."
+    entries, the second of which spans the rest of the block and conceals the root of the index.
+    Interior index nodes are blocks containing a single empty entry which spans the whole block.
+    Each index block contains a sorted array of (hash, block) pairs, the first of which holds the
+    count and limit of the array in place of its hash.  Leaf blocks are ordinary directory blocks.
+*/
+#define EXT2_DX_HASH_LEGACY                 (0)
+#define EXT2_DX_HASH_HALF_MD4               (1)
+#define EXT2_DX_HASH_TEA                    (2)
+#define EXT2_DX_HASH_LEGACY_UNSIGNED        (3)
+#define EXT2_DX_HASH_HALF_MD4_UNSIGNED      (4)
+#define EXT2_DX_HASH_TEA_UNSIGNED           (5)
+
+#define EXT2_DX_ROOT_INFO_OFFSET    (24)    /* Offset of the root info: after "." and ".."      */
+#define EXT2_DX_NODE_OFFSET         (8)     /* Offset of the entries in an interior node        */
+#define EXT2_DX_MAX_LEVELS          (2)     /* Maximum number of interior levels supported      */
+#define EXT2_DX_BLOCK_MASK          (0x0fffffff)
+#define EXT2_DX_MAX_LEAVES          (4)     /* Max leaves searched for colliding hashes         */
+
+struct ext2_dx_root_info
+{
+    u32 reserved_zero;
+    u8 hash_version;                /* EXT2_DX_HASH_*                                           */
+    u8 info_length;                 /* Length of this structure (8)                             */
+    u8 indirect_levels;             /* Number of interior levels below the root                 */
+    u8 unused_flags;
+} __attribute__((packed));
+
+struct ext2_dx_entry
+{
+    u32 hash;                       /* Lowest hash in the block; bit 0 = hash collision         */
+    u32 block;                      /* Logical block number within the directory                */
+} __attribute__((packed));
+
+struct ext2_dx_countlimit
+{
+    u16 limit;                      /* Maximum number of entries in the block                   */
+    u16 count;                      /* Number of entries in the block                           */
+} __attribute__((packed));
+
+
+/*
+    Inode cache.  The cache holds copies of recently-read on-disk inodes, so that repeated lookups
+    of the same inode (e.g. the directories along a path) do not require the inode table to be
+    read.  The number of entries is derived from the number of inodes per block group, within the
+    limits below.
+*/
+#define EXT2_ICACHE_RATIO       (16)    /* One cache entry per this many inodes per group       */
+#define EXT2_ICACHE_MIN         (16)    /* Minimum number of entries in the cache               */
+#define EXT2_ICACHE_MAX         (256)   /* Maximum number of entries in the cache               */
+#define EXT2_ICACHE_BUCKETS     (32)    /* Number of hash buckets; must be a power of two       */
+
+typedef struct ext2_icache_ent
+{
+    list_t              hash;           /* Position in hash bucket                              */
+    list_t              lru;            /* Position in the LRU list                             */
+    u32                 inum;           /* Inode number, or 0 if the entry is unused            */
+    struct ext2_inode   inode;          /* Copy of the on-disk inode                            */
+} ext2_icache_ent_t;
+
+typedef struct ext2_icache
+{
+    u32                 nentries;
+    list_t              lru;            /* All entries, least-recently used (or unused) first   */
+    list_t              buckets[EXT2_ICACHE_BUCKETS];
+    ext2_icache_ent_t   *ents;
+    u32                 hits;
+    u32                 misses;
+} ext2_icache_t;
+
+
+/*
+    A run of logical blocks of a file which map onto physically-contiguous blocks.  A physical
+    block number of zero indicates a hole: a run of blocks which are not allocated.
+*/
+typedef struct ext2_extent
+{
+    u32 logical;                        /* First logical block of the run                       */
+    u32 physical;                       /* First physical block of the run, or 0 for a hole     */
+    u32 len;                            /* Length of the run, in blocks                         */
+} ext2_extent_t;
+
+/*
+    Block-map cache.  For each of the most recently used files, the cache holds the translation of
+    its logical blocks, from block zero up to a high-water mark, as a sorted array of extents.  The
+    translation is extended on demand, one indirect block at a time, so the indirect blocks of a
+    file being read sequentially are each read once.  Files too fragmented to be described by
+    EXT2_BMAP_MAX_RUNS extents are translated uncached beyond the last run.
+*/
+#define EXT2_BMAP_CACHE_FILES   (8)     /* Number of files whose block maps are cached          */
+#define EXT2_BMAP_MAX_RUNS      (32)    /* Maximum number of extents cached per file            */
+
+typedef struct ext2_bmap
+{
+    list_t          lru;
+    u32             inum;               /* Inode number, or 0 if the map is unused              */
+    u32             mapped;             /* Number of logical blocks translated                  */
+    u32             nruns;
+    ext2_extent_t   runs[EXT2_BMAP_MAX_RUNS];
+} ext2_bmap_t;
+
+typedef struct ext2_bmap_cache
+{
+    sem_t           lock;               /* Protects the maps and the buffer                     */
+    list_t          lru;                /* Least-recently used map first                        */
+    u32             *buf;               /* Indirect block buffer                                */
+    ext2_bmap_t     maps[EXT2_BMAP_CACHE_FILES];
+} ext2_bmap_cache_t;
+
+
+/*
+    Block and inode allocation.  The allocator keeps the most recently used block bitmap and inode
+    bitmap in memory.  Modified bitmaps, the block group descriptor table and the superblock are
+    written back through the block cache by ext2_alloc_sync().
+
+    New blocks are placed as close as possible to a goal block: the block following the previous
+    block of the file, or the start of the file's block group.  When a file is extended, the
+    allocator looks for a run of free blocks rather than a single free block, and reserves the part
+    of the run which it does not use as a preallocation window for that file.  The window exists
+    only in memory; other files' allocations avoid it, so files appended to concurrently each
+    remain contiguous.  Each time a file extends beyond the end of its window, the size of its next
+    window is doubled, so a file which keeps growing is laid out in ever longer runs.
+*/
+#define EXT2_PREALLOC_WINDOWS   (4)     /* Number of files which may have preallocation windows */
+#define EXT2_PREALLOC_BLOCKS    (64)    /* Initial size of a preallocation window, in blocks    */
+#define EXT2_PREALLOC_MAX       (2048)  /* Maximum size of a preallocation window, in blocks    */
+#define EXT2_NO_GROUP           (0xffffffff)
+
+typedef struct ext2_prealloc
+{
+    list_t              lru;
+    u32                 inum;           /* Owning inode, or 0 if the window is unused           */
+    u32                 start;          /* Next block in the window                             */
+    u32                 end;            /* Block following the last block in the window         */
+    u32                 size;           /* Size of the window when it was reserved, in blocks   */
+} ext2_prealloc_t;
+
+typedef struct ext2_bitmap
+{
+    u32                 group;          /* Block group whose bitmap is loaded, or EXT2_NO_GROUP */
+    u32                 block;          /* Block number of the bitmap                           */
+    u32                 dirty;          /* Non-zero if buf has been modified                    */
+    u8                  *buf;
+} ext2_bitmap_t;
+
+typedef struct ext2_alloc
+{
+    sem_t               lock;           /* Protects the bitmaps, BGD table and superblock counts */
+    ext2_bitmap_t       blocks;         /* Block bitmap cache                                   */
+    ext2_bitmap_t       inodes;         /* Inode bitmap cache                                   */
+    u8                  *bgd_dirty;     /* Dirty flag for each BLOCK_SIZE unit of the BGD table  */
+    u32                 sblk_dirty;     /* Non-zero if the superblock counts have changed       */
+    list_t              lru;            /* Preallocation windows, least-recently used first     */
+    ext2_prealloc_t     windows[EXT2_PREALLOC_WINDOWS];
+} ext2_alloc_t;
+
+
+/* Number of extents translated per iteration when reading a file */
+#define EXT2_READ_EXTENTS       (8)
+
+
+/* Directory iteration context, created by ext2_open_dir() */
+typedef struct ext2_dir_ctx
+{
+    u32                 inum;           /* Inode number of the directory                        */
+    u32                 logical;        /* Next logical block of the directory to be read       */
+    u32                 pos;            /* Offset of the next entry within buf                  */
+    u32                 len;            /* Number of valid bytes in buf                         */
+    u8                  *buf;           /* Current directory block                              */
+    struct ext2_inode   inode;          /* The directory's inode                                */
+} ext2_dir_ctx_t;
+
 
 struct ext2_fs
 {
     struct ext2_superblock *sblk;
     struct ext2_bgd *bgd;
     u32 bgd_table_clean:1;              /* 1 = table unmodified; 0 = changes not flushed to disc */
+    u32 block_size;                     /* File system block size, in bytes                     */
+    u32 log_block_size;                 /* log2(block_size)                                     */
+    u32 inodes_per_group;
+    u32 inode_size;                     /* Size of an on-disk inode, in bytes                   */
+    u32 num_block_groups;
+    u32 blocks_per_group;
+    u32 first_data_block;
+    u32 blocks_count;
+    u32 bgd_units;                      /* Size of the BGD table, in BLOCK_SIZE units            */
+    u32 writable;                       /* Non-zero if the fs uses only features we can write    */
+    ext2_icache_t *icache;
+    ext2_bmap_cache_t *bmaps;
+    ext2_alloc_t *alloc;
 };
 
 typedef struct ext2_superblock ext2_superblock_t;
 typedef struct ext2_bgd ext2_bgd_t;
 typedef struct ext2_inode ext2_inode_t;
 typedef struct ext2_node ext2_node_t;
+typedef struct ext2_dx_root_info ext2_dx_root_info_t;
+typedef struct ext2_dx_entry ext2_dx_entry_t;
+typedef struct ext2_dx_countlimit ext2_dx_countlimit_t;
 typedef struct ext2_fs ext2_fs_t;
 
 typedef u32 inum_t;
@@ -199,9 +423,30 @@ vfs_driver_t g_ext2_ops;
 u32 block_group_contains_superblock(const ext2_fs_t *fs, ku32 block_group);
 u32 ext2_read_block(vfs_t *vfs, ku32 block, void **ppbuf);
 u32 ext2_read_inode(vfs_t *vfs, u32 inum, ext2_inode_t *inode);
+s32 ext2_write_inode(vfs_t *vfs, ku32 inum, const ext2_inode_t *inode);
 u32 unaligned_read(u32 start, u32 len, void *data);
 u32 unaligned_write(u32 start, u32 len, const void *data);
-u32 ext2_inode_get_block(vfs_t *vfs, const ext2_inode_t *inode, u32 num, u32 *block);
+s32 ext2_bmap_range(vfs_t *vfs, ku32 inum, const ext2_inode_t *inode, ku32 first, u32 count,
+                    ext2_extent_t *ext, ku32 max_ext);
+s32 ext2_read_file_block(vfs_t *vfs, ku32 inum, const ext2_inode_t *inode, ku32 logical,
+                         void *buf);
+
+s32 ext2_create_node(vfs_t *vfs, ku32 parent, fs_node_t *node);
+
+/* alloc.c */
+s32 ext2_alloc_init(vfs_t *vfs);
+void ext2_alloc_destroy(ext2_fs_t *fs);
+s32 ext2_alloc_blocks(vfs_t *vfs, ku32 inum, u32 goal, ku32 want, u32 *got);
+s32 ext2_free_blocks(vfs_t *vfs, ku32 first, ku32 count);
+void ext2_prealloc_discard(vfs_t *vfs, ku32 inum);
+s32 ext2_alloc_inode(vfs_t *vfs, ku32 parent, ku32 is_dir);
+s32 ext2_free_inode(vfs_t *vfs, ku32 inum, ku32 is_dir);
+s32 ext2_alloc_sync(vfs_t *vfs);
+
+/* htree.c */
+u32 ext2_dx_hash(const ext2_fs_t *fs, ku32 version, const char *name, ku32 len);
+s32 ext2_dx_lookup(vfs_t *vfs, ku32 inum, const ext2_inode_t *inode, const char *name, ku32 len,
+                   u32 *leaves, ku32 max_leaves);
 u32 ext2_parse_path(vfs_t *vfs, ks8 *path, inum_t *inum);
 void ext2();
 
@@ -0,0 +1,387 @@
+/*
+    ext2 hashed-tree directory index support
+
+    Part of ayumos
+
+
+    (c) Stuart Wallace <stuartw@atom.net>, October 2026.
+
+
+    Directories with the EXT2_INDEX_FL flag set, on file systems with the "dir_index" feature,
+    contain a tree of (hash, block) pairs which maps the hash of an entry's name to the single leaf
+    block which holds it.  This file implements the hash functions used by the index, and a lookup
+    function which walks the tree to find the leaf block(s) which may contain a given name.
+
+    The hash functions are compatible with those used by Linux and e2fsprogs.
+*/
+
+#ifdef WITH_FS_EXT2
+
+#include <kernel/fs/ext2/ext2.h>
+
+
+#define EXT2_DX_TEA_DELTA       (0x9e3779b9)
+
+#define EXT2_DX_ROL32(x, n)     (((x) << (n)) | ((x) >> (32 - (n))))
+
+/* Half-MD4 round functions and constants */
+#define EXT2_DX_F(x, y, z)      ((z) ^ ((x) & ((y) ^ (z))))
+#define EXT2_DX_G(x, y, z)      (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define EXT2_DX_H(x, y, z)      ((x) ^ (y) ^ (z))
+
+#define EXT2_DX_ROUND(f, a, b, c, d, x, s)                                                       \
+    ((a) += f((b), (c), (d)) + (x), (a) = EXT2_DX_ROL32((a), (s)))
+
+#define EXT2_DX_K1              (0)
+#define EXT2_DX_K2              (013240474631UL)
+#define EXT2_DX_K3              (015666365641UL)
+
+
+static void ext2_dx_tea_transform(u32 buf[4], ku32 in[4]);
+static void ext2_dx_half_md4_transform(u32 buf[4], ku32 in[8]);
+static u32 ext2_dx_legacy_hash(const char *name, u32 len, ku32 is_unsigned);
+static void ext2_dx_str2hashbuf(const char *msg, u32 len, u32 *buf, s32 num, ku32 is_unsigned);
+static const ext2_dx_entry_t *ext2_dx_search(const ext2_dx_entry_t * const entries, ku32 count,
+                                             ku32 hash);
+
+
+/*
+    ext2_dx_tea_transform() - mix the 16-byte block <in> into <buf> using the TEA cipher.
+*/
+static void ext2_dx_tea_transform(u32 buf[4], ku32 in[4])
+{
+    u32 sum = 0, b0 = buf[0], b1 = buf[1];
+    ku32 a = in[0], b = in[1], c = in[2], d = in[3];
+    u32 n;
+
+    for(n = 16; n--;)
+    {
+        sum += EXT2_DX_TEA_DELTA;
+        b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+        b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+    }
+
+    buf[0] += b0;
+    buf[1] += b1;
+}
+
+
+/*
+    ext2_dx_half_md4_transform() - mix the 32-byte block <in> into <buf> using a cut-down version
+    of the MD4 transform.
+*/
+static void ext2_dx_half_md4_transform(u32 buf[4], ku32 in[8])
+{
+    u32 a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+    /* Round 1 */
+    EXT2_DX_ROUND(EXT2_DX_F, a, b, c, d, in[0] + EXT2_DX_K1,  3);
+    EXT2_DX_ROUND(EXT2_DX_F, d, a, b, c, in[1] + EXT2_DX_K1,  7);
+    EXT2_DX_ROUND(EXT2_DX_F, c, d, a, b, in[2] + EXT2_DX_K1, 11);
+    EXT2_DX_ROUND(EXT2_DX_F, b, c, d, a, in[3] + EXT2_DX_K1, 19);
+    EXT2_DX_ROUND(EXT2_DX_F, a, b, c, d, in[4] + EXT2_DX_K1,  3);
+    EXT2_DX_ROUND(EXT2_DX_F, d, a, b, c, in[5] + EXT2_DX_K1,  7);
+    EXT2_DX_ROUND(EXT2_DX_F, c, d, a, b, in[6] + EXT2_DX_K1, 11);
+    EXT2_DX_ROUND(EXT2_DX_F, b, c, d, a, in[7] + EXT2_DX_K1, 19);
+
+    /* Round 2 */
+    EXT2_DX_ROUND(EXT2_DX_G, a, b, c, d, in[1] + EXT2_DX_K2,  3);
+    EXT2_DX_ROUND(EXT2_DX_G, d, a, b, c, in[3] + EXT2_DX_K2,  5);
+    EXT2_DX_ROUND(EXT2_DX_G, c, d, a, b, in[5] + EXT2_DX_K2,  9);
+    EXT2_DX_ROUND(EXT2_DX_G, b, c, d, a, in[7] + EXT2_DX_K2, 13);
+    EXT2_DX_ROUND(EXT2_DX_G, a, b, c, d, in[0] + EXT2_DX_K2,  3);
+    EXT2_DX_ROUND(EXT2_DX_G, d, a, b, c, in[2] + EXT2_DX_K2,  5);
+    EXT2_DX_ROUND(EXT2_DX_G, c, d, a, b, in[4] + EXT2_DX_K2,  9);
+    EXT2_DX_ROUND(EXT2_DX_G, b, c, d, a, in[6] + EXT2_DX_K2, 13);
+
+    /* Round 3 */
+    EXT2_DX_ROUND(EXT2_DX_H, a, b, c, d, in[3] + EXT2_DX_K3,  3);
+    EXT2_DX_ROUND(EXT2_DX_H, d, a, b, c, in[7] + EXT2_DX_K3,  9);
+    EXT2_DX_ROUND(EXT2_DX_H, c, d, a, b, in[2] + EXT2_DX_K3, 11);
+    EXT2_DX_ROUND(EXT2_DX_H, b, c, d, a, in[6] + EXT2_DX_K3, 15);
+    EXT2_DX_ROUND(EXT2_DX_H, a, b, c, d, in[1] + EXT2_DX_K3,  3);
+    EXT2_DX_ROUND(EXT2_DX_H, d, a, b, c, in[5] + EXT2_DX_K3,  9);
+    EXT2_DX_ROUND(EXT2_DX_H, c, d, a, b, in[0] + EXT2_DX_K3, 11);
+    EXT2_DX_ROUND(EXT2_DX_H, b, c, d, a, in[4] + EXT2_DX_K3, 15);
+
+    buf[0] += a;
+    buf[1] += b;
+    buf[2] += c;
+    buf[3] += d;
+}
+
+
+/*
+    ext2_dx_legacy_hash() - compute the original ("legacy") ext3 directory hash of a name.  The
+    characters of the name are treated as signed or unsigned according to <is_unsigned>.
+*/
+static u32 ext2_dx_legacy_hash(const char *name, u32 len, ku32 is_unsigned)
+{
+    u32 hash, hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+
+    for(; len--; ++name)
+    {
+        ks32 c = is_unsigned ? (s32) *((const u8 *) name) : (s32) *((const s8 *) name);
+
+        hash = hash1 + (hash0 ^ (u32) (c * 7152373));
+        if(hash & 0x80000000)
+            hash -= 0x7fffffff;
+
+        hash1 = hash0;
+        hash0 = hash;
+    }
+
+    return hash0 << 1;
+}
+
+
+/*
+    ext2_dx_str2hashbuf() - pack up to <num> * 4 characters of <msg> into the u32 array <buf>,
+    padding with a value derived from the length of the message.
+*/
+static void ext2_dx_str2hashbuf(const char *msg, u32 len, u32 *buf, s32 num, ku32 is_unsigned)
+{
+    u32 pad, val, i;
+
+    pad = len | (len << 8);
+    pad |= pad << 16;
+
+    val = pad;
+    if(len > (u32) num * 4)
+        len = num * 4;
+
+    for(i = 0; i < len; ++i)
+    {
+        ks32 c = is_unsigned ? (s32) ((const u8 *) msg)[i] : (s32) ((const s8 *) msg)[i];
+
+        val = (u32) c + (val << 8);
+        if((i & 3) == 3)
+        {
+            *buf++ = val;
+            val = pad;
+            --num;
+        }
+    }
+
+    if(--num >= 0)
+        *buf++ = val;
+
+    while(--num >= 0)
+        *buf++ = pad;
+}
+
+
+/*
+    ext2_dx_hash() - compute the directory index hash of the <len>-character name <name>, using the
+    hash function <version> (EXT2_DX_HASH_*) and the file system's hash seed.  Returns the "major"
+    hash, which is the value stored in index entries; bit 0 is always clear.
+*/
+u32 ext2_dx_hash(const ext2_fs_t *fs, ku32 version, const char *name, ku32 len)
+{
+    u32 buf[4], in[8], hash, i;
+    s32 remaining;
+
+    /* The default seed is used if the superblock's seed is all zeroes */
+    buf[0] = 0x67452301;
+    buf[1] = 0xefcdab89;
+    buf[2] = 0x98badcfe;
+    buf[3] = 0x10325476;
+
+    for(i = 0; i < 4; ++i)
+    {
+        if(fs->sblk->s_hash_seed[i])
+        {
+            for(i = 0; i < 4; ++i)
+                buf[i] = LE2N32(fs->sblk->s_hash_seed[i]);
+            break;
+        }
+    }
+
+    switch(version)
+    {
+        case EXT2_DX_HASH_LEGACY:
+        case EXT2_DX_HASH_LEGACY_UNSIGNED:
+            hash = ext2_dx_legacy_hash(name, len, version == EXT2_DX_HASH_LEGACY_UNSIGNED);
+            break;
+
+        case EXT2_DX_HASH_HALF_MD4:
+        case EXT2_DX_HASH_HALF_MD4_UNSIGNED:
+            for(remaining = len; remaining > 0; remaining -= 32, name += 32)
+            {
+                ext2_dx_str2hashbuf(name, remaining, in, 8,
+                                    version == EXT2_DX_HASH_HALF_MD4_UNSIGNED);
+                ext2_dx_half_md4_transform(buf, in);
+            }
+
+            hash = buf[1];
+            break;
+
+        case EXT2_DX_HASH_TEA:
+        case EXT2_DX_HASH_TEA_UNSIGNED:
+            for(remaining = len; remaining > 0; remaining -= 16, name += 16)
+            {
+                ext2_dx_str2hashbuf(name, remaining, in, 4, version == EXT2_DX_HASH_TEA_UNSIGNED);
+                ext2_dx_tea_transform(buf, in);
+            }
+
+            hash = buf[0];
+            break;
+
+        default:
+            hash = 0;
+            break;
+    }
+
+    hash &= ~1;
+
+    /* 0xfffffffe is reserved as an end-of-directory marker by readdir() implementations */
+    if(hash == 0xfffffffe)
+        hash = 0xfffffffc;
+
+    return hash;
+}
+
+
+/*
+    ext2_dx_search() - binary-search the <count> index entries at <entries> for the last entry whose
+    hash is less than or equal to <hash>.  The first entry has no hash and covers all hashes lower
+    than that of the second entry.
+*/
+static const ext2_dx_entry_t *ext2_dx_search(const ext2_dx_entry_t * const entries, ku32 count,
+                                             ku32 hash)
+{
+    u32 lo = 1, hi = count - 1;
+
+    while(lo <= hi)
+    {
+        ku32 mid = lo + ((hi - lo) >> 1);
+
+        if(LE2N32(entries[mid].hash) > hash)
+            hi = mid - 1;
+        else
+            lo = mid + 1;
+    }
+
+    return entries + lo - 1;
+}
+
+
+/*
+    ext2_dx_lookup() - use the hashed-tree index of the directory <inum>, whose inode is <inode>, to
+    find the leaf block(s) which may contain an entry named <name> (of length <len>).  Stores the
+    logical block numbers of up to <max_leaves> leaf blocks in <leaves>, and returns the number of
+    leaves found.  Normally this is one; more are returned if the name's hash collides with entries
+    which spill over into subsequent leaves.  Returns -ENOSYS if the directory has no usable index,
+    in which case the caller should search the directory linearly.
+*/
+s32 ext2_dx_lookup(vfs_t *vfs, ku32 inum, const ext2_inode_t *inode, const char *name, ku32 len,
+                   u32 *leaves, ku32 max_leaves)
+{
+    const ext2_fs_t * const fs = (const ext2_fs_t *) vfs->data;
+    const ext2_dx_root_info_t *info;
+    const ext2_dx_entry_t *entries, *at;
+    const ext2_dx_countlimit_t *cl;
+    u32 version, hash, levels, level, count, next_hash = 0, next_valid = 0, nleaves;
+    u8 *buf;
+    s32 ret;
+
+    if(!(LE2N32(fs->sblk->s_feature_compat) & EXT2_FEATURE_COMPAT_DIR_INDEX)
+       || !(LE2N32(inode->i_flags) & EXT2_INDEX_FL) || !max_leaves)
+        return -ENOSYS;
+
+    buf = (u8 *) kmalloc(fs->block_size);
+    if(buf == NULL)
+        return -ENOMEM;
+
+    /* Read and validate the root of the index, which lives in the directory's first block */
+    ret = ext2_read_file_block(vfs, inum, inode, 0, buf);
+    if(ret != SUCCESS)
+        goto done;
+
+    info = (const ext2_dx_root_info_t *) (buf + EXT2_DX_ROOT_INFO_OFFSET);
+    version = info->hash_version;
+    levels = info->indirect_levels;
+
+    if((version > EXT2_DX_HASH_TEA) || (info->unused_flags & 1) || (levels > EXT2_DX_MAX_LEVELS)
+       || (info->info_length < sizeof(ext2_dx_root_info_t))
+       || (EXT2_DX_ROOT_INFO_OFFSET + info->info_length + sizeof(ext2_dx_entry_t)
+                > fs->block_size))
+    {
+        ret = -ENOSYS;
+        goto done;
+    }
+
+    if(LE2N32(fs->sblk->s_flags) & EXT2_FLAGS_UNSIGNED_HASH)
+        version += EXT2_DX_HASH_LEGACY_UNSIGNED;
+
+    hash = ext2_dx_hash(fs, version, name, len);
+
+    entries = (const ext2_dx_entry_t *) ((const u8 *) info + info->info_length);
+
+    for(level = 0;; ++level)
+    {
+        ku32 max_count = (fs->block_size - ((const u8 *) entries - buf)) / sizeof(ext2_dx_entry_t);
+
+        cl = (const ext2_dx_countlimit_t *) entries;
+        count = LE2N16(cl->count);
+
+        if(!count || (count > LE2N16(cl->limit)) || (LE2N16(cl->limit) != max_count))
+        {
+            ret = -ENOSYS;
+            goto done;
+        }
+
+        at = ext2_dx_search(entries, count, hash);
+
+        if(level == levels)
+            break;
+
+        /* Remember the lowest hash covered by the following subtree, to detect collisions which
+           span the boundary between two index nodes */
+        if(at + 1 < entries + count)
+        {
+            next_hash = LE2N32(at[1].hash);
+            next_valid = 1;
+        }
+
+        /* Descend into the interior node */
+        ret = ext2_read_file_block(vfs, inum, inode, LE2N32(at->block) & EXT2_DX_BLOCK_MASK, buf);
+        if(ret != SUCCESS)
+        {
+            if(ret == -ENODATA)
+                ret = -ENOSYS;
+            goto done;
+        }
+
+        entries = (const ext2_dx_entry_t *) (buf + EXT2_DX_NODE_OFFSET);
+    }
+
+    leaves[0] = LE2N32(at->block) & EXT2_DX_BLOCK_MASK;
+    nleaves = 1;
+
+    /* If the following entries have the collision bit set and the same hash, the name may be in
+       one of their leaves instead */
+    for(++at; (at < entries + count) && ((LE2N32(at->hash) & ~1) == hash); ++at)
+    {
+        if(nleaves == max_leaves)
+        {
+            ret = -ENOSYS;
+            goto done;
+        }
+
+        leaves[nleaves++] = LE2N32(at->block) & EXT2_DX_BLOCK_MASK;
+    }
+
+    /* A run of colliding hashes may continue into the next index node; fall back to a linear
+       search in this (very unlikely) case */
+    if((at == entries + count) && next_valid && ((next_hash & ~1) == hash))
+        ret = -ENOSYS;
+    else
+        ret = nleaves;
+
+done:
+    kfree(buf);
+    return ret;
+}
+
+#endif /* WITH_FS_EXT2 */
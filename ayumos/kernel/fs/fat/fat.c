@@ -1,5 +1,5 @@
 /*
-    FAT16 file system support
+    FAT16/FAT32 file system support
 
     Part of ayumos
 
@@ -21,6 +21,8 @@
 #include <kernel/include/byteorder.h>
 #include <kernel/include/defs.h>
 #include <kernel/include/error.h>
+#include <kernel/include/list.h>
+#include <kernel/include/semaphore.h>
 #include <kernel/include/types.h>
 #include <kernel/util/kutil.h>
 #include <klibc/include/strings.h>
@@ -53,6 +55,64 @@ struct fat_bpb_block
 } __attribute__((packed));  /* 512 bytes */
 
 
+/*
+    FAT32 boot sector.  The fields up to and including large_sectors are shared with FAT12/FAT16.
+*/
+struct fat32_bpb_block
+{
+    u8  jmp[3];
+    s8  oem_id[8];
+    u16 bytes_per_sector;
+    u8  sectors_per_cluster;
+    u16 reserved_sectors;
+    u8  fats;
+    u16 root_entry_count;       /* Always zero in FAT32 */
+    u16 sectors_in_volume;
+    u8  media_descriptor_type;
+    u16 sectors_per_fat;        /* Always zero in FAT32 */
+    u16 sectors_per_track;
+    u16 heads;
+    u32 hidden_sectors;
+    u32 large_sectors;
+    u32 sectors_per_fat32;
+    u16 ext_flags;
+    u16 fs_version;
+    u32 root_cluster;
+    u16 fsinfo_sector;
+    u16 backup_boot_sector;
+    u8  reserved[12];
+    u8  drive_number;
+    u8  winnt_flags;
+    u8  signature;
+    u32 volume_serial_number;
+    s8  volume_label[11];
+    s8  system_identifier[8];
+    u8  boot_code[420];
+    u16 partition_signature;
+} __attribute__((packed));  /* 512 bytes */
+
+
+/*
+    FAT32 FSInfo sector.  This holds hints for the number of free clusters and the location of the
+    next free cluster, so that they need not be found by scanning the FAT.
+*/
+struct fat32_fsinfo
+{
+    u32 lead_sig;
+    u8  reserved1[480];
+    u32 struct_sig;
+    u32 free_count;             /* FAT32_FREE_UNKNOWN if unknown */
+    u32 next_free;              /* FAT32_FREE_UNKNOWN if unknown */
+    u8  reserved2[12];
+    u32 trail_sig;
+} __attribute__((packed));  /* 512 bytes */
+
+#define FAT32_FSINFO_LEAD_SIG       (0x41615252)
+#define FAT32_FSINFO_STRUCT_SIG     (0x61417272)
+#define FAT32_FSINFO_TRAIL_SIG      (0xaa550000)
+#define FAT32_FREE_UNKNOWN          (0xffffffff)
+
+
 /*
     FAT directory entry
 */
@@ -101,6 +161,53 @@ struct fat_lfn_node
 typedef struct fat_lfn_node fat_lfn_node_t;
 
 
+/*
+    Cluster-chain extent cache.  Each map describes the cluster chain of one file, identified by its
+    first cluster, as an array of runs of contiguous clusters sorted by position in the file.  Maps
+    are populated lazily: the chain is followed only as far as the furthest cluster requested so
+    far.  Finding the cluster at a given position in a file is then a binary search of the runs,
+    rather than a walk along the chain, and a run of contiguous clusters can be transferred with a
+    single multi-block request.  A map is invalidated when its chain is modified.
+
+    The run array of a map is allocated when the map is first extended, and doubled in size
+    whenever it fills up; it is kept when the map is recycled.  Only if the array cannot be grown is
+    the chain walked from the end of the map.
+*/
+#define FAT_EXTENT_CACHE_FILES      (8)     /* Number of files whose chains are mapped          */
+#define FAT_EXTENT_INITIAL_RUNS     (32)    /* Initial size of the run array of each map        */
+
+struct fat_extent
+{
+    u32 file_cluster;       /* Position of the first cluster of the run within the file */
+    u32 cluster;            /* First cluster of the run                                 */
+    u32 len;                /* Number of clusters in the run                            */
+};
+
+typedef struct fat_extent fat_extent_t;
+
+struct fat_extent_map
+{
+    list_t          lru;
+    u32             first_cluster;  /* First cluster of the file; zero if the map is unused */
+    u32             mapped;         /* Number of clusters mapped so far                     */
+    u32             next;           /* Cluster following the last mapped cluster            */
+    u32             nruns;
+    u32             maxruns;        /* Number of runs for which space is allocated          */
+    fat_extent_t    *runs;
+};
+
+typedef struct fat_extent_map fat_extent_map_t;
+
+struct fat_extent_cache
+{
+    sem_t               lock;
+    list_t              lru;        /* Maps, least-recently used first */
+    fat_extent_map_t    maps[FAT_EXTENT_CACHE_FILES];
+};
+
+typedef struct fat_extent_cache fat_extent_cache_t;
+
+
 /*
     This struct contains various useful numbers, computed at mount time.  A struct fat_fs will be
     allocated and filled in fat_mount(), and stored in vfs->data.  It is then deallocated in
@@ -113,24 +220,34 @@ struct fat_fs
     u32 first_data_sector;
     u32 first_fat_sector;
     u32 root_dir_first_sector;
-    u16 total_clusters;
-    u16 root_dir_clusters;
-    u16 sectors_per_fat;
+    u32 root_cluster;           /* FAT32 only: first cluster of the root directory    */
+    u32 total_clusters;
+    u32 sectors_per_fat;
+    u32 bytes_per_cluster;
+    u16 root_dir_clusters;      /* FAT16 only: size of the fixed root directory area  */
     u16 sectors_per_cluster;
-    u16 bytes_per_cluster;
-    u16 last_free_cluster;
+    u16 fsinfo_sector;          /* FAT32 only                                         */
+    u8 type;                    /* FAT_TYPE_FAT16 or FAT_TYPE_FAT32                   */
+    u8 fat_entry_shift;         /* log2(size of a FAT entry in bytes)                 */
+    u32 free_clusters;          /* FAT32_FREE_UNKNOWN if not yet known (FAT32 only)   */
+    u32 next_free;              /* FAT32 only: cluster at which to start searching    */
+    u8 *free_map;               /* FAT16 only: free-cluster bitmap; bit set = free    */
+    sem_t alloc_lock;           /* Serialises cluster allocation and FAT updates      */
+    fat_extent_cache_t *extents;
 };
 
 typedef struct fat_fs fat_fs_t;
-typedef u16 fat16_cluster_id;
+typedef u32 fat_cluster_id;
 
 struct fat_dir_ctx
 {
     fat_node_t *buffer;
     fat_node_t *buffer_end;
-    fat16_cluster_id cluster;
+    fat_cluster_id first_cluster;
+    fat_cluster_id cluster;
+    u32 index;                  /* Position of <cluster> in the directory, counting from zero */
     fat_node_t *de;
-    s8 is_root_dir;
+    s8 is_root_dir;             /* Non-zero if this is the fixed root directory area of FAT16 */
 };
 
 typedef struct fat_dir_ctx fat_dir_ctx_t;
@@ -140,6 +257,16 @@ typedef struct fat_dir_ctx fat_dir_ctx_t;
 
 #define FAT_FIRST_DATA_CLUSTER      (2)
 
+/* FAT variants, distinguished by the number of clusters in the volume */
+#define FAT_TYPE_FAT16              (16)
+#define FAT_TYPE_FAT32              (32)
+
+#define FAT16_MIN_CLUSTERS          (4085)          /* Fewer clusters than this means FAT12 */
+#define FAT32_MIN_CLUSTERS          (65525)
+
+/* One past the highest valid cluster ID */
+#define FAT_CLUSTER_LIMIT(fs)       ((fs)->total_clusters + FAT_FIRST_DATA_CLUSTER)
+
 /* Constants used during superblock validation */
 #define FAT_PARTITION_SIG           (0xaa55)
 #define FAT_JMP_BYTE0               (0xeb)
@@ -165,14 +292,45 @@ typedef struct fat_dir_ctx fat_dir_ctx_t;
 #define FAT_LFN_PART_NUM(order_byte) \
     (((order_byte) & FAT_LFN_ORDER_MASK) - 1)
 
-#define FAT_CHAIN_TERMINATOR        (0xfff7)
-#define FAT_CHAIN_END(x)            ((x) >= LE2N16(FAT_CHAIN_TERMINATOR))
+/*
+    FAT entry values.  fat_get_entry() converts any end-of-chain (or bad-cluster) entry into
+    FAT_CHAIN_TERMINATOR, so the rest of the driver need not distinguish between FAT16 and FAT32
+    chain terminators.
+*/
+#define FAT16_CHAIN_END_MIN         (0xfff7)
+#define FAT16_EOC                   (0xffff)
+#define FAT32_CLUSTER_MASK          (0x0fffffff)    /* FAT32 cluster IDs are 28 bits wide */
+#define FAT32_CHAIN_END_MIN         (0x0ffffff7)
+
+#define FAT_CHAIN_TERMINATOR        (0x0fffffff)
+#define FAT_CHAIN_END(x)            ((u32) (x) >= FAT32_CHAIN_END_MIN)
 
-#define FAT_CLUSTERS_PER_FAT_BLOCK  (BLOCK_SIZE / sizeof(fat16_cluster_id))
+/* Location of the FAT entry for a cluster */
+#define FAT_ENTRIES_PER_BLOCK(fs)   (BLOCK_SIZE >> (fs)->fat_entry_shift)
+#define FAT_ENTRY_SECTOR(fs, c)     ((fs)->first_fat_sector \
+                                        + ((c) >> (LOG_BLOCK_SIZE - (fs)->fat_entry_shift)))
+#define FAT_ENTRY_INDEX(fs, c)      ((c) & (FAT_ENTRIES_PER_BLOCK(fs) - 1))
+
+/* Number of FAT sectors read per request when building the free-cluster bitmap */
+#define FAT_MAP_READ_SECTORS        (16)
+
+/* Free-cluster bitmap access */
+#define FAT_CLUSTER_IS_FREE(fs, c)  ((fs)->free_map[(c) >> 3] & BIT((c) & 7))
+#define FAT_MARK_FREE(fs, c)        ((fs)->free_map[(c) >> 3] |= BIT((c) & 7))
+#define FAT_MARK_USED(fs, c)        ((fs)->free_map[(c) >> 3] &= ~BIT((c) & 7))
 
 #define FAT_DIRENT_END              (0x00)  /* End-of-directory-entries marker  */
 #define FAT_DIRENT_UNUSED           (0xe5)  /* Deleted directory entry marker   */
 
+/*
+    Location of a directory entry, as stored in fs_node_t.dir_entry: the entry's sector multiplied
+    by the number of entries per sector, plus its index within the sector.  Sector zero holds the
+    boot sector, so zero means "no directory entry".
+*/
+#define FAT_DIRENTS_PER_BLOCK       (BLOCK_SIZE / sizeof(fat_node_t))
+#define FAT_DIRENT_SECTOR(loc)      ((loc) / FAT_DIRENTS_PER_BLOCK)
+#define FAT_DIRENT_INDEX(loc)       ((loc) % FAT_DIRENTS_PER_BLOCK)
+
 /* FAT-format date/time extraction/conversion macros */
 #define FAT_YEAR_FROM_DATE(d)       ((((d) & 0xFE00) >> 9) + 1980)
 #define FAT_MONTH_FROM_DATE(d)      (((d) & 0x01E0) >> 5)
@@ -227,6 +385,42 @@ typedef struct fat_dir_ctx fat_dir_ctx_t;
     })
 
 
+/*
+    fat_get_entry() - return entry <index> of the FAT sector <sector>.  End-of-chain values are
+    converted to FAT_CHAIN_TERMINATOR.
+*/
+static inline u32 fat_get_entry(const fat_fs_t * const fs, const void * const sector, ku32 index)
+{
+    u32 val;
+
+    if(fs->type == FAT_TYPE_FAT16)
+    {
+        val = LE2N16(((const u16 *) sector)[index]);
+        return (val >= FAT16_CHAIN_END_MIN) ? FAT_CHAIN_TERMINATOR : val;
+    }
+
+    val = LE2N32(((const u32 *) sector)[index]) & FAT32_CLUSTER_MASK;
+    return (val >= FAT32_CHAIN_END_MIN) ? FAT_CHAIN_TERMINATOR : val;
+}
+
+
+/*
+    fat_set_entry() - set entry <index> of the FAT sector <sector> to <val>.  The reserved top four
+    bits of a FAT32 entry are preserved.
+*/
+static inline void fat_set_entry(const fat_fs_t * const fs, void * const sector, ku32 index,
+                                 ku32 val)
+{
+    if(fs->type == FAT_TYPE_FAT16)
+        ((u16 *) sector)[index] = N2LE16((val == FAT_CHAIN_TERMINATOR) ? FAT16_EOC : val);
+    else
+    {
+        u32 * const ent = ((u32 *) sector) + index;
+        *ent = (*ent & N2LE32(~FAT32_CLUSTER_MASK)) | N2LE32(val & FAT32_CLUSTER_MASK);
+    }
+}
+
+
 s32 fat_init();
 static s32 fat_mount(vfs_t * const vfs);
 static s32 fat_unmount(vfs_t * const vfs);
@@ -234,24 +428,46 @@ static s32 fat_get_root_node(vfs_t * const vfs, fs_node_t **node);
 static s32 fat_open_dir(vfs_t *vfs, u32 node, void **ctx);
 static s32 fat_read_dir(vfs_t *vfs, void *ctx, ks8* const name, fs_node_t *node);
 static s32 fat_close_dir(vfs_t *vfs, void *ctx);
+static s32 fat_read_dir_multi(vfs_t *vfs, void *ctx, vfs_dirent_t *buf, ku32 len);
+static s32 fat_tell_dir(vfs_t *vfs, void *ctx, u32 *pos);
+static s32 fat_seek_dir(vfs_t *vfs, void *ctx, ku32 pos);
 static s32 fat_read(vfs_t * const vfs, fs_node_t * const node, void * const buffer, u32 offset,
                     ks32 count);
 static s32 fat_write(vfs_t * const vfs, fs_node_t * const node, const void * const buffer,
                      u32 offset, ks32 count);
 static s32 fat_reallocate(vfs_t * const vfs, fs_node_t * const node, ks32 new_len);
 static s32 fat_stat(vfs_t *vfs, fs_stat_t *st);
+static s32 fat_write_node(vfs_t * const vfs, fs_node_t * const node);
 static s32 fat_read_cluster(vfs_t * const vfs, ku32 cluster, void * const buffer);
-static s32 fat_read_cluster_partial(vfs_t * const vfs, ku32 cluster, void * const buffer,
-                                    ku16 offset, ku16 count);
-static s32 fat_write_cluster(vfs_t * const vfs, ku32 cluster, const void * const buffer);
-static s32 fat_write_cluster_partial(vfs_t * const vfs, ku32 cluster, const void * const buffer,
-                                     ku16 offset, ku16 count);
+static s32 fat_read_run(vfs_t * const vfs, ku32 cluster, void * const buffer, ku32 offset,
+                        ku32 count);
+static s32 fat_write_run(vfs_t * const vfs, ku32 cluster, const void * const buffer, ku32 offset,
+                         ku32 count);
 /* static */ s32 fat_create_node(vfs_t * const vfs, ku32 parent_block, fs_node_t * const node);
-static s32 fat_get_next_cluster(vfs_t * const vfs, fat16_cluster_id cluster);
-static s32 fat_alloc_cluster(vfs_t * const vfs);
-static s32 fat_link_chain(vfs_t * const vfs, const fat16_cluster_id from,
-                          const fat16_cluster_id to);
-static s32 fat_free_chain(vfs_t * const vfs, const fat16_cluster_id cluster);
+static s32 fat_get_next_cluster(vfs_t * const vfs, fat_cluster_id cluster);
+static s32 fat_dir_next_entry(vfs_t * const vfs, fat_dir_ctx_t * const dir_ctx, ks8 * const name,
+                              s8 * const lfn, fat_node_t ** const start);
+static void fat_dir_entry_to_node(vfs_t * const vfs, const fat_node_t * const de,
+                                  fs_node_t * const node);
+static u32 fat_dir_entry_location(vfs_t * const vfs, const fat_dir_ctx_t * const dir_ctx);
+static s32 fat_dir_read_cluster(vfs_t * const vfs, fat_dir_ctx_t * const dir_ctx);
+static s32 fat_dir_next_cluster(vfs_t * const vfs, fat_dir_ctx_t * const dir_ctx);
+static s32 fat32_read_fsinfo(vfs_t * const vfs, fat_fs_t * const fs);
+static s32 fat32_write_fsinfo(vfs_t * const vfs);
+static s32 fat32_count_free(vfs_t * const vfs);
+static s32 fat32_find_free_run(vfs_t * const vfs, ku32 wanted, u32 * const len);
+static s32 fat_build_free_map(vfs_t * const vfs, fat_fs_t * const fs);
+static s32 fat_alloc_run(vfs_t * const vfs, ku32 wanted, u32 * const len);
+static s32 fat_write_run_chain(vfs_t * const vfs, ku32 first, ku32 len);
+static s32 fat_zero_run(vfs_t * const vfs, ku32 first, ku32 run_len, u32 * const len);
+static s32 fat_link_chain(vfs_t * const vfs, const fat_cluster_id from, const fat_cluster_id to);
+static s32 fat_free_chain(vfs_t * const vfs, const fat_cluster_id cluster);
+static s32 fat_extent_cache_init(fat_fs_t * const fs);
+static void fat_extent_cache_destroy(fat_fs_t * const fs);
+static s32 fat_extent_lookup(vfs_t * const vfs, ku32 first_cluster, ku32 file_cluster,
+                             u32 * const cluster);
+static s32 fat_extent_extend(vfs_t * const vfs, fat_extent_map_t * const map, ku32 file_cluster);
+static void fat_extent_invalidate(vfs_t * const vfs, ku32 cluster);
 /* static */ s32 fat_generate_basis_name(s8 * lfn, u32 tailnum, char * const basis_name);
 /* static */ u8 fat_lfn_checksum(u8 *short_name);
 
@@ -272,10 +488,14 @@ vfs_driver_t g_fat_ops =
     .open_dir       = fat_open_dir,
     .read_dir       = fat_read_dir,
     .close_dir      = fat_close_dir,
+    .read_dir_multi = fat_read_dir_multi,
+    .tell_dir       = fat_tell_dir,
+    .seek_dir       = fat_seek_dir,
     .read           = fat_read,
     .write          = fat_write,
     .reallocate     = fat_reallocate,
-    .stat           = fat_stat
+    .stat           = fat_stat,
+    .write_node     = fat_write_node
 };
 
 
@@ -291,74 +511,159 @@ s32 fat_init()
 */
 static s32 fat_mount(vfs_t * const vfs)
 {
-    struct fat_bpb_block bpb;
+    union
+    {
+        struct fat_bpb_block fat16;
+        struct fat32_bpb_block fat32;
+    } sb;
+    struct fat_bpb_block * const bpb = &sb.fat16;
     struct fat_fs *fs;
     s32 ret;
-    u32 root_dir_sectors;
+    u32 root_dir_sectors, cache_shift;
 
     /* Read first sector */
-    ret = block_read(vfs->dev, 0, &bpb);
+    ret = block_read(vfs->dev, 0, &sb);
     if(ret != SUCCESS)
         return ret;
 
     /* Validate jump entry */
-    if((bpb.jmp[0] != 0xeb) || (bpb.jmp[2] != 0x90))
+    if((bpb->jmp[0] != 0xeb) || (bpb->jmp[2] != 0x90))
     {
         printf("%s: bad FAT superblock: incorrect jump bytes: expected 0xeb 0xxx 0x90, "
-               "read 0x%02x 0x%02x 0x%02x\n", vfs->dev->name, bpb.jmp[0], bpb.jmp[1], bpb.jmp[2]);
+               "read 0x%02x 0x%02x 0x%02x\n", vfs->dev->name, bpb->jmp[0], bpb->jmp[1],
+               bpb->jmp[2]);
         return -EBADSBLK;
     }
 
     /* Validate partition signature */
-    if(LE2N16(bpb.partition_signature) != FAT_PARTITION_SIG)
+    if(LE2N16(bpb->partition_signature) != FAT_PARTITION_SIG)
     {
         printf("%s: bad FAT superblock: incorrect partition signature: expected 0x%04x, "
-               "read 0x%04x\n", vfs->dev->name, FAT_PARTITION_SIG, LE2N16(bpb.partition_signature));
+               "read 0x%04x\n", vfs->dev->name, FAT_PARTITION_SIG,
+               LE2N16(bpb->partition_signature));
         return -EBADSBLK;
     }
 
-    fs = slab_alloc(sizeof(struct fat_fs));
-    if(!fs)
-        return -ENOMEM;
-
     /* FIXME - use BLOCK_SIZE everywhere?  e.g. retire ATA_SECTOR_SIZE, etc. */
-    if(LE2N16(bpb.bytes_per_sector) != BLOCK_SIZE)
+    if(LE2N16(bpb->bytes_per_sector) != BLOCK_SIZE)
     {
         printf("%s: bad FAT sector size %d; can only handle %d-byte sectors\n",
-               vfs->dev->name, LE2N16(bpb.bytes_per_sector), BLOCK_SIZE);
-        slab_free(fs);
+               vfs->dev->name, LE2N16(bpb->bytes_per_sector), BLOCK_SIZE);
+        return -EBADSBLK;
+    }
+
+    if(!bpb->sectors_per_cluster)
+    {
+        printf("%s: bad FAT superblock: zero sectors per cluster\n", vfs->dev->name);
         return -EBADSBLK;
     }
 
+    fs = (struct fat_fs *) CHECKED_KCALLOC(1, sizeof(struct fat_fs));
+
     /* Precalculate some useful figures.  TODO: maybe some validation on these numbers? */
-    root_dir_sectors = ((LE2N16(bpb.root_entry_count) * sizeof(fat_node_t))
+    root_dir_sectors = ((LE2N16(bpb->root_entry_count) * sizeof(fat_node_t))
                         + (BLOCK_SIZE - 1)) >> LOG_BLOCK_SIZE;
 
-    fs->sectors_per_cluster     = bpb.sectors_per_cluster;
-    fs->bytes_per_cluster       = bpb.sectors_per_cluster * LE2N16(bpb.bytes_per_sector);
-    fs->sectors_per_fat         = LE2N16(bpb.sectors_per_fat);
+    fs->sectors_per_cluster     = bpb->sectors_per_cluster;
+    fs->bytes_per_cluster       = bpb->sectors_per_cluster * LE2N16(bpb->bytes_per_sector);
+    fs->sectors_per_fat         = bpb->sectors_per_fat ? LE2N16(bpb->sectors_per_fat) :
+                                  LE2N32(sb.fat32.sectors_per_fat32);
 
-    fs->first_fat_sector        = LE2N16(bpb.reserved_sectors);
+    fs->first_fat_sector        = LE2N16(bpb->reserved_sectors);
 
-    fs->first_data_sector       = LE2N16(bpb.reserved_sectors) + (bpb.fats * fs->sectors_per_fat)
+    fs->first_data_sector       = LE2N16(bpb->reserved_sectors) + (bpb->fats * fs->sectors_per_fat)
                                   + root_dir_sectors;
 
     fs->root_dir_first_sector   = fs->first_data_sector - root_dir_sectors;
 
-    fs->total_sectors           = bpb.sectors_in_volume ? LE2N16(bpb.sectors_in_volume) :
-                                  LE2N32(bpb.large_sectors);
+    fs->total_sectors           = bpb->sectors_in_volume ? LE2N16(bpb->sectors_in_volume) :
+                                  LE2N32(bpb->large_sectors);
 
-    fs->total_data_sectors      = fs->total_sectors - (LE2N16(bpb.reserved_sectors)
-                                  + (bpb.fats * fs->sectors_per_fat) + root_dir_sectors);
+    fs->total_data_sectors      = fs->total_sectors - (LE2N16(bpb->reserved_sectors)
+                                  + (bpb->fats * fs->sectors_per_fat) + root_dir_sectors);
 
     fs->total_clusters          = fs->total_data_sectors / fs->sectors_per_cluster;
 
-    fs->root_dir_clusters       = root_dir_sectors / fs->sectors_per_cluster;
+    fs->root_dir_clusters       = (root_dir_sectors + fs->sectors_per_cluster - 1)
+                                    / fs->sectors_per_cluster;
+
+    /* The FAT type is determined by the number of clusters in the volume */
+    if(fs->total_clusters < FAT16_MIN_CLUSTERS)
+    {
+        printf("%s: FAT12 file systems are not supported\n", vfs->dev->name);
+        kfree(fs);
+        return -EBADSBLK;
+    }
+    else if(fs->total_clusters < FAT32_MIN_CLUSTERS)
+    {
+        fs->type = FAT_TYPE_FAT16;
+        fs->fat_entry_shift = 1;
+    }
+    else
+    {
+        fs->type = FAT_TYPE_FAT32;
+        fs->fat_entry_shift = 2;
+        fs->root_cluster = LE2N32(sb.fat32.root_cluster) & FAT32_CLUSTER_MASK;
+        fs->fsinfo_sector = LE2N16(sb.fat32.fsinfo_sector);
+        fs->root_dir_clusters = 0;
+
+        if((fs->root_cluster < FAT_FIRST_DATA_CLUSTER)
+           || (fs->root_cluster >= FAT_CLUSTER_LIMIT(fs)))
+        {
+            printf("%s: bad FAT32 superblock: invalid root cluster %u\n", vfs->dev->name,
+                   fs->root_cluster);
+            kfree(fs);
+            return -EBADSBLK;
+        }
+    }
+
+    /*
+        Cache the device in cluster-sized blocks where possible.  Cache blocks are aligned to their
+        size, so the cache block size is limited by the alignment of the first data sector.
+    */
+    for(cache_shift = 0; (cache_shift < BC_MAX_SHIFT)
+                         && ((2U << cache_shift) <= fs->sectors_per_cluster)
+                         && !(fs->first_data_sector & ((2U << cache_shift) - 1)); ++cache_shift)
+        ;
+
+    /*
+        FAT16 volumes have a free-cluster bitmap, built by scanning the FAT.  The FAT of a FAT32
+        volume may be very large, so it is not scanned; instead the FSInfo sector supplies the free
+        cluster count and a starting point for allocation, and FAT sectors are read on demand
+        through the block cache.
+    */
+    if(fs->type == FAT_TYPE_FAT16)
+        ret = fat_build_free_map(vfs, fs);
+    else
+        ret = fat32_read_fsinfo(vfs, fs);
+
+    if(ret != SUCCESS)
+    {
+        kfree(fs);
+        return ret;
+    }
+
+    ret = fat_extent_cache_init(fs);
+    if(ret != SUCCESS)
+    {
+        kfree(fs->free_map);
+        kfree(fs);
+        return ret;
+    }
+
+    ret = block_cache_set_block_size(vfs->dev, BLOCK_SIZE << cache_shift);
+    if(ret != SUCCESS)
+    {
+        fat_extent_cache_destroy(fs);
+        kfree(fs->free_map);
+        kfree(fs);
+        return ret;
+    }
 
-    fs->last_free_cluster       = FAT_FIRST_DATA_CLUSTER;
+    sem_init(&fs->alloc_lock);
 
     vfs->data = fs;
-    vfs->root_block = FAT_ROOT_BLOCK;
+    vfs->root_block = (fs->type == FAT_TYPE_FAT32) ? fs->root_cluster : FAT_ROOT_BLOCK;
 
     return SUCCESS;
 }
@@ -371,9 +676,17 @@ static s32 fat_unmount(vfs_t * const vfs)
         - ensure no open file handles exist on this fs
         - (maybe) duplicate the main FAT into the secondary FAT, if present
     */
-    slab_free(vfs->data);
+    fat_fs_t * const fs = (fat_fs_t *) vfs->data;
 
-    return SUCCESS;
+    if(fs->type == FAT_TYPE_FAT32)
+        fat32_write_fsinfo(vfs);
+
+    sem_destroy(&fs->alloc_lock);
+    fat_extent_cache_destroy(fs);
+    kfree(fs->free_map);
+    kfree(fs);
+
+    return block_cache_set_block_size(vfs->dev, BLOCK_SIZE);
 }
 
 
@@ -386,7 +699,7 @@ static s32 fat_read_cluster(vfs_t * const vfs, ku32 cluster, void * const buffer
     u32 block;
     s32 ret;
 
-    if(cluster >= fs->total_clusters)
+    if((cluster < FAT_FIRST_DATA_CLUSTER) || (cluster >= FAT_CLUSTER_LIMIT(fs)))
         return -EINVAL;
 
     block = ((cluster - FAT_FIRST_DATA_CLUSTER) * fs->sectors_per_cluster) + fs->first_data_sector;
@@ -403,16 +716,17 @@ static s32 fat_read_cluster(vfs_t * const vfs, ku32 cluster, void * const buffer
 
 
 /*
-    fat_read_cluster_partial() - read <count> blocks, starting from block <offset>, from <cluster>
-    into <buffer>.
+    fat_read_run() - read <count> blocks into <buffer>, starting <offset> blocks from the start of
+    <cluster>.  The blocks may extend beyond <cluster>, into a run of clusters which are contiguous
+    on disk.
 */
-static s32 fat_read_cluster_partial(vfs_t * const vfs, ku32 cluster, void * const buffer,
-                                    ku16 offset, ku16 count)
+static s32 fat_read_run(vfs_t * const vfs, ku32 cluster, void * const buffer, ku32 offset,
+                        ku32 count)
 {
     const fat_fs_t * const fs = (const fat_fs_t *) vfs->data;
     u32 block;
 
-    if((cluster >= fs->total_clusters) || ((offset + count) > fs->sectors_per_cluster))
+    if((cluster < FAT_FIRST_DATA_CLUSTER) || (cluster >= FAT_CLUSTER_LIMIT(fs)))
         return -EINVAL;
 
     block = ((cluster - FAT_FIRST_DATA_CLUSTER) * fs->sectors_per_cluster)
@@ -423,88 +737,99 @@ static s32 fat_read_cluster_partial(vfs_t * const vfs, ku32 cluster, void * cons
 
 
 /*
-    fat_write_cluster() - write <buffer> into cluster <cluster>.
+    fat_write_run() - write <count> blocks of data from <buffer>, starting <offset> blocks from the
+    start of <cluster>.  The blocks may extend beyond <cluster>, into a run of clusters which are
+    contiguous on disk.
 */
-static s32 fat_write_cluster(vfs_t * const vfs, ku32 cluster, const void * const buffer)
+static s32 fat_write_run(vfs_t * const vfs, ku32 cluster, const void * const buffer, ku32 offset,
+                         ku32 count)
 {
     const fat_fs_t * const fs = (const fat_fs_t *) vfs->data;
     u32 block;
-    s32 ret;
 
-    if(cluster > fs->total_clusters)
-        return -EINVAL;
+    block = ((cluster - FAT_FIRST_DATA_CLUSTER) * fs->sectors_per_cluster)
+            + fs->first_data_sector + offset;
 
-    block = ((cluster - FAT_FIRST_DATA_CLUSTER) * fs->sectors_per_cluster) + fs->first_data_sector;
+    return block_write_multi(vfs->dev, block, count, buffer);
+}
 
-    ret = block_write_multi(vfs->dev, block, fs->sectors_per_cluster, buffer);
 
-    if(ret == fs->sectors_per_cluster)
-        return SUCCESS;
-    else if(ret < 0)
+/*
+    fat_get_next_cluster() - given a cluster, find the next cluster in the chain.  The FAT sector is
+    read through the block cache.
+*/
+static s32 fat_get_next_cluster(vfs_t * const vfs, const fat_cluster_id cluster)
+{
+    const fat_fs_t * const fs = (const fat_fs_t *) vfs->data;
+    u32 sector[BLOCK_SIZE / sizeof(u32)];
+    s32 ret;
+
+    if(FAT_CHAIN_END(cluster))
+        return cluster;     /* If cluster is an end-of-chain marker, return another EOC marker */
+
+    ret = block_read(vfs->dev, FAT_ENTRY_SECTOR(fs, cluster), sector);
+    if(ret != SUCCESS)
         return ret;
-    else
-        return -EREAD;
+
+    return fat_get_entry(fs, sector, FAT_ENTRY_INDEX(fs, cluster));
 }
 
 
 /*
-    fat_write_cluster_partial() - write <count> blocks of data from <buffer> to <cluster>, starting
-    <offset> blocks from the beginning of the cluster.
+    fat_dir_read_cluster() - read the current cluster of the directory described by <dir_ctx> into
+    the context's buffer.  The fixed root directory area of a FAT16 volume is addressed by cluster
+    numbers counting from zero at the start of the area.
 */
-static s32 fat_write_cluster_partial(vfs_t * const vfs, ku32 cluster, const void * const buffer,
-                                     ku16 offset, ku16 count)
+static s32 fat_dir_read_cluster(vfs_t * const vfs, fat_dir_ctx_t * const dir_ctx)
 {
     const fat_fs_t * const fs = (const fat_fs_t *) vfs->data;
-    u32 block;
+    s32 ret;
 
-    if((offset + count) > fs->sectors_per_cluster)
-        return -EINVAL;
+    if(!dir_ctx->is_root_dir)
+        return fat_read_cluster(vfs, dir_ctx->cluster, dir_ctx->buffer);
 
-    block = ((cluster - FAT_FIRST_DATA_CLUSTER) * fs->sectors_per_cluster)
-            + fs->first_data_sector + offset;
+    ret = block_read_multi(vfs->dev, fs->root_dir_first_sector
+                           + (dir_ctx->cluster * fs->sectors_per_cluster),
+                           fs->sectors_per_cluster, dir_ctx->buffer);
 
-    return block_write_multi(vfs->dev, block, count, buffer);
+    if(ret == fs->sectors_per_cluster)
+        return SUCCESS;
+    else if(ret < 0)
+        return ret;
+    else
+        return -EREAD;
 }
 
 
 /*
-    fat_get_next_cluster() - given a cluster, find the next cluster in the chain.
+    fat_dir_next_cluster() - advance the directory described by <dir_ctx> to its next cluster.  The
+    new cluster number, which may be an end-of-chain marker, is stored in dir_ctx->cluster.
 */
-static s32 fat_get_next_cluster(vfs_t * const vfs, const fat16_cluster_id cluster)
+static s32 fat_dir_next_cluster(vfs_t * const vfs, fat_dir_ctx_t * const dir_ctx)
 {
     const fat_fs_t * const fs = (const fat_fs_t *) vfs->data;
-    fat16_cluster_id sector[BLOCK_SIZE / sizeof(fat16_cluster_id)];
-    u32 fat_offset, fat_sector, ent_offset;
     s32 ret;
 
-    if((cluster - FAT_ROOT_BLOCK) < fs->root_dir_clusters)
+    if(dir_ctx->is_root_dir)
     {
         /*
-            This node is within the root directory area.  The next node is node+1, unless we have
-            reached the end of the root dir nodes.
+            This cluster is within the root directory area.  The next cluster is cluster+1, unless
+            we have reached the end of the root directory area.
         */
-        return ((cluster + 1 - FAT_ROOT_BLOCK) < fs->root_dir_clusters) ?
-                    cluster + 1 : N2LE16(FAT_CHAIN_TERMINATOR);
+        dir_ctx->cluster = ((dir_ctx->cluster + 1) < fs->root_dir_clusters) ?
+                                dir_ctx->cluster + 1 : FAT_CHAIN_TERMINATOR;
+        ++dir_ctx->index;
+        return SUCCESS;
     }
 
-    if(FAT_CHAIN_END(cluster))
-        return cluster;     /* If cluster is an end-of-chain marker, return another EOC marker */
-
-    /* Compute offset from start of FAT, in bytes, of the specified node */
-    fat_offset = cluster * sizeof(fat16_cluster_id);
-
-    /* Determine which sector contains the bytes specified by fat_offset */
-    fat_sector = fs->first_fat_sector + (fat_offset >> LOG_BLOCK_SIZE);
-
-    /* Calculate the offset into the sector */
-    ent_offset = (fat_offset & (BLOCK_SIZE - 1)) >> 1;
-
-    /* Read sector */
-    ret = block_read(vfs->dev, fat_sector, sector);
-    if(ret != SUCCESS)
+    ret = fat_get_next_cluster(vfs, dir_ctx->cluster);
+    if(ret < 0)
         return ret;
 
-    return LE2N16(sector[ent_offset]);
+    dir_ctx->cluster = ret;
+    ++dir_ctx->index;
+
+    return SUCCESS;
 }
 
 
@@ -540,7 +865,7 @@ static s32 fat_get_root_node(vfs_t * const vfs, fs_node_t **node)
     root_node->type = FSNODE_TYPE_DIR;
     root_node->permissions = FS_PERM_UGORWX;
     root_node->size = fs->root_dir_clusters * fs->bytes_per_cluster;
-    root_node->first_block = FAT_ROOT_BLOCK;
+    root_node->first_block = vfs->root_block;
 
     *node = root_node;
 
@@ -572,8 +897,15 @@ static s32 fat_open_dir(vfs_t *vfs, u32 block, void **ctx)
         return -ENOMEM;
     }
 
+    dir_ctx->buffer_end = ((void *) dir_ctx->buffer) + bytes_per_cluster;
+    dir_ctx->first_cluster = block;
+    dir_ctx->cluster = block;
+    dir_ctx->index = 0;
+    dir_ctx->de = dir_ctx->buffer;   /* Point de (addr of current node) at start of node buffer */
+    dir_ctx->is_root_dir = (fs->type == FAT_TYPE_FAT16) && (block == FAT_ROOT_BLOCK);
+
     /* Read the cluster into dir_ctx->buffer */
-    ret = fat_read_cluster(vfs, block, dir_ctx->buffer);
+    ret = fat_dir_read_cluster(vfs, dir_ctx);
     if(ret != SUCCESS)
     {
         kfree(dir_ctx->buffer);
@@ -581,11 +913,6 @@ static s32 fat_open_dir(vfs_t *vfs, u32 block, void **ctx)
         return ret;
     }
 
-    dir_ctx->buffer_end = ((void *) dir_ctx->buffer) + bytes_per_cluster;
-    dir_ctx->cluster = block;
-    dir_ctx->de = dir_ctx->buffer;   /* Point de (addr of current node) at start of node buffer */
-    dir_ctx->is_root_dir = (block == FAT_ROOT_BLOCK);
-
     *ctx = dir_ctx;
 
     return SUCCESS;
@@ -593,13 +920,15 @@ static s32 fat_open_dir(vfs_t *vfs, u32 block, void **ctx)
 
 
 /*
-    fat_read_dir() - if name is NULL, read the next entry from a directory and populate node with
-    its details.  If name is non-NULL, search for an entry matching name and populate the node.
+    fat_dir_next_entry() - if name is NULL, find the next entry in a directory; otherwise, find the
+    entry matching name.  On success, the entry's name is written to <lfn>, dir_ctx->de points at
+    the entry's short directory entry, and <*start> points at the first of the directory entries
+    (including any long filename parts) which make up the entry.  The caller must advance
+    dir_ctx->de past the entry once it has been consumed.
 */
-static s32 fat_read_dir(vfs_t *vfs, void *ctx, ks8 * const name, fs_node_t *node)
+static s32 fat_dir_next_entry(vfs_t * const vfs, fat_dir_ctx_t * const dir_ctx, ks8 * const name,
+                              s8 * const lfn, fat_node_t ** const start)
 {
-    fat_dir_ctx_t *dir_ctx = (fat_dir_ctx_t *) ctx;
-    s8 lfn[FAT_LFN_MAX_LEN + 1];
     s32 lfn_len, ret;
 
     while(!FAT_CHAIN_END(dir_ctx->cluster))
@@ -618,6 +947,9 @@ static s32 fat_read_dir(vfs_t *vfs, void *ctx, ks8 * const name, fs_node_t *node
                 u16 chars[FAT_LFN_PART_TOTAL_LEN];
                 s32 i, j, offset;
 
+                if(!lfn_len)
+                    *start = dir_ctx->de;
+
                 offset = FAT_LFN_PART_NUM(lde->order) * FAT_LFN_PART_TOTAL_LEN;
 
                 /* Extract this part of the long filename into the "chars" buffer */
@@ -653,15 +985,19 @@ static s32 fat_read_dir(vfs_t *vfs, void *ctx, ks8 * const name, fs_node_t *node
                     */
                     s32 len;
 
+                    *start = dir_ctx->de;
+
+                    strn_trim_cpy(lfn, dir_ctx->de->file_name, FAT_FILENAME_LEN);
+
                     /*
                         If the first byte of the name is 0x05, we substitute 0xe5 (which is normally
                         used to indicate an unused/deleted entry), because 0xe5 is a valid char and
-                        is otherwise unrepresentable as the first char of a file name.
+                        is otherwise unrepresentable as the first char of a file name.  The entry
+                        itself is left untouched, because it may be read again.
                     */
-                    if(dir_ctx->de->file_name[0] == 0x05)
-                        dir_ctx->de->file_name[0] = 0xe5;
+                    if(lfn[0] == 0x05)
+                        lfn[0] = 0xe5;
 
-                    strn_trim_cpy(lfn, dir_ctx->de->file_name, FAT_FILENAME_LEN);
                     len = strlen(lfn);
 
                     lfn[len++] = '.';
@@ -681,82 +1017,29 @@ static s32 fat_read_dir(vfs_t *vfs, void *ctx, ks8 * const name, fs_node_t *node
 
                 /*
                     At this point we have a complete directory entry, with a filename in lfn.  If
-                    the "name" arg is NULL, populate a node and return it; otherwise, compare the
-                    entry's name with "name" (case-insensitive, because FAT) and return a node if
-                    there is a match.  If there is no match, continue searching the directory.
+                    the "name" arg is NULL, return the entry; otherwise, compare the entry's name
+                    with "name" (case-insensitive, because FAT) and return the entry if there is a
+                    match.  If there is no match, continue searching the directory.
                 */
                 if((name == NULL) || !strcasecmp(name, lfn))
-                {
-                    /*
-                        Populate the supplied node structure.  If node is NULL, the caller was
-                        checking whether or not the node exists, and doesn't care about any details
-                        beyond that.
-                    */
-                    if(node != NULL)
-                    {
-                        ku16 attribs = dir_ctx->de->attribs;
-                        u16 flags = 0;
-
-                        node->atime = FAT_DATETIME_TO_TIMESTAMP(LE2N16(dir_ctx->de->adate), 0);
-                        node->ctime = FAT_DATETIME_TO_TIMESTAMP(LE2N16(dir_ctx->de->cdate),
-                                                                    LE2N16(dir_ctx->de->ctime));
-                        node->mtime = FAT_DATETIME_TO_TIMESTAMP(LE2N16(dir_ctx->de->mdate),
-                                                                    LE2N16(dir_ctx->de->mtime));
-
-                        node->first_block = (LE2N16(dir_ctx->de->first_cluster_high) << 16)
-                                                | LE2N16(dir_ctx->de->first_cluster_low);
-
-                        node->type = (attribs & FAT_FILEATTRIB_DIRECTORY) ?
-                                            FSNODE_TYPE_DIR : FSNODE_TYPE_FILE;
-
-                        if(attribs & FAT_FILEATTRIB_HIDDEN)
-                            flags |= FS_FLAG_HIDDEN;
-                        if(attribs & FAT_FILEATTRIB_SYSTEM)
-                            flags |= FS_FLAG_SYSTEM;
-                        if(attribs & FAT_FILEATTRIB_ARCHIVE)
-                            flags |= FS_FLAG_ARCHIVE;
-
-                        node->flags = flags;
-
-                        ret = fs_node_set_name(node, lfn);
-                        if(ret != SUCCESS)
-                            return ret;
-
-                        node->size = LE2N32(dir_ctx->de->size);
-
-                        /*
-                            The FAT fs does not conform to the Unix file-permissions system, so we
-                            set some defaults here: rwxrwxrwx for writeable files, and r-xr-xr-x
-                            for read-only files.
-                        */
-                        node->permissions = (attribs & FAT_FILEATTRIB_READ_ONLY) ?
-                                                FS_PERM_UGORX : FS_PERM_UGORWX;
-
-                        /* The FAT fs has no concept of file ownership */
-                        node->gid = 0;
-                        node->uid = 0;
-                    }
-
-                    ++dir_ctx->de;
                     return SUCCESS;
-                }
             }
         }
 
         /* Reached the end of the node without finding a complete entry. */
         /* Find the next node in the chain */
-        ret = fat_get_next_cluster(vfs, dir_ctx->cluster);
-        if(ret < 0)
+        ret = fat_dir_next_cluster(vfs, dir_ctx);
+        if(ret != SUCCESS)
             return ret;
 
-        dir_ctx->cluster = ret;
-
         if(!FAT_CHAIN_END(dir_ctx->cluster))
         {
             /* Read the next cluster into dir_ctx->buffer (which was alloc'ed by fat_open_dir() */
-            ret = fat_read_cluster(vfs, dir_ctx->cluster, dir_ctx->buffer);
+            ret = fat_dir_read_cluster(vfs, dir_ctx);
             if(ret != SUCCESS)
                 return ret;
+
+            dir_ctx->de = dir_ctx->buffer;
         }
     }
 
@@ -765,181 +1048,355 @@ static s32 fat_read_dir(vfs_t *vfs, void *ctx, ks8 * const name, fs_node_t *node
 
 
 /*
-    fat_close_dir() - clean up after iterating over a directory
-*/
-static s32 fat_close_dir(vfs_t *vfs, void *ctx)
-{
-    UNUSED(vfs);
-
-    kfree(((fat_dir_ctx_t *) ctx)->buffer);
-    slab_free(ctx);
-
-    return SUCCESS;
-}
-
-
-/*
-    fat_read() - read <count> blocks, starting from <offset>, into <buffer> from the file indicated
-    by <node>.
+    fat_dir_entry_to_node() - populate <node>, except for its name, from the directory entry <de>.
 */
-static s32 fat_read(vfs_t * const vfs, fs_node_t * const node, void * const buffer, u32 offset,
-                    ks32 count)
+static void fat_dir_entry_to_node(vfs_t * const vfs, const fat_node_t * const de,
+                                  fs_node_t * const node)
 {
-    const fat_fs_t * const fs = (const fat_fs_t *) vfs->data;
-    u8 *buffer_;
-    s32 cluster, ret;
-    u32 remaining;
+    ku16 attribs = de->attribs;
+    u16 flags = 0;
 
-    if(count < 0)
-        return -EINVAL;
+    node->atime = FAT_DATETIME_TO_TIMESTAMP(LE2N16(de->adate), 0);
+    node->ctime = FAT_DATETIME_TO_TIMESTAMP(LE2N16(de->cdate), LE2N16(de->ctime));
+    node->mtime = FAT_DATETIME_TO_TIMESTAMP(LE2N16(de->mdate), LE2N16(de->mtime));
 
-    buffer_ = (u8 *) buffer;
-    cluster = node->first_block;
-    remaining = count;
+    node->first_block = LE2N16(de->first_cluster_low);
 
-    /* Find the first cluster containing the blocks to be read */
-    for(cluster = node->first_block; offset >= fs->sectors_per_cluster;
-        offset -= fs->sectors_per_cluster)
+    if(((fat_fs_t *) vfs->data)->type == FAT_TYPE_FAT32)
     {
-        cluster = fat_get_next_cluster(vfs, cluster);
-        if(cluster < 0)
-            return cluster;
+        node->first_block |= LE2N16(de->first_cluster_high) << 16;
 
-        if(FAT_CHAIN_END(cluster))
-            return -EINVAL;
+        /* A ".." entry refers to the root directory as cluster zero */
+        if(!node->first_block && (attribs & FAT_FILEATTRIB_DIRECTORY))
+            node->first_block = vfs->root_block;
     }
 
-    /* Read the appropriate part of this cluster into the buffer */
-    if(remaining < (fs->sectors_per_cluster - offset))
-        return fat_read_cluster_partial(vfs, cluster, buffer_, offset, remaining);
+    node->type = (attribs & FAT_FILEATTRIB_DIRECTORY) ? FSNODE_TYPE_DIR : FSNODE_TYPE_FILE;
 
-    ret = fat_read_cluster_partial(vfs, cluster, buffer_, offset, fs->sectors_per_cluster - offset);
-    if(ret < (s32) (fs->sectors_per_cluster - offset))
-        return ret;     /* Bail out following a short read or an error */
+    if(attribs & FAT_FILEATTRIB_HIDDEN)
+        flags |= FS_FLAG_HIDDEN;
+    if(attribs & FAT_FILEATTRIB_SYSTEM)
+        flags |= FS_FLAG_SYSTEM;
+    if(attribs & FAT_FILEATTRIB_ARCHIVE)
+        flags |= FS_FLAG_ARCHIVE;
 
-    remaining -= fs->sectors_per_cluster - offset;
-    buffer_ += BLOCK_SIZE * (fs->sectors_per_cluster - offset);
-
-    /* Copy additional clusters, as needed */
-    for(; remaining >= fs->sectors_per_cluster; remaining -= fs->sectors_per_cluster)
-    {
-        cluster = fat_get_next_cluster(vfs, cluster);
-        if(cluster < 0)
-            return cluster;
+    node->flags = flags;
 
-        if(FAT_CHAIN_END(cluster))
-            return count - remaining;           /* Partial read */
+    node->size = LE2N32(de->size);
 
-        ret = fat_read_cluster(vfs, cluster, buffer_);
-        if(ret != SUCCESS)
-            return ret;
+    /*
+        The FAT fs does not conform to the Unix file-permissions system, so we set some defaults
+        here: rwxrwxrwx for writeable files, and r-xr-xr-x for read-only files.
+    */
+    node->permissions = (attribs & FAT_FILEATTRIB_READ_ONLY) ? FS_PERM_UGORX : FS_PERM_UGORWX;
 
-        buffer_ += BLOCK_SIZE * fs->sectors_per_cluster;
-    }
+    /* The FAT fs has no concept of file ownership */
+    node->gid = 0;
+    node->uid = 0;
+}
 
-    /* Final cluster: copy the appropriate part into the buffer */
-    if(remaining)
-    {
-        cluster = fat_get_next_cluster(vfs, cluster);
-        if(cluster < 0)
-            return cluster;
 
-        if(!FAT_CHAIN_END(cluster))
-        {
-            ret = fat_read_cluster_partial(vfs, cluster, buffer_, 0, remaining);
-            if(ret < 0)
-                return ret;
+/*
+    fat_dir_entry_location() - return the location, in the form stored in fs_node_t.dir_entry, of
+    the directory entry at dir_ctx->de.
+*/
+static u32 fat_dir_entry_location(vfs_t * const vfs, const fat_dir_ctx_t * const dir_ctx)
+{
+    const fat_fs_t * const fs = (const fat_fs_t *) vfs->data;
+    ku32 index = dir_ctx->de - dir_ctx->buffer;
+    u32 sector;
 
-            return count - (remaining - ret);
-        }
-    }
+    if(dir_ctx->is_root_dir)
+        sector = fs->root_dir_first_sector + (dir_ctx->cluster * fs->sectors_per_cluster);
+    else
+        sector = ((dir_ctx->cluster - FAT_FIRST_DATA_CLUSTER) * fs->sectors_per_cluster)
+                 + fs->first_data_sector;
 
-    return count;
+    return (sector * FAT_DIRENTS_PER_BLOCK) + index;
 }
 
 
 /*
-    fat_write() - write <count> blocks from <buffer> into the file indicated by <node>.  Fail if the
-    write would run past the end of the file.
+    fat_read_dir() - if name is NULL, read the next entry from a directory and populate node with
+    its details.  If name is non-NULL, search for an entry matching name and populate the node.
 */
-static s32 fat_write(vfs_t * const vfs, fs_node_t * const node, const void * const buffer,
-                     u32 offset, ks32 count)
+static s32 fat_read_dir(vfs_t *vfs, void *ctx, ks8 * const name, fs_node_t *node)
 {
-    const fat_fs_t * const fs = (const fat_fs_t *) vfs->data;
-    u8 *buffer_;
-    u32 remaining;
-    s32 cluster, ret;
-
-    if(count < 0)
-        return -EINVAL;
+    fat_dir_ctx_t *dir_ctx = (fat_dir_ctx_t *) ctx;
+    s8 lfn[FAT_LFN_MAX_LEN + 1];
+    fat_node_t *start;
+    s32 ret;
 
-    /* Ensure that the file is long enough for the write */
-    if(((node->size + (fs->bytes_per_cluster - 1)) / fs->bytes_per_cluster) <
-       ((offset + count + fs->sectors_per_cluster - 1) / fs->sectors_per_cluster))
-        return -EINVAL;
+    ret = fat_dir_next_entry(vfs, dir_ctx, name, lfn, &start);
+    if(ret != SUCCESS)
+        return ret;
+
+    /*
+        Populate the supplied node structure.  If node is NULL, the caller was checking whether or
+        not the node exists, and doesn't care about any details beyond that.
+    */
+    if(node != NULL)
+    {
+        ret = fs_node_set_name(node, lfn);
+        if(ret != SUCCESS)
+            return ret;
+
+        fat_dir_entry_to_node(vfs, dir_ctx->de, node);
+        node->dir_entry = fat_dir_entry_location(vfs, dir_ctx);
+    }
+
+    ++dir_ctx->de;
+    return SUCCESS;
+}
 
-    buffer_ = (u8 *) buffer;
-    cluster = node->first_block;
-    remaining = count;
 
-    /* Find the first cluster containing the blocks to be written */
-    for(cluster = node->first_block; offset >= fs->sectors_per_cluster;
-        offset -= fs->sectors_per_cluster)
+/*
+    fat_read_dir_multi() - read as many directory entries as will fit into the <len>-byte buffer
+    <buf>.  Return the number of bytes used, or zero at the end of the directory.  Entries are
+    decoded straight from the directory cluster buffer; an entry which does not fit is left there,
+    to be returned by the next call.
+*/
+static s32 fat_read_dir_multi(vfs_t *vfs, void *ctx, vfs_dirent_t *buf, ku32 len)
+{
+    fat_dir_ctx_t *dir_ctx = (fat_dir_ctx_t *) ctx;
+    s8 lfn[FAT_LFN_MAX_LEN + 1];
+    vfs_dirent_t *ent = buf;
+    u32 used = 0;
+    s32 ret;
+
+    while(1)
     {
-        cluster = fat_get_next_cluster(vfs, cluster);
-        if(cluster < 0)
-            return cluster;
+        fat_node_t *start;
+        fs_node_t node;
+        u32 name_len, rec_len;
 
-        if(FAT_CHAIN_END(cluster))
-            return -EINVAL;     /* Premature end-of-chain: this indicates corruption. */
+        ret = fat_dir_next_entry(vfs, dir_ctx, NULL, lfn, &start);
+        if(ret != SUCCESS)
+            break;
+
+        name_len = MIN(strlen(lfn), (u32) NAME_MAX_LEN);
+        rec_len = VFS_DIRENT_LEN(name_len);
+
+        if(used + rec_len > len)
+        {
+            /* Rewind to the start of this entry, including any long filename parts */
+            dir_ctx->de = start;
+            ret = -EINVAL;
+            break;
+        }
+
+        fat_dir_entry_to_node(vfs, dir_ctx->de, &node);
+        ++dir_ctx->de;
+
+        ent->len = rec_len;
+        ent->type = node.type;
+        ent->name_len = name_len;
+        ent->permissions = node.permissions;
+        ent->flags = node.flags;
+        ent->size = node.size;
+        ent->mtime = node.mtime;
+        ent->first_block = node.first_block;
+        memcpy(ent->name, lfn, name_len);
+        ent->name[name_len] = '\0';
+
+        used += rec_len;
+        ent = VFS_DIRENT_NEXT(ent);
     }
 
-    /* Write the appropriate part of this cluster */
-    if(remaining < (fs->sectors_per_cluster - offset))
-        return fat_write_cluster_partial(vfs, cluster, buffer_, offset, remaining);
+    /* Report the end of the directory, or an error, only if no entries were read */
+    if(used || (ret == -ENOENT))
+        return used;
+
+    return ret;
+}
+
+
+/*
+    fat_tell_dir() - store in <*pos> the byte offset, within the directory, of the next entry to be
+    read.
+*/
+static s32 fat_tell_dir(vfs_t *vfs, void *ctx, u32 *pos)
+{
+    const fat_dir_ctx_t * const dir_ctx = (const fat_dir_ctx_t *) ctx;
+
+    *pos = (dir_ctx->index * ((const fat_fs_t *) vfs->data)->bytes_per_cluster)
+            + ((dir_ctx->de - dir_ctx->buffer) * sizeof(fat_node_t));
+
+    return SUCCESS;
+}
+
 
-    ret = fat_write_cluster_partial(vfs, cluster, buffer_, offset,
-                                    fs->sectors_per_cluster - offset);
-    if(ret < (s32) (fs->sectors_per_cluster - offset))
-        return ret;     /* Bail out following a short read or an error */
+/*
+    fat_seek_dir() - move to the entry at byte offset <pos> within the directory, as returned by
+    fat_tell_dir().  The cluster containing the offset is found through the extent cache, and read
+    unless it is already in the context's buffer.
+*/
+static s32 fat_seek_dir(vfs_t *vfs, void *ctx, ku32 pos)
+{
+    const fat_fs_t * const fs = (const fat_fs_t *) vfs->data;
+    fat_dir_ctx_t * const dir_ctx = (fat_dir_ctx_t *) ctx;
+    ku32 index = pos / fs->bytes_per_cluster, offset = pos % fs->bytes_per_cluster;
+    u32 cluster;
+    s32 ret;
 
-    remaining -= fs->sectors_per_cluster - offset;
-    buffer_ += BLOCK_SIZE * (fs->sectors_per_cluster - offset);
+    if(offset % sizeof(fat_node_t))
+        return -EINVAL;
 
-    /* Copy additional clusters, as needed */
-    for(; remaining >= fs->sectors_per_cluster;
-        remaining -= fs->sectors_per_cluster, buffer_ += BLOCK_SIZE * fs->sectors_per_cluster)
+    if(index != dir_ctx->index)
     {
-        cluster = fat_get_next_cluster(vfs, cluster);
-        if(cluster < 0)
-            return cluster;
+        if(dir_ctx->is_root_dir)
+            cluster = (index < fs->root_dir_clusters) ? index : FAT_CHAIN_TERMINATOR;
+        else
+        {
+            ret = fat_extent_lookup(vfs, dir_ctx->first_cluster, index, &cluster);
+            if(ret < 0)
+                return ret;
+            else if(!ret)
+                cluster = FAT_CHAIN_TERMINATOR;     /* Beyond the end of the directory */
+        }
 
-        if(FAT_CHAIN_END(cluster))
-            return -EINVAL;     /* Premature end-of-chain: this indicates corruption. */
+        dir_ctx->cluster = cluster;
+        dir_ctx->index = index;
+
+        if(!FAT_CHAIN_END(cluster))
+        {
+            ret = fat_dir_read_cluster(vfs, dir_ctx);
+            if(ret != SUCCESS)
+            {
+                dir_ctx->cluster = FAT_CHAIN_TERMINATOR;
+                return ret;
+            }
+        }
+    }
+
+    dir_ctx->de = dir_ctx->buffer + (offset / sizeof(fat_node_t));
+
+    return SUCCESS;
+}
+
+
+/*
+    fat_close_dir() - clean up after iterating over a directory
+*/
+static s32 fat_close_dir(vfs_t *vfs, void *ctx)
+{
+    UNUSED(vfs);
+
+    kfree(((fat_dir_ctx_t *) ctx)->buffer);
+    slab_free(ctx);
+
+    return SUCCESS;
+}
+
+
+/*
+    fat_read() - read <count> blocks, starting from <offset>, into <buffer> from the file indicated
+    by <node>.  Each run of contiguous clusters is read with a single request.
+*/
+static s32 fat_read(vfs_t * const vfs, fs_node_t * const node, void * const buffer, u32 offset,
+                    ks32 count)
+{
+    const fat_fs_t * const fs = (const fat_fs_t *) vfs->data;
+    u8 *buffer_;
+    u32 remaining;
+    s32 ret;
+
+    if(count < 0)
+        return -EINVAL;
+
+    for(buffer_ = (u8 *) buffer, remaining = count; remaining;)
+    {
+        ku32 cluster_offset = offset % fs->sectors_per_cluster;
+        u32 cluster, len;
+
+        /* Find the run of contiguous clusters containing the next block to be read */
+        ret = fat_extent_lookup(vfs, node->first_block, offset / fs->sectors_per_cluster,
+                                &cluster);
+        if(ret <= 0)
+        {
+            if(remaining < (u32) count)
+                break;                          /* Partial read */
+
+            return ret ? ret : -EINVAL;
+        }
+
+        len = MIN((ret * fs->sectors_per_cluster) - cluster_offset, remaining);
+
+        ret = fat_read_run(vfs, cluster, buffer_, cluster_offset, len);
+        if(ret < 0)
+        {
+            if(remaining < (u32) count)
+                break;
 
-        ret = fat_write_cluster(vfs, cluster, buffer_);
-        if(ret != SUCCESS)
             return ret;
+        }
+
+        buffer_ += ret * BLOCK_SIZE;
+        offset += ret;
+        remaining -= ret;
+
+        if((u32) ret < len)
+            break;                              /* Short read */
     }
 
-    /* Write the final blocks into the last cluster */
-    if(remaining)
+    return count - remaining;
+}
+
+
+/*
+    fat_write() - write <count> blocks from <buffer> into the file indicated by <node>.  Fail if the
+    write would run past the end of the file.  Each run of contiguous clusters is written with a
+    single request.
+*/
+static s32 fat_write(vfs_t * const vfs, fs_node_t * const node, const void * const buffer,
+                     u32 offset, ks32 count)
+{
+    const fat_fs_t * const fs = (const fat_fs_t *) vfs->data;
+    const u8 *buffer_;
+    u32 remaining;
+    s32 ret;
+
+    if(count < 0)
+        return -EINVAL;
+
+    /* Ensure that the file is long enough for the write */
+    if(((node->size + (fs->bytes_per_cluster - 1)) / fs->bytes_per_cluster) <
+       ((offset + count + fs->sectors_per_cluster - 1) / fs->sectors_per_cluster))
+        return -EINVAL;
+
+    for(buffer_ = (const u8 *) buffer, remaining = count; remaining;)
     {
-        cluster = fat_get_next_cluster(vfs, cluster);
-        if(cluster < 0)
-            return cluster;
+        ku32 cluster_offset = offset % fs->sectors_per_cluster;
+        u32 cluster, len;
 
-        if(FAT_CHAIN_END(cluster))
+        /* Find the run of contiguous clusters containing the next block to be written */
+        ret = fat_extent_lookup(vfs, node->first_block, offset / fs->sectors_per_cluster,
+                                &cluster);
+        if(ret < 0)
+            return ret;
+        else if(!ret)
             return -EINVAL;     /* Premature end-of-chain: this indicates corruption. */
 
-        ret = fat_write_cluster_partial(vfs, cluster, buffer_, 0, remaining);
+        len = MIN((ret * fs->sectors_per_cluster) - cluster_offset, remaining);
+
+        ret = fat_write_run(vfs, cluster, buffer_, cluster_offset, len);
         if(ret < 0)
+        {
+            if(remaining < (u32) count)
+                break;
+
             return ret;
+        }
+
+        buffer_ += ret * BLOCK_SIZE;
+        offset += ret;
+        remaining -= ret;
 
-        return count - (remaining - ret);
+        if((u32) ret < len)
+            break;                              /* Short write */
     }
 
-    return count;
+    return count - remaining;
 }
 
 
@@ -965,7 +1422,7 @@ static s32 fat_write(vfs_t * const vfs, fs_node_t * const node, const void * con
     while(!FAT_CHAIN_END(dir_ctx->cluster))
     {
         /* Read the cluster into dir_ctx->buffer (which was alloc'ed by fat_open_dir() */
-        ret = fat_read_cluster(vfs, dir_ctx->cluster, dir_ctx->buffer);
+        ret = fat_dir_read_cluster(vfs, dir_ctx);
         if(ret != SUCCESS)
             return ret;
 
@@ -1091,14 +1548,12 @@ static s32 fat_write(vfs_t * const vfs, fs_node_t * const node, const void * con
 
         /* Reached the end of the block without finding a complete entry. */
         /* Find the next block in the chain */
-        ret = fat_get_next_cluster(vfs, dir_ctx->cluster);
-        if(ret < 0)
+        ret = fat_dir_next_cluster(vfs, dir_ctx);
+        if(ret != SUCCESS)
         {
             fat_close_dir(vfs, dir_ctx);
             return ret;
         }
-
-        dir_ctx->cluster = ret;
     }
 
     fat_close_dir(vfs, dir_ctx);
@@ -1112,57 +1567,91 @@ static s32 fat_write(vfs_t * const vfs, fs_node_t * const node, const void * con
     cluster chain.  If the file is truncated, any data in detached clusters will become
     inaccessible.  If it is extended, the additional clusters will be zeroed.  If the new length of
     the file, as specified by <new_len>, does not require any clusters to be added to or removed
-    from the chain, this function becomes a no-op.
+    from the chain, this function becomes a no-op.  If the file has no clusters, a new chain is
+    allocated and its first cluster is stored in node->first_block.
 */
 static s32 fat_reallocate(vfs_t * const vfs, fs_node_t * const node, ks32 new_len)
 {
     const fat_fs_t * const fs = (const fat_fs_t *) vfs->data;
     u32 current_len_clusters, new_len_clusters;
-    s32 cluster, next_cluster, ret;
+    s32 ret;
 
     current_len_clusters = (node->size + fs->bytes_per_cluster - 1) / fs->bytes_per_cluster;
     new_len_clusters = (new_len + fs->bytes_per_cluster - 1) / fs->bytes_per_cluster;
 
     if(new_len_clusters > current_len_clusters)             /* Extend the cluster chain */
     {
-        /* Iterate to the end of the chain */
-        for(cluster = node->first_block, next_cluster = 0; !FAT_CHAIN_END(next_cluster);
-            cluster = next_cluster)
+        u32 pos, cluster, chain_len, last_cluster = 0;
+
+        if(node->first_block)
+        {
+            /*
+                Find the end of the chain, and its length.  Start from the cluster at the current
+                end of the file, but follow the chain beyond it, in case it is longer than the file.
+            */
+            for(pos = current_len_clusters ? current_len_clusters - 1 : 0;; pos += ret)
+            {
+                ret = fat_extent_lookup(vfs, node->first_block, pos, &cluster);
+                if(ret < 0)
+                    return ret;
+                else if(!ret)
+                    break;
+
+                last_cluster = cluster + ret - 1;
+            }
+
+            if(!last_cluster)
+                return -EINVAL;     /* Premature end-of-chain: this indicates corruption. */
+
+            chain_len = pos;
+            fat_extent_invalidate(vfs, node->first_block);
+        }
+        else
         {
-            next_cluster = fat_get_next_cluster(vfs, cluster);
-            if(next_cluster < 0)
-                return next_cluster;
+            /* The file has no clusters yet: allocate the first run and start a chain with it */
+            u32 len = 0;
+            ks32 new_cluster = fat_alloc_run(vfs, new_len_clusters, &len);
+            if(new_cluster < 0)
+                return new_cluster;     /* = error code */
+
+            node->first_block = new_cluster;
+            last_cluster = new_cluster + len - 1;
+            chain_len = len;
         }
 
-        /* Reached the end of the chain.  Append new clusters. */
-        for(; current_len_clusters < new_len_clusters; ++current_len_clusters)
+        /* Reached the end of the chain.  Append runs of new clusters, if the chain is too short. */
+        while(chain_len < new_len_clusters)
         {
-            s32 new_cluster = fat_alloc_cluster(vfs);
+            u32 len = 0;
+            ks32 new_cluster = fat_alloc_run(vfs, new_len_clusters - chain_len, &len);
             if(new_cluster < 0)
                 return new_cluster;     /* = error code */
 
-            ret = fat_link_chain(vfs, cluster, new_cluster);
+            ret = fat_link_chain(vfs, last_cluster, new_cluster);
             if(ret != SUCCESS)
                 return ret;
 
-            cluster = new_cluster;
+            last_cluster = new_cluster + len - 1;
+            chain_len += len;
         }
     }
     else if(new_len_clusters < current_len_clusters)        /* Truncate the cluster chain */
     {
-        /* Iterate to the cluster representing the new end of the chain */
-        for(cluster = node->first_block; new_len_clusters--; cluster = next_cluster)
-        {
-            next_cluster = fat_get_next_cluster(vfs, cluster);
-            if(next_cluster < 0)
-                return next_cluster;
+        u32 last_cluster;
 
-            if(FAT_CHAIN_END(next_cluster))
-                return -EINVAL;     /* Premature end-of-chain: this indicates corruption. */
-        }
+        /*
+            Find the cluster representing the new end of the chain.  The first cluster is retained
+            even if the file is truncated to zero length, so that the node's first block, which
+            identifies it in the node cache, does not change.
+        */
+        ret = fat_extent_lookup(vfs, node->first_block,
+                                new_len_clusters ? new_len_clusters - 1 : 0, &last_cluster);
+        if(ret < 0)
+            return ret;
+        else if(!ret)
+            return -EINVAL;     /* Premature end-of-chain: this indicates corruption. */
 
-        /* At this point: cluster represents the end of the chain */
-        return fat_free_chain(vfs, cluster);
+        return fat_free_chain(vfs, last_cluster);
     }
 
     return SUCCESS;
@@ -1170,136 +1659,787 @@ static s32 fat_reallocate(vfs_t * const vfs, fs_node_t * const node, ks32 new_le
 
 
 /*
-    fat_stat() - return information about a file.
+    fat_write_node() - write the size and first cluster of the file <node> back to its directory
+    entry.  FAT records neither the size of a directory nor anything else which the VFS may change,
+    so directories (including the root directory, which has no entry) need not be written.
 */
-static s32 fat_stat(vfs_t *vfs, fs_stat_t *st)
+static s32 fat_write_node(vfs_t * const vfs, fs_node_t * const node)
 {
-    UNUSED(vfs);
-    UNUSED(st);
+    const fat_fs_t * const fs = (const fat_fs_t *) vfs->data;
+    u32 sector[BLOCK_SIZE / sizeof(u32)];
+    fat_node_t *de;
+    s32 ret;
+
+    if(node->type == FSNODE_TYPE_DIR)
+        return SUCCESS;
+
+    if(!node->dir_entry)
+        return -EINVAL;     /* The node did not come from a directory: nowhere to write it */
+
+    ret = block_read(vfs->dev, FAT_DIRENT_SECTOR(node->dir_entry), sector);
+    if(ret != SUCCESS)
+        return ret;
+
+    de = (fat_node_t *) sector + FAT_DIRENT_INDEX(node->dir_entry);
 
-    /* TODO */
+    de->size = N2LE32(node->size);
+    de->first_cluster_low = N2LE16(node->first_block & 0xffff);
 
-    return 0;
+    if(fs->type == FAT_TYPE_FAT32)
+        de->first_cluster_high = N2LE16(node->first_block >> 16);
+
+    return block_write(vfs->dev, FAT_DIRENT_SECTOR(node->dir_entry), sector);
 }
 
 
 /*
-    fat_alloc_cluster() - find a free cluster in the FAT and mark it as allocated by setting it to
-    the end-of-chain marker.  Return the cluster ID on success, or -ENOSPC if no free clusters are
-    available.  Other errors may be returned by the calls to block_read() and block_write().
+    fat_stat() - return information about a file system.  Free space is tracked by the free-cluster
+    bitmap (FAT16) or the FSInfo free count (FAT32), so no FAT sectors need to be read, unless the
+    FSInfo sector of a FAT32 volume did not hold a valid free count.
 */
-static s32 fat_alloc_cluster(vfs_t * const vfs)
+static s32 fat_stat(vfs_t *vfs, fs_stat_t *st)
 {
-    const fat_fs_t * const fs = (const fat_fs_t *) vfs->data;
-    fat16_cluster_id sector[BLOCK_SIZE / sizeof(fat16_cluster_id)], start_block, block;
-
-    /* Calculate starting point, based on the location of the last free cluster found */
-    start_block = fs->last_free_cluster / FAT_CLUSTERS_PER_FAT_BLOCK;
+    fat_fs_t * const fs = (fat_fs_t *) vfs->data;
 
-    block = start_block;
-    do
+    if(fs->free_clusters == FAT32_FREE_UNKNOWN)
     {
-        fat16_cluster_id offset;
         s32 ret;
 
-        ret = block_read(vfs->dev, fs->first_fat_sector + block, sector);
+        sem_acquire(&fs->alloc_lock);
+        ret = (fs->free_clusters == FAT32_FREE_UNKNOWN) ? fat32_count_free(vfs) : SUCCESS;
+        sem_release(&fs->alloc_lock);
+
         if(ret != SUCCESS)
             return ret;
+    }
 
-        for(offset = 0; offset < BLOCK_SIZE / sizeof(fat16_cluster_id); ++offset)
-        {
-            if(!sector[offset])
-            {
-                const fat16_cluster_id found = (block * FAT_CLUSTERS_PER_FAT_BLOCK) + offset;
+    st->total_blocks = fs->total_clusters * fs->sectors_per_cluster;
+    st->free_blocks = fs->free_clusters * fs->sectors_per_cluster;
+    st->label = NULL;
 
-                /* Found a free cluster */
-                sector[offset] = N2LE16(FAT_CHAIN_TERMINATOR);
+    return SUCCESS;
+}
 
-                ret = block_write(vfs->dev, fs->first_fat_sector + block, sector);
-                if(ret != SUCCESS)
-                    return ret;
 
-                /* Zero the cluster */
-                ret = fat_write_cluster(vfs, found, NULL);
-                if(ret != SUCCESS)
-                    return ret;
+/*
+    fat_build_free_map() - read the FAT of a FAT16 volume and build a bitmap of free clusters, in
+    which a set bit indicates a free cluster.  Also count the free clusters.
+*/
+static s32 fat_build_free_map(vfs_t * const vfs, fat_fs_t * const fs)
+{
+    ku32 limit = FAT_CLUSTER_LIMIT(fs);
+    u16 *buf;
+    u32 cluster;
+
+    fs->free_map = (u8 *) kcalloc((limit + 7) / 8, 1);
+    if(fs->free_map == NULL)
+        return -ENOMEM;
+
+    buf = (u16 *) kmalloc(FAT_MAP_READ_SECTORS * BLOCK_SIZE);
+    if(buf == NULL)
+    {
+        kfree(fs->free_map);
+        return -ENOMEM;
+    }
+
+    fs->free_clusters = 0;
 
-                return found;
+    for(cluster = 0; cluster < limit;)
+    {
+        ku32 end = MIN(cluster + (FAT_MAP_READ_SECTORS * FAT_ENTRIES_PER_BLOCK(fs)), limit);
+        ku32 nsectors = (end - cluster + FAT_ENTRIES_PER_BLOCK(fs) - 1) / FAT_ENTRIES_PER_BLOCK(fs);
+        s32 ret;
+        u32 u;
+
+        ret = block_read_multi(vfs->dev, FAT_ENTRY_SECTOR(fs, cluster), nsectors, buf);
+        if(ret != (s32) nsectors)
+        {
+            kfree(buf);
+            kfree(fs->free_map);
+            return (ret < 0) ? ret : -EREAD;
+        }
+
+        for(u = cluster ? cluster : FAT_FIRST_DATA_CLUSTER; u < end; ++u)
+        {
+            if(!buf[u - cluster])
+            {
+                FAT_MARK_FREE(fs, u);
+                ++fs->free_clusters;
             }
         }
 
-        if(++block == fs->sectors_per_fat)
-            block = 0;
-    } while(block != start_block);
+        cluster = end;
+    }
+
+    kfree(buf);
 
-    return -ENOSPC;     /* No free nodes found */
+    return SUCCESS;
 }
 
 
 /*
-    fat_link_chain() - link cluster <from> to cluster <to> in the FAT.
+    fat32_read_fsinfo() - read the FSInfo sector of a FAT32 volume, and use it to initialise the
+    free cluster count and the allocation starting point.  If the sector is missing or invalid,
+    the free cluster count is marked as unknown; it will be computed when it is first needed.
 */
-static s32 fat_link_chain(vfs_t * const vfs, const fat16_cluster_id from, const fat16_cluster_id to)
+static s32 fat32_read_fsinfo(vfs_t * const vfs, fat_fs_t * const fs)
 {
-    const fat_fs_t * const fs = (const fat_fs_t *) vfs->data;
-    fat16_cluster_id sector[BLOCK_SIZE / sizeof(fat16_cluster_id)];
-    u32 sector_id;
+    struct fat32_fsinfo fsinfo;
     s32 ret;
 
-    /* Find the FAT sector containing the <from> cluster ID */
-    sector_id = fs->first_fat_sector + (from / FAT_CLUSTERS_PER_FAT_BLOCK);
+    fs->free_clusters = FAT32_FREE_UNKNOWN;
+    fs->next_free = FAT_FIRST_DATA_CLUSTER;
+
+    if(!fs->fsinfo_sector || (fs->fsinfo_sector >= fs->first_fat_sector))
+        return SUCCESS;
 
-    ret = block_read(vfs->dev, sector_id, sector);
+    ret = block_read(vfs->dev, fs->fsinfo_sector, &fsinfo);
     if(ret != SUCCESS)
         return ret;
 
-    sector[from % FAT_CLUSTERS_PER_FAT_BLOCK] = N2LE16(to);
+    if((LE2N32(fsinfo.lead_sig) != FAT32_FSINFO_LEAD_SIG)
+       || (LE2N32(fsinfo.struct_sig) != FAT32_FSINFO_STRUCT_SIG)
+       || (LE2N32(fsinfo.trail_sig) != FAT32_FSINFO_TRAIL_SIG))
+    {
+        printf("%s: ignoring invalid FAT32 FSInfo sector\n", vfs->dev->name);
+        fs->fsinfo_sector = 0;
+        return SUCCESS;
+    }
+
+    if(LE2N32(fsinfo.free_count) <= fs->total_clusters)
+        fs->free_clusters = LE2N32(fsinfo.free_count);
+
+    if((LE2N32(fsinfo.next_free) >= FAT_FIRST_DATA_CLUSTER)
+       && (LE2N32(fsinfo.next_free) < FAT_CLUSTER_LIMIT(fs)))
+        fs->next_free = LE2N32(fsinfo.next_free);
 
-    return block_write(vfs->dev, sector_id, sector);
+    return SUCCESS;
 }
 
 
 /*
-    fat_free_chain() - free the FAT chain starting at <cluster>.  Note that this function doesn't
-    modify any of the data stored in the chain; it just frees the cluster.
+    fat32_write_fsinfo() - write the free cluster count and allocation starting point back to the
+    FSInfo sector of a FAT32 volume.
 */
-static s32 fat_free_chain(vfs_t * const vfs, const fat16_cluster_id cluster)
+static s32 fat32_write_fsinfo(vfs_t * const vfs)
 {
     const fat_fs_t * const fs = (const fat_fs_t *) vfs->data;
-    fat16_cluster_id sector[BLOCK_SIZE / sizeof(fat16_cluster_id)], next;
-    u32 sector_id;
-    u16 offset;
+    struct fat32_fsinfo fsinfo;
     s32 ret;
-    u8 first = 0;
 
-    next = cluster;
-    do
-    {
-        /* Find the FAT sector containing <cluster> */
-        sector_id = fs->first_fat_sector + (next / FAT_CLUSTERS_PER_FAT_BLOCK);
+    if(!fs->fsinfo_sector)
+        return SUCCESS;
 
-        ret = block_read(vfs->dev, sector_id, sector);
-        if(ret != SUCCESS)
-            return ret;
+    ret = block_read(vfs->dev, fs->fsinfo_sector, &fsinfo);
+    if(ret != SUCCESS)
+        return ret;
 
-        offset = next % FAT_CLUSTERS_PER_FAT_BLOCK;
+    fsinfo.free_count = N2LE32(fs->free_clusters);
+    fsinfo.next_free = N2LE32(fs->next_free);
 
-        next = LE2N16(sector[offset]);
+    return block_write(vfs->dev, fs->fsinfo_sector, &fsinfo);
+}
 
-        if(!first)
-        {
-            sector[offset] = N2LE16(FAT_CHAIN_TERMINATOR);
-            first = 1;
-        }
-        else
-            sector[offset] = 0;
 
-        ret = block_write(vfs->dev, sector_id, sector);
+/*
+    fat32_count_free() - count the free clusters on a FAT32 volume by scanning the FAT.  This is
+    only necessary if the FSInfo sector did not supply a valid free cluster count.  Must be called
+    with fs->alloc_lock held.
+*/
+static s32 fat32_count_free(vfs_t * const vfs)
+{
+    fat_fs_t * const fs = (fat_fs_t *) vfs->data;
+    ku32 limit = FAT_CLUSTER_LIMIT(fs);
+    u32 sector[BLOCK_SIZE / sizeof(u32)], cluster, nfree = 0;
+
+    for(cluster = 0; cluster < limit;)
+    {
+        ku32 end = MIN(cluster + FAT_ENTRIES_PER_BLOCK(fs), limit);
+        ks32 ret = block_read(vfs->dev, FAT_ENTRY_SECTOR(fs, cluster), sector);
         if(ret != SUCCESS)
             return ret;
-    } while(!FAT_CHAIN_END(next));
 
-    return -ENOSYS;
+        for(cluster = cluster ? cluster : FAT_FIRST_DATA_CLUSTER; cluster < end; ++cluster)
+            if(!fat_get_entry(fs, sector, FAT_ENTRY_INDEX(fs, cluster)))
+                ++nfree;
+    }
+
+    fs->free_clusters = nfree;
+
+    return SUCCESS;
+}
+
+
+/*
+    fat32_find_free_run() - find a run of free clusters on a FAT32 volume, ideally <wanted> clusters
+    long.  The FAT is too large to map in memory, so it is searched, through the block cache, from
+    the allocation starting point; the first free run found is used, up to <wanted> clusters of it.
+    Returns the first cluster of the run and stores its length in <len>, or returns -ENOSPC.  Must
+    be called with fs->alloc_lock held.
+*/
+static s32 fat32_find_free_run(vfs_t * const vfs, ku32 wanted, u32 * const len)
+{
+    fat_fs_t * const fs = (fat_fs_t *) vfs->data;
+    ku32 limit = FAT_CLUSTER_LIMIT(fs);
+    u32 sector[BLOCK_SIZE / sizeof(u32)], sector_id = 0, c, n, start = 0, run_len = 0;
+
+    if(!fs->free_clusters)
+        return -ENOSPC;
+
+    for(c = fs->next_free, n = 0; n < fs->total_clusters; ++c, ++n)
+    {
+        if(c >= limit)
+        {
+            if(run_len)
+                break;          /* Runs do not wrap around the end of the volume */
+
+            c = FAT_FIRST_DATA_CLUSTER;
+        }
+
+        if(FAT_ENTRY_SECTOR(fs, c) != sector_id)
+        {
+            ks32 ret = block_read(vfs->dev, FAT_ENTRY_SECTOR(fs, c), sector);
+            if(ret != SUCCESS)
+                return ret;
+
+            sector_id = FAT_ENTRY_SECTOR(fs, c);
+        }
+
+        if(!fat_get_entry(fs, sector, FAT_ENTRY_INDEX(fs, c)))
+        {
+            if(!run_len++)
+                start = c;
+
+            if(run_len == wanted)
+                break;
+        }
+        else if(run_len)
+            break;
+    }
+
+    if(!run_len)
+        return -ENOSPC;
+
+    fs->next_free = start + run_len;
+    if(fs->next_free >= limit)
+        fs->next_free = FAT_FIRST_DATA_CLUSTER;
+
+    *len = run_len;
+    return start;
+}
+
+
+/*
+    fat_alloc_run() - allocate a run of contiguous free clusters, ideally <wanted> clusters long.
+    On FAT16 volumes, the smallest free run of at least <wanted> clusters is chosen; if there is
+    none, the largest free run is allocated instead.  On FAT32 volumes, the first free run after the
+    allocation starting point is used (see fat32_find_free_run()).  The clusters are linked into a
+    chain terminated by an end-of-chain marker, with a single FAT write, and zeroed with a single
+    data write.  The free-cluster search and the FAT update are serialised by fs->alloc_lock.
+    Return the first cluster of the run and store its length in <len>, or return -ENOSPC if no free
+    clusters are available.  Other errors may be returned by the block-level functions.
+*/
+static s32 fat_alloc_run(vfs_t * const vfs, ku32 wanted, u32 * const len)
+{
+    fat_fs_t * const fs = (fat_fs_t *) vfs->data;
+    u32 c, best = 0, best_len = 0, largest = 0, largest_len = 0, first, run_len;
+    s32 ret;
+
+    sem_acquire(&fs->alloc_lock);
+
+    if(fs->type == FAT_TYPE_FAT32)
+    {
+        ret = fat32_find_free_run(vfs, wanted, &run_len);
+        if(ret >= 0)
+        {
+            first = ret;
+            ret = fat_write_run_chain(vfs, first, run_len);
+            if((ret == SUCCESS) && (fs->free_clusters != FAT32_FREE_UNKNOWN))
+                fs->free_clusters -= run_len;
+        }
+
+        sem_release(&fs->alloc_lock);
+
+        if(ret != SUCCESS)
+            return ret;
+
+        return fat_zero_run(vfs, first, run_len, len);
+    }
+
+    if(!fs->free_clusters)
+    {
+        sem_release(&fs->alloc_lock);
+        return -ENOSPC;
+    }
+
+    /* Best-fit search of the free runs */
+    for(c = FAT_FIRST_DATA_CLUSTER; c < FAT_CLUSTER_LIMIT(fs);)
+    {
+        u32 start;
+
+        if(!(c & 7) && !fs->free_map[c >> 3])
+        {
+            c += 8;         /* Skip eight allocated clusters */
+            continue;
+        }
+
+        if(!FAT_CLUSTER_IS_FREE(fs, c))
+        {
+            ++c;
+            continue;
+        }
+
+        for(start = c; (c < FAT_CLUSTER_LIMIT(fs)) && FAT_CLUSTER_IS_FREE(fs, c); ++c)
+            ;
+
+        run_len = c - start;
+
+        if(run_len >= wanted)
+        {
+            if(!best_len || (run_len < best_len))
+            {
+                best = start;
+                best_len = run_len;
+
+                if(run_len == wanted)
+                    break;          /* Exact fit */
+            }
+        }
+        else if(run_len > largest_len)
+        {
+            largest = start;
+            largest_len = run_len;
+        }
+    }
+
+    if(best_len)
+    {
+        first = best;
+        run_len = wanted;
+    }
+    else
+    {
+        first = largest;
+        run_len = largest_len;
+    }
+
+    ret = fat_write_run_chain(vfs, first, run_len);
+    if(ret == SUCCESS)
+    {
+        for(c = first; c < (first + run_len); ++c)
+            FAT_MARK_USED(fs, c);
+
+        fs->free_clusters -= run_len;
+    }
+
+    sem_release(&fs->alloc_lock);
+
+    if(ret != SUCCESS)
+        return ret;
+
+    return fat_zero_run(vfs, first, run_len, len);
+}
+
+
+/*
+    fat_zero_run() - zero the <run_len> newly-allocated clusters starting at <first>, with a single
+    write.  On success, store <run_len> in <len> and return <first>.
+*/
+static s32 fat_zero_run(vfs_t * const vfs, ku32 first, ku32 run_len, u32 * const len)
+{
+    const fat_fs_t * const fs = (const fat_fs_t *) vfs->data;
+    ku32 nblocks = run_len * fs->sectors_per_cluster;
+    ks32 ret = fat_write_run(vfs, first, NULL, 0, nblocks);
+
+    if(ret == (s32) nblocks)
+    {
+        *len = run_len;
+        return first;
+    }
+
+    return (ret < 0) ? ret : -EIO;
+}
+
+
+/*
+    fat_write_run_chain() - link the <len> clusters starting at <first> into a chain, terminated by
+    an end-of-chain marker.  The FAT sectors covering the run are read and written with one request
+    each.  Must be called with fs->alloc_lock held.
+*/
+static s32 fat_write_run_chain(vfs_t * const vfs, ku32 first, ku32 len)
+{
+    const fat_fs_t * const fs = (const fat_fs_t *) vfs->data;
+    ku32 first_sector = FAT_ENTRY_SECTOR(fs, first),
+         nsectors = FAT_ENTRY_SECTOR(fs, first + len - 1) - first_sector + 1;
+    u8 *buf;
+    u32 c;
+    s32 ret;
+
+    buf = (u8 *) kmalloc(nsectors * BLOCK_SIZE);
+    if(buf == NULL)
+        return -ENOMEM;
+
+    ret = block_read_multi(vfs->dev, first_sector, nsectors, buf);
+    if(ret == (s32) nsectors)
+    {
+        ku32 base = FAT_ENTRY_INDEX(fs, first);
+
+        for(c = 0; c < (len - 1); ++c)
+            fat_set_entry(fs, buf, base + c, first + c + 1);
+
+        fat_set_entry(fs, buf, base + c, FAT_CHAIN_TERMINATOR);
+
+        ret = block_write_multi(vfs->dev, first_sector, nsectors, buf);
+    }
+
+    kfree(buf);
+
+    if(ret == (s32) nsectors)
+        return SUCCESS;
+
+    return (ret < 0) ? ret : -EIO;
+}
+
+
+/*
+    fat_link_chain() - link cluster <from> to cluster <to> in the FAT.
+*/
+static s32 fat_link_chain(vfs_t * const vfs, const fat_cluster_id from, const fat_cluster_id to)
+{
+    fat_fs_t * const fs = (fat_fs_t *) vfs->data;
+    u32 sector[BLOCK_SIZE / sizeof(u32)];
+    s32 ret;
+
+    sem_acquire(&fs->alloc_lock);
+
+    ret = block_read(vfs->dev, FAT_ENTRY_SECTOR(fs, from), sector);
+    if(ret == SUCCESS)
+    {
+        fat_set_entry(fs, sector, FAT_ENTRY_INDEX(fs, from), to);
+        ret = block_write(vfs->dev, FAT_ENTRY_SECTOR(fs, from), sector);
+    }
+
+    sem_release(&fs->alloc_lock);
+
+    return ret;
+}
+
+
+/*
+    fat_free_chain() - truncate the FAT chain at <cluster>: <cluster> becomes the end of the chain,
+    and all subsequent clusters in the chain are freed.  Note that this function doesn't modify any
+    of the data stored in the chain.  Each FAT sector is written once, after all the entries in it
+    which belong to the chain have been updated.  The FAT and the free-cluster accounting are
+    updated under fs->alloc_lock.
+*/
+static s32 fat_free_chain(vfs_t * const vfs, const fat_cluster_id cluster)
+{
+    fat_fs_t * const fs = (fat_fs_t *) vfs->data;
+    u32 sector[BLOCK_SIZE / sizeof(u32)];
+    fat_cluster_id next;
+    u32 sector_id = 0;      /* FAT sectors follow the reserved sectors, so zero is never valid */
+    s32 ret;
+    u8 first = 1;
+
+    fat_extent_invalidate(vfs, cluster);
+
+    sem_acquire(&fs->alloc_lock);
+
+    next = cluster;
+    do
+    {
+        const fat_cluster_id current = next;
+        ku32 offset = FAT_ENTRY_INDEX(fs, current);
+
+        /* Find the FAT sector containing <current>, writing back the previous sector if needed */
+        if(FAT_ENTRY_SECTOR(fs, current) != sector_id)
+        {
+            if(sector_id)
+            {
+                ret = block_write(vfs->dev, sector_id, sector);
+                if(ret != SUCCESS)
+                {
+                    sem_release(&fs->alloc_lock);
+                    return ret;
+                }
+            }
+
+            sector_id = FAT_ENTRY_SECTOR(fs, current);
+
+            ret = block_read(vfs->dev, sector_id, sector);
+            if(ret != SUCCESS)
+            {
+                sem_release(&fs->alloc_lock);
+                return ret;
+            }
+        }
+
+        next = fat_get_entry(fs, sector, offset);
+
+        if(first)
+        {
+            fat_set_entry(fs, sector, offset, FAT_CHAIN_TERMINATOR);
+            first = 0;
+        }
+        else
+        {
+            fat_set_entry(fs, sector, offset, 0);
+
+            if(fs->free_map != NULL)
+                FAT_MARK_FREE(fs, current);
+
+            if(fs->free_clusters != FAT32_FREE_UNKNOWN)
+                ++fs->free_clusters;
+        }
+    } while(!FAT_CHAIN_END(next) && (next >= FAT_FIRST_DATA_CLUSTER)
+            && (next < FAT_CLUSTER_LIMIT(fs)));
+
+    ret = block_write(vfs->dev, sector_id, sector);
+
+    sem_release(&fs->alloc_lock);
+
+    return ret;
+}
+
+
+/*
+    fat_extent_cache_init() - allocate and initialise the cluster-chain extent cache for <fs>.
+*/
+static s32 fat_extent_cache_init(fat_fs_t * const fs)
+{
+    fat_extent_cache_t *cache;
+    u32 u;
+
+    cache = (fat_extent_cache_t *) CHECKED_KCALLOC(1, sizeof(fat_extent_cache_t));
+
+    sem_init(&cache->lock);
+    list_init(&cache->lru);
+
+    for(u = 0; u < FAT_EXTENT_CACHE_FILES; ++u)
+        list_insert(&cache->maps[u].lru, &cache->lru);
+
+    fs->extents = cache;
+
+    return SUCCESS;
+}
+
+
+/*
+    fat_extent_cache_destroy() - release the cluster-chain extent cache for <fs>.
+*/
+static void fat_extent_cache_destroy(fat_fs_t * const fs)
+{
+    u32 u;
+
+    for(u = 0; u < FAT_EXTENT_CACHE_FILES; ++u)
+        kfree(fs->extents->maps[u].runs);
+
+    sem_destroy(&fs->extents->lock);
+    kfree(fs->extents);
+    fs->extents = NULL;
+}
+
+
+/*
+    fat_extent_lookup() - find the cluster at position <file_cluster> in the chain which starts at
+    <first_cluster>, and return it through <cluster>.  Returns the number of clusters in the run of
+    contiguous clusters starting at <cluster> (which is at least one), zero if the chain ends before
+    <file_cluster>, or a negative error code.
+*/
+static s32 fat_extent_lookup(vfs_t * const vfs, ku32 first_cluster, ku32 file_cluster,
+                             u32 * const cluster)
+{
+    fat_extent_cache_t * const cache = ((fat_fs_t *) vfs->data)->extents;
+    fat_extent_map_t *map;
+    s32 ret;
+
+    if(first_cluster < FAT_FIRST_DATA_CLUSTER)
+        return -EINVAL;
+
+    sem_acquire(&cache->lock);
+
+    /* Find the map for this chain, or recycle the least-recently-used map */
+    list_for_each_entry(map, &cache->lru, lru)
+        if(map->first_cluster == first_cluster)
+            break;
+
+    if(&map->lru == &cache->lru)
+    {
+        map = list_first_entry(&cache->lru, fat_extent_map_t, lru);
+        map->first_cluster = first_cluster;
+        map->mapped = 0;
+        map->next = first_cluster;
+        map->nruns = 0;
+    }
+
+    list_move_insert(&map->lru, &cache->lru);
+
+    if(file_cluster >= map->mapped)
+    {
+        ret = fat_extent_extend(vfs, map, file_cluster);
+        if(ret != SUCCESS)
+        {
+            sem_release(&cache->lock);
+            return ret;
+        }
+    }
+
+    if(file_cluster < map->mapped)
+    {
+        /* Binary search for the run containing file_cluster */
+        u32 lo = 0, hi = map->nruns - 1;
+
+        while(lo < hi)
+        {
+            ku32 mid = (lo + hi + 1) / 2;
+
+            if(map->runs[mid].file_cluster <= file_cluster)
+                lo = mid;
+            else
+                hi = mid - 1;
+        }
+
+        *cluster = map->runs[lo].cluster + (file_cluster - map->runs[lo].file_cluster);
+        ret = map->runs[lo].len - (file_cluster - map->runs[lo].file_cluster);
+    }
+    else if(FAT_CHAIN_END(map->next))
+        ret = 0;
+    else
+    {
+        /* The run array could not be grown; walk the rest of the chain from the end of the map */
+        u32 n;
+        s32 next = map->next;
+
+        for(n = map->mapped; (n < file_cluster) && !FAT_CHAIN_END(next); ++n)
+        {
+            next = fat_get_next_cluster(vfs, next);
+            if(next < 0)
+                break;
+        }
+
+        if(next < 0)
+            ret = next;
+        else if(FAT_CHAIN_END(next))
+            ret = 0;
+        else
+        {
+            *cluster = next;
+            ret = 1;
+        }
+    }
+
+    sem_release(&cache->lock);
+
+    return ret;
+}
+
+
+/*
+    fat_extent_extend() - follow the chain described by <map> until it covers position
+    <file_cluster> or the chain ends, growing the run array as necessary.  If the run array cannot
+    be grown, the map is left covering as much of the chain as it can hold.  Consecutive entries in
+    the same FAT sector are read from a single copy of the sector.  Must be called with the extent
+    cache locked.
+*/
+static s32 fat_extent_extend(vfs_t * const vfs, fat_extent_map_t * const map, ku32 file_cluster)
+{
+    const fat_fs_t * const fs = (const fat_fs_t *) vfs->data;
+    u32 sector[BLOCK_SIZE / sizeof(u32)];
+    u32 sector_id = 0;      /* FAT sectors follow the reserved sectors, so zero is never valid */
+
+    while((map->mapped <= file_cluster) && !FAT_CHAIN_END(map->next))
+    {
+        ku32 cluster = map->next;
+        fat_extent_t *run = map->nruns ? &map->runs[map->nruns - 1] : NULL;
+        u32 next;
+
+        if((run == NULL) || ((run->cluster + run->len) != cluster))
+        {
+            if(map->nruns == map->maxruns)
+            {
+                ku32 maxruns = map->maxruns ? map->maxruns * 2 : FAT_EXTENT_INITIAL_RUNS;
+                fat_extent_t * const runs =
+                    (fat_extent_t *) krealloc(map->runs, maxruns * sizeof(fat_extent_t));
+
+                if(runs == NULL)
+                    break;      /* Map is full and cannot be grown */
+
+                map->runs = runs;
+                map->maxruns = maxruns;
+            }
+
+            run = NULL;
+        }
+
+        /* Find the next cluster in the chain */
+        if(FAT_ENTRY_SECTOR(fs, cluster) != sector_id)
+        {
+            s32 ret;
+
+            sector_id = FAT_ENTRY_SECTOR(fs, cluster);
+
+            ret = block_read(vfs->dev, sector_id, sector);
+            if(ret != SUCCESS)
+                return ret;
+        }
+
+        next = fat_get_entry(fs, sector, FAT_ENTRY_INDEX(fs, cluster));
+
+        if(!FAT_CHAIN_END(next)
+           && ((next < FAT_FIRST_DATA_CLUSTER) || (next >= FAT_CLUSTER_LIMIT(fs))))
+            return -EINVAL;     /* Free or out-of-range cluster in chain: corruption */
+
+        /* Add the cluster to the map */
+        if(run != NULL)
+            ++run->len;
+        else
+        {
+            run = &map->runs[map->nruns++];
+            run->file_cluster = map->mapped;
+            run->cluster = cluster;
+            run->len = 1;
+        }
+
+        ++map->mapped;
+        map->next = next;
+    }
+
+    return SUCCESS;
+}
+
+
+/*
+    fat_extent_invalidate() - discard any extent maps which include <cluster>.  This must be called
+    whenever a cluster chain is modified.
+*/
+static void fat_extent_invalidate(vfs_t * const vfs, ku32 cluster)
+{
+    fat_extent_cache_t * const cache = ((fat_fs_t *) vfs->data)->extents;
+    fat_extent_map_t *map, *tmp;
+
+    sem_acquire(&cache->lock);
+
+    list_for_each_entry_safe(map, tmp, &cache->lru, lru)
+    {
+        u32 u;
+
+        if(!map->first_cluster)
+            continue;
+
+        for(u = 0; u < map->nruns; ++u)
+            if((cluster >= map->runs[u].cluster)
+               && (cluster < (map->runs[u].cluster + map->runs[u].len)))
+                break;
+
+        if((map->first_cluster == cluster) || (u < map->nruns) || (map->next == cluster))
+        {
+            /* Mark the map unused, and move it to the least-recently-used end of the list */
+            map->first_cluster = 0;
+            list_move_append(&map->lru, &cache->lru);
+        }
+    }
+
+    sem_release(&cache->lock);
 }
 
 
@@ -1452,13 +2592,14 @@ void fat_debug_dump_superblock(vfs_t * vfs)
            "- sectors_per_cluster = %d\n"
            "- bytes per cluster   = %d\n"
            "- sectors_per_fat     = %d\n"
+           "- FAT type            = FAT%d\n"
            "- root_dir_clusters   = %d\n"
            "- first_fat_sector    = %d\n"
            "- first_data_sector   = %d\n\n"
            "- total capacity      = %dMB\n"
            "- data capacity       = %dMB\n",
            vfs->dev->name, fs->total_sectors, fs->total_clusters, fs->total_data_sectors,
-           fs->sectors_per_cluster, fs->bytes_per_cluster, fs->sectors_per_fat,
+           fs->sectors_per_cluster, fs->bytes_per_cluster, fs->sectors_per_fat, fs->type,
            fs->root_dir_clusters, fs->first_fat_sector, fs->first_data_sector,
            (fs->total_sectors * BLOCK_SIZE) >> 20, (fs->total_data_sectors * BLOCK_SIZE) >> 20);
 }
@@ -0,0 +1,167 @@
+/*
+    Per-process file descriptor table
+
+    Part of ayumos
+
+
+    (c) Stuart Wallace <stuartw@atom.net>, October 2026.
+
+
+    A process' descriptor table is allocated when it first opens a file, or when it inherits its
+    parent's descriptors.  The table is only modified by its owning process, or by its parent before
+    the process has started running, so it needs no lock; the reference counts of the file handles
+    it refers to, which may be shared between processes, are maintained by file_handle_ref() and
+    file_close().
+*/
+
+#include <kernel/include/fs/fd.h>
+#include <kernel/include/memory/kmalloc.h>
+#include <klibc/include/strings.h>
+
+
+/*
+    fd_table_get() - return the descriptor table of process <proc>, allocating it if necessary.
+*/
+static fd_table_t *fd_table_get(proc_t * const proc)
+{
+    if(proc->files == NULL)
+    {
+        fd_table_t * const table = (fd_table_t *) kmalloc(sizeof(fd_table_t));
+        if(table == NULL)
+            return NULL;
+
+        bzero(table, sizeof(fd_table_t));
+        proc->files = table;
+    }
+
+    return proc->files;
+}
+
+
+/*
+    fd_alloc() - allocate the lowest-numbered free descriptor in process <proc>, and make it refer
+    to the file handle <fh>.  The descriptor takes over the caller's reference to the handle.
+    Returns the descriptor, or -EMFILE if the table is full.
+*/
+s32 fd_alloc(proc_t * const proc, file_handle_t * const fh)
+{
+    fd_table_t * const table = fd_table_get(proc);
+    u32 free;
+    s32 fd;
+
+    if(table == NULL)
+        return -ENOMEM;
+
+    free = ~table->used;
+    if(!free)
+        return -EMFILE;
+
+    for(fd = 0; !(free & BIT(fd)); ++fd)
+        ;
+
+    table->used |= BIT(fd);
+    table->fh[fd] = fh;
+
+    return fd;
+}
+
+
+/*
+    fd_get() - return the file handle referred to by descriptor <fd> in process <proc>, or NULL if
+    the descriptor is not open.  No reference is taken: the handle remains valid until the process
+    closes the descriptor.
+*/
+file_handle_t *fd_get(const proc_t * const proc, ks32 fd)
+{
+    return ((proc->files != NULL) && ((u32) fd < FD_MAX)) ? proc->files->fh[fd] : NULL;
+}
+
+
+/*
+    fd_close() - close descriptor <fd> in process <proc>, releasing its reference to its file
+    handle.
+*/
+s32 fd_close(proc_t * const proc, ks32 fd)
+{
+    file_handle_t * const fh = fd_get(proc, fd);
+
+    if(fh == NULL)
+        return -EBADF;
+
+    proc->files->fh[fd] = NULL;
+    proc->files->used &= ~BIT(fd);
+
+    file_close(fh);
+
+    return SUCCESS;
+}
+
+
+/*
+    fd_dup() - allocate a new descriptor in process <proc> referring to the same file handle, and
+    therefore sharing the same file offset, as descriptor <fd>.  Returns the new descriptor.
+*/
+s32 fd_dup(proc_t * const proc, ks32 fd)
+{
+    file_handle_t * const fh = fd_get(proc, fd);
+    s32 ret;
+
+    if(fh == NULL)
+        return -EBADF;
+
+    file_handle_ref(fh);
+
+    ret = fd_alloc(proc, fh);
+    if(ret < 0)
+        file_close(fh);
+
+    return ret;
+}
+
+
+/*
+    fd_table_inherit() - give the new process <proc> a copy of the descriptor table of its parent,
+    <parent>.  Each descriptor refers to the same file handle as the parent's descriptor.
+*/
+s32 fd_table_inherit(proc_t * const proc, const proc_t * const parent)
+{
+    fd_table_t *table;
+    u32 fd;
+
+    if(parent->files == NULL)
+        return SUCCESS;
+
+    table = fd_table_get(proc);
+    if(table == NULL)
+        return -ENOMEM;
+
+    *table = *parent->files;
+
+    for(fd = 0; fd < FD_MAX; ++fd)
+        if(table->fh[fd] != NULL)
+            file_handle_ref(table->fh[fd]);
+
+    return SUCCESS;
+}
+
+
+/*
+    fd_table_destroy() - close all of the descriptors of process <proc>, and free its descriptor
+    table.  Called by proc_destroy() while the process is still able to sleep, since closing a file
+    may write back its node.
+*/
+void fd_table_destroy(proc_t * const proc)
+{
+    fd_table_t * const table = proc->files;
+    u32 fd;
+
+    if(table == NULL)
+        return;
+
+    for(fd = 0; fd < FD_MAX; ++fd)
+        if(table->fh[fd] != NULL)
+            file_close(table->fh[fd]);
+
+    kfree(table);
+    proc->files = NULL;
+}
@@ -7,10 +7,18 @@
     (c) Stuart Wallace <stuartw@atom.net>, August 2015.
 */
 
+#include <kernel/include/fs/fd.h>
 #include <kernel/include/fs/file.h>
 #include <kernel/include/fs/path.h>
 #include <kernel/include/memory/slab.h>
+#include <kernel/include/preempt.h>
 #include <kernel/include/process.h>
+#include <klibc/include/stdlib.h>
+#include <klibc/include/string.h>
+#include <klibc/include/strings.h>
+
+
+extern time_t g_current_timestamp;
 
 
 /*
@@ -39,14 +47,14 @@ s32 file_open(ks8 * const path, u16 flags, file_handle_t **fh)
         /* Node already exists.  Was exclusive creation requested? */
         if(flags & O_EXCL)
         {
-            slab_free(node);
+            fs_node_put(node);
             return -EEXIST;
         }
 
         /* Ensure that the node doesn't represent a directory */
         if(node->type == FSNODE_TYPE_DIR)
         {
-            slab_free(node);
+            fs_node_put(node);
             return -EISDIR;
         }
 
@@ -54,7 +62,7 @@ s32 file_open(ks8 * const path, u16 flags, file_handle_t **fh)
         ret = fs_node_check_perms(perm_needed, node);
         if(ret != SUCCESS)
         {
-            slab_free(node);
+            fs_node_put(node);
             return ret;
         }
     }
@@ -63,12 +71,9 @@ s32 file_open(ks8 * const path, u16 flags, file_handle_t **fh)
         /* File does not exist.  Was creation requested? */
         if(flags & O_CREATE)
         {
-            ret = file_create(path, proc_current_default_perm(), &node);
+            ret = file_create(path, proc_current_default_perm(), &vfs, &node);
             if(ret != SUCCESS)
-            {
-                slab_free(node);
                 return ret;
-            }
         }
         else
             return -ENOENT;     /* File does not exist */
@@ -79,7 +84,7 @@ s32 file_open(ks8 * const path, u16 flags, file_handle_t **fh)
     fh_new = slab_alloc(sizeof(file_handle_t));
     if(fh_new == NULL)
     {
-        slab_free(node);
+        fs_node_put(node);
         return -ENOMEM;
     }
 
@@ -87,6 +92,8 @@ s32 file_open(ks8 * const path, u16 flags, file_handle_t **fh)
     fh_new->node = node;
     fh_new->flags = flags;
     fh_new->offset = 0;
+    fh_new->refcount = 1;
+    fh_new->pid = proc_get_pid();
 
     *fh = fh_new;
 
@@ -95,26 +102,114 @@ s32 file_open(ks8 * const path, u16 flags, file_handle_t **fh)
 
 
 /*
-    file_create() - create a new file at path.
+    file_create() - create a new, empty file at the absolute path <path>, with permissions <perm>,
+    owned by the current user.  The caller must have write and execute permission on the directory
+    in which the file is created.  On success, the file's VFS and node are returned through <*vfs>
+    and <*node>; the node must be released with fs_node_put().
 */
-s32 file_create(ks8 * const path, file_perm_t perm, fs_node_t **node)
+s32 file_create(ks8 * const path, file_perm_t perm, vfs_t **vfs, fs_node_t **node)
 {
-    UNUSED(path);
-    UNUSED(perm);
-    UNUSED(node);
+    char *dir_path, *name;
+    vfs_t *vfs_;
+    fs_node_t *parent, *new_node;
+    s32 ret;
+
+    if(!path_is_absolute(path))
+        return -EINVAL;
+
+    dir_path = strdup(path);
+    if(dir_path == NULL)
+        return -ENOMEM;
+
+    /* Split the path into the parent directory's path and the new file's name */
+    path_canonicalise(dir_path);
+    name = strrchr(dir_path, DIR_SEPARATOR);
+    if((name == NULL) || !name[1])
+    {
+        kfree(dir_path);
+        return -EINVAL;
+    }
+
+    *name++ = '\0';
+
+    vfs_ = NULL;
+    if(dir_path[0])
+        ret = path_open(dir_path, &vfs_, &parent);
+    else
+        ret = vfs_get_child_node(NULL, NULL, &vfs_, &parent);     /* File is in the root dir */
+
+    if(ret != SUCCESS)
+    {
+        kfree(dir_path);
+        return ret;
+    }
+
+    ret = (parent->type == FSNODE_TYPE_DIR) ? fs_node_check_perms(FS_PERM_W | FS_PERM_X, parent)
+                                            : -ENOTDIR;
+    if(ret == SUCCESS)
+        ret = fs_node_alloc(&new_node);
+
+    if(ret == SUCCESS)
+    {
+        bzero(new_node, sizeof(fs_node_t));
 
-    /* TODO - a whole world of TODO, right here. */
+        ret = fs_node_set_name(new_node, name);
+        if(ret == SUCCESS)
+        {
+            new_node->type = FSNODE_TYPE_FILE;
+            new_node->uid = proc_current_uid();
+            new_node->gid = proc_current_gid();
+            new_node->permissions = perm;
+            new_node->ctime = g_current_timestamp;
+            new_node->mtime = new_node->ctime;
+            new_node->atime = new_node->ctime;
+
+            ret = vfs_create_node(vfs_, parent, new_node);
+        }
+
+        if(ret == SUCCESS)
+            ret = fs_node_get(vfs_, new_node, node);
+        else
+            fs_node_free(new_node);
+    }
+
+    fs_node_put(parent);
+    kfree(dir_path);
 
-    return -ENOSYS;
+    if(ret == SUCCESS)
+        *vfs = vfs_;
+
+    return ret;
 }
 
 
 /*
-    file_handle_free() - release resources associated with a file handle.
+    file_handle_ref() - take an additional reference to a file handle obtained from file_open().
+*/
+void file_handle_ref(file_handle_t * const fh)
+{
+    preempt_disable();
+    ++fh->refcount;
+    preempt_enable();
+}
+
+
+/*
+    file_close() - release a reference to a file handle.  When the last reference is released, the
+    handle's node is released and the handle is freed.
 */
 void file_close(file_handle_t *fh)
 {
-    slab_free(fh->node);
+    u16 refcount;
+
+    preempt_disable();
+    refcount = --fh->refcount;
+    preempt_enable();
+
+    if(refcount)
+        return;
+
+    fs_node_put(fh->node);
     slab_free(fh);
 }
 
@@ -159,33 +254,124 @@ s32 file_write(file_handle_t *fh, const void *buffer, size_t count)
 */
 s32 syscall_open(const char * const path, u16 mode)
 {
-    UNUSED(path);
-    UNUSED(mode);
+    file_handle_t *fh;
+    s32 ret;
+
+    ret = file_open(path, mode, &fh);
+    if(ret != SUCCESS)
+        return ret;
 
-    return -ENOSYS;
+    ret = fd_alloc(proc_current(), fh);
+    if(ret < 0)
+        file_close(fh);
+
+    return ret;
 }
 
 
 /*
     syscall_create() - attempt to create a file at <path>, taking into account the options specified
-    in <mode>.  Return a file descriptor number, or an error code.
+    in <mode>.  The file is opened for writing, and must not already exist.  Return a file
+    descriptor number, or an error code.
 */
-s32 syscall_create(const char * const path, u16 mode)
+s32 syscall_create(const char * const path, ku16 mode)
 {
-    UNUSED(path);
-    UNUSED(mode);
+    return syscall_open(path, mode | O_WR | O_CREATE | O_EXCL);
+}
+
 
-    return -ENOSYS;
+/*
+    syscall_close() - close the file descriptor <fd>.
+*/
+s32 syscall_close(ks32 fd)
+{
+    return fd_close(proc_current(), fd);
 }
 
 
 /*
-    syscall_close() - close the file descriptor <filenum>.
+    syscall_read() - read up to <count> bytes from the file descriptor <fd> into <buffer>.  Return
+    the number of bytes read, or an error code.
 */
-s32 syscall_close(const s32 filenum)
+s32 syscall_read(ks32 fd, void *buffer, size_t count)
 {
-    UNUSED(filenum);
+    file_handle_t * const fh = fd_get(proc_current(), fd);
+
+    if((fh == NULL) || !(fh->flags & O_RD))
+        return -EBADF;
 
-    return -ENOSYS;
+    return file_read(fh, buffer, count);
 }
 
+
+/*
+    syscall_write() - write <count> bytes from <buffer> to the file descriptor <fd>.  Return the
+    number of bytes written, or an error code.
+*/
+s32 syscall_write(ks32 fd, const void *buffer, size_t count)
+{
+    file_handle_t * const fh = fd_get(proc_current(), fd);
+
+    if((fh == NULL) || !(fh->flags & O_WR))
+        return -EBADF;
+
+    return file_write(fh, buffer, count);
+}
+
+
+/*
+    syscall_dup() - allocate a new file descriptor referring to the same open file as <fd>.  Return
+    the new descriptor, or an error code.
+*/
+s32 syscall_dup(ks32 fd)
+{
+    return fd_dup(proc_current(), fd);
+}
+
+
+/*
+    syscall_read_dir() - read entries from the directory at <path> into the <len>-byte buffer <buf>,
+    as a sequence of vfs_dirent_t records, starting at the position <*pos>.  Return the number of
+    bytes used, zero if there are no more entries, or an error code.  There are no directory
+    handles, so a caller which needs more than one call to read a directory passes zero in <*pos>
+    on the first call; each call stores in <*pos> the position of the next entry, from which the
+    following call resumes.  The position is opaque; see vfs_tell_dir().
+*/
+s32 syscall_read_dir(const char * const path, vfs_dirent_t * const buf, ku32 len, u32 * const pos)
+{
+    vfs_t *vfs;
+    fs_node_t *node;
+    vfs_dir_ctx_t *ctx;
+    s32 ret;
+
+    if(!path_is_absolute(path) || (buf == NULL) || (pos == NULL))
+        return -EINVAL;
+
+    ret = path_open(path, &vfs, &node);
+    if(ret != SUCCESS)
+        return ret;
+
+    ret = fs_node_check_perms(FS_PERM_R, node);
+    if(ret == SUCCESS)
+        ret = vfs_open_dir(vfs, node, &ctx);
+
+    if(ret == SUCCESS)
+    {
+        ret = vfs_seek_dir(ctx, *pos);
+        if(ret == SUCCESS)
+            ret = vfs_read_dir_multi(ctx, buf, len);
+
+        if(ret >= 0)
+        {
+            ks32 ret_tell = vfs_tell_dir(ctx, pos);
+            if(ret_tell != SUCCESS)
+                ret = ret_tell;
+        }
+
+        vfs_close_dir(ctx);
+    }
+
+    fs_node_put(node);
+
+    return ret;
+}
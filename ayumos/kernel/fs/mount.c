@@ -8,6 +8,7 @@
 */
 
 #include <kernel/include/defs.h>
+#include <kernel/include/fs/dcache.h>
 #include <kernel/include/fs/mount.h>
 #include <kernel/include/fs/vfs.h>
 #include <kernel/include/lock.h>
@@ -28,7 +29,10 @@ s32 mount_init()
 
 /*
     mount_add() - mount the file system specified by <driver> and <dev> at the location specified by
-    <host_vfs>:<host_node>.
+    <host_vfs>:<host_node>.  The mount holds a reference to <host_node>, which must have been
+    obtained from the node cache; this keeps the node cached, so that subsequent lookups return the
+    same node and can be matched against the mount table by mount_find().  <dev> may be NULL if the
+    file system needs no device (e.g. tmpfs).
 */
 s32 mount_add(vfs_t * const host_vfs, fs_node_t * const host_node, vfs_driver_t * const driver,
               dev_t * const dev)
@@ -46,7 +50,7 @@ s32 mount_add(vfs_t * const host_vfs, fs_node_t * const host_node, vfs_driver_t
         Validate args: either host_vfs and host_node must be NULL (implying that we are mounting the
         root filesystem) or they must both be non-NULL (implying that we are mounting a child fs).
     */
-    if(((host_vfs != NULL) && (host_node == NULL)) || ((host_vfs != NULL) && (host_node == NULL)))
+    if(((host_vfs != NULL) && (host_node == NULL)) || ((host_vfs == NULL) && (host_node != NULL)))
         return -EINVAL;
 
     preempt_disable();                              /* BEGIN locked section */
@@ -57,7 +61,7 @@ s32 mount_add(vfs_t * const host_vfs, fs_node_t * const host_node, vfs_driver_t
     */
     for(ent = g_mount_table; ent != NULL; ent = ent->next)
         if(((ent->host_vfs == host_vfs) && (ent->host_node == host_node))
-            ||(ent->host_vfs->dev == dev) || (ent->inner_vfs->dev == dev))
+            || ((dev != NULL) && (ent->inner_vfs->dev == dev)))
         {
             preempt_enable();
             return -EBUSY;
@@ -70,6 +74,10 @@ s32 mount_add(vfs_t * const host_vfs, fs_node_t * const host_node, vfs_driver_t
         return ret;
     }
 
+    /* Lookups which previously resolved within the host file system may now cross the mount */
+    if(host_vfs != NULL)
+        dcache_invalidate_vfs(host_vfs);
+
     new_ent = (mount_ent_t *) slab_alloc(sizeof(mount_ent_t));
     if(new_ent == NULL)
     {
@@ -78,6 +86,9 @@ s32 mount_add(vfs_t * const host_vfs, fs_node_t * const host_node, vfs_driver_t
         return -ENOMEM;
     }
 
+    if(host_node != NULL)
+        fs_node_ref(host_node);
+
     new_ent->host_vfs  = host_vfs;
     new_ent->host_node = host_node;
     new_ent->inner_vfs = inner_vfs;
@@ -86,7 +97,12 @@ s32 mount_add(vfs_t * const host_vfs, fs_node_t * const host_node, vfs_driver_t
     if(g_mount_table == NULL)
         g_mount_table = new_ent;
     else
+    {
+        for(ent = g_mount_table; ent->next != NULL; ent = ent->next)
+            ;
+
         ent->next = new_ent;
+    }
 
     preempt_enable();                               /* END locked section */
 
@@ -110,7 +126,7 @@ s32 mount_remove(const vfs_t * const host_vfs, const fs_node_t * const host_node
         If a location is specified by <host_vfs>:<host_node>, both must be non-NULL.  Otherwise,
         both must be NULL.
     */
-    if(((host_vfs != NULL) && (host_node == NULL)) || ((host_vfs != NULL) && (host_node == NULL)))
+    if(((host_vfs != NULL) && (host_node == NULL)) || ((host_vfs == NULL) && (host_node != NULL)))
         return -EINVAL;
 
     preempt_disable();
@@ -118,6 +134,7 @@ s32 mount_remove(const vfs_t * const host_vfs, const fs_node_t * const host_node
     {
         if((ent->host_vfs == host_vfs) && (ent->host_node == host_node))
         {
+            fs_node_t *host_node_;
             s32 ret;
 
             if((dev != NULL) && (dev != ent->inner_vfs->dev))
@@ -127,13 +144,6 @@ s32 mount_remove(const vfs_t * const host_vfs, const fs_node_t * const host_node
             }
 
             /* Unmount the filesystem */
-            ret = vfs_unmount(ent->inner_vfs);
-            if(ret != SUCCESS)
-            {
-                preempt_enable();
-                return ret;
-            }
-
             ret = vfs_detach(ent->inner_vfs);
             if(ret != SUCCESS)
             {
@@ -146,9 +156,13 @@ s32 mount_remove(const vfs_t * const host_vfs, const fs_node_t * const host_node
             else
                 g_mount_table = ent->next;
 
+            host_node_ = ent->host_node;
             slab_free(ent);
             preempt_enable();
 
+            if(host_node_ != NULL)
+                fs_node_put(host_node_);
+
             return SUCCESS;
         }
     }
@@ -179,7 +193,7 @@ s32 mount_find(const vfs_t * const host_vfs, const fs_node_t * const host_node,
         {
             if(inner_node != NULL)
             {
-                ret = mnt->inner_vfs->driver->get_root_node(mnt->inner_vfs, inner_node);
+                ret = vfs_get_root_node(mnt->inner_vfs, inner_node);
                 if(ret != SUCCESS)
                 {
                     preempt_enable();
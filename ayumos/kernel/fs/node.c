@@ -7,13 +7,45 @@
     (c) Stuart Wallace <stuartw@atom.net>, February 2017.
 */
 
+/*
+    Nodes returned by the VFS lookup functions are held in a node cache, keyed on (VFS, first
+    block).  The first block serves as a node ID: it is the first cluster of a FAT file, or the
+    inode number of an ext2 file.  A node is shared by everyone who looks it up, and is reference-
+    counted; fs_node_get() takes a reference and fs_node_put() releases it.  Changes to a node's
+    metadata (e.g. its size) are therefore seen by all users of the node.  A node whose metadata
+    has changed is marked dirty, and its metadata is written back through the driver's write_node
+    function when its last reference is released, or when its VFS is unmounted.  The node's dirty
+    pages in the page cache (see vfs_write()) are written back at the same points, and its pages are
+    discarded when the node is freed.
+
+    Up to FS_NODE_CACHE_UNUSED_MAX unreferenced nodes are retained, so that repeated lookups of
+    the same node are served from memory; beyond that, the least-recently-used unreferenced node is
+    freed.  FAT files which have no clusters allocated share first block zero, so they cannot be
+    identified by first block; such nodes are not entered into the cache, and are freed when their
+    last reference is released.  A driver may change a node's first block (e.g. when the first
+    cluster of an empty FAT file is allocated); the node is then moved to its new hash bucket by
+    fs_node_rehash().
+
+    Node cache state is protected by disabling pre-emption.
+*/
+
 #include <kernel/include/fs/node.h>
+#include <kernel/include/fs/vfs.h>
 #include <kernel/include/error.h>
 #include <kernel/include/memory/slab.h>
+#include <kernel/include/preempt.h>
 #include <kernel/include/process.h>
 #include <klibc/include/string.h>
 
 
+static list_t g_node_cache[FS_NODE_CACHE_BUCKETS];
+static list_t g_node_cache_unused;          /* Unreferenced nodes, least-recently used first */
+static u32 g_node_cache_num_unused;
+static fs_node_cache_stats_t g_node_cache_stats;
+
+static list_t *fs_node_bucket(const struct vfs * const vfs, ku32 first_block);
+
+
 /*
     fs_node_alloc() - allocate memory at <*node> to hold a fs_node_t struct.  This function does not
     allocate space for the node's <name> field.
@@ -95,16 +127,13 @@ s32 fs_node_check_perms(const file_perm_t op, const fs_node_t * const node)
 
 
 /*
-    fs_node_perm_str() build in str a ten-character "permission string", e.g. "drwxr-x---" from the
-    supplied node.  str must point to a buffer of at least 10 characters.
+    fs_perm_str() build in str a ten-character "permission string", e.g. "drwxr-x---" from the
+    supplied node type and permissions.  str must point to a buffer of at least 10 characters.
 
     TODO: this probably shouldn't be here; put it somewhere else.
 */
-s8 *fs_node_perm_str(const fs_node_t * const node, s8 *str)
+s8 *fs_perm_str(const fsnode_type_t type, const file_perm_t perm, s8 *str)
 {
-    const file_perm_t perm = node->permissions;
-    const fsnode_type_t type = node->type;
-
     str[0] = (type == FSNODE_TYPE_DIR) ? 'd' : '-';
     str[1] = (perm & FS_PERM_UR) ? 'r' : '-';
     str[2] = (perm & FS_PERM_UW) ? 'w' : '-';
@@ -125,3 +154,388 @@ s8 *fs_node_perm_str(const fs_node_t * const node, s8 *str)
     return str;
 }
 
+
+/*
+    fs_node_perm_str() build in str a ten-character "permission string", e.g. "drwxr-x---" from the
+    supplied node.  str must point to a buffer of at least 10 characters.
+*/
+s8 *fs_node_perm_str(const fs_node_t * const node, s8 *str)
+{
+    return fs_perm_str(node->type, node->permissions, str);
+}
+
+
+
+/*
+    fs_node_cache_init() - initialise the node cache.
+*/
+s32 fs_node_cache_init()
+{
+    u32 u;
+
+    for(u = 0; u < FS_NODE_CACHE_BUCKETS; ++u)
+        list_init(&g_node_cache[u]);
+
+    list_init(&g_node_cache_unused);
+    g_node_cache_num_unused = 0;
+
+    return SUCCESS;
+}
+
+
+/*
+    fs_node_bucket() - return the hash bucket for the node identified by <vfs>:<first_block>.
+*/
+static list_t *fs_node_bucket(const struct vfs * const vfs, ku32 first_block)
+{
+    return &g_node_cache[(((u32) vfs >> 4) ^ first_block) & (FS_NODE_CACHE_BUCKETS - 1)];
+}
+
+
+/*
+    fs_node_get() - take a reference to the cached node corresponding to <node>, a node on <vfs>
+    which was newly populated by a file system driver, and return it through <*cached>.  If the node
+    is already cached, <node> is freed and the cached node is returned; otherwise <node> is entered
+    into the cache and returned.  In either case the caller relinquishes ownership of <node>, and
+    must release the returned node with fs_node_put().
+*/
+s32 fs_node_get(struct vfs * const vfs, fs_node_t * const node, fs_node_t **cached)
+{
+    list_t * const bucket = fs_node_bucket(vfs, node->first_block);
+    fs_node_t *n;
+
+    preempt_disable();
+
+    ++g_node_cache_stats.lookups;
+
+    /* Nodes with no allocated storage cannot be identified by first block */
+    if((node->type != FSNODE_TYPE_DIR) && !node->first_block)
+    {
+        preempt_enable();
+
+        node->vfs = vfs;
+        node->refcount = 1;
+        node->dirty = 0;
+        node->pages = 0;
+        list_init(&node->hash);
+        list_init(&node->unused);
+
+        *cached = node;
+        return SUCCESS;
+    }
+
+    list_for_each_entry(n, bucket, hash)
+    {
+        if((n->vfs == vfs) && (n->first_block == node->first_block))
+        {
+            if(!n->refcount++)
+            {
+                list_delete(&n->unused);
+                --g_node_cache_num_unused;
+            }
+
+            ++g_node_cache_stats.hits;
+            preempt_enable();
+
+            fs_node_free(node);
+            *cached = n;
+            return SUCCESS;
+        }
+    }
+
+    node->vfs = vfs;
+    node->refcount = 1;
+    node->dirty = 0;
+    node->pages = 0;
+    list_init(&node->unused);
+    list_insert(&node->hash, bucket);
+
+    ++g_node_cache_stats.entries;
+    preempt_enable();
+
+    *cached = node;
+    return SUCCESS;
+}
+
+
+/*
+    fs_node_ref() - take an additional reference to a node which was obtained from fs_node_get().
+*/
+void fs_node_ref(fs_node_t * const node)
+{
+    preempt_disable();
+    ++node->refcount;
+    preempt_enable();
+}
+
+
+/*
+    fs_node_put() - release a reference to a node.  When the last reference is released, the node's
+    dirty pages and metadata are written back.  The node is then retained in the cache, or freed if
+    it is not cached.  If too many unreferenced nodes are being retained, the least-recently-used
+    one is freed.
+*/
+void fs_node_put(fs_node_t * const node)
+{
+    fs_node_t *victim = NULL;
+
+    preempt_disable();
+
+    if((node->refcount == 1) && (node->dirty || (node->pages & FS_NODE_PAGES_DIRTY)))
+    {
+        /*
+            Write back dirty pages and metadata.  This may sleep, so it's done outside the locked
+            section.  The caller's reference is held until the write-back is complete, so that a
+            concurrent fs_node_get() finds the node referenced, and not on the unused list.
+        */
+        preempt_enable();
+        fs_node_sync(node);
+        preempt_disable();
+    }
+
+    if(--node->refcount)
+    {
+        /* The node is still referenced, possibly after being looked up again during write-back */
+        preempt_enable();
+        return;
+    }
+
+    if(list_is_empty(&node->hash))
+    {
+        preempt_enable();
+        vfs_invalidate_pages(node, 0);
+        fs_node_free(node);
+        return;
+    }
+
+    list_insert(&node->unused, &g_node_cache_unused);
+
+    if(++g_node_cache_num_unused > FS_NODE_CACHE_UNUSED_MAX)
+    {
+        /* Evict the least-recently-used unreferenced node.  Its metadata has been written back. */
+        victim = list_first_entry(&g_node_cache_unused, fs_node_t, unused);
+        list_delete(&victim->unused);
+        list_delete(&victim->hash);
+        --g_node_cache_num_unused;
+        --g_node_cache_stats.entries;
+        ++g_node_cache_stats.evictions;
+    }
+
+    preempt_enable();
+
+    if(victim != NULL)
+    {
+        vfs_invalidate_pages(victim, 0);
+        fs_node_free(victim);
+    }
+}
+
+
+/*
+    fs_node_rehash() - move <node>, which was obtained from fs_node_get(), to the hash bucket for its
+    current first block, after the first block has been changed by the file system driver.  A node
+    which was not cached because it had no storage is entered into the cache.  Any other node with
+    the same first block on the same VFS is stale, since its storage must have been freed; it is
+    removed from the cache, and freed now if it is unreferenced.
+*/
+void fs_node_rehash(fs_node_t * const node)
+{
+    list_t * const bucket = fs_node_bucket(node->vfs, node->first_block);
+    fs_node_t *n, *victim = NULL;
+    u8 was_cached;
+
+    preempt_disable();
+
+    was_cached = !list_is_empty(&node->hash);
+    if(was_cached)
+        list_delete(&node->hash);
+
+    list_for_each_entry(n, bucket, hash)
+    {
+        if((n->vfs == node->vfs) && (n->first_block == node->first_block))
+        {
+            list_delete(&n->hash);
+            list_init(&n->hash);
+            --g_node_cache_stats.entries;
+
+            if(!n->refcount)
+            {
+                list_delete(&n->unused);
+                --g_node_cache_num_unused;
+                victim = n;
+            }
+
+            break;
+        }
+    }
+
+    if((node->type == FSNODE_TYPE_DIR) || node->first_block)
+    {
+        list_insert(&node->hash, bucket);
+        if(!was_cached)
+            ++g_node_cache_stats.entries;
+    }
+    else
+    {
+        list_init(&node->hash);
+        if(was_cached)
+            --g_node_cache_stats.entries;
+    }
+
+    preempt_enable();
+
+    if(victim != NULL)
+    {
+        vfs_invalidate_pages(victim, 0);
+        fs_node_free(victim);
+    }
+}
+
+
+/*
+    fs_node_remove() - remove <node>, whose storage is about to be deleted, from the node cache, so
+    that it is freed when the caller releases it, and a node which later reuses its first block is
+    not confused with it.  Fails with -EBUSY if anyone other than the caller holds a reference to
+    the node.  If the deletion fails, fs_node_rehash() puts the node back into the cache.
+*/
+s32 fs_node_remove(fs_node_t * const node)
+{
+    preempt_disable();
+
+    if(node->refcount != 1)
+    {
+        preempt_enable();
+        return -EBUSY;
+    }
+
+    if(!list_is_empty(&node->hash))
+    {
+        list_delete(&node->hash);
+        list_init(&node->hash);
+        --g_node_cache_stats.entries;
+    }
+
+    preempt_enable();
+
+    return SUCCESS;
+}
+
+
+/*
+    fs_node_mark_dirty() - record that the metadata of <node> has changed, and must be written back.
+*/
+void fs_node_mark_dirty(fs_node_t * const node)
+{
+    node->dirty = 1;
+}
+
+
+/*
+    fs_node_sync() - write back the dirty pages of <node>, then, if its metadata is dirty, write it
+    back through the file system driver.  A driver which does not implement write_node() holds no
+    metadata apart from that which is written as a side-effect of other operations, so -ENOSYS is
+    not treated as an error.
+*/
+s32 fs_node_sync(fs_node_t * const node)
+{
+    vfs_t * const vfs = node->vfs;
+    s32 ret;
+
+    ret = vfs_flush_pages(node);
+    if(ret != SUCCESS)
+        return ret;
+
+    if(!node->dirty)
+        return SUCCESS;
+
+    node->dirty = 0;
+
+    ret = vfs->driver->write_node(vfs, node);
+    if(ret == -ENOSYS)
+        return SUCCESS;
+
+    if(ret != SUCCESS)
+        node->dirty = 1;
+    else
+        ++g_node_cache_stats.writebacks;
+
+    return ret;
+}
+
+
+/*
+    fs_node_cache_flush() - write back the pages and metadata of all dirty nodes on <vfs>, then free
+    all of its unreferenced nodes and their pages.  Returns -EBUSY if any nodes on <vfs> remain
+    referenced.
+*/
+s32 fs_node_cache_flush(struct vfs * const vfs)
+{
+    fs_node_t *node, *tmp;
+    u32 u;
+    s32 ret = SUCCESS;
+
+    for(u = 0; u < FS_NODE_CACHE_BUCKETS; ++u)
+    {
+        preempt_disable();
+restart:
+        list_for_each_entry_safe(node, tmp, &g_node_cache[u], hash)
+        {
+            if(node->vfs != vfs)
+                continue;
+
+            if(node->refcount)
+            {
+                ret = -EBUSY;
+                continue;
+            }
+
+            /*
+                Unreferenced nodes are written back when released, but a write-back may have failed.
+                Pages are discarded here too, as this may sleep.
+            */
+            if(node->dirty || node->pages)
+            {
+                s32 ret_sync;
+
+                /* Hold a reference to the node while it is written back, so it can't be evicted */
+                ++node->refcount;
+                preempt_enable();
+
+                ret_sync = fs_node_sync(node);
+                if(ret_sync == SUCCESS)
+                    vfs_invalidate_pages(node, 0);
+
+                preempt_disable();
+                --node->refcount;
+
+                if(ret_sync != SUCCESS)
+                {
+                    preempt_enable();
+                    return ret_sync;
+                }
+
+                goto restart;       /* The bucket may have changed while pre-emption was enabled */
+            }
+
+            list_delete(&node->unused);
+            list_delete(&node->hash);
+            --g_node_cache_num_unused;
+            --g_node_cache_stats.entries;
+
+            fs_node_free(node);
+        }
+
+        preempt_enable();
+    }
+
+    return ret;
+}
+
+
+/*
+    fs_node_cache_stats() - return a pointer to the node cache statistics.
+*/
+const fs_node_cache_stats_t *fs_node_cache_stats()
+{
+    return &g_node_cache_stats;
+}
@@ -31,7 +31,8 @@ s32 path_is_absolute(ks8 *path)
 /*
     path_open() - walk the absolute path specified in <path>.  Fail with EINVAL if <path> is not
     absolute, and ENOMEM if any memory allocation fails.  Fail with EPERM if a permissions error
-    occurs while traversing the path.
+    occurs while traversing the path.  On success, the node returned through <*node> must be
+    released with fs_node_put().
 
     TODO - handle symlinks
 */
@@ -74,7 +75,7 @@ s32 path_open(const char *path, vfs_t **vfs, fs_node_t **node)
         ret = vfs_get_child_node(parent, component, &vfs_, &child);
         if(ret != SUCCESS)
         {
-            fs_node_free(parent);
+            fs_node_put(parent);
             kfree(path_canon);
             return ret;
         }
@@ -84,14 +85,14 @@ s32 path_open(const char *path, vfs_t **vfs, fs_node_t **node)
             ret = fs_node_check_perms(FS_PERM_R | FS_PERM_X, child);
             if(ret != SUCCESS)
             {
-                fs_node_free(parent);
-                fs_node_free(child);
+                fs_node_put(parent);
+                fs_node_put(child);
                 kfree(path_canon);
                 return ret;
             }
         }
 
-        fs_node_free(parent);
+        fs_node_put(parent);
         parent = child;
     } while(sep);
 
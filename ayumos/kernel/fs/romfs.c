@@ -5,12 +5,29 @@
 
 
     (c) Stuart Wallace, January 2016
+
+
+    A romfs image normally lives in directly-addressable memory (e.g. ROM, or a RAM disk), so it is
+    accessed in place: the address of the image is obtained from the device through
+    dc_get_mem_base, and file contents are handed out as pointers into the image (see romfs_map()).
+    Images on devices which are not memory-mapped are loaded into the kernel heap at mount time.
+
+    Compressed files cannot be mapped.  Reads from them decompress only the chunks which overlap
+    the requested range; chunks which are only partly needed are kept in a small LRU cache, so that
+    a sequence of small reads does not decompress the same chunk repeatedly.
 */
 
 #ifdef WITH_FS_ROMFS
 
+#include <kernel/include/byteorder.h>
+#include <kernel/include/device/block.h>
+#include <kernel/include/error.h>
 #include <kernel/include/fs/romfs.h>
 #include <kernel/include/fs/node.h>
+#include <kernel/include/memory/kmalloc.h>
+#include <kernel/util/kutil.h>
+#include <klibc/include/string.h>
+#include <klibc/include/strings.h>
 
 
 s32 romfs_init();
@@ -20,7 +37,23 @@ s32 romfs_get_root_node(vfs_t *vfs, fs_node_t **node);
 s32 romfs_open_dir(vfs_t *vfs, u32 node, void **ctx);
 s32 romfs_read_dir(vfs_t *vfs, void *ctx, ks8* const name, fs_node_t *node);
 s32 romfs_close_dir(vfs_t *vfs, void *ctx);
+s32 romfs_read(vfs_t * const vfs, fs_node_t * const node, void * const buffer, u32 offset,
+               ks32 count);
 s32 romfs_stat(vfs_t *vfs, fs_stat_t *st);
+s32 romfs_map(vfs_t * const vfs, fs_node_t * const node, const void **addr);
+
+static s32 romfs_load_image(dev_t * const dev, romfs_fs_t * const fs);
+static s32 romfs_validate(romfs_fs_t * const fs);
+static const romfs_node_t *romfs_get_node(const romfs_fs_t * const fs, ku32 id);
+static const romfs_node_t *romfs_find(const romfs_fs_t * const fs,
+                                      const romfs_dir_ctx_t * const dir_ctx, ks8 * const name);
+static void romfs_node_to_node(const romfs_node_t * const rn, fs_node_t * const node);
+static s32 romfs_read_compressed(romfs_fs_t * const fs, const romfs_node_t * const rn,
+                                 u8 *buffer, u32 pos, u32 len);
+static s32 romfs_decompress_chunk(const romfs_fs_t * const fs, const romfs_node_t * const rn,
+                                  ku32 chunk, u8 * const buffer);
+static const u8 *romfs_get_chunk(romfs_fs_t * const fs, const romfs_node_t * const rn,
+                                 ku32 chunk, s32 * const err);
 
 vfs_driver_t g_romfs_ops =
 {
@@ -32,7 +65,9 @@ vfs_driver_t g_romfs_ops =
     .open_dir = romfs_open_dir,
     .read_dir = romfs_read_dir,
     .close_dir = romfs_close_dir,
-    .stat = romfs_stat
+    .read = romfs_read,
+    .stat = romfs_stat,
+    .map = romfs_map
 };
 
 
@@ -43,61 +78,652 @@ s32 romfs_init()
 }
 
 
+/*
+    romfs_mount() - mount the romfs on vfs->dev.  If the device's contents are memory-mapped, the
+    image is used in place; otherwise it is loaded into the kernel heap.
+*/
 s32 romfs_mount(vfs_t *vfs)
 {
-    UNUSED(vfs);
-    return -ENOSYS;
+    romfs_fs_t *fs;
+    u8 *base;
+    s32 ret;
+
+    fs = (romfs_fs_t *) CHECKED_KCALLOC(1, sizeof(romfs_fs_t));
+
+    if(vfs->dev->control(vfs->dev, dc_get_mem_base, NULL, &base) == SUCCESS)
+        fs->image = base;
+    else
+    {
+        ret = romfs_load_image(vfs->dev, fs);
+        if(ret != SUCCESS)
+        {
+            kfree(fs);
+            return ret;
+        }
+    }
+
+    ret = romfs_validate(fs);
+    if((ret == SUCCESS) && (fs->len > (vfs->dev->len * vfs->dev->block_size)))
+        ret = -EBADSBLK;    /* Image extends beyond the end of the device */
+
+    if(ret != SUCCESS)
+    {
+        if(fs->owns_image)
+            kfree((void *) fs->image);
+
+        kfree(fs);
+        return ret;
+    }
+
+    sem_init(&fs->chunk_lock);
+
+    vfs->data = fs;
+    vfs->root_block = ROMFS_ROOT_ID;
+
+    return SUCCESS;
 }
 
 
+/*
+    romfs_load_image() - read the romfs image on <dev> into the kernel heap.
+*/
+static s32 romfs_load_image(dev_t * const dev, romfs_fs_t * const fs)
+{
+    const romfs_superblock_t *sblk;
+    u8 *image;
+    u32 nblocks;
+    s32 ret;
+
+    image = kmalloc(BLOCK_SIZE);
+    if(image == NULL)
+        return -ENOMEM;
+
+    ret = block_read(dev, 0, image);
+    if(ret != SUCCESS)
+    {
+        kfree(image);
+        return ret;
+    }
+
+    sblk = (const romfs_superblock_t *) image;
+    if((BE2N32(sblk->magic) != ROMFS_SUPERBLOCK_MAGIC)
+       || (BE2N32(sblk->len) < sizeof(romfs_superblock_t)))
+    {
+        kfree(image);
+        return -EBADSBLK;
+    }
+
+    nblocks = (BE2N32(sblk->len) + BLOCK_SIZE - 1) >> LOG_BLOCK_SIZE;
+    if(nblocks > 1)
+    {
+        u8 * const new_image = krealloc(image, nblocks << LOG_BLOCK_SIZE);
+        if(new_image == NULL)
+        {
+            kfree(image);
+            return -ENOMEM;
+        }
+
+        image = new_image;
+
+        ret = block_read_multi(dev, 1, nblocks - 1, image + BLOCK_SIZE);
+        if((ret >= 0) && ((u32) ret != nblocks - 1))
+            ret = -EREAD;
+
+        if(ret < 0)
+        {
+            kfree(image);
+            return ret;
+        }
+    }
+
+    fs->image = image;
+    fs->owns_image = 1;
+
+    return SUCCESS;
+}
+
+
+/*
+    romfs_validate() - check the superblock and node table of the image at fs->image, and populate
+    the remaining fields of <fs>.  Every node's data and name, and every directory's range of
+    children, are checked to lie within the image, so that they need not be checked again when
+    accessed.
+*/
+static s32 romfs_validate(romfs_fs_t * const fs)
+{
+    const romfs_superblock_t * const sblk = (const romfs_superblock_t *) fs->image;
+    u16 i;
+
+    if(BE2N32(sblk->magic) != ROMFS_SUPERBLOCK_MAGIC)
+        return -EBADSBLK;
+
+    fs->len = BE2N32(sblk->len);
+    fs->nnodes = BE2N16(sblk->nnodes);
+    fs->version = BE2N16(sblk->version);
+    fs->root_nchildren = BE2N16(sblk->root_nchildren);
+    fs->features = BE2N16(sblk->features);
+    fs->nodes = (const romfs_node_t *) (fs->image + sizeof(romfs_superblock_t));
+
+    if((fs->version > ROMFS_VERSION) || (fs->features & ~ROMFS_FEATURES_SUPPORTED)
+       || (fs->len < sizeof(romfs_superblock_t) + (fs->nnodes * sizeof(romfs_node_t))))
+        return -EBADSBLK;
+
+    if((fs->version == ROMFS_VERSION_SORTED) && (fs->root_nchildren > fs->nnodes))
+        return -EBADSBLK;
+
+    /* The name table is at the end of the image, so a terminated final byte terminates all names */
+    if(fs->nnodes && fs->image[fs->len - 1])
+        return -EBADSBLK;
+
+    for(i = 0; i < fs->nnodes; ++i)
+    {
+        const romfs_node_t * const rn = &fs->nodes[i];
+        ku32 offset = BE2N32(rn->offset), size = BE2N32(rn->size);
+        ku16 flags = BE2N16(rn->flags);
+
+        if(BE2N32(rn->name_offset) >= fs->len)
+            return -EBADSBLK;
+
+        if(flags & RN_COMPRESSED)
+        {
+            /* Compressed file: the chunk table and the data which it describes must both fit */
+            ku32 table_len = ((size + ROMFS_CHUNK_SIZE - 1) >> ROMFS_LOG_CHUNK_SIZE) << 2;
+            u32 data_len;
+
+            if(!(fs->features & ROMFS_FEATURE_COMPRESSED) || !(flags & RN_FILE) || !size
+               || (offset & 3) || (offset > fs->len) || (table_len > fs->len - offset))
+                return -EBADSBLK;
+
+            data_len = BE2N32(*((const u32 *) (fs->image + offset + table_len) - 1));
+            if((data_len < table_len) || (data_len > fs->len - offset))
+                return -EBADSBLK;
+        }
+        else if(flags & RN_FILE)
+        {
+            if((offset > fs->len) || (size > fs->len - offset))
+                return -EBADSBLK;
+        }
+        else if(fs->version == ROMFS_VERSION_SORTED)
+        {
+            /* Directory: offset and size describe the range of nodes holding its children */
+            if((offset > fs->nnodes) || (size > fs->nnodes - offset))
+                return -EBADSBLK;
+        }
+
+        if((fs->version == ROMFS_VERSION_SORTED) && (BE2N16(rn->id) != i + 1))
+            return -EBADSBLK;
+    }
+
+    return SUCCESS;
+}
+
+
+/*
+    romfs_unmount() - release the file system's resources, including the image if it was copied
+    into RAM.  This is only called once no nodes on the file system are referenced: vfs_unmount()
+    fails with -EBUSY while, for example, an executable image is being executed in place from it
+    (see elf_load_file()).
+*/
 s32 romfs_unmount(vfs_t *vfs)
 {
-    UNUSED(vfs);
-    return -ENOSYS;
+    romfs_fs_t * const fs = (romfs_fs_t *) vfs->data;
+    u16 i;
+
+    if(fs->chunk_cache != NULL)
+    {
+        for(i = 0; i < ROMFS_CHUNK_CACHE_ENTRIES; ++i)
+            kfree(fs->chunk_cache[i].data);
+
+        kfree(fs->chunk_cache);
+    }
+
+    sem_destroy(&fs->chunk_lock);
+
+    if(fs->owns_image)
+        kfree((void *) fs->image);
+
+    kfree(fs);
+    vfs->data = NULL;
+
+    return SUCCESS;
 }
 
 
 s32 romfs_get_root_node(vfs_t *vfs, fs_node_t **node)
 {
-    UNUSED(vfs);
-    UNUSED(node);
-    return -ENOSYS;
+    const romfs_fs_t * const fs = (const romfs_fs_t *) vfs->data;
+    const romfs_superblock_t * const sblk = (const romfs_superblock_t *) fs->image;
+    fs_node_t *root_node;
+    s32 ret;
+
+    ret = fs_node_alloc(&root_node);
+    if(ret != SUCCESS)
+        return ret;
+
+    /* Zero out the node struct - that way we only have to set nonzero fields */
+    bzero(root_node, sizeof(fs_node_t));
+
+    ret = fs_node_set_name(root_node, ROOT_DIR);
+    if(ret != SUCCESS)
+    {
+        fs_node_free(root_node);
+        return ret;
+    }
+
+    root_node->type = FSNODE_TYPE_DIR;
+    root_node->permissions = FS_PERM_UGORX;
+    root_node->ctime = BE2N32(sblk->cdate);
+    root_node->mtime = root_node->ctime;
+    root_node->atime = root_node->ctime;
+    root_node->first_block = ROMFS_ROOT_ID;
+
+    *node = root_node;
+
+    return SUCCESS;
 }
 
 
-s32 romfs_open_dir(vfs_t *vfs, u32 node, void **ctx)
+/*
+    romfs_get_node() - return the node whose ID is <id>, or NULL if there is no such node.
+*/
+static const romfs_node_t *romfs_get_node(const romfs_fs_t * const fs, ku32 id)
 {
-    UNUSED(vfs);
-    UNUSED(node);
-    UNUSED(ctx);
-    return -ENOSYS;
+    u16 i;
+
+    /* mkromfs numbers nodes consecutively from 1, so node <id> is normally at index (id - 1); in a
+       sorted image, this is guaranteed */
+    if(id && (id <= fs->nnodes) && (BE2N16(fs->nodes[id - 1].id) == id))
+        return &fs->nodes[id - 1];
+
+    if(fs->version == ROMFS_VERSION_SORTED)
+        return NULL;
+
+    for(i = 0; i < fs->nnodes; ++i)
+        if(BE2N16(fs->nodes[i].id) == id)
+            return &fs->nodes[i];
+
+    return NULL;
+}
+
+
+/*
+    romfs_node_to_node() - populate an fs_node_t with the metadata in a romfs_node_t.
+*/
+static void romfs_node_to_node(const romfs_node_t * const rn, fs_node_t * const node)
+{
+    node->type = (BE2N16(rn->flags) & RN_DIR) ? FSNODE_TYPE_DIR : FSNODE_TYPE_FILE;
+    node->uid = BE2N16(rn->uid);
+    node->gid = BE2N16(rn->gid);
+    node->permissions = BE2N16(rn->permissions);
+    node->flags = 0;
+    node->size = (BE2N16(rn->flags) & RN_FILE) ? BE2N32(rn->size) : 0;
+    node->ctime = BE2N32(rn->mdate);
+    node->mtime = node->ctime;
+    node->atime = node->ctime;
+    node->first_block = BE2N16(rn->id);
+}
+
+
+/*
+    romfs_open_dir() - prepare to iterate over the directory whose node ID is <id>.  In a sorted
+    image, iteration is confined to the directory's own range of nodes; in an unsorted image, every
+    node must be examined.
+*/
+s32 romfs_open_dir(vfs_t *vfs, u32 id, void **ctx)
+{
+    const romfs_fs_t * const fs = (const romfs_fs_t *) vfs->data;
+    romfs_dir_ctx_t *dir_ctx;
+    u16 first, count;
+
+    first = 0;
+    count = (fs->version == ROMFS_VERSION_SORTED) ? fs->root_nchildren : fs->nnodes;
+
+    if(id != ROMFS_ROOT_ID)
+    {
+        const romfs_node_t * const rn = romfs_get_node(fs, id);
+
+        if(rn == NULL)
+            return -ENOENT;
+
+        if(!(BE2N16(rn->flags) & RN_DIR))
+            return -ENOTDIR;
+
+        if(fs->version == ROMFS_VERSION_SORTED)
+        {
+            first = BE2N32(rn->offset);
+            count = BE2N32(rn->size);
+        }
+    }
+
+    dir_ctx = (romfs_dir_ctx_t *) CHECKED_KCALLOC(1, sizeof(romfs_dir_ctx_t));
+
+    dir_ctx->id = id;
+    dir_ctx->first = first;
+    dir_ctx->end = first + count;
+    dir_ctx->pos = first;
+
+    *ctx = dir_ctx;
+
+    return SUCCESS;
 }
 
 
+/*
+    romfs_find() - look up the entry named <name> in the directory described by <dir_ctx>.  Return
+    the entry's node, or NULL if there is no such entry.  Sorted directories are binary-searched.
+*/
+static const romfs_node_t *romfs_find(const romfs_fs_t * const fs,
+                                      const romfs_dir_ctx_t * const dir_ctx, ks8 * const name)
+{
+    u16 lo, hi, i;
+
+    if(fs->version == ROMFS_VERSION_SORTED)
+    {
+        for(lo = dir_ctx->first, hi = dir_ctx->end; lo < hi;)
+        {
+            const romfs_node_t * const rn = &fs->nodes[lo + ((hi - lo) >> 1)];
+            ks32 cmp = strcmp(name, (ks8 *) fs->image + BE2N32(rn->name_offset));
+
+            if(!cmp)
+                return rn;
+
+            if(cmp < 0)
+                hi = rn - fs->nodes;
+            else
+                lo = (rn - fs->nodes) + 1;
+        }
+
+        return NULL;
+    }
+
+    for(i = dir_ctx->first; i < dir_ctx->end; ++i)
+    {
+        const romfs_node_t * const rn = &fs->nodes[i];
+
+        if((BE2N16(rn->parent_id) == dir_ctx->id)
+           && !strcmp(name, (ks8 *) fs->image + BE2N32(rn->name_offset)))
+            return rn;
+    }
+
+    return NULL;
+}
+
+
+/*
+    romfs_read_dir() - if <name> is NULL, return the next entry in the directory; otherwise, look up
+    the entry named <name>.  If <node> is NULL, only report whether the entry exists.  Fail with
+    ENOENT if there are no more entries, or no entry named <name>.
+*/
 s32 romfs_read_dir(vfs_t *vfs, void *ctx, ks8 * const name, fs_node_t *node)
 {
-    UNUSED(vfs);
-    UNUSED(ctx);
-    UNUSED(node);
-    UNUSED(name);
-    return -ENOSYS;
+    const romfs_fs_t * const fs = (const romfs_fs_t *) vfs->data;
+    romfs_dir_ctx_t * const dir_ctx = (romfs_dir_ctx_t *) ctx;
+    const romfs_node_t *rn;
+    s32 ret;
+
+    if(name != NULL)
+    {
+        rn = romfs_find(fs, dir_ctx, name);
+        if(rn == NULL)
+            return -ENOENT;
+    }
+    else
+    {
+        /* Skip nodes belonging to other directories; there are none in a sorted image */
+        for(; (dir_ctx->pos < dir_ctx->end)
+              && (BE2N16(fs->nodes[dir_ctx->pos].parent_id) != dir_ctx->id); ++dir_ctx->pos)
+            ;
+
+        if(dir_ctx->pos == dir_ctx->end)
+            return -ENOENT;
+
+        rn = &fs->nodes[dir_ctx->pos++];
+    }
+
+    /* If node is NULL, the caller only wanted to know whether or not the entry exists */
+    if(node == NULL)
+        return SUCCESS;
+
+    ret = fs_node_set_name(node, (ks8 *) fs->image + BE2N32(rn->name_offset));
+    if(ret != SUCCESS)
+        return ret;
+
+    romfs_node_to_node(rn, node);
+
+    return SUCCESS;
 }
 
 
 s32 romfs_close_dir(vfs_t *vfs, void *ctx)
 {
     UNUSED(vfs);
-    UNUSED(ctx);
-    return -ENOSYS;
+
+    kfree(ctx);
+
+    return SUCCESS;
+}
+
+
+/*
+    romfs_read() - read <count> blocks, starting from block <offset>, into <buffer> from the file
+    indicated by <node>.  The final block of the file is zero-padded.
+*/
+s32 romfs_read(vfs_t * const vfs, fs_node_t * const node, void * const buffer, u32 offset,
+               ks32 count)
+{
+    romfs_fs_t * const fs = (romfs_fs_t *) vfs->data;
+    const romfs_node_t * const rn = romfs_get_node(fs, node->first_block);
+    u32 size, start, len;
+
+    if(rn == NULL)
+        return -ENOENT;
+
+    if(!(BE2N16(rn->flags) & RN_FILE))
+        return -EISDIR;
+
+    size = BE2N32(rn->size);
+    start = offset << LOG_BLOCK_SIZE;
+    if((count <= 0) || (start >= size))
+        return 0;
+
+    len = MIN((u32) count << LOG_BLOCK_SIZE, size - start);
+
+    if(BE2N16(rn->flags) & RN_COMPRESSED)
+    {
+        ks32 ret = romfs_read_compressed(fs, rn, (u8 *) buffer, start, len);
+        if(ret != SUCCESS)
+            return ret;
+    }
+    else
+        memcpy(buffer, fs->image + BE2N32(rn->offset) + start, len);
+
+    if(len & (BLOCK_SIZE - 1))
+        bzero((u8 *) buffer + len, BLOCK_SIZE - (len & (BLOCK_SIZE - 1)));
+
+    return (len + BLOCK_SIZE - 1) >> LOG_BLOCK_SIZE;
+}
+
+
+/*
+    romfs_read_compressed() - copy <len> bytes, starting at offset <pos>, from the compressed file
+    <rn> into <buffer>.  Chunks which are wholly within the range are decompressed straight into
+    <buffer>; the others are obtained through the chunk cache.
+*/
+static s32 romfs_read_compressed(romfs_fs_t * const fs, const romfs_node_t * const rn,
+                                 u8 *buffer, u32 pos, u32 len)
+{
+    ku32 size = BE2N32(rn->size);
+    s32 ret;
+
+    while(len)
+    {
+        ku32 chunk = pos >> ROMFS_LOG_CHUNK_SIZE, chunk_offset = pos & (ROMFS_CHUNK_SIZE - 1),
+             chunk_len = MIN(ROMFS_CHUNK_SIZE, size - (chunk << ROMFS_LOG_CHUNK_SIZE)),
+             n = MIN(len, chunk_len - chunk_offset);
+
+        if(n == chunk_len)
+        {
+            ret = romfs_decompress_chunk(fs, rn, chunk, buffer);
+            if(ret != SUCCESS)
+                return ret;
+        }
+        else
+        {
+            const u8 *data;
+
+            sem_acquire(&fs->chunk_lock);
+
+            data = romfs_get_chunk(fs, rn, chunk, &ret);
+            if(data != NULL)
+                memcpy(buffer, data + chunk_offset, n);
+
+            sem_release(&fs->chunk_lock);
+
+            if(data == NULL)
+                return ret;
+        }
+
+        buffer += n;
+        pos += n;
+        len -= n;
+    }
+
+    return SUCCESS;
+}
+
+
+/*
+    romfs_decompress_chunk() - decompress chunk number <chunk> of the compressed file <rn> into
+    <buffer>, which must be large enough to hold the chunk.
+*/
+static s32 romfs_decompress_chunk(const romfs_fs_t * const fs, const romfs_node_t * const rn,
+                                  ku32 chunk, u8 * const buffer)
+{
+    const u8 * const data = fs->image + BE2N32(rn->offset);
+    const u32 * const table = (const u32 *) data;
+    ku32 size = BE2N32(rn->size),
+         chunk_len = MIN(ROMFS_CHUNK_SIZE, size - (chunk << ROMFS_LOG_CHUNK_SIZE)),
+         start = chunk ? BE2N32(table[chunk - 1])
+                       : ((size + ROMFS_CHUNK_SIZE - 1) >> ROMFS_LOG_CHUNK_SIZE) << 2,
+         end = BE2N32(table[chunk]);
+    s32 ret;
+
+    /* romfs_validate() checked that the final chunk ends within the image, so a well-ordered table
+       keeps every chunk within the image */
+    if((start > end) || (end > BE2N32(table[((size - 1) >> ROMFS_LOG_CHUNK_SIZE)])))
+        return -EDATA;
+
+    if(end - start == chunk_len)
+    {
+        memcpy(buffer, data + start, chunk_len);    /* Chunk is stored uncompressed */
+        return SUCCESS;
+    }
+
+    ret = lz4_decompress(data + start, end - start, buffer, chunk_len);
+    if(ret < 0)
+        return ret;
+
+    return ((u32) ret == chunk_len) ? SUCCESS : -EDATA;
+}
+
+
+/*
+    romfs_get_chunk() - return a pointer to the decompressed contents of chunk number <chunk> of the
+    compressed file <rn>, decompressing it into the least-recently-used cache entry if it is not
+    already cached.  On failure, return NULL and set *<err> to an error code.  The caller must hold
+    fs->chunk_lock until it has finished with the returned data.
+*/
+static const u8 *romfs_get_chunk(romfs_fs_t * const fs, const romfs_node_t * const rn,
+                                 ku32 chunk, s32 * const err)
+{
+    ku16 id = BE2N16(rn->id);
+    romfs_chunk_t *ent, *victim;
+    u16 i;
+    s32 ret;
+
+    if(fs->chunk_cache == NULL)
+    {
+        fs->chunk_cache = kcalloc(ROMFS_CHUNK_CACHE_ENTRIES, sizeof(romfs_chunk_t));
+        if(fs->chunk_cache == NULL)
+        {
+            *err = -ENOMEM;
+            return NULL;
+        }
+    }
+
+    ++fs->chunk_clock;
+
+    for(victim = ent = fs->chunk_cache, i = 0; i < ROMFS_CHUNK_CACHE_ENTRIES; ++i, ++ent)
+    {
+        if((ent->id == id) && (ent->chunk == chunk))
+        {
+            ent->last_used = fs->chunk_clock;
+            return ent->data;
+        }
+
+        if(!ent->id || (victim->id && (ent->last_used < victim->last_used)))
+            victim = ent;
+    }
+
+    if(victim->data == NULL)
+    {
+        victim->data = kmalloc(ROMFS_CHUNK_SIZE);
+        if(victim->data == NULL)
+        {
+            *err = -ENOMEM;
+            return NULL;
+        }
+    }
+
+    ret = romfs_decompress_chunk(fs, rn, chunk, victim->data);
+    if(ret != SUCCESS)
+    {
+        victim->id = 0;
+        *err = ret;
+        return NULL;
+    }
+
+    victim->id = id;
+    victim->chunk = chunk;
+    victim->last_used = fs->chunk_clock;
+
+    return victim->data;
+}
+
+
+/*
+    romfs_map() - return, through <addr>, the address of the contents of the file at <node> within
+    the romfs image.  Compressed files cannot be mapped.
+*/
+s32 romfs_map(vfs_t * const vfs, fs_node_t * const node, const void **addr)
+{
+    const romfs_fs_t * const fs = (const romfs_fs_t *) vfs->data;
+    const romfs_node_t * const rn = romfs_get_node(fs, node->first_block);
+
+    if(rn == NULL)
+        return -ENOENT;
+
+    if(!(BE2N16(rn->flags) & RN_FILE))
+        return -EISDIR;
+
+    if(BE2N16(rn->flags) & RN_COMPRESSED)
+        return -ENOSYS;
+
+    *addr = fs->image + BE2N32(rn->offset);
+
+    return SUCCESS;
 }
 
 
 s32 romfs_stat(vfs_t *vfs, fs_stat_t *st)
 {
-    UNUSED(vfs);
-    UNUSED(st);
-    return -ENOSYS;
+    const romfs_fs_t * const fs = (const romfs_fs_t *) vfs->data;
+
+    st->total_blocks = (fs->len + BLOCK_SIZE - 1) >> LOG_BLOCK_SIZE;
+    st->free_blocks = 0;
+    st->label = ((const romfs_superblock_t *) fs->image)->label;
+
+    return SUCCESS;
 }
 
 #endif /* WITH_FS_ROMFS */
-
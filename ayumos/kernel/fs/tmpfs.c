@@ -0,0 +1,731 @@
+/*
+    tmpfs (RAM-backed file system) support
+
+    Part of ayumos
+
+
+    (c) Stuart Wallace <stuartw@atom.net>, October 2026.
+
+
+    Node IDs are indices into a table of node pointers, so finding a node is O(1); the entry of an
+    unlinked node is cleared, and reused, lowest first, when a node is next created.  Each directory
+    keeps a list of its children; each file keeps a table of pointers to its chunks, which is
+    extended as the file grows.  File contents are copied directly between the caller's buffer and
+    the chunks, and the driver is flagged VFS_DRIVER_MEMORY_BACKED so that the VFS does not also
+    hold a copy of them in the page cache.  A single semaphore per mount protects the node table
+    and the nodes' contents.  Directory contexts point straight at the directory's node and at its
+    last-returned child, so a node cannot be unlinked while its directory is open.
+*/
+
+#ifdef WITH_FS_TMPFS
+
+#include <kernel/include/error.h>
+#include <kernel/include/fs/node.h>
+#include <kernel/include/fs/tmpfs.h>
+#include <kernel/include/memory/kmalloc.h>
+#include <kernel/include/memory/slab.h>
+#include <klibc/include/string.h>
+#include <klibc/include/strings.h>
+
+
+s32 tmpfs_init();
+s32 tmpfs_mount(vfs_t *vfs);
+s32 tmpfs_unmount(vfs_t *vfs);
+s32 tmpfs_get_root_node(vfs_t *vfs, fs_node_t **node);
+s32 tmpfs_open_dir(vfs_t *vfs, u32 node, void **ctx);
+s32 tmpfs_read_dir(vfs_t *vfs, void *ctx, ks8* const name, fs_node_t *node);
+s32 tmpfs_close_dir(vfs_t *vfs, void *ctx);
+s32 tmpfs_read(vfs_t * const vfs, fs_node_t * const node, void * const buffer, u32 offset,
+               ks32 count);
+s32 tmpfs_write(vfs_t * const vfs, fs_node_t * const node, const void * const buffer, u32 offset,
+                ks32 count);
+s32 tmpfs_reallocate(vfs_t * const vfs, fs_node_t * const node, ks32 new_len);
+s32 tmpfs_stat(vfs_t *vfs, fs_stat_t *st);
+s32 tmpfs_write_node(vfs_t * const vfs, fs_node_t * const node);
+s32 tmpfs_create_node(vfs_t * const vfs, ku32 parent, fs_node_t * const node);
+s32 tmpfs_unlink(vfs_t * const vfs, ku32 parent, const char * const name);
+
+static tmpfs_node_t *tmpfs_get_node(const tmpfs_fs_t * const fs, ku32 id);
+static s32 tmpfs_node_new(tmpfs_fs_t * const fs, ks8 * const name, const fsnode_type_t type,
+                          tmpfs_node_t **node);
+static void tmpfs_node_to_node(const tmpfs_node_t * const tn, fs_node_t * const node);
+static tmpfs_node_t *tmpfs_find(const tmpfs_node_t * const dir, ks8 * const name);
+static s32 tmpfs_extend_chunk_table(tmpfs_node_t * const tn, ku32 nchunks);
+static void tmpfs_free_chunks(tmpfs_fs_t * const fs, tmpfs_node_t * const tn, ku32 first);
+static void tmpfs_node_free(tmpfs_fs_t * const fs, tmpfs_node_t * const tn);
+
+vfs_driver_t g_tmpfs_ops =
+{
+    .name = "tmpfs",
+    .flags = VFS_DRIVER_MEMORY_BACKED,
+    .init = tmpfs_init,
+    .mount = tmpfs_mount,
+    .unmount = tmpfs_unmount,
+    .get_root_node = tmpfs_get_root_node,
+    .open_dir = tmpfs_open_dir,
+    .read_dir = tmpfs_read_dir,
+    .close_dir = tmpfs_close_dir,
+    .read = tmpfs_read,
+    .write = tmpfs_write,
+    .reallocate = tmpfs_reallocate,
+    .stat = tmpfs_stat,
+    .write_node = tmpfs_write_node,
+    .create_node = tmpfs_create_node,
+    .unlink = tmpfs_unlink
+};
+
+
+s32 tmpfs_init()
+{
+    /* Nothing to do here */
+    return SUCCESS;
+}
+
+
+/*
+    tmpfs_mount() - create an empty tmpfs.  The device, if any, is ignored.
+*/
+s32 tmpfs_mount(vfs_t *vfs)
+{
+    tmpfs_fs_t *fs;
+    tmpfs_node_t *root;
+    s32 ret;
+
+    fs = (tmpfs_fs_t *) CHECKED_KCALLOC(1, sizeof(tmpfs_fs_t));
+
+    fs->size_max = TMPFS_SIZE_MAX;
+
+    ret = tmpfs_node_new(fs, ROOT_DIR, FSNODE_TYPE_DIR, &root);
+    if(ret != SUCCESS)
+    {
+        kfree(fs->nodes);
+        kfree(fs);
+        return ret;
+    }
+
+    root->permissions = FS_PERM_UGORWX;
+
+    sem_init(&fs->lock);
+
+    vfs->data = fs;
+    vfs->root_block = TMPFS_ROOT_ID;
+
+    return SUCCESS;
+}
+
+
+/*
+    tmpfs_unmount() - discard a tmpfs and all of its contents.
+*/
+s32 tmpfs_unmount(vfs_t *vfs)
+{
+    tmpfs_fs_t * const fs = (tmpfs_fs_t *) vfs->data;
+    u32 i;
+
+    for(i = 0; i < fs->nnodes; ++i)
+        if(fs->nodes[i] != NULL)
+            tmpfs_node_free(fs, fs->nodes[i]);
+
+    kfree(fs->nodes);
+    sem_destroy(&fs->lock);
+    kfree(fs);
+    vfs->data = NULL;
+
+    return SUCCESS;
+}
+
+
+/*
+    tmpfs_node_new() - allocate a node of type <type>, named <name>, and add it to the node table,
+    in the lowest free entry.  The node is not linked into any directory.
+*/
+static s32 tmpfs_node_new(tmpfs_fs_t * const fs, ks8 * const name, const fsnode_type_t type,
+                          tmpfs_node_t **node)
+{
+    tmpfs_node_t *tn;
+
+    if((fs->first_free == fs->nnodes) && !(fs->nnodes % TMPFS_NODES_INCREMENT))
+    {
+        tmpfs_node_t ** const nodes =
+            krealloc(fs->nodes, (fs->nnodes + TMPFS_NODES_INCREMENT) * sizeof(tmpfs_node_t *));
+
+        if(nodes == NULL)
+            return -ENOMEM;
+
+        fs->nodes = nodes;
+    }
+
+    tn = (tmpfs_node_t *) slab_calloc(sizeof(tmpfs_node_t));
+    if(tn == NULL)
+        return -ENOMEM;
+
+    tn->name = strdup(name);
+    if(tn->name == NULL)
+    {
+        slab_free(tn);
+        return -ENOMEM;
+    }
+
+    tn->type = type;
+    if(type == FSNODE_TYPE_DIR)
+        list_init(&tn->u.children);
+
+    list_init(&tn->sibling);
+
+    fs->nodes[fs->first_free] = tn;
+    tn->id = fs->first_free + 1;
+
+    if(fs->first_free == fs->nnodes)
+        fs->first_free = ++fs->nnodes;
+    else
+        while((++fs->first_free < fs->nnodes) && (fs->nodes[fs->first_free] != NULL))
+            ;
+
+    *node = tn;
+
+    return SUCCESS;
+}
+
+
+/*
+    tmpfs_node_free() - free the node <tn>, its name and, if it is a file, its contents.  The node
+    must already have been removed from the node table and from its directory.
+*/
+static void tmpfs_node_free(tmpfs_fs_t * const fs, tmpfs_node_t * const tn)
+{
+    if(tn->type == FSNODE_TYPE_FILE)
+    {
+        tmpfs_free_chunks(fs, tn, 0);
+        kfree(tn->u.file.chunks);
+    }
+
+    kfree(tn->name);
+    slab_free(tn);
+}
+
+
+/*
+    tmpfs_get_node() - return the node whose ID is <id>, or NULL if there is no such node (including
+    if the node has been unlinked).
+*/
+static tmpfs_node_t *tmpfs_get_node(const tmpfs_fs_t * const fs, ku32 id)
+{
+    return (id && (id <= fs->nnodes)) ? fs->nodes[id - 1] : NULL;
+}
+
+
+/*
+    tmpfs_node_to_node() - populate an fs_node_t with the metadata in a tmpfs_node_t.
+*/
+static void tmpfs_node_to_node(const tmpfs_node_t * const tn, fs_node_t * const node)
+{
+    node->type = tn->type;
+    node->uid = tn->uid;
+    node->gid = tn->gid;
+    node->permissions = tn->permissions;
+    node->flags = tn->flags;
+    node->size = tn->size;
+    node->ctime = tn->ctime;
+    node->mtime = tn->mtime;
+    node->atime = tn->atime;
+    node->first_block = tn->id;
+}
+
+
+s32 tmpfs_get_root_node(vfs_t *vfs, fs_node_t **node)
+{
+    tmpfs_fs_t * const fs = (tmpfs_fs_t *) vfs->data;
+    fs_node_t *root_node;
+    s32 ret;
+
+    ret = fs_node_alloc(&root_node);
+    if(ret != SUCCESS)
+        return ret;
+
+    /* Zero out the node struct - that way we only have to set nonzero fields */
+    bzero(root_node, sizeof(fs_node_t));
+
+    ret = fs_node_set_name(root_node, ROOT_DIR);
+    if(ret != SUCCESS)
+    {
+        fs_node_free(root_node);
+        return ret;
+    }
+
+    sem_acquire(&fs->lock);
+    tmpfs_node_to_node(tmpfs_get_node(fs, TMPFS_ROOT_ID), root_node);
+    sem_release(&fs->lock);
+
+    *node = root_node;
+
+    return SUCCESS;
+}
+
+
+/*
+    tmpfs_open_dir() - prepare to iterate over the directory whose node ID is <id>.
+*/
+s32 tmpfs_open_dir(vfs_t *vfs, u32 id, void **ctx)
+{
+    tmpfs_fs_t * const fs = (tmpfs_fs_t *) vfs->data;
+    tmpfs_node_t *dir;
+    tmpfs_dir_ctx_t *dir_ctx;
+
+    dir_ctx = (tmpfs_dir_ctx_t *) CHECKED_KCALLOC(1, sizeof(tmpfs_dir_ctx_t));
+
+    sem_acquire(&fs->lock);
+
+    dir = tmpfs_get_node(fs, id);
+    if((dir == NULL) || (dir->type != FSNODE_TYPE_DIR))
+    {
+        sem_release(&fs->lock);
+        kfree(dir_ctx);
+        return (dir == NULL) ? -ENOENT : -ENOTDIR;
+    }
+
+    ++dir->nopen;
+
+    sem_release(&fs->lock);
+
+    dir_ctx->dir = dir;
+    dir_ctx->pos = &dir->u.children;
+
+    *ctx = dir_ctx;
+
+    return SUCCESS;
+}
+
+
+/*
+    tmpfs_find() - return the child of <dir> named <name>, or NULL if there is no such child.  The
+    caller must hold the file system lock.
+*/
+static tmpfs_node_t *tmpfs_find(const tmpfs_node_t * const dir, ks8 * const name)
+{
+    tmpfs_node_t *tn;
+
+    list_for_each_entry(tn, &dir->u.children, sibling)
+        if(!strcmp(tn->name, name))
+            return tn;
+
+    return NULL;
+}
+
+
+/*
+    tmpfs_read_dir() - if <name> is NULL, return the next entry in the directory; otherwise, look up
+    the entry named <name>.  If <node> is NULL, only report whether the entry exists.  Fail with
+    ENOENT if there are no more entries, or no entry named <name>.  Entries are returned in the
+    order in which they were created.
+*/
+s32 tmpfs_read_dir(vfs_t *vfs, void *ctx, ks8 * const name, fs_node_t *node)
+{
+    tmpfs_fs_t * const fs = (tmpfs_fs_t *) vfs->data;
+    tmpfs_dir_ctx_t * const dir_ctx = (tmpfs_dir_ctx_t *) ctx;
+    tmpfs_node_t *tn;
+    s32 ret = SUCCESS;
+
+    sem_acquire(&fs->lock);
+
+    if(name != NULL)
+        tn = tmpfs_find(dir_ctx->dir, name);
+    else if(dir_ctx->pos->next != &dir_ctx->dir->u.children)
+    {
+        dir_ctx->pos = dir_ctx->pos->next;
+        tn = list_entry(dir_ctx->pos, tmpfs_node_t, sibling);
+    }
+    else
+        tn = NULL;
+
+    if(tn == NULL)
+        ret = -ENOENT;
+    else if(node != NULL)
+    {
+        ret = fs_node_set_name(node, tn->name);
+        if(ret == SUCCESS)
+            tmpfs_node_to_node(tn, node);
+    }
+
+    sem_release(&fs->lock);
+
+    return ret;
+}
+
+
+s32 tmpfs_close_dir(vfs_t *vfs, void *ctx)
+{
+    tmpfs_fs_t * const fs = (tmpfs_fs_t *) vfs->data;
+
+    sem_acquire(&fs->lock);
+    --((tmpfs_dir_ctx_t *) ctx)->dir->nopen;
+    sem_release(&fs->lock);
+
+    kfree(ctx);
+
+    return SUCCESS;
+}
+
+
+/*
+    tmpfs_read() - read <count> blocks, starting from block <offset>, into <buffer> from the file
+    indicated by <node>.  Holes read as zeroes, and the final block of the file is zero-padded.
+*/
+s32 tmpfs_read(vfs_t * const vfs, fs_node_t * const node, void * const buffer, u32 offset,
+               ks32 count)
+{
+    tmpfs_fs_t * const fs = (tmpfs_fs_t *) vfs->data;
+    const tmpfs_node_t *tn;
+    u8 *buf = (u8 *) buffer;
+    u32 pos, len, remaining;
+
+    pos = offset << LOG_BLOCK_SIZE;
+    if((count <= 0) || (pos >= node->size))
+        return 0;
+
+    remaining = len = MIN((u32) count << LOG_BLOCK_SIZE, node->size - pos);
+
+    sem_acquire(&fs->lock);
+
+    tn = tmpfs_get_node(fs, node->first_block);
+    if((tn == NULL) || (tn->type != FSNODE_TYPE_FILE))
+    {
+        sem_release(&fs->lock);
+        return (tn == NULL) ? -ENOENT : -EISDIR;
+    }
+
+    while(remaining)
+    {
+        ku32 chunk = pos >> TMPFS_LOG_CHUNK_SIZE, chunk_offset = pos & (TMPFS_CHUNK_SIZE - 1),
+             n = MIN(remaining, TMPFS_CHUNK_SIZE - chunk_offset);
+
+        if((chunk < tn->u.file.nchunks) && (tn->u.file.chunks[chunk] != NULL))
+            memcpy(buf, tn->u.file.chunks[chunk] + chunk_offset, n);
+        else
+            bzero(buf, n);
+
+        buf += n;
+        pos += n;
+        remaining -= n;
+    }
+
+    sem_release(&fs->lock);
+
+    if(len & (BLOCK_SIZE - 1))
+        bzero(buf, BLOCK_SIZE - (len & (BLOCK_SIZE - 1)));
+
+    return (len + BLOCK_SIZE - 1) >> LOG_BLOCK_SIZE;
+}
+
+
+/*
+    tmpfs_extend_chunk_table() - ensure that the chunk table of the file <tn> has at least <nchunks>
+    entries.  The table is grown geometrically, so that a file written sequentially does not
+    reallocate its table on every write.
+*/
+static s32 tmpfs_extend_chunk_table(tmpfs_node_t * const tn, ku32 nchunks)
+{
+    u8 **chunks;
+    u32 n;
+
+    if(nchunks <= tn->u.file.nchunks)
+        return SUCCESS;
+
+    n = MAX(nchunks, tn->u.file.nchunks << 1);
+
+    chunks = (u8 **) krealloc(tn->u.file.chunks, n * sizeof(u8 *));
+    if(chunks == NULL)
+        return -ENOMEM;
+
+    bzero(chunks + tn->u.file.nchunks, (n - tn->u.file.nchunks) * sizeof(u8 *));
+
+    tn->u.file.chunks = chunks;
+    tn->u.file.nchunks = n;
+
+    return SUCCESS;
+}
+
+
+/*
+    tmpfs_write() - write <count> blocks, starting from block <offset>, from <buffer> to the file
+    indicated by <node>.  Chunks are allocated for any holes in the range written; the parts of new
+    chunks not covered by the request are zeroed.  If the file system's size limit is reached, the
+    number of blocks written so far is returned, or ENOSPC if none were written.
+*/
+s32 tmpfs_write(vfs_t * const vfs, fs_node_t * const node, const void * const buffer, u32 offset,
+                ks32 count)
+{
+    tmpfs_fs_t * const fs = (tmpfs_fs_t *) vfs->data;
+    const u8 *buf = (const u8 *) buffer;
+    tmpfs_node_t *tn;
+    u32 pos, remaining;
+    s32 ret = SUCCESS;
+
+    if(count < 0)
+        return -EINVAL;
+
+    pos = offset << LOG_BLOCK_SIZE;
+    remaining = (u32) count << LOG_BLOCK_SIZE;
+
+    sem_acquire(&fs->lock);
+
+    tn = tmpfs_get_node(fs, node->first_block);
+    if((tn == NULL) || (tn->type != FSNODE_TYPE_FILE))
+    {
+        sem_release(&fs->lock);
+        return (tn == NULL) ? -ENOENT : -EISDIR;
+    }
+
+    if(count)
+        ret = tmpfs_extend_chunk_table(tn, ((pos + remaining - 1) >> TMPFS_LOG_CHUNK_SIZE) + 1);
+
+    while((ret == SUCCESS) && remaining)
+    {
+        ku32 chunk = pos >> TMPFS_LOG_CHUNK_SIZE, chunk_offset = pos & (TMPFS_CHUNK_SIZE - 1),
+             n = MIN(remaining, TMPFS_CHUNK_SIZE - chunk_offset);
+        u8 *data = tn->u.file.chunks[chunk];
+
+        if(data == NULL)
+        {
+            if(fs->used + TMPFS_CHUNK_SIZE > fs->size_max)
+            {
+                ret = -ENOSPC;
+                break;
+            }
+
+            /* A chunk which is only partly written must read as zeroes elsewhere */
+            data = (n == TMPFS_CHUNK_SIZE) ? kmalloc(TMPFS_CHUNK_SIZE)
+                                           : kcalloc(1, TMPFS_CHUNK_SIZE);
+            if(data == NULL)
+            {
+                ret = -ENOMEM;
+                break;
+            }
+
+            tn->u.file.chunks[chunk] = data;
+            fs->used += TMPFS_CHUNK_SIZE;
+        }
+
+        memcpy(data + chunk_offset, buf, n);
+
+        buf += n;
+        pos += n;
+        remaining -= n;
+    }
+
+    sem_release(&fs->lock);
+
+    /* Report a partial write, or an error if nothing was written */
+    if((buf == (const u8 *) buffer) && count)
+        return ret;
+
+    return (buf - (const u8 *) buffer) >> LOG_BLOCK_SIZE;
+}
+
+
+/*
+    tmpfs_free_chunks() - free the chunks of the file <tn>, starting with chunk <first>.  The caller
+    must hold the file system lock.
+*/
+static void tmpfs_free_chunks(tmpfs_fs_t * const fs, tmpfs_node_t * const tn, ku32 first)
+{
+    u32 i;
+
+    for(i = first; i < tn->u.file.nchunks; ++i)
+    {
+        if(tn->u.file.chunks[i] != NULL)
+        {
+            kfree(tn->u.file.chunks[i]);
+            tn->u.file.chunks[i] = NULL;
+            fs->used -= TMPFS_CHUNK_SIZE;
+        }
+    }
+}
+
+
+/*
+    tmpfs_reallocate() - change the space allocated to a file.  If the file is truncated to
+    <new_len> bytes, the chunks beyond the new end of the file are freed, and the remainder of the
+    final chunk is zeroed so that it reads as zeroes if the file is later extended.  Extending a
+    file is a no-op: the file becomes sparse, and chunks are allocated when they are written.
+*/
+s32 tmpfs_reallocate(vfs_t * const vfs, fs_node_t * const node, ks32 new_len)
+{
+    tmpfs_fs_t * const fs = (tmpfs_fs_t *) vfs->data;
+    tmpfs_node_t *tn;
+    u32 keep;
+
+    if(new_len < 0)
+        return -EINVAL;
+
+    sem_acquire(&fs->lock);
+
+    tn = tmpfs_get_node(fs, node->first_block);
+    if((tn == NULL) || (tn->type != FSNODE_TYPE_FILE))
+    {
+        sem_release(&fs->lock);
+        return (tn == NULL) ? -ENOENT : -EISDIR;
+    }
+
+    keep = ((u32) new_len + TMPFS_CHUNK_SIZE - 1) >> TMPFS_LOG_CHUNK_SIZE;
+    tmpfs_free_chunks(fs, tn, keep);
+
+    if((new_len & (TMPFS_CHUNK_SIZE - 1)) && (keep <= tn->u.file.nchunks)
+       && (tn->u.file.chunks[keep - 1] != NULL))
+    {
+        ku32 tail = new_len & (TMPFS_CHUNK_SIZE - 1);
+        bzero(tn->u.file.chunks[keep - 1] + tail, TMPFS_CHUNK_SIZE - tail);
+    }
+
+    if((u32) new_len < node->size)
+    {
+        node->size = new_len;
+        tn->size = new_len;
+    }
+
+    sem_release(&fs->lock);
+
+    return SUCCESS;
+}
+
+
+/*
+    tmpfs_write_node() - store the metadata of <node> in its tmpfs node.
+*/
+s32 tmpfs_write_node(vfs_t * const vfs, fs_node_t * const node)
+{
+    tmpfs_fs_t * const fs = (tmpfs_fs_t *) vfs->data;
+    tmpfs_node_t *tn;
+
+    sem_acquire(&fs->lock);
+
+    tn = tmpfs_get_node(fs, node->first_block);
+    if(tn == NULL)
+    {
+        sem_release(&fs->lock);
+        return -ENOENT;
+    }
+
+    tn->uid = node->uid;
+    tn->gid = node->gid;
+    tn->permissions = node->permissions;
+    tn->flags = node->flags;
+    tn->ctime = node->ctime;
+    tn->mtime = node->mtime;
+    tn->atime = node->atime;
+
+    if(tn->type == FSNODE_TYPE_FILE)
+        tn->size = node->size;
+
+    sem_release(&fs->lock);
+
+    return SUCCESS;
+}
+
+
+/*
+    tmpfs_create_node() - create a new, empty file or directory, described by <node>, in the
+    directory whose node ID is <parent>.  On success, the new node's ID is stored in
+    node->first_block.
+*/
+s32 tmpfs_create_node(vfs_t * const vfs, ku32 parent, fs_node_t * const node)
+{
+    tmpfs_fs_t * const fs = (tmpfs_fs_t *) vfs->data;
+    tmpfs_node_t *dir, *tn;
+    s32 ret;
+
+    if((node->name == NULL) || !node->name[0])
+        return -EINVAL;
+
+    sem_acquire(&fs->lock);
+
+    dir = tmpfs_get_node(fs, parent);
+    if(dir == NULL)
+        ret = -ENOENT;
+    else if(dir->type != FSNODE_TYPE_DIR)
+        ret = -ENOTDIR;
+    else if(tmpfs_find(dir, node->name) != NULL)
+        ret = -EEXIST;
+    else
+        ret = tmpfs_node_new(fs, node->name, node->type, &tn);
+
+    if(ret == SUCCESS)
+    {
+        node->size = 0;
+        node->first_block = tn->id;
+
+        tn->uid = node->uid;
+        tn->gid = node->gid;
+        tn->permissions = node->permissions;
+        tn->flags = node->flags;
+        tn->ctime = node->ctime;
+        tn->mtime = node->mtime;
+        tn->atime = node->atime;
+
+        list_insert(&tn->sibling, &dir->u.children);
+    }
+
+    sem_release(&fs->lock);
+
+    return ret;
+}
+
+
+/*
+    tmpfs_unlink() - remove the entry <name> from the directory whose node ID is <parent>, and free
+    the node it refers to, together with its contents.  A directory must be empty.  Fails with
+    -EBUSY if the parent directory, or the node itself, is open.  The node's ID becomes free for
+    reuse.
+*/
+s32 tmpfs_unlink(vfs_t * const vfs, ku32 parent, const char * const name)
+{
+    tmpfs_fs_t * const fs = (tmpfs_fs_t *) vfs->data;
+    tmpfs_node_t *dir, *tn = NULL;
+    s32 ret = SUCCESS;
+
+    sem_acquire(&fs->lock);
+
+    dir = tmpfs_get_node(fs, parent);
+    if(dir == NULL)
+        ret = -ENOENT;
+    else if(dir->type != FSNODE_TYPE_DIR)
+        ret = -ENOTDIR;
+    else if((tn = tmpfs_find(dir, name)) == NULL)
+        ret = -ENOENT;
+    else if(dir->nopen || ((tn->type == FSNODE_TYPE_DIR) && tn->nopen))
+        ret = -EBUSY;
+    else if((tn->type == FSNODE_TYPE_DIR) && !list_is_empty(&tn->u.children))
+        ret = -ENOTEMPTY;
+
+    if(ret == SUCCESS)
+    {
+        list_delete(&tn->sibling);
+
+        fs->nodes[tn->id - 1] = NULL;
+        if((tn->id - 1) < fs->first_free)
+            fs->first_free = tn->id - 1;
+
+        tmpfs_node_free(fs, tn);
+    }
+
+    sem_release(&fs->lock);
+
+    return ret;
+}
+
+
+/*
+    tmpfs_stat() - return information about a tmpfs.  Sizes are expressed in blocks of BLOCK_SIZE
+    bytes.
+*/
+s32 tmpfs_stat(vfs_t *vfs, fs_stat_t *st)
+{
+    const tmpfs_fs_t * const fs = (const tmpfs_fs_t *) vfs->data;
+
+    st->total_blocks = fs->size_max >> LOG_BLOCK_SIZE;
+    st->free_blocks = (fs->size_max - fs->used) >> LOG_BLOCK_SIZE;
+    st->label = NULL;
+
+    return SUCCESS;
+}
+
+#endif /* WITH_FS_TMPFS */
@@ -7,13 +7,17 @@
     (c) Stuart Wallace <stuartw@atom.net>, July 2012.
 */
 
+#include <kernel/include/device/block.h>
 #include <kernel/include/device/devctl.h>
 #include <kernel/include/device/device.h>
 #include <kernel/include/device/nvram.h>
+#include <kernel/include/fs/aio.h>
+#include <kernel/include/fs/dcache.h>
 #include <kernel/include/fs/vfs.h>
 #include <kernel/include/fs/mount.h>
 #include <kernel/include/memory/primitives.h>
 #include <kernel/include/memory/slab.h>
+#include <kernel/include/process.h>
 
 
 /*
@@ -22,12 +26,16 @@
 #include <kernel/fs/fat/fat.h>
 #include <kernel/fs/ext2/ext2.h>
 #include <kernel/include/fs/romfs.h>
+#include <kernel/include/fs/tmpfs.h>
 
 vfs_driver_t * g_fs_drivers[] =
 {
 #ifdef WITH_FS_ROMFS
     &g_romfs_ops,
 #endif
+#ifdef WITH_FS_TMPFS
+    &g_tmpfs_ops,
+#endif
 #ifdef WITH_FS_FAT
     &g_fat_ops,
 #endif
@@ -44,12 +52,30 @@ static s32 vfs_default_get_root_node(vfs_t *vfs, fs_node_t **node);
 static s32 vfs_default_open_dir(vfs_t *vfs, u32 node, void **ctx);
 static s32 vfs_default_read_dir(vfs_t *vfs, void *ctx, ks8 * const name, fs_node_t *node);
 static s32 vfs_default_close_dir(vfs_t *vfs, void *ctx);
+static s32 vfs_default_read_dir_multi(vfs_t *vfs, void *ctx, vfs_dirent_t *buf, ku32 len);
 static s32 vfs_default_read(vfs_t * const vfs, fs_node_t * const node, void * const buffer,
                             u32 offset, ks32 count);
 static s32 vfs_default_write(vfs_t * const vfs, fs_node_t * const node, const void * const buffer,
                              u32 offset, ks32 count);
 static s32 vfs_default_reallocate(vfs_t * const vfs, fs_node_t * const node, ks32 new_len);
 static s32 vfs_default_stat(vfs_t *vfs, fs_stat_t *st);
+static s32 vfs_default_write_node(vfs_t * const vfs, fs_node_t * const node);
+static s32 vfs_default_map(vfs_t * const vfs, fs_node_t * const node, const void **addr);
+static s32 vfs_default_create_node(vfs_t * const vfs, ku32 parent, fs_node_t * const node);
+static s32 vfs_default_unlink(vfs_t * const vfs, ku32 parent, const char * const name);
+
+static u8 *vfs_get_scratch_block();
+static void vfs_node_extend(fs_node_t * const node, ku32 new_size);
+static s32 vfs_read_page(vfs_t * const vfs, fs_node_t * const node, ku32 block, void * const buf);
+static s32 vfs_read_blocks(vfs_t * const vfs, fs_node_t * const node, u8 * const buf, ku32 block,
+                           ku32 nblocks);
+static s32 vfs_write_page(vfs_t * const vfs, fs_node_t * const node, ku32 block,
+                          const void * const buf);
+static s32 vfs_write_partial(vfs_t * const vfs, fs_node_t * const node, const void * const buffer,
+                             ku32 block, ku32 block_offset, ku32 len);
+static s32 vfs_write_blocks(vfs_t * const vfs, fs_node_t * const node, const u8 * const buf,
+                            ku32 block, ku32 nblocks);
+static s32 vfs_page_writeback(void *arg, ku32 page, const void * const buf);
 
 
 s32 vfs_init()
@@ -77,10 +103,16 @@ s32 vfs_init()
             if(NULL == pdrv->open_dir)      pdrv->open_dir      = vfs_default_open_dir;
             if(NULL == pdrv->read_dir)      pdrv->read_dir      = vfs_default_read_dir;
             if(NULL == pdrv->close_dir)     pdrv->close_dir     = vfs_default_close_dir;
+            if(NULL == pdrv->read_dir_multi)
+                pdrv->read_dir_multi = vfs_default_read_dir_multi;
             if(NULL == pdrv->read)          pdrv->read          = vfs_default_read;
             if(NULL == pdrv->write)         pdrv->write         = vfs_default_write;
             if(NULL == pdrv->reallocate)    pdrv->reallocate    = vfs_default_reallocate;
             if(NULL == pdrv->stat)          pdrv->stat          = vfs_default_stat;
+            if(NULL == pdrv->write_node)    pdrv->write_node    = vfs_default_write_node;
+            if(NULL == pdrv->map)           pdrv->map           = vfs_default_map;
+            if(NULL == pdrv->create_node)   pdrv->create_node   = vfs_default_create_node;
+            if(NULL == pdrv->unlink)        pdrv->unlink        = vfs_default_unlink;
 
             printf("vfs: initialised '%s' fs driver\n", pdrv->name);
         }
@@ -91,10 +123,22 @@ s32 vfs_init()
         }
     }
 
+    ret = fs_node_cache_init();
+    if(ret != SUCCESS)
+        return ret;
+
+    ret = dcache_init();
+    if(ret != SUCCESS)
+        return ret;
+
     ret = mount_init();
     if(ret != SUCCESS)
         return ret;
 
+    ret = aio_init();
+    if(ret != SUCCESS)
+        return ret;
+
     /* Find rootfs device */
     ret = nvram_bpb_read(&bpb);
     if(ret != SUCCESS)
@@ -169,10 +213,11 @@ s32 vfs_detach(vfs_t *vfs)
 {
     s32 ret;
 
-    ret = vfs->driver->unmount(vfs);
+    ret = vfs_unmount(vfs);
     if(ret != SUCCESS)
         return ret;
 
+    dcache_invalidate_vfs(vfs);
     slab_free(vfs);
 
     return SUCCESS;
@@ -235,6 +280,56 @@ static s32 vfs_default_close_dir(vfs_t *vfs, void *ctx)
 }
 
 
+/*
+    vfs_default_read_dir_multi() - unlike the other defaults, this does not return -ENOSYS: it
+    emulates read_dir_multi using the driver's read_dir function.  Entries are only read while a
+    record of the maximum length would fit in the remaining space, because an entry cannot be
+    "un-read" once read_dir has returned it.
+*/
+static s32 vfs_default_read_dir_multi(vfs_t *vfs, void *ctx, vfs_dirent_t *buf, ku32 len)
+{
+    fs_node_t node;
+    vfs_dirent_t *de = buf;
+    u32 used = 0;
+    s32 ret = -ENOENT;
+
+    bzero(&node, sizeof(node));
+
+    while(len - used >= VFS_DIRENT_MAX_LEN)
+    {
+        u32 name_len;
+
+        ret = vfs->driver->read_dir(vfs, ctx, NULL, &node);
+        if(ret != SUCCESS)
+            break;
+
+        name_len = MIN(strlen(node.name), (u32) NAME_MAX_LEN);
+
+        de->len = VFS_DIRENT_LEN(name_len);
+        de->type = node.type;
+        de->name_len = name_len;
+        de->permissions = node.permissions;
+        de->flags = node.flags;
+        de->size = node.size;
+        de->mtime = node.mtime;
+        de->first_block = node.first_block;
+        memcpy(de->name, node.name, name_len);
+        de->name[name_len] = '\0';
+
+        used += de->len;
+        de = VFS_DIRENT_NEXT(de);
+    }
+
+    kfree(node.name);
+
+    /* Report the end of the directory, or an error, only if no entries were read */
+    if(used || (ret == -ENOENT))
+        return used;
+
+    return ret;
+}
+
+
 static s32 vfs_default_read(vfs_t * const vfs, fs_node_t * const node, void * const buffer, u32 offset,
                             ks32 count)
 {
@@ -278,6 +373,45 @@ static s32 vfs_default_stat(vfs_t *vfs, fs_stat_t *st)
 
     return -ENOSYS;
 }
+
+
+static s32 vfs_default_write_node(vfs_t * const vfs, fs_node_t * const node)
+{
+    UNUSED(vfs);
+    UNUSED(node);
+
+    return -ENOSYS;
+}
+
+
+static s32 vfs_default_map(vfs_t * const vfs, fs_node_t * const node, const void **addr)
+{
+    UNUSED(vfs);
+    UNUSED(node);
+    UNUSED(addr);
+
+    return -ENOSYS;
+}
+
+
+static s32 vfs_default_create_node(vfs_t * const vfs, ku32 parent, fs_node_t * const node)
+{
+    UNUSED(vfs);
+    UNUSED(parent);
+    UNUSED(node);
+
+    return -ENOSYS;
+}
+
+
+static s32 vfs_default_unlink(vfs_t * const vfs, ku32 parent, const char * const name)
+{
+    UNUSED(vfs);
+    UNUSED(parent);
+    UNUSED(name);
+
+    return -ENOSYS;
+}
 /* === END default handlers for functions in vfs_driver_t === */
 
 
@@ -301,10 +435,17 @@ vfs_driver_t *vfs_get_driver_by_name(ks8 * const name)
 
 
 /*
-    vfs_unmount() - unmount the device associated with the VFS at <vfs>.
+    vfs_unmount() - unmount the device associated with the VFS at <vfs>, after writing back any dirty
+    node metadata.  Fails with EBUSY if any of the VFS' nodes are in use.
 */
 s32 vfs_unmount(vfs_t *vfs)
 {
+    s32 ret;
+
+    ret = fs_node_cache_flush(vfs);
+    if(ret != SUCCESS)
+        return ret;
+
     return vfs->driver->unmount(vfs);
 }
 
@@ -326,6 +467,7 @@ s32 vfs_open_dir(vfs_t * const vfs, fs_node_t * const node, vfs_dir_ctx_t **ctx)
         return -ENOMEM;
 
     context->vfs = vfs;
+    context->pos = 0;
 
     ret = vfs->driver->open_dir(vfs, node->first_block, &(context->ctx));
     if(ret != SUCCESS)
@@ -342,11 +484,18 @@ s32 vfs_open_dir(vfs_t * const vfs, fs_node_t * const node, vfs_dir_ctx_t **ctx)
 
 /*
     vfs_get_root_node() - get the "root node" (i.e. the root directory) of the supplied VFS; return
-    it through <*node>.
+    it through <*node>.  The node must be released with fs_node_put().
 */
 s32 vfs_get_root_node(vfs_t *vfs, fs_node_t **node)
 {
-    return vfs->driver->get_root_node(vfs, node);
+    fs_node_t *root;
+    s32 ret;
+
+    ret = vfs->driver->get_root_node(vfs, &root);
+    if(ret != SUCCESS)
+        return ret;
+
+    return fs_node_get(vfs, root, node);
 }
 
 
@@ -355,7 +504,76 @@ s32 vfs_get_root_node(vfs_t *vfs, fs_node_t **node)
 */
 s32 vfs_read_dir(vfs_dir_ctx_t *ctx, ks8 * const name, fs_node_t *node)
 {
-    return ctx->vfs->driver->read_dir(ctx->vfs, ctx->ctx, name, node);
+    ks32 ret = ctx->vfs->driver->read_dir(ctx->vfs, ctx->ctx, name, node);
+
+    if((ret == SUCCESS) && (name == NULL))
+        ++ctx->pos;
+
+    return ret;
+}
+
+
+/*
+    vfs_read_dir_multi() - read as many entries as will fit from a directory "opened" by
+    vfs_open_dir() into the <len>-byte buffer <buf>, as a sequence of vfs_dirent_t records.  Return
+    the number of bytes used, or zero at the end of the directory.  <len> must be at least
+    VFS_DIRENT_MAX_LEN, so that any entry will fit.
+*/
+s32 vfs_read_dir_multi(vfs_dir_ctx_t *ctx, vfs_dirent_t *buf, ku32 len)
+{
+    const vfs_dirent_t *de;
+    s32 ret;
+
+    if(len < VFS_DIRENT_MAX_LEN)
+        return -EINVAL;
+
+    ret = ctx->vfs->driver->read_dir_multi(ctx->vfs, ctx->ctx, buf, len);
+
+    /* Count the entries read, if the driver cannot report its position in the directory */
+    if((ret > 0) && (ctx->vfs->driver->tell_dir == NULL))
+        for(de = buf; (u8 *) de < (u8 *) buf + ret; de = VFS_DIRENT_NEXT(de))
+            ++ctx->pos;
+
+    return ret;
+}
+
+
+/*
+    vfs_tell_dir() - store in <*pos> the position of the next entry to be read from a directory
+    "opened" by vfs_open_dir().  The position is a cookie which may be passed to vfs_seek_dir(),
+    possibly after the directory has been closed and reopened; it is a byte offset into the
+    directory if the driver supports tell_dir, or otherwise the number of entries read so far.
+*/
+s32 vfs_tell_dir(vfs_dir_ctx_t *ctx, u32 *pos)
+{
+    if(ctx->vfs->driver->tell_dir != NULL)
+        return ctx->vfs->driver->tell_dir(ctx->vfs, ctx->ctx, pos);
+
+    *pos = ctx->pos;
+    return SUCCESS;
+}
+
+
+/*
+    vfs_seek_dir() - move a directory "opened" by vfs_open_dir() to the position <pos>, previously
+    obtained from vfs_tell_dir().  If the driver does not support seek_dir, this is emulated by
+    skipping entries, which is only possible in the forward direction.  Seeking past the end of
+    the directory is not an error; the next read reports the end of the directory.
+*/
+s32 vfs_seek_dir(vfs_dir_ctx_t *ctx, ku32 pos)
+{
+    s32 ret = SUCCESS;
+
+    if(ctx->vfs->driver->seek_dir != NULL)
+        return ctx->vfs->driver->seek_dir(ctx->vfs, ctx->ctx, pos);
+
+    if(pos < ctx->pos)
+        return -EINVAL;
+
+    while((ctx->pos < pos) && ((ret = vfs_read_dir(ctx, NULL, NULL)) == SUCCESS))
+        ;
+
+    return (ret == -ENOENT) ? SUCCESS : ret;
 }
 
 
@@ -373,56 +591,397 @@ s32 vfs_close_dir(vfs_dir_ctx_t *ctx)
 }
 
 
+/*
+    vfs_get_scratch_block() - return a pointer to the current process' BLOCK_SIZE-byte scratch
+    buffer, allocating it if necessary.  The buffer is used for the partial blocks at the start and
+    end of an unaligned transfer.  Returns NULL if the buffer cannot be allocated.
+*/
+static u8 *vfs_get_scratch_block()
+{
+    proc_t * const proc = proc_current();
+
+    if(proc->fs_scratch == NULL)
+        proc->fs_scratch = kmalloc(BLOCK_SIZE);
+
+    return (u8 *) proc->fs_scratch;
+}
+
+
+/*
+    vfs_read_page() - read block <block> of <node> into <buf>, from the page cache if possible.
+    Returns 1 if the block was read, or the (zero or negative) value returned by the driver.
+*/
+static s32 vfs_read_page(vfs_t * const vfs, fs_node_t * const node, ku32 block, void * const buf)
+{
+    s32 ret;
+
+    if(vfs->driver->flags & VFS_DRIVER_MEMORY_BACKED)
+        return vfs->driver->read(vfs, node, buf, block, 1);
+
+    if(block_cache_page_read(node, block, buf) == SUCCESS)
+        return 1;
+
+    ret = vfs->driver->read(vfs, node, buf, block, 1);
+    if(ret == 1)
+    {
+        block_cache_page_fill(node, block, buf);
+        node->pages |= FS_NODE_PAGES_CACHED;
+    }
+
+    return ret;
+}
+
+
+/*
+    vfs_read_blocks() - read <nblocks> whole blocks, starting at block <block> of <node>, into
+    <buf>.  Blocks present in the page cache are copied from it; each run of uncached blocks is
+    read directly into <buf> by a single call to the driver, then added to the page cache.  Returns
+    the number of blocks read, or a negative error code if no blocks were read.
+*/
+static s32 vfs_read_blocks(vfs_t * const vfs, fs_node_t * const node, u8 * const buf, ku32 block,
+                           ku32 nblocks)
+{
+    u32 i, j, k;
+    s32 ret;
+
+    if(vfs->driver->flags & VFS_DRIVER_MEMORY_BACKED)
+        return vfs->driver->read(vfs, node, buf, block, nblocks);
+
+    for(i = 0; i < nblocks;)
+    {
+        if(block_cache_page_read(node, block + i, buf + (i * BLOCK_SIZE)) == SUCCESS)
+        {
+            ++i;
+            continue;
+        }
+
+        /* Find the end of this run of uncached blocks.  Block j, if present, is copied. */
+        for(j = i + 1; (j < nblocks)
+            && (block_cache_page_read(node, block + j, buf + (j * BLOCK_SIZE)) != SUCCESS); ++j)
+            ;
+
+        ret = vfs->driver->read(vfs, node, buf + (i * BLOCK_SIZE), block + i, j - i);
+        if(ret < 0)
+            return i ? (s32) i : ret;
+
+        for(k = 0; k < (u32) ret; ++k)
+            block_cache_page_fill(node, block + i + k, buf + ((i + k) * BLOCK_SIZE));
+
+        node->pages |= FS_NODE_PAGES_CACHED;
+
+        if((u32) ret < (j - i))
+            return i + ret;         /* Partial read */
+
+        i = (j < nblocks) ? j + 1 : j;
+    }
+
+    return nblocks;
+}
+
+
 /*
     vfs_read() - read <count> bytes, starting at <offset>, from the specified <node> into <buffer>.
     The block drivers deal only with block-sized transfers, so the VFS layer does the necessary work
-    to translate non-block-aligned read requests into block-aligned ones.
+    to translate non-block-aligned read requests into block-aligned ones.  Data is read through the
+    page cache, so repeated reads of a file are served from memory.  Whole blocks which miss the
+    cache are read directly into <buffer>; partial blocks at the start and end of the request are
+    read into the current process' scratch block, and the requested part of each is copied into
+    <buffer>.  Files whose contents are directly addressable (see vfs_map()) bypass the page cache,
+    and are copied straight into <buffer>; so do files on memory-backed file systems (see
+    VFS_DRIVER_MEMORY_BACKED), which are read straight from the driver.
 */
 s32 vfs_read(vfs_t * const vfs, fs_node_t * const node, void * const buffer, ku32 offset,
              ks32 count)
 {
-    u32 block;
-    s32 ret, nblocks;
-    u8 *buf;
-    ku32 block_offset = offset % BLOCK_SIZE;
-    s32 count_;
+    u8 *buf = (u8 *) buffer, *scratch;
+    u32 block, block_offset, remaining, nblocks, len;
+    const void *addr;
+    s32 ret;
+
+    if(count < 0)
+        return -EINVAL;
+
+    /* Don't read beyond the end of the file */
+    if(offset >= node->size)
+        return 0;
 
+    remaining = MIN((u32) count, node->size - offset);
+
+    if(vfs->driver->map(vfs, node, &addr) == SUCCESS)
+    {
+        memcpy(buffer, (ku8 *) addr + offset, remaining);
+        return remaining;
+    }
     block = offset / BLOCK_SIZE;
-    nblocks = (block_offset + count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    block_offset = offset % BLOCK_SIZE;
 
-    buf = umalloc(nblocks * BLOCK_SIZE);
+    /* Partial block at the start of the request */
+    if(block_offset || (remaining < BLOCK_SIZE))
+    {
+        scratch = vfs_get_scratch_block();
+        if(scratch == NULL)
+            return -ENOMEM;
 
-    if(buf == NULL)
-        return -ENOMEM;
+        ret = vfs_read_page(vfs, node, block++, scratch);
+        if(ret < 1)
+            return ret;
+
+        len = MIN(BLOCK_SIZE - block_offset, remaining);
+        memcpy(buf, scratch + block_offset, len);
+
+        buf += len;
+        remaining -= len;
+    }
 
-    ret = vfs->driver->read(vfs, node, buf, block, nblocks);
-    if(ret < nblocks)
+    /* Whole blocks */
+    nblocks = remaining / BLOCK_SIZE;
+    if(nblocks)
     {
-        if(ret <= 0)
+        ret = vfs_read_blocks(vfs, node, buf, block, nblocks);
+        if(ret < 0)
+            return (buf == (u8 *) buffer) ? ret : buf - (u8 *) buffer;
+
+        buf += ret * BLOCK_SIZE;
+
+        if((u32) ret < nblocks)
+            return buf - (u8 *) buffer;         /* Partial read */
+
+        block += nblocks;
+        remaining -= nblocks * BLOCK_SIZE;
+    }
+
+    /* Partial block at the end of the request */
+    if(remaining)
+    {
+        scratch = vfs_get_scratch_block();
+        if(scratch == NULL)
+            return -ENOMEM;
+
+        ret = vfs_read_page(vfs, node, block, scratch);
+        if(ret == 1)
         {
-            /* Read error, or zero bytes read */
-            ufree(buf);
-            return ret;
+            memcpy(buf, scratch, remaining);
+            buf += remaining;
         }
-        else
+        else if((ret < 0) && (buf == (u8 *) buffer))
+            return ret;
+    }
+
+    return buf - (u8 *) buffer;
+}
+
+
+/*
+    vfs_map() - if the contents of the file at <node> are held in directly-addressable memory, e.g.
+    a file in a romfs image in ROM, return their address through <addr>.  The contents must not be
+    modified, and remain valid until the file system is unmounted.  Fail with ENOSYS if the file
+    system does not support mapping, or if the file cannot be mapped.
+*/
+s32 vfs_map(vfs_t * const vfs, fs_node_t * const node, const void **addr)
+{
+    if(node->type != FSNODE_TYPE_FILE)
+        return -EISDIR;
+
+    return vfs->driver->map(vfs, node, addr);
+}
+
+
+/*
+    vfs_create_node() - create a new file or directory, described by <node>, in the directory
+    <parent>.  <node> must be populated with the new node's name, type, ownership, permissions and
+    timestamps; on success, the driver fills in its first block (i.e. its ID) and size.  Any
+    negative directory cache entry for the name is replaced.
+*/
+s32 vfs_create_node(vfs_t * const vfs, fs_node_t * const parent, fs_node_t * const node)
+{
+    s32 ret;
+
+    if(parent->type != FSNODE_TYPE_DIR)
+        return -ENOTDIR;
+
+    ret = vfs->driver->create_node(vfs, parent->first_block, node);
+    if(ret == SUCCESS)
+        dcache_add(vfs, parent->first_block, node->name, node);
+
+    return ret;
+}
+
+
+/*
+    vfs_unlink() - remove the entry <name> from the directory <parent> on <vfs>, and release the
+    node it refers to.  A directory must be empty.  Fails with -EBUSY if the node is a mount point,
+    or if anyone else holds a reference to it.  The node is removed from the node cache before the
+    driver is called, as the driver may reuse its ID, and its dirty metadata and pages are discarded.
+    A negative directory cache entry replaces any entry for the name.
+*/
+s32 vfs_unlink(vfs_t * const vfs, fs_node_t * const parent, const char * const name)
+{
+    vfs_t *vfs_ = vfs;
+    fs_node_t *node;
+    s32 ret;
+
+    ret = vfs_get_child_node(parent, name, &vfs_, &node);
+    if(ret != SUCCESS)
+        return ret;
+
+    ret = (vfs_ == vfs) ? fs_node_remove(node) : -EBUSY;
+    if(ret == SUCCESS)
+    {
+        dcache_invalidate_node(vfs, node);
+
+        ret = vfs->driver->unlink(vfs, parent->first_block, name);
+        if(ret == SUCCESS)
         {
-            /* Partial read - read some, but not all, of the requested blocks */
-            memcpy_align4(buffer, buf + block_offset, (ret * BLOCK_SIZE) - block_offset);
-            ufree(buf);
+            dcache_add(vfs, parent->first_block, name, NULL);
 
-            return (ret * BLOCK_SIZE) - block_offset;
+            node->dirty = 0;
+            vfs_invalidate_pages(node, 0);
         }
+        else
+            fs_node_rehash(node);
     }
 
-    if((offset + count) > node->size)
-        count_ = node->size - offset;
-    else
-        count_ = count;
+    fs_node_put(node);
+
+    return ret;
+}
+
+
+/*
+    vfs_reallocate() - change the space allocated to <node>, a node obtained from fs_node_get(), to
+    <new_len> bytes.  Cached directory entries for the node are discarded first, as its metadata may
+    change.  The driver may change the node's first block (e.g. FAT allocates the first cluster of an
+    empty file); if so, the node is moved to its new position in the node cache, even if the driver
+    failed part-way.
+*/
+s32 vfs_reallocate(vfs_t * const vfs, fs_node_t * const node, ks32 new_len)
+{
+    ku32 first_block = node->first_block;
+    s32 ret;
+
+    dcache_invalidate_node(vfs, node);
+
+    ret = vfs->driver->reallocate(vfs, node, new_len);
+
+    if(node->first_block != first_block)
+        fs_node_rehash(node);
+
+    return ret;
+}
+
+
+/*
+    vfs_node_extend() - if <new_size> is greater than the size of <node>, update the node's size and
+    mark its metadata dirty.
+*/
+static void vfs_node_extend(fs_node_t * const node, ku32 new_size)
+{
+    if(new_size > node->size)
+    {
+        node->size = new_size;
+        fs_node_mark_dirty(node);
+    }
+}
+
+
+/*
+    vfs_write_page() - write <buf> to block <block> of <node>.  If the block lies within the current
+    extent of the file, and the dirty page limit allows it, the block is stored as a dirty page in
+    the page cache, to be written back later by vfs_flush_pages().  Otherwise the block is written
+    through to the driver, and the page cache is updated with a clean copy.  Returns 1 if the block
+    was written, or the (zero or negative) value returned by the driver.
+*/
+static s32 vfs_write_page(vfs_t * const vfs, fs_node_t * const node, ku32 block,
+                          const void * const buf)
+{
+    s32 ret;
+
+    if(vfs->driver->flags & VFS_DRIVER_MEMORY_BACKED)
+        return vfs->driver->write(vfs, node, buf, block, 1);
+
+    if((block < ((node->size + BLOCK_SIZE - 1) / BLOCK_SIZE))
+       && (block_cache_page_write(node, block, buf, 1) == SUCCESS))
+    {
+        node->pages |= FS_NODE_PAGES_CACHED | FS_NODE_PAGES_DIRTY;
+        return 1;
+    }
+
+    ret = vfs->driver->write(vfs, node, buf, block, 1);
+    if(ret == 1)
+    {
+        block_cache_page_write(node, block, buf, 0);
+        node->pages |= FS_NODE_PAGES_CACHED;
+    }
+
+    return ret;
+}
+
+
+/*
+    vfs_write_partial() - write <len> bytes from <buffer> into block <block> of <node>, starting at
+    byte <block_offset> within the block.  This involves a read-around-write through the current
+    process' scratch block.  Returns the number of bytes written, or a negative error code.
+*/
+static s32 vfs_write_partial(vfs_t * const vfs, fs_node_t * const node, const void * const buffer,
+                             ku32 block, ku32 block_offset, ku32 len)
+{
+    u8 * const scratch = vfs_get_scratch_block();
+    s32 ret;
+
+    if(scratch == NULL)
+        return -ENOMEM;
+
+    ret = vfs_read_page(vfs, node, block, scratch);
+    if(ret < 1)
+        return ret;
+
+    memcpy(scratch + block_offset, buffer, len);
+
+    ret = vfs_write_page(vfs, node, block, scratch);
+    if(ret < 1)
+        return ret;
+
+    return len;
+}
+
+
+/*
+    vfs_write_blocks() - write <nblocks> whole blocks from <buf>, starting at block <block> of
+    <node>.  Blocks within the current extent of the file are written to the page cache where
+    possible; blocks beyond it are written through to the driver in a single call, and the page
+    cache is updated with clean copies.  Returns the number of blocks written, or a negative error
+    code if no blocks were written.
+*/
+static s32 vfs_write_blocks(vfs_t * const vfs, fs_node_t * const node, const u8 * const buf,
+                            ku32 block, ku32 nblocks)
+{
+    ku32 file_blocks = (node->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    u32 i, k;
+    s32 ret;
 
-    memcpy(buffer, buf + (offset % BLOCK_SIZE), count_);
-    ufree(buf);
+    if(vfs->driver->flags & VFS_DRIVER_MEMORY_BACKED)
+        return vfs->driver->write(vfs, node, buf, block, nblocks);
+
+    for(i = 0; (i < nblocks) && ((block + i) < file_blocks); ++i)
+    {
+        ret = vfs_write_page(vfs, node, block + i, buf + (i * BLOCK_SIZE));
+        if(ret < 1)
+            return i ? (s32) i : ret;
+    }
 
-    return count_;
+    if(i == nblocks)
+        return nblocks;
+
+    ret = vfs->driver->write(vfs, node, buf + (i * BLOCK_SIZE), block + i, nblocks - i);
+    if(ret < 0)
+        return i ? (s32) i : ret;
+
+    for(k = 0; k < (u32) ret; ++k)
+        block_cache_page_write(node, block + i + k, buf + ((i + k) * BLOCK_SIZE), 0);
+
+    node->pages |= FS_NODE_PAGES_CACHED;
+
+    return i + ret;
 }
 
 
@@ -430,71 +989,136 @@ s32 vfs_read(vfs_t * const vfs, fs_node_t * const node, void * const buffer, ku3
     vfs_write() - write <count> bytes from <buffer> to the specified <node>, at the starting
     position specified by <offset>.  The block drivers deal only with block-sized transfers, so the
     VFS layer does the necessary work to translate non-block-aligned write requests into block-
-    aligned ones.  This will usually involve read-around-writes.
+    aligned ones.  Data is written through the page cache (see vfs_write_page()).  Whole blocks are
+    written directly from <buffer>; partial blocks at the start and end of the request involve
+    read-around-writes through the current process' scratch block.
 */
 s32 vfs_write(vfs_t * const vfs, fs_node_t * const node, const void * const buffer, ku32 offset,
               s32 count)
 {
-    u32 block;
-    s32 ret, nblocks;
-    u8 *buf;
+    const u8 *buf = (const u8 *) buffer;
+    u32 block, block_offset, remaining, nblocks, len;
+    s32 ret;
 
-    /* If <offset> and <count> are block-aligned, the write is easy. */
-    if(!(offset % BLOCK_SIZE) && !(count % BLOCK_SIZE))
-    {
-        ret = vfs->driver->write(vfs, node, buffer, offset / BLOCK_SIZE, count / BLOCK_SIZE);
-        if(ret <= 0)
-            return ret;
+    if(count < 0)
+        return -EINVAL;
 
-        return ret * BLOCK_SIZE;
-    }
+    /* Cached copies of the node may no longer reflect its metadata */
+    dcache_invalidate_node(vfs, node);
 
-    /* In most cases, we won't be so lucky. */
+    remaining = count;
     block = offset / BLOCK_SIZE;
-    nblocks = ((offset % BLOCK_SIZE) + count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    block_offset = offset % BLOCK_SIZE;
 
-    buf = umalloc(nblocks * BLOCK_SIZE);
-    if(buf == NULL)
-        return -ENOMEM;
+    /* Partial block at the start of the request */
+    if(remaining && (block_offset || (remaining < BLOCK_SIZE)))
+    {
+        len = MIN(BLOCK_SIZE - block_offset, remaining);
 
-    ret = vfs->driver->read(vfs, node, buf, block, nblocks);
-    if(ret < nblocks)
+        ret = vfs_write_partial(vfs, node, buf, block++, block_offset, len);
+        if(ret < 1)
+            return ret;
+
+        buf += len;
+        remaining -= len;
+    }
+
+    /* Whole blocks */
+    nblocks = remaining / BLOCK_SIZE;
+    if(nblocks)
     {
-        if(ret <= 0)
+        ret = vfs_write_blocks(vfs, node, buf, block, nblocks);
+        if(ret < 0)
         {
-            /* Read error, or no data read */
-            ufree(buf);
-            return ret;
+            if(buf == (const u8 *) buffer)
+                return ret;
+
+            remaining = 0;
         }
         else
         {
-            /* Partial read - read some, but not all, of the requested blocks */
-            count -= (nblocks - ret) * BLOCK_SIZE;
-            nblocks = ret;
-        }
-    }
+            buf += ret * BLOCK_SIZE;
 
-    memcpy(buf + (offset % BLOCK_SIZE), buffer, count);
-
-    ret = vfs->driver->write(vfs, node, buf, block, nblocks);
+            if((u32) ret < nblocks)
+                remaining = 0;          /* Partial write */
+            else
+                remaining -= nblocks * BLOCK_SIZE;
+        }
 
-    ufree(buf);
+        block += nblocks;
+    }
 
-    if(ret < nblocks)
+    /* Partial block at the end of the request */
+    if(remaining)
     {
-        if(ret <= 0)
-        {
-            /* Write error, or no data written */
+        ret = vfs_write_partial(vfs, node, buf, block, 0, remaining);
+        if(ret > 0)
+            buf += ret;
+        else if((ret < 0) && (buf == (const u8 *) buffer))
             return ret;
-        }
-        else
-        {
-            /* Partial write - wrote some, but not all, of the requested blocks */
-            count -= (nblocks - ret) * BLOCK_SIZE;
-        }
     }
 
-    return count;
+    vfs_node_extend(node, offset + (buf - (const u8 *) buffer));
+
+    return buf - (const u8 *) buffer;
+}
+
+
+/*
+    vfs_page_writeback() - write back a dirty page of the node <arg>.  Called by
+    block_cache_page_flush().
+*/
+static s32 vfs_page_writeback(void *arg, ku32 page, const void * const buf)
+{
+    fs_node_t * const node = (fs_node_t *) arg;
+    ks32 ret = node->vfs->driver->write(node->vfs, node, buf, page, 1);
+
+    if(ret == 1)
+        return SUCCESS;
+
+    return (ret < 0) ? ret : -EIO;
+}
+
+
+/*
+    vfs_flush_pages() - write back all dirty pages of <node>.
+*/
+s32 vfs_flush_pages(fs_node_t * const node)
+{
+    u8 *scratch;
+    s32 ret;
+
+    if(!(node->pages & FS_NODE_PAGES_DIRTY))
+        return SUCCESS;
+
+    scratch = vfs_get_scratch_block();
+    if(scratch == NULL)
+        return -ENOMEM;
+
+    node->pages &= ~FS_NODE_PAGES_DIRTY;
+
+    ret = block_cache_page_flush(node, vfs_page_writeback, node, scratch);
+    if(ret != SUCCESS)
+        node->pages |= FS_NODE_PAGES_DIRTY;
+
+    return ret;
+}
+
+
+/*
+    vfs_invalidate_pages() - discard the pages of <node>, starting at block <first_block>, from the
+    page cache.  Dirty pages are discarded without being written back.  This must be called before
+    <node> is freed, and when a file is truncated.
+*/
+void vfs_invalidate_pages(fs_node_t * const node, ku32 first_block)
+{
+    if(!(node->pages & FS_NODE_PAGES_CACHED))
+        return;
+
+    block_cache_page_invalidate(node, first_block);
+
+    if(!first_block)
+        node->pages = 0;
 }
 
 
@@ -525,6 +1149,9 @@ s32 vfs_write(vfs_t * const vfs, fs_node_t * const node, const void * const buff
     [*] if <child> is on a different VFS than <parent>, <child>'s VFS will be returned through
         <*vfs>.
 
+    The node returned through <*node> is held in the node cache, and must be released with
+    fs_node_put().
+
     TODO: support symlinks
 */
 s32 vfs_get_child_node(fs_node_t *parent, const char * const child, vfs_t **vfs, fs_node_t **node)
@@ -532,27 +1159,23 @@ s32 vfs_get_child_node(fs_node_t *parent, const char * const child, vfs_t **vfs,
     s32 ret;
     vfs_t *inner_vfs;
     vfs_dir_ctx_t *ctx;
-    fs_node_t *parent_, *inner_node;
+    fs_node_t *parent_, *child_, *inner_node;
 
     if(*vfs == NULL)
     {
         vfs_t *root_fs;
-        fs_node_t *root_node;
 
         /* The only valid operation with <*vfs> == NULL is to retrieve the root fs node. */
         if((parent != NULL) || (child != NULL))
             return -EINVAL;
 
-        ret = mount_find(NULL, NULL, &root_fs, &root_node);
+        ret = mount_find(NULL, NULL, &root_fs, NULL);
         if(ret != SUCCESS)
             return ret;         /* No root fs - an unusual situation */
 
-        ret = vfs_get_root_node(root_fs, &root_node);
+        ret = vfs_get_root_node(root_fs, node);
         if(ret == SUCCESS)
-        {
             *vfs = root_fs;
-            *node = root_node;
-        }
 
         return ret;
     }
@@ -563,6 +1186,13 @@ s32 vfs_get_child_node(fs_node_t *parent, const char * const child, vfs_t **vfs,
         ret = vfs_get_root_node(*vfs, &parent_);
         if(ret != SUCCESS)
             return ret;
+
+        /* Null <parent> and <child> imply the root dir itself */
+        if(child == NULL)
+        {
+            *node = parent_;
+            return SUCCESS;
+        }
     }
     else
     {
@@ -573,22 +1203,45 @@ s32 vfs_get_child_node(fs_node_t *parent, const char * const child, vfs_t **vfs,
         parent_ = parent;
     }
 
-    ret = vfs_open_dir(*vfs, parent_, &ctx);
-
-    if(parent == NULL)          /* If parent == NULL, we allocated parent_ above - free it here */
-        fs_node_free(parent_);
+    if(parent_->type != FSNODE_TYPE_DIR)
+        ret = -ENOTDIR;
+    else
+    {
+        /* Try the directory entry cache before searching the directory */
+        ret = dcache_lookup(*vfs, parent_->first_block, child, &child_);
+        if(ret == -ENODATA)
+        {
+            ret = fs_node_alloc(&child_);
+            if(ret == SUCCESS)
+            {
+                ret = vfs_open_dir(*vfs, parent_, &ctx);
+                if(ret == SUCCESS)
+                {
+                    ret = vfs_read_dir(ctx, child, child_);
+                    vfs_close_dir(ctx);
+                }
+
+                if(ret == SUCCESS)
+                    dcache_add(*vfs, parent_->first_block, child, child_);
+                else
+                {
+                    if(ret == -ENOENT)
+                        dcache_add(*vfs, parent_->first_block, child, NULL);
+
+                    fs_node_free(child_);
+                }
+            }
+        }
+    }
 
-    if(ret != SUCCESS)
-        return ret;
+    if(parent == NULL)          /* If parent == NULL, we obtained parent_ above - release it here */
+        fs_node_put(parent_);
 
-    ret = fs_node_alloc(node);
     if(ret != SUCCESS)
         return ret;
 
-    ret = vfs_read_dir(ctx, child, *node);
-
-    vfs_close_dir(ctx);
-
+    /* Exchange the newly-populated node for its counterpart in the node cache */
+    ret = fs_node_get(*vfs, child_, node);
     if(ret != SUCCESS)
         return ret;
 
@@ -597,9 +1250,8 @@ s32 vfs_get_child_node(fs_node_t *parent, const char * const child, vfs_t **vfs,
     if(ret == SUCCESS)
     {
         /* <*vfs>:<*node> is a mount point. */
-        fs_node_free(*node);
+        fs_node_put(*node);
 
-        /* BUG? should inner_node be copied into *node here? Ownership is unclear otherwise */
         *vfs = inner_vfs;
         *node = inner_node;
 
@@ -607,6 +1259,7 @@ s32 vfs_get_child_node(fs_node_t *parent, const char * const child, vfs_t **vfs,
     }
     else if(ret == -ENOENT)
         return SUCCESS;     /* <*vfs>:<*node> is not a mount point - this isn't an error */
-    else
-        return ret;
+
+    fs_node_put(*node);
+    return ret;
 }
@@ -47,6 +47,9 @@ inline u8 cpu_tas(u8 *addr);
 s32 cpu_proc_init(regs_t *r, void *entry_point, void *arg, void *ustack_top, void *kstack_top,
                   ku32 flags);
 
+/* Set the register through which a new process addresses its data (GOT), e.g. A5 on the 680x0 */
+void cpu_proc_set_data_base(regs_t *r, void *base);
+
 /*
     Both of these functions perform a context switch by saving context, calling sched(), and then
     restoring the context of the incoming process.
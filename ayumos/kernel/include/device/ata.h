@@ -16,7 +16,9 @@
 
 #include <kernel/include/device/block.h>
 #include <kernel/include/device/device.h>
+#include <kernel/include/device/ioqueue.h>
 #include <kernel/include/platform.h>        /* for platform-specific definitions */
+#include <kernel/include/tick.h>
 #include <kernel/include/types.h>
 
 
@@ -27,9 +29,23 @@ typedef enum ata_drive
 } ata_drive_t;
 
 
+/* Per-drive state */
 typedef struct ata_dev_data
 {
     ata_drive_t drive;
+    ioqueue_t queue;
+
+    u16 multiple;           /* Sectors per DRQ block in READ/WRITE MULTIPLE; 0 = not in use     */
+
+    /* State of the request in progress */
+    ioreq_t *req;           /* Request (head of merged run) being serviced                      */
+    ioreq_t *xfer_req;      /* Request in the run to/from whose buffer data is being moved      */
+    u32 xfer_done;          /* Number of sectors of xfer_req transferred so far                 */
+    u32 next_block;         /* First sector of the next command to be issued for the run        */
+    u32 remaining;          /* Number of sectors in the run not yet covered by a command        */
+    u32 cmd_remaining;      /* Number of sectors not yet transferred in the current command     */
+    u8 pending;             /* Nonzero if the request is waiting for the bus to become free     */
+    u8 await_drq;           /* Nonzero if a write command is waiting to accept its first block  */
 
     char model[48];
     char serial[24];
@@ -37,6 +53,16 @@ typedef struct ata_dev_data
 } ata_dev_data_t;
 
 
+/* Per-interface (bus) state.  Only one drive on a bus may execute a command at any time. */
+typedef struct ata_bus
+{
+    dev_t *drive[2];        /* Drives attached to the bus, indexed by ata_drive_t               */
+    dev_t *active;          /* Drive executing a command, or NULL if the bus is idle            */
+    u32 deadline;           /* Tick count by which the active drive must next interrupt         */
+    tick_fn_t watchdog;
+} ata_bus_t;
+
+
 /*
     "Driver" functions
 */
@@ -55,6 +81,16 @@ blockdev_stats_t g_ata_stats;
 
 #define ATA_SECTOR_SIZE     (512)       /* Sector size - constant for all ATA devices   */
 #define ATA_LOG_SECTOR_SIZE (9)         /* = log2(ATA_SECTOR_SIZE)                      */
+#define ATA_MAX_SECTORS     (256)       /* Max sectors per READ/WRITE command           */
+
+#define ATA_CMD_TIMEOUT     (TICK_RATE * 5)     /* Max ticks between command interrupts */
+#define ATA_WATCHDOG_INTVL  (1)                 /* Interval between watchdog checks     */
+
+/*
+    Max number of status polls made, with pre-emption disabled, for a write command's first DRQ.  A
+    drive which takes longer than this to accept the first block is polled by the watchdog.
+*/
+#define ATA_DRQ_POLL_VAL    (250)
 
 #define ATA_TIMEOUT_VAL     (1000000)   /* Timeout ctr initial val.  TODO: improve this */
 
@@ -16,25 +16,48 @@
 
 #define GREAT_BIG_PRIME             (0xfffffffb)    /* Largest prime representable as a u32 */
 
+/*
+    Cache block sizes.  Each device is cached in blocks of (BLOCK_SIZE << dev->cache_block_shift)
+    bytes; the largest permitted cache block is (BLOCK_SIZE << BC_MAX_SHIFT) bytes, i.e. 4KB.
+    The cache is divided into "lines" of BC_LINE_UNITS BLOCK_SIZE-byte units; no cached block ever
+    straddles a line boundary.
+*/
+#define BC_MAX_SHIFT                (3)
+#define BC_LINE_UNITS               (1 << BC_MAX_SHIFT)
+
 /* Cached-block flags */
 #define BC_DIRTY                    BIT(0)  /* Block has been modified                          */
 #define BC_LOCKED                   BIT(1)  /* Block is locked in cache (cannot be evicted)     */
 #define BC_ZERO                     BIT(2)  /* Block is zero-filled - ignore data in memory     */
+#define BC_PAGE                     BIT(3)  /* Block is a page of an object, not a device block */
+
+/* Maximum number of dirty pages, as a fraction (1 / BC_DIRTY_PAGE_RATIO) of the cache */
+#define BC_DIRTY_PAGE_RATIO         (4)
 
 
 typedef u32 block_id;
 
 
-/* Block descriptor - reflects the status of a single block in the block cache */
+/*
+    Block descriptor - reflects the status of a single block in the block cache.  A descriptor
+    describes either a block of a device, or (if BC_PAGE is set) a BLOCK_SIZE-byte page of some
+    other object, e.g. a file.
+*/
 typedef struct block_descriptor
 {
     dev_t       *dev;       /* Device containing the block              */
-    block_id    block;      /* ID of the block on the device            */
+    const void  *obj;       /* Object containing the page (BC_PAGE)     */
+    block_id    block;      /* ID of the cache block, or page number    */
     u16         flags;      /* Information associated with the block    */
-    sem_t       sem;        /* Semaphore for locking the block          */
+    u8          shift;      /* log2(cache block size / BLOCK_SIZE)      */
+    sem_t       sem;        /* Semaphore for locking the cache line     */
 } block_descriptor_t;
 
 
+/* Function used to write back a dirty page; see block_cache_page_flush() */
+typedef s32 (*block_cache_writeback_fn)(void *arg, ku32 page, const void * const buf);
+
+
 /* Block cache statistics */
 typedef struct block_cache_stats
 {
@@ -43,6 +66,10 @@ typedef struct block_cache_stats
     u32 evictions;
     u32 hits;
     u32 misses;
+    u32 page_hits;
+    u32 page_misses;
+    u32 page_writebacks;
+    u32 dirty_pages;
 } block_cache_stats_t;
 
 
@@ -52,23 +79,33 @@ typedef struct block_cache
     block_descriptor_t *descriptors;
     u8 *cache;
     u32 nblocks;
+    u32 write_seq;                  /* Incremented by each device write made by the cache   */
     block_cache_stats_t stats;
 } block_cache_t;
 
 
 typedef struct blockdev_stats
 {
+    u32 reads;
+    u32 writes;
     u32 blocks_read;
     u32 blocks_written;
 } blockdev_stats_t;
 
 
 s32 block_cache_init(ku32 size);
+s32 block_cache_set_block_size(dev_t * const dev, ku32 size);
 s32 block_read(dev_t * const dev, ku32 block, void *buf);
 s32 block_write(dev_t * const dev, ku32 block, const void *buf);
 s32 block_read_multi(dev_t * const dev, u32 block, u32 count, void *buf);
 s32 block_write_multi(dev_t * const dev, u32 block, u32 count, const void *buf);
 s32 block_cache_sync();
+s32 block_cache_page_read(const void * const obj, ku32 page, void *buf);
+s32 block_cache_page_fill(const void * const obj, ku32 page, const void *buf);
+s32 block_cache_page_write(const void * const obj, ku32 page, const void *buf, ku32 dirty);
+s32 block_cache_page_flush(const void * const obj, block_cache_writeback_fn fn, void *arg,
+                           void *buf);
+void block_cache_page_invalidate(const void * const obj, ku32 first_page);
 const block_cache_stats_t *block_cache_stats();
 
 #endif
@@ -25,6 +25,9 @@ typedef enum devctl_fn
     dc_get_partition_type       = 0x0007,   /* Get partition type                               */
     dc_get_partition_type_name  = 0x0008,   /* Get partition type name                          */
     dc_get_partition_active     = 0x0009,   /* Get partition active flag                        */
+    dc_get_ioqueue_stats        = 0x000a,   /* Get request queue stats: *out = ioqueue_stats_t  */
+    dc_get_blockdev_stats       = 0x000b,   /* Get device I/O stats: *out = blockdev_stats_t    */
+    dc_get_mem_base             = 0x000c,   /* Get addr of memory-mapped contents: *out = u8 *  */
 
     /* Serial ports */
     dc_get_baud_rate            = 0x0100,   /* Get device baud rate                             */
@@ -49,6 +52,10 @@ typedef enum devctl_fn
     dc_timer_get_enable         = 0x0403,   /* Determine whether timer is enabled               */
     dc_timer_set_tick_fn        = 0x0404,   /* Set a function to be called every tick           */
 
+    /* RAM disks */
+    dc_ramdisk_get_latency      = 0x0500,   /* Get access latency: *out = ramdisk_latency_t     */
+    dc_ramdisk_set_latency      = 0x0501,   /* Set access latency: *in = ramdisk_latency_t      */
+
     /* Generic devctls */
     dc_get_power_state          = 0x8000,   /* Get power state for a device                     */
     dc_set_power_state          = 0x8001    /* Set power state for a device                     */
@@ -80,6 +80,7 @@ struct dev
 
     u32             block_size;
     u32             len;
+    u32             cache_block_shift;
 
     s32             (*control)(dev_t *dev, const devctl_fn_t fn, const void *in, void *out);
     s32             (*read)(dev_t *dev, ku32 offset, u32 *len, void *buf);
@@ -0,0 +1,96 @@
+#ifndef KERNEL_INCLUDE_DEVICE_IOQUEUE_H_INC
+#define KERNEL_INCLUDE_DEVICE_IOQUEUE_H_INC
+/*
+    Block device I/O request queue
+
+    Part of ayumos
+
+
+    (c) Stuart Wallace <stuartw@atom.net>, October 2026.
+*/
+
+#include <kernel/include/defs.h>
+#include <kernel/include/device/device.h>
+#include <kernel/include/list.h>
+#include <kernel/include/process.h>
+#include <kernel/include/types.h>
+
+
+/* Request expiry times, in ticks.  An expired request is serviced ahead of the sweep order. */
+#define IOQUEUE_READ_EXPIRE         (TICK_RATE / 2)     /* 500ms    */
+#define IOQUEUE_WRITE_EXPIRE        (TICK_RATE * 5)     /* 5s       */
+
+
+typedef enum ioreq_dir
+{
+    IOREQ_READ      = 0,
+    IOREQ_WRITE     = 1
+} ioreq_dir_t;
+
+
+/*
+    An I/O request.  Requests for adjacent block ranges may be merged: the first request in the
+    merged run remains in the queue, and the rest are chained from it via next_merged in ascending
+    block order.  Requests are allocated on the submitting process' kernel stack.
+*/
+typedef struct ioreq ioreq_t;
+
+struct ioreq
+{
+    list_t      queue;          /* Position in the block-sorted queue                   */
+    list_t      fifo;           /* Position in the arrival-order queue                  */
+    ioreq_t     *next_merged;   /* Next request in a merged run                         */
+    ioreq_dir_t dir;
+    u32         block;          /* First block                                          */
+    u32         count;          /* Number of blocks transferred to/from buf             */
+    u32         nblocks;        /* Total number of blocks in a merged run (head only)   */
+    void        *buf;           /* Data buffer; NULL = zero-fill (writes only)          */
+    u32         submitted;      /* Tick count at submission                             */
+    u32         deadline;       /* Tick count at which the request expires              */
+    proc_t      *proc;          /* Submitting process                                   */
+    vs32        status;         /* -EINPROGRESS until the request completes             */
+};
+
+
+/*
+    Driver function which carries out a (possibly merged) request.  Returns -EINPROGRESS if the
+    request will be completed later via ioqueue_done(); otherwise returns the request's status.
+*/
+typedef s32 (*ioqueue_dispatch_fn)(dev_t *dev, ioreq_t *req);
+
+
+/* Request queue statistics */
+typedef struct ioqueue_stats
+{
+    u32 requests;               /* Requests submitted                                   */
+    u32 merges;                 /* Requests merged into an existing request             */
+    u32 dispatches;             /* Requests (or merged runs) passed to the driver       */
+    u32 expired;                /* Dispatches made out of order because of expiry       */
+    u32 depth;                  /* Requests currently queued or in progress             */
+    u32 max_depth;              /* Greatest value of depth seen                         */
+    u32 total_latency;          /* Sum of submission-to-completion times, in ticks      */
+    u32 max_latency;            /* Greatest submission-to-completion time, in ticks     */
+} ioqueue_stats_t;
+
+
+/* A per-device request queue */
+typedef struct ioqueue
+{
+    list_t              sorted;         /* Queued requests, in ascending block order    */
+    list_t              fifo;           /* Queued requests, in order of arrival         */
+    dev_t               *dev;
+    ioqueue_dispatch_fn dispatch;
+    u32                 max_blocks;     /* Largest run that may be built by merging     */
+    u32                 head_pos;       /* Block following the last-dispatched request  */
+    ioreq_t * volatile  current;        /* Request in progress, if any                  */
+    ioqueue_stats_t     stats;
+} ioqueue_t;
+
+
+s32 ioqueue_init(ioqueue_t * const q, dev_t * const dev, ioqueue_dispatch_fn dispatch,
+                 ku32 max_blocks);
+s32 ioqueue_submit(ioqueue_t * const q, const ioreq_dir_t dir, ku32 block, ku32 count,
+                   const void * const buf);
+void ioqueue_done(ioqueue_t * const q, ks32 status);
+
+#endif
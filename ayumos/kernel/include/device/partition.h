@@ -45,6 +45,7 @@ typedef struct partition_data
 
 
 s32 partition_init();
+s32 partition_scan(dev_t *dev);
 s32 partition_shut_down(dev_t *dev);
 
 s8 *partition_type_name(ku8 type);
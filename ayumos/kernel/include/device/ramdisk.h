@@ -0,0 +1,47 @@
+#ifndef KERNEL_INCLUDE_DEVICE_RAMDISK_H_INC
+#define KERNEL_INCLUDE_DEVICE_RAMDISK_H_INC
+/*
+    RAM disk block device driver
+
+    Part of ayumos
+
+
+    (c) Stuart Wallace <stuartw@atom.net>, October 2026.
+*/
+
+#ifdef WITH_DRV_MST_RAMDISK
+#ifndef WITH_MASS_STORAGE
+#error This driver requires kernel mass-storage support (build option WITH_MASS_STORAGE)
+#else
+
+#include <kernel/include/device/block.h>
+#include <kernel/include/device/device.h>
+#include <kernel/include/types.h>
+
+
+#define RAMDISK_BLOCK_SIZE      (512)
+
+
+/* Artificial access latency, applied to each read/write request */
+typedef struct ramdisk_latency
+{
+    u32 request_us;             /* Fixed per-request latency, in microseconds           */
+    u32 block_us;               /* Additional latency per block, in microseconds        */
+} ramdisk_latency_t;
+
+
+typedef struct ramdisk_state
+{
+    u8                  *data;          /* Backing store                                */
+    u8                  owns_data;      /* Non-zero if data was allocated by the driver */
+    u8                  read_only;      /* Non-zero if the disk is an image in ROM      */
+    ramdisk_latency_t   latency;
+    blockdev_stats_t    stats;
+} ramdisk_state_t;
+
+
+s32 ramdisk_create(void *mem, u32 len, const void *image, u32 image_len, dev_t **dev);
+
+#endif /* WITH_MASS_STORAGE */
+#endif /* WITH_DRV_MST_RAMDISK */
+#endif
@@ -325,7 +325,19 @@ typedef struct
     u32     p_align;            /* Alignment of segment in memory and file              */
 } Elf32_Phdr;
 
-s32 elf_load_exe(const void * const buf, ku32 len, exe_img_t **img);
+/* Flags for elf_load_exe() */
+#define ELF_LOAD_XIP        BIT(0)      /* Execute read-only sections in place  */
+
+/*
+    An executable may only be executed in place if it addresses its GOT through a register
+    (-msep-data).  Such an executable declares this by containing a section with this name, which
+    may be empty, e.g. by including ".section .sepdata" in its start-up code.
+*/
+#define ELF_SEP_DATA_SECTION    ".sepdata"
+
+s32 elf_load_exe(const void * const buf, ku32 len, u32 flags, exe_img_t **img);
+s32 elf_load_file(ks8 * const path, exe_img_t **img);
+void exe_img_free(exe_img_t *img);
 
 u32 elf_is_relevant_progbits_section(ks8 * name);
 u32 elf_is_relevant_nobits_section(ks8 * name);
@@ -0,0 +1,101 @@
+#ifndef KERNEL_INCLUDE_FS_AIO_H_INC
+#define KERNEL_INCLUDE_FS_AIO_H_INC
+/*
+    Asynchronous file I/O
+
+    Part of ayumos
+
+
+    (c) Stuart Wallace <stuartw@atom.net>, October 2026.
+
+
+    A process submits a read or write request, described by an aio_cb_t, with aio_submit(); the
+    call returns as soon as the request has been queued.  Requests are carried out by a pool of
+    kernel worker processes, so several requests from one process may be in progress at once (and
+    may be merged or reordered by the block device's request queue).  Each completed request is
+    added to its submitting process' completion queue, and the process is woken if it is waiting
+    for a completion.  aio_reap() removes a completion from the queue, optionally waiting for one.
+*/
+
+#include <kernel/include/defs.h>
+#include <kernel/include/fs/file.h>
+#include <kernel/include/list.h>
+#include <kernel/include/process.h>
+#include <kernel/include/types.h>
+
+
+/* Number of kernel worker processes servicing requests */
+#ifndef AIO_WORKERS
+#define AIO_WORKERS             (2)
+#endif
+
+/* Maximum number of requests which a process may have outstanding (queued or not yet reaped) */
+#define AIO_MAX_OUTSTANDING     (16)
+
+/* Flags for aio_reap() */
+#define AIO_WAIT                BIT(0)      /* Sleep until a request completes                  */
+
+
+typedef enum aio_op
+{
+    AIO_READ    = 0,
+    AIO_WRITE   = 1
+} aio_op_t;
+
+
+/*
+    Asynchronous I/O control block, describing a request.  The control block is copied by
+    aio_submit(), and may be reused as soon as the call returns; the buffer must remain valid until
+    the request's completion has been reaped.
+*/
+typedef struct aio_cb
+{
+    s32             fd;             /* File descriptor to be read or written                */
+    void            *buf;           /* Data buffer                                          */
+    u32             offset;         /* Offset in the file, in bytes                         */
+    u32             count;          /* Number of bytes to transfer                          */
+    void            *tag;           /* Caller-defined value, returned with the completion   */
+    u16             op;             /* aio_op_t                                             */
+} aio_cb_t;
+
+
+/* A completion, as returned by aio_reap() */
+typedef struct aio_event
+{
+    void            *tag;           /* Tag supplied in the request's control block          */
+    s32             status;         /* Number of bytes transferred, or an error code        */
+} aio_event_t;
+
+
+/* A request, queued for a worker or awaiting collection in a completion queue */
+typedef struct aio_req
+{
+    list_t          queue;          /* Position in the work queue or completion queue       */
+    vfs_t           *vfs;
+    fs_node_t       *node;          /* Referenced until the request has been carried out    */
+    void            *buf;
+    u32             offset;
+    u32             count;
+    void            *tag;
+    struct aio_ctx  *ctx;           /* Submitting process' asynchronous I/O state           */
+    s32             status;
+    aio_op_t        op;
+} aio_req_t;
+
+
+/* Per-process asynchronous I/O state, allocated on first use */
+typedef struct aio_ctx
+{
+    list_t          done;           /* Completed requests, in order of completion           */
+    u32             outstanding;    /* Requests submitted but not yet reaped                */
+    proc_t          *proc;          /* Owning process                                       */
+    u8              waiting;        /* Non-zero if the process is sleeping in aio_reap()    */
+} aio_ctx_t;
+
+
+s32 aio_init();
+s32 aio_submit(const aio_cb_t * const cb);
+s32 aio_reap(aio_event_t * const ev, ku32 flags);
+void aio_proc_exit(proc_t * const proc);
+
+#endif
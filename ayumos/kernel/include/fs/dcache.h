@@ -0,0 +1,67 @@
+#ifndef KERNEL_INCLUDE_FS_DCACHE_H_INC
+#define KERNEL_INCLUDE_FS_DCACHE_H_INC
+/*
+    Directory entry cache
+
+    Part of ayumos
+
+
+    (c) Stuart Wallace <stuartw@atom.net>, October 2026.
+*/
+
+#include <kernel/include/defs.h>
+#include <kernel/include/fs/node.h>
+#include <kernel/include/fs/vfs.h>
+#include <kernel/include/list.h>
+#include <kernel/include/types.h>
+
+
+#define DCACHE_ENTRIES          (128)   /* Number of entries in the cache                       */
+#define DCACHE_BUCKETS          (64)    /* Number of hash buckets; must be a power of two       */
+#define DCACHE_NAME_LEN         (27)    /* Longest name which will be cached                    */
+
+
+/*
+    A cached directory entry.  The entry is keyed on the VFS, the first block of the parent
+    directory, and the name of the child.  A negative entry records that the child does not exist.
+    Positive entries are also hashed on the VFS and the first block of the child, so that the
+    entries referring to a node can be found when it is written.
+*/
+typedef struct dcache_ent
+{
+    list_t      hash;                       /* Position in hash bucket, or in the free list     */
+    list_t      node_hash;                  /* Position in node hash bucket (positive entries)  */
+    list_t      lru;                        /* Position in the LRU list                         */
+    vfs_t       *vfs;
+    u32         parent;                     /* First block of parent directory                  */
+    u32         name_hash;
+    u8          negative;                   /* Non-zero if the child does not exist             */
+    char        name[DCACHE_NAME_LEN + 1];  /* Name of child, as looked up                      */
+    char        node_name[DCACHE_NAME_LEN + 1]; /* Name of child, as stored in the directory    */
+    fs_node_t   node;                       /* Copy of the child node (positive entries only);  */
+                                            /* its name field is unused                         */
+} dcache_ent_t;
+
+
+typedef struct dcache_stats
+{
+    u32 lookups;
+    u32 hits;
+    u32 negative_hits;
+    u32 misses;
+    u32 evictions;
+    u32 invalidations;
+    u32 entries;                /* Entries currently in use */
+} dcache_stats_t;
+
+
+s32 dcache_init();
+s32 dcache_lookup(const vfs_t * const vfs, ku32 parent, const char * const name,
+                  fs_node_t ** const node);
+void dcache_add(vfs_t * const vfs, ku32 parent, const char * const name,
+                const fs_node_t * const node);
+void dcache_invalidate_node(const vfs_t * const vfs, const fs_node_t * const node);
+void dcache_invalidate_vfs(const vfs_t * const vfs);
+const dcache_stats_t *dcache_stats();
+
+#endif
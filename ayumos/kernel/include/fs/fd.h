@@ -0,0 +1,44 @@
+#ifndef KERNEL_INCLUDE_FS_FD_H_INC
+#define KERNEL_INCLUDE_FS_FD_H_INC
+/*
+    Per-process file descriptor table
+
+    Part of ayumos
+
+
+    (c) Stuart Wallace <stuartw@atom.net>, October 2026.
+
+
+    A file descriptor is an index into its process' descriptor table, an array of pointers to file
+    handles, so translating a descriptor into a handle is a single array access.  Free slots are
+    tracked in a bitmap; a new descriptor always takes the lowest free slot.  Each slot holds a
+    reference to its file handle, so a handle may be shared by several descriptors (after
+    fd_dup()) or by several processes (after a process inherits its parent's descriptors); the
+    handle, and its offset, persist until the last descriptor referring to it is closed.
+*/
+
+#include <kernel/include/defs.h>
+#include <kernel/include/fs/file.h>
+#include <kernel/include/process.h>
+#include <kernel/include/types.h>
+
+
+/* Maximum number of open file descriptors per process; the free-slot bitmap is a single u32 */
+#define FD_MAX              (32)
+
+
+typedef struct fd_table
+{
+    u32             used;           /* Bitmap of allocated descriptors                      */
+    file_handle_t   *fh[FD_MAX];    /* File handle referred to by each descriptor           */
+} fd_table_t;
+
+
+s32 fd_alloc(proc_t * const proc, file_handle_t * const fh);
+file_handle_t *fd_get(const proc_t * const proc, ks32 fd);
+s32 fd_close(proc_t * const proc, ks32 fd);
+s32 fd_dup(proc_t * const proc, ks32 fd);
+s32 fd_table_inherit(proc_t * const proc, const proc_t * const parent);
+void fd_table_destroy(proc_t * const proc);
+
+#endif
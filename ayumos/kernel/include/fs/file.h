@@ -26,24 +26,34 @@
 #define O_RDWR (O_RD | O_WR)        /* Open file for reading and writing */
 
 
+/*
+    An open file.  A handle may be shared by several file descriptors, in one or more processes;
+    it is freed when the last reference to it is released with file_close().
+*/
 typedef struct file_handle
 {
     vfs_t *vfs;
     fs_node_t *node;
     u32 offset;
     u16 flags;
+    u16 refcount;
     pid_t pid;
 } file_handle_t;
 
 
 s32 file_open(ks8 * const path, u16 flags, file_handle_t **fh);
-s32 file_create(ks8 * const path, file_perm_t perm, fs_node_t **node);
+s32 file_create(ks8 * const path, file_perm_t perm, vfs_t **vfs, fs_node_t **node);
+void file_handle_ref(file_handle_t * const fh);
 void file_close(file_handle_t *fh);
 s32 file_read(file_handle_t *fh, void *buffer, size_t count);
 s32 file_write(file_handle_t *fh, const void *buffer, size_t count);
 
 s32 syscall_open(const char * const path, u16 mode);
 s32 syscall_create(const char * const path, ku16 mode);
-s32 syscall_close(s32 filenum);
+s32 syscall_close(ks32 fd);
+s32 syscall_read(ks32 fd, void *buffer, size_t count);
+s32 syscall_write(ks32 fd, const void *buffer, size_t count);
+s32 syscall_dup(ks32 fd);
+s32 syscall_read_dir(const char * const path, vfs_dirent_t * const buf, ku32 len, u32 * const pos);
 
 #endif
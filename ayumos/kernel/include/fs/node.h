@@ -10,9 +10,19 @@
 */
 
 #include <kernel/include/defs.h>
+#include <kernel/include/list.h>
 #include <kernel/include/types.h>
 
 
+/* Maximum number of unreferenced nodes retained in the node cache */
+#define FS_NODE_CACHE_UNUSED_MAX    (32)
+
+/* Number of node cache hash buckets; must be a power of two */
+#define FS_NODE_CACHE_BUCKETS       (32)
+
+
+struct vfs;
+
 typedef u16 file_perm_t;
 
 typedef enum fsnode_type
@@ -35,10 +45,33 @@ typedef struct fs_node
     time_t          mtime;
     time_t          atime;
     u32             first_block;
-    /* how to link to clusters? */
+    u32             dir_entry;      /* Driver-specific location of the node's directory entry */
+
+    /* Node cache state, managed by fs_node_get() / fs_node_put() */
+    struct vfs     *vfs;
+    list_t          hash;           /* Position in hash bucket; empty if node is not cached */
+    list_t          unused;         /* Position in unused-node LRU list, if refcount == 0   */
+    u16             refcount;
+    u8              dirty;          /* Non-zero if metadata must be written back            */
+    u8              pages;          /* Page cache state: FS_NODE_PAGES_* flags              */
 } fs_node_t;
 
 
+/* Page cache state flags (fs_node_t.pages) */
+#define FS_NODE_PAGES_CACHED        BIT(0)  /* Node may have pages in the page cache        */
+#define FS_NODE_PAGES_DIRTY         BIT(1)  /* Node may have dirty pages in the page cache  */
+
+
+typedef struct fs_node_cache_stats
+{
+    u32 lookups;
+    u32 hits;
+    u32 evictions;
+    u32 writebacks;
+    u32 entries;                /* Nodes currently cached */
+} fs_node_cache_stats_t;
+
+
 /* Permissions bits */
 #define FS_PERM_UR          (0x0800)        /* User (owner) read        */
 #define FS_PERM_UW          (0x0400)        /* User (owner) write       */
@@ -82,10 +115,21 @@ typedef struct fs_node
 #define FS_FLAG_SYSTEM      (0x0002)        /* Not sure this will be respected  */
 #define FS_FLAG_ARCHIVE     (0x0004)        /* I have no idea what this means   */
 
+s8 *fs_perm_str(const fsnode_type_t type, const file_perm_t perm, s8 *str);
 s8 *fs_node_perm_str(const fs_node_t * const node, s8 *str);
 s32 fs_node_alloc(fs_node_t **node);
 s32 fs_node_set_name(fs_node_t *node, const char * const name);
 void fs_node_free(fs_node_t *node);
+s32 fs_node_cache_init();
+s32 fs_node_get(struct vfs * const vfs, fs_node_t * const node, fs_node_t **cached);
+void fs_node_ref(fs_node_t * const node);
+void fs_node_put(fs_node_t * const node);
+void fs_node_rehash(fs_node_t * const node);
+s32 fs_node_remove(fs_node_t * const node);
+void fs_node_mark_dirty(fs_node_t * const node);
+s32 fs_node_sync(fs_node_t * const node);
+s32 fs_node_cache_flush(struct vfs * const vfs);
+const fs_node_cache_stats_t *fs_node_cache_stats();
 s32 fs_node_check_perms(const file_perm_t op, const fs_node_t * const node);
 
 #endif
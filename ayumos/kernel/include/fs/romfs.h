@@ -7,21 +7,65 @@
 
 
     (c) Stuart Wallace, January 2016
+
+
+    A romfs image consists of a superblock, followed by an array of romfs_node_t structures, the
+    contents of each file, and a table of zero-terminated node names.  All multi-byte values are
+    big-endian.  The root directory is not represented by a node; its ID is ROMFS_ROOT_ID.  File
+    contents are padded to a multiple of four bytes, so each file starts on a four-byte boundary
+    relative to the superblock.
+
+    In version ROMFS_VERSION_SORTED images, the children of each directory occupy a contiguous range
+    of the node array, sorted by name (in strcmp() order).  The root directory's children come
+    first; the range of each other directory is recorded in its node.  Node IDs equal the node's
+    index in the array plus one.  In version ROMFS_VERSION_UNSORTED images, nodes are in no
+    particular order, and are related only by their parent IDs.
+
+    If the superblock's ROMFS_FEATURE_COMPRESSED flag is set, the image may contain compressed files,
+    whose nodes are flagged RN_COMPRESSED.  The size of a compressed file is its uncompressed size.
+    Its contents are divided into chunks of ROMFS_CHUNK_SIZE bytes (the last chunk may be shorter),
+    each of which is LZ4-compressed independently so that any part of the file can be read without
+    decompressing what precedes it.  The data block of a compressed file begins with a table of
+    32-bit offsets, one per chunk; entry N is the offset, from the start of the data block, of the
+    end of chunk N's compressed data.  Chunk 0's data immediately follows the table.  A chunk whose
+    compressed length equals its uncompressed length is stored uncompressed.  Compressed files
+    cannot be accessed in place, so executables are normally left uncompressed.
 */
 
 #ifdef WITH_FS_ROMFS
 
 #include <kernel/include/defs.h>
 #include <kernel/include/types.h>
+#include <kernel/include/semaphore.h>
 #include <kernel/include/fs/vfs.h>
 
 
 /* Meaningless "magic number" which validates a romfs superblock */
 #define ROMFS_SUPERBLOCK_MAGIC      (0x6c1f39e4)
 
+/* ID of the root directory, i.e. the parent ID of the nodes in the root directory */
+#define ROMFS_ROOT_ID               (0)
+
+/* Image format versions (romfs_superblock_t.version) */
+#define ROMFS_VERSION_UNSORTED      (0)     /* Nodes in arbitrary order                     */
+#define ROMFS_VERSION_SORTED        (1)     /* Directory contents contiguous and sorted     */
+#define ROMFS_VERSION               ROMFS_VERSION_SORTED
+
+/* Optional image features (romfs_superblock_t.features) */
+#define ROMFS_FEATURE_COMPRESSED    (0x0001)    /* Image may contain compressed files       */
+#define ROMFS_FEATURES_SUPPORTED    (ROMFS_FEATURE_COMPRESSED)
+
+/* Compressed files are divided into independently-compressed chunks of ROMFS_CHUNK_SIZE bytes */
+#define ROMFS_LOG_CHUNK_SIZE        (12)
+#define ROMFS_CHUNK_SIZE            (1U << ROMFS_LOG_CHUNK_SIZE)
+
+/* Number of decompressed chunks cached by each mounted romfs */
+#define ROMFS_CHUNK_CACHE_ENTRIES   (4)
+
 /* Flags associated with a romfs_node_t */
 #define RN_FILE         (0x0001)    /* Node represents a file       */
 #define RN_DIR          (0x0002)    /* Node represents a directory  */
+#define RN_COMPRESSED   (0x0004)    /* File contents are compressed */
 
 
 typedef struct romfs_superblock
@@ -31,6 +75,9 @@ typedef struct romfs_superblock
     time_t  cdate;              /* Timestamp at which the fs image was created      */
     u16     nnodes;             /* Number of romfs_node_t structures in the fs      */
     char    label[16];          /* Zero-terminated volume label (name) string       */
+    u16     version;            /* Image format version (ROMFS_VERSION_*)           */
+    u16     root_nchildren;     /* Number of nodes in the root directory (sorted)   */
+    u16     features;           /* Optional features used (ROMFS_FEATURE_*)         */
 } romfs_superblock_t;
 
 
@@ -39,8 +86,10 @@ typedef struct romfs_node
 {
     u16         id;             /* Unique identifier of this node                               */
     u16         parent_id;      /* Identifier of this node's parent                             */
-    u32         size;           /* Size of this node's data block; zero for directory nodes     */
-    u32         offset;         /* Offset of the data block, from the start of the superblock   */
+    u32         size;           /* Size of this node's data block.  Directories: number of      */
+                                /* children (sorted), or zero (unsorted)                        */
+    u32         offset;         /* Offset of the data block, from the start of the superblock.  */
+                                /* Directories: index of the first child (sorted), or zero      */
     u32         name_offset;    /* Offset of the node name, from the start of the superblock    */
     time_t      mdate;          /* Node last-modification timestamp                             */
     u16         uid;            /* Owner user ID                                                */
@@ -49,6 +98,44 @@ typedef struct romfs_node
     u16         flags;          /* Flags (see constants defined above)                          */
 } romfs_node_t;
 
+
+/* A decompressed chunk of a compressed file */
+typedef struct romfs_chunk
+{
+    u8          *data;          /* Decompressed contents (ROMFS_CHUNK_SIZE bytes)   */
+    u32         chunk;          /* Index of the chunk within its file               */
+    u32         last_used;      /* Value of romfs_fs_t.chunk_clock at last use      */
+    u16         id;             /* ID of the file's node, or 0 if the entry is free */
+} romfs_chunk_t;
+
+
+/* State associated with a mounted romfs */
+typedef struct romfs_fs
+{
+    const u8                    *image;         /* Start of the image, i.e. the superblock      */
+    const romfs_node_t          *nodes;         /* Node array                                   */
+    u32                         len;            /* Length of the image                          */
+    u16                         nnodes;         /* Number of nodes                              */
+    u16                         version;        /* Image format version (ROMFS_VERSION_*)       */
+    u16                         root_nchildren; /* Number of nodes in the root directory        */
+    u16                         features;       /* Optional features (ROMFS_FEATURE_*)          */
+    u8                          owns_image;     /* Non-zero if image was copied into the heap   */
+    sem_t                       chunk_lock;     /* Protects the chunk cache                     */
+    romfs_chunk_t               *chunk_cache;   /* Decompressed chunks; allocated on first use  */
+    u32                         chunk_clock;    /* Incremented on each chunk cache access       */
+} romfs_fs_t;
+
+
+/* Directory iteration state */
+typedef struct romfs_dir_ctx
+{
+    u16 id;                     /* ID of the directory being read                       */
+    u16 first;                  /* Index of the first node which may be a child         */
+    u16 end;                    /* Index following the last node which may be a child   */
+    u16 pos;                    /* Index of the next node to be examined                */
+} romfs_dir_ctx_t;
+
+
 vfs_driver_t g_romfs_ops;
 
 #endif /* WITH_FS_ROMFS */
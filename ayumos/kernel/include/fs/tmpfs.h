@@ -0,0 +1,97 @@
+#ifndef KERNEL_INCLUDE_FS_TMPFS_H_INC
+#define KERNEL_INCLUDE_FS_TMPFS_H_INC
+/*
+    tmpfs (RAM-backed file system) support
+
+    Part of ayumos
+
+
+    (c) Stuart Wallace <stuartw@atom.net>, October 2026.
+
+
+    A tmpfs holds its nodes and their contents in kernel memory, and needs no device: it is mounted
+    by passing a NULL device to mount_add().  Its contents are lost when it is unmounted.  Nodes are
+    allocated from the slab allocator; file contents are stored in TMPFS_CHUNK_SIZE-byte chunks,
+    allocated from the kernel heap as they are first written, so files may be sparse.  The total
+    size of the chunks allocated by a tmpfs is limited to TMPFS_SIZE_MAX bytes.  Unlinking a node
+    frees its chunks and the node itself, and its ID is reused by the next node created.
+*/
+
+#ifdef WITH_FS_TMPFS
+
+#include <kernel/include/defs.h>
+#include <kernel/include/list.h>
+#include <kernel/include/semaphore.h>
+#include <kernel/include/types.h>
+#include <kernel/include/fs/vfs.h>
+
+
+/* Maximum number of bytes of file data which may be stored in each tmpfs */
+#ifndef TMPFS_SIZE_MAX
+#define TMPFS_SIZE_MAX          (262144)
+#endif
+
+/* File contents are stored in chunks of TMPFS_CHUNK_SIZE bytes */
+#define TMPFS_LOG_CHUNK_SIZE    (12)
+#define TMPFS_CHUNK_SIZE        (1U << TMPFS_LOG_CHUNK_SIZE)
+#define TMPFS_CHUNK_BLOCKS      (TMPFS_CHUNK_SIZE >> LOG_BLOCK_SIZE)
+
+/* ID of the root directory */
+#define TMPFS_ROOT_ID           (1)
+
+/* Number of entries by which the node table is extended when it fills */
+#define TMPFS_NODES_INCREMENT   (32)
+
+
+/* A file or directory in a tmpfs */
+typedef struct tmpfs_node
+{
+    char            *name;          /* Name of this node (kmalloc()ed)                      */
+    list_t          sibling;        /* Position in the parent directory's list of children  */
+    union
+    {
+        struct
+        {
+            u8      **chunks;       /* Chunk pointers; NULL entries are holes               */
+            u32     nchunks;        /* Number of entries in chunks[]                        */
+        } file;
+        list_t      children;       /* Directory: list of child nodes                       */
+    } u;
+    u32             size;           /* File size, in bytes                                  */
+    time_t          ctime;
+    time_t          mtime;
+    time_t          atime;
+    u16             uid;
+    u16             gid;
+    file_perm_t     permissions;
+    u16             flags;
+    u16             nopen;          /* Directory: number of open directory contexts         */
+    fsnode_type_t   type;
+    u32             id;             /* Node ID, i.e. index in tmpfs_fs_t.nodes[] plus one   */
+} tmpfs_node_t;
+
+
+/* State associated with a mounted tmpfs */
+typedef struct tmpfs_fs
+{
+    tmpfs_node_t    **nodes;        /* Node table, indexed by (node ID - 1)                 */
+    u32             nnodes;         /* Number of entries in nodes[]                         */
+    u32             first_free;     /* Lowest free (NULL) entry in nodes[]; nnodes if none  */
+    u32             used;           /* Bytes of file data allocated                         */
+    u32             size_max;       /* Maximum value of <used>                              */
+    sem_t           lock;           /* Protects the node table and all nodes                */
+} tmpfs_fs_t;
+
+
+/* Directory iteration state */
+typedef struct tmpfs_dir_ctx
+{
+    tmpfs_node_t    *dir;           /* Directory being read                                 */
+    list_t          *pos;           /* Last entry returned; &dir->u.children at start       */
+} tmpfs_dir_ctx_t;
+
+
+vfs_driver_t g_tmpfs_ops;
+
+#endif /* WITH_FS_TMPFS */
+#endif
@@ -25,9 +25,41 @@ typedef struct fs_stat
     ks8 *label;
 } fs_stat_t;
 
+/*
+    Compact directory entry, as returned by vfs_read_dir_multi().  Entries are variable-length
+    records, packed into the caller's buffer; <len> gives the offset of the next record.  <name> is
+    nul-terminated.
+*/
+typedef struct vfs_dirent
+{
+    u16             len;            /* Length of this record, in bytes                      */
+    u8              type;           /* fsnode_type_t                                        */
+    u8              name_len;       /* Length of name, excluding the terminating nul        */
+    file_perm_t     permissions;
+    u16             flags;
+    u32             size;
+    time_t          mtime;
+    u32             first_block;
+    char            name[];
+} vfs_dirent_t;
+
+/* Records are padded so that each one starts on a four-byte boundary */
+#define VFS_DIRENT_LEN(name_len) \
+    ((offsetof(vfs_dirent_t, name) + (name_len) + 1 + 3) & ~3)
+
+/* Length of the longest possible record; a read_dir_multi buffer must be at least this long */
+#define VFS_DIRENT_MAX_LEN          VFS_DIRENT_LEN(NAME_MAX_LEN)
+
+#define VFS_DIRENT_NEXT(de)         ((vfs_dirent_t *) ((u8 *) (de) + (de)->len))
+
+/* Driver flags (vfs_driver_t.flags) */
+#define VFS_DRIVER_MEMORY_BACKED    BIT(0)      /* File contents are held in RAM: bypass the    */
+                                                /* page cache                                   */
+
 typedef struct vfs_driver
 {
     ks8 *name;
+    u16 flags;
     s32 (*init)();
     s32 (*mount)(vfs_t *vfs);
     s32 (*unmount)(vfs_t *vfs);
@@ -35,18 +67,26 @@ typedef struct vfs_driver
     s32 (*open_dir)(vfs_t *vfs, u32 block, void **ctx);
     s32 (*read_dir)(vfs_t *vfs, void *ctx, ks8 * const name, fs_node_t *node);
     s32 (*close_dir)(vfs_t *vfs, void *ctx);
+    s32 (*read_dir_multi)(vfs_t *vfs, void *ctx, vfs_dirent_t *buf, ku32 len);
+    s32 (*tell_dir)(vfs_t *vfs, void *ctx, u32 *pos);
+    s32 (*seek_dir)(vfs_t *vfs, void *ctx, ku32 pos);
     s32 (*read)(vfs_t * const vfs, fs_node_t * const node, void * const buffer, u32 offset,
                 ks32 count);
     s32 (*write)(vfs_t * const vfs, fs_node_t * const node, const void * const buffer, u32 offset,
                  ks32 count);
     s32 (*reallocate)(vfs_t * const vfs, fs_node_t * const node, ks32 new_len);
     s32 (*stat)(vfs_t *vfs, fs_stat_t *st);
+    s32 (*write_node)(vfs_t * const vfs, fs_node_t * const node);
+    s32 (*map)(vfs_t * const vfs, fs_node_t * const node, const void **addr);
+    s32 (*create_node)(vfs_t * const vfs, ku32 parent, fs_node_t * const node);
+    s32 (*unlink)(vfs_t * const vfs, ku32 parent, const char * const name);
 } vfs_driver_t;
 
 typedef struct vfs_dir_ctx
 {
     vfs_t *vfs;
     void *ctx;      /* FIXME rename this to "data" */
+    u32 pos;        /* Entries read so far, if the driver does not implement tell_dir/seek_dir */
 } vfs_dir_ctx_t;
 
 
@@ -67,11 +107,20 @@ s32 vfs_unmount(vfs_t *vfs);
 s32 vfs_get_root_node(vfs_t *vfs, fs_node_t **node);
 s32 vfs_open_dir(vfs_t * const vfs, fs_node_t * const node, vfs_dir_ctx_t **ctx);
 s32 vfs_read_dir(vfs_dir_ctx_t *ctx, ks8 * const name, fs_node_t *node);
+s32 vfs_read_dir_multi(vfs_dir_ctx_t *ctx, vfs_dirent_t *buf, ku32 len);
+s32 vfs_tell_dir(vfs_dir_ctx_t *ctx, u32 *pos);
+s32 vfs_seek_dir(vfs_dir_ctx_t *ctx, ku32 pos);
 s32 vfs_close_dir(vfs_dir_ctx_t *ctx);
 s32 vfs_read(vfs_t * const vfs, fs_node_t * const node, void * const buffer, ku32 offset,
              ks32 count);
 s32 vfs_write(vfs_t * const vfs, fs_node_t * const node, const void * const buffer, ku32 offset,
               s32 count);
+s32 vfs_map(vfs_t * const vfs, fs_node_t * const node, const void **addr);
+s32 vfs_create_node(vfs_t * const vfs, fs_node_t * const parent, fs_node_t * const node);
+s32 vfs_reallocate(vfs_t * const vfs, fs_node_t * const node, ks32 new_len);
+s32 vfs_unlink(vfs_t * const vfs, fs_node_t * const parent, const char * const name);
+s32 vfs_flush_pages(fs_node_t * const node);
+void vfs_invalidate_pages(fs_node_t * const node, ku32 first_block);
 s32 vfs_get_child_node(fs_node_t *parent, const char * const child, vfs_t **vfs, fs_node_t **node);
 
 #endif
@@ -98,6 +98,21 @@ inline void mem_gather16v(vu16 * restrict dest, ku16 * restrict src, u16 count)
 #endif
 
 
+/*
+    mem_gather16v_bswap() - perform a "gather" operation to a 16-bit-wide volatile destination,
+    swapping the bytes in each half-word.  This primitive can be used to copy a block of data to a
+    data port in a 16-bit peripheral whose data bus is connected with the opposite byte order.
+*/
+#ifndef HAVE_mem_gather16v_bswap
+#define HAVE_mem_gather16v_bswap
+inline void mem_gather16v_bswap(vu16 * restrict dest, ku16 * restrict src, u16 count)
+{
+    while(count--)
+        *dest = bswap_16(*(src++));
+};
+#endif
+
+
 /*
     mem_gather16v_zf() - perform a "gather" operation to a 16-bit-wide volatile destination,
     writing <count> 0x0000 words to the destination.  This is a specialised zero-filling version of
@@ -126,4 +141,33 @@ inline void mem_scatter16v(u16 * restrict dest, vu16 * restrict src, u16 count)
 };
 #endif
 
+
+/*
+    mem_scatter16v_bswap() - perform a "scatter" operation from a 16-bit-wide volatile source,
+    swapping the bytes in each half-word.  This primitive can be used to copy a block of data from a
+    data port in a 16-bit peripheral whose data bus is connected with the opposite byte order.
+*/
+#ifndef HAVE_mem_scatter16v_bswap
+#define HAVE_mem_scatter16v_bswap
+inline void mem_scatter16v_bswap(u16 * restrict dest, vu16 * restrict src, u16 count)
+{
+    while(count--)
+        *(dest++) = bswap_16(*src);
+};
+#endif
+
+
+/*
+    mem_copy16v() - copy <count> half-words from a 16-bit-wide volatile, memory-mapped buffer (e.g.
+    a window onto a peripheral's buffer RAM) to <dest>.
+*/
+#ifndef HAVE_mem_copy16v
+#define HAVE_mem_copy16v
+inline void mem_copy16v(u16 * restrict dest, vu16 * restrict src, u16 count)
+{
+    while(count--)
+        *(dest++) = *(src++);
+};
+#endif
+
 #endif
@@ -15,28 +15,34 @@
 
 
 extern vu32 preempt_count;
+extern u32 preempt_saved_sr;
 
 
 /*
     preempt_disable() - disable CPU interrupts and increment the global pre-emption disable counter.
-    This allows nested calls to preempt_disable() / preempt_enable().
+    This allows nested calls to preempt_disable() / preempt_enable().  The outermost call saves the
+    previous IRQ mask.
 */
 inline void preempt_disable()
 {
-    cpu_disable_interrupts();
-    preempt_count++;
+    ku32 sr = cpu_disable_interrupts_save();
+
+    if(!preempt_count++)
+        preempt_saved_sr = sr;
 }
 
 
 /*
-    preempt_enable() - decrement the global pre-emption disable counter, and enable CPU interrupts
-    if the counter has reached zero.  Note that improper nesting of calls to preempt_disable() /
-    preempt_enable() will give rise to a race condition on the preempt_count variable.
+    preempt_enable() - decrement the global pre-emption disable counter, and restore the IRQ mask
+    saved by the outermost preempt_disable() if the counter has reached zero.  Outside an interrupt
+    handler, this re-enables interrupts; inside one, interrupts of the handler's priority or lower
+    remain masked.  Note that improper nesting of calls to preempt_disable() / preempt_enable() will
+    give rise to a race condition on the preempt_count variable.
 */
 inline void preempt_enable()
 {
-    if(--preempt_count)
-        cpu_enable_interrupts();
+    if(!--preempt_count)
+        cpu_restore_interrupts(preempt_saved_sr);
 }
 
 #endif
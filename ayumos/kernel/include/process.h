@@ -68,7 +68,9 @@ struct proc_struct
     s8 *cwd;                    /* Current working directory */
 
     file_perm_t default_perm;   /* Default permissions for new files */
-    file_handle_t *files;       /* Open file list */
+    struct fd_table *files;     /* File descriptor table; allocated on demand                   */
+    void *fs_scratch;           /* Scratch block for unaligned file I/O; allocated on demand    */
+    struct aio_ctx *aio;        /* Asynchronous I/O state; allocated on demand                  */
 
     const proc_t *parent;
     list_t queue;
@@ -87,6 +89,7 @@ void proc_destroy(s32 exit_code);
 void proc_sleep();
 void proc_sleep_until(s32 when);
 void proc_sleep_for(s32 secs);
+void proc_wake(proc_t * const proc);
 void proc_wake_by_id(const pid_t pid);
 uid_t proc_current_uid();
 gid_t proc_current_gid();
@@ -27,8 +27,12 @@
 #define SYS_close               8       /* Close a file                                     */
 #define SYS_read                9       /* Read from a file descriptor                      */
 #define SYS_write               10      /* Write to a file descriptor                       */
+#define SYS_read_dir            11      /* Read a batch of directory entries                */
+#define SYS_aio_submit          12      /* Submit an asynchronous read or write request     */
+#define SYS_aio_reap            13      /* Collect an asynchronous I/O completion           */
+#define SYS_dup                 14      /* Duplicate a file descriptor                      */
 
 /* The highest system call number */
-#define MAX_SYSCALL             10
+#define MAX_SYSCALL             14
 
 #endif
@@ -90,6 +90,10 @@ struct exe_img
     void *start;                    /* Ptr to first byte of img in memory   */
     u32 len;                        /* Img len                              */
     proc_entry_fn_t entry_point;    /* Ptr to first instruction of img      */
+    void *data;                     /* Ptr to user-heap copy of writable    */
+                                    /* sections; == start unless XIP        */
+    void *got;                      /* Ptr to global offset table, or NULL  */
+    struct fs_node *node;           /* File executed in place, or NULL      */
 };
 
 typedef struct exe_img exe_img_t;
@@ -22,3 +22,10 @@
     preempt_disable() / preempt_enable() will be correctly nested.
 */
 vu32 preempt_count = 0;
+
+/*
+    The SR (or equivalent) at the time of the outermost call to preempt_disable().  The outermost
+    call to preempt_enable() restores the IRQ mask from it, rather than unmasking all interrupts, so
+    that pre-emption may safely be disabled and re-enabled inside an interrupt handler.
+*/
+u32 preempt_saved_sr = 0;
@@ -8,6 +8,9 @@
 */
 
 #include <kernel/include/process.h>
+#include <kernel/include/elf.h>
+#include <kernel/include/fs/aio.h>
+#include <kernel/include/fs/fd.h>
 #include <kernel/include/fs/path.h>
 #include <kernel/include/limits.h>
 #include <kernel/include/memory/kmalloc.h>
@@ -134,6 +137,24 @@ s32 proc_create(const uid_t uid, const gid_t gid, const s8* name, exe_img_t *img
         return ret;
     }
 
+    /* Executables built with separate data address their GOT through a register */
+    if((img != NULL) && (img->got != NULL))
+        cpu_proc_set_data_base(&p->regs, img->got);
+
+    /* A process inherits its parent's open files */
+    if(parent != NULL)
+    {
+        ret = fd_table_inherit(p, parent);
+        if(ret != SUCCESS)
+        {
+            kfree(p->cwd);
+            kfree(p->kstack);
+            ufree(p->ustack);
+            kfree(p);
+            return ret;
+        }
+    }
+
     p->state = ps_runnable; /* Mark process as runnable so scheduler will pick it up. */
 
     preempt_disable();
@@ -235,6 +256,12 @@ void proc_destroy(s32 exit_code)
 
     g_exiting->exit_code = exit_code;
 
+    /* Cancel or wait for outstanding asynchronous I/O requests, while the process can still sleep */
+    aio_proc_exit(g_exiting);
+
+    /* Close the process' open files; this may also sleep, while nodes are written back */
+    fd_table_destroy(g_exiting);
+
     sched();
 
     /* Note: we're running in g_current_proc->next's quantum at this point... */
@@ -248,14 +275,13 @@ void proc_destroy(s32 exit_code)
     if(g_exiting->ustack != NULL)
         kfree(g_exiting->ustack);
 
-    /* TODO: deallocate any other resources allocated by g_exiting (heaps, file handles, ...) */
+    if(g_exiting->fs_scratch != NULL)
+        kfree(g_exiting->fs_scratch);
+
+    /* TODO: deallocate any other resources allocated by g_exiting (heaps, ...) */
 
-    /* TODO: move this code into a generic exe_img_free() fn */
     if(g_exiting->img != NULL)
-    {
-        kfree(g_exiting->img->start);
-        kfree(g_exiting->img);
-    }
+        exe_img_free(g_exiting->img);
 
     /* TODO: move g_exiting onto "exited" list, to await exit-code collection? */
 
@@ -278,6 +304,23 @@ void proc_sleep()
 }
 
 
+/*
+    proc_wake() - wake a sleeping process.  The process may have marked itself as sleeping without
+    yet having yielded the CPU, in which case it is simply marked runnable again.
+*/
+void proc_wake(proc_t * const proc)
+{
+    if(proc->state != ps_sleeping)
+        return;
+
+    proc->state = ps_runnable;
+
+    /* A sleeping process other than the current one will have been moved to the sleep queue */
+    if(proc != g_current_proc)
+        list_move_append(&proc->queue, &g_run_queue);
+}
+
+
 /*
     proc_sleep_for() -"sleep" the current process for the specified number of seconds.  Note that
     the process does not actually move on to the sleep queue during this time - instead it
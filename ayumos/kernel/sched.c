@@ -67,9 +67,12 @@ void sched()
     else
         g_current_proc = list_next_entry(g_current_proc, queue);
 
-    /* If the process went to sleep, move it to the "sleeping" queue */
+    /*
+        If the process went to sleep, move it to the "sleeping" queue.  If there is no other process
+        to run, it stays on the run queue and keeps the CPU until it is woken.
+    */
 
-    if(g_prev_proc->state == ps_sleeping)
+    if((g_prev_proc->state == ps_sleeping) && (g_current_proc != g_prev_proc))
         list_move_insert(&g_prev_proc->queue, &g_sleep_queue);
 
     ++g_ncontext_switches;
@@ -8,6 +8,7 @@
 */
 
 #include <kernel/include/console.h>
+#include <kernel/include/fs/aio.h>
 #include <kernel/include/fs/file.h>
 #include <kernel/include/process.h>
 #include <kernel/include/syscall.h>
@@ -27,11 +28,15 @@ const syscall_table_entry_t g_syscalls[MAX_SYSCALL + 1] =
     {0,     syscall_console_getchar},
     {1,     syscall_leds},
     {0,     syscall_yield},
-    {2,     file_open},
-    {2,     file_create},
-    {2,     file_close},
-    {3,     file_read},
-    {3,     file_write},
+    {2,     syscall_open},
+    {2,     syscall_create},
+    {1,     syscall_close},
+    {3,     syscall_read},
+    {3,     syscall_write},
+    {4,     syscall_read_dir},
+    {1,     aio_submit},
+    {2,     aio_reap},
+    {1,     syscall_dup},
 };
 
 
@@ -160,7 +160,7 @@ s32 tick_add_callback(tick_callback_fn_t fn, void *arg, ku32 interval, tick_fn_t
 
     preempt_enable();
 
-    if(*id)
+    if(id)
         *id = cbnew->id;
 
     return SUCCESS;
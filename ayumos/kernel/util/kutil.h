@@ -24,6 +24,13 @@ u16 fletcher16(const void *buf, u32 len);
 #define CHECKSUM16(buf, len)    fletcher16((buf), (len))
 
 
+/*
+    Compression functions
+*/
+
+s32 lz4_decompress(const void * const src, ku32 src_len, void * const dst, ku32 dst_len);
+
+
 /*
     Date/time-related functions
 */
@@ -0,0 +1,112 @@
+/*
+    LZ4 block decompression
+
+    Part of ayumos
+
+
+    (c) Stuart Wallace <stuartw@atom.net>, October 2026.
+
+
+    Decodes data in the LZ4 block format (no frame header).  A block is a sequence of "sequences",
+    each consisting of a token byte, an optional literal-length extension, a run of literal bytes,
+    a two-byte little-endian match offset, and an optional match-length extension.  The final
+    sequence has no match part.  See: https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+
+    The format suits the 68000 well: decoding needs no tables and no multiplication, and every
+    access is a byte access, so there are no alignment constraints on the source or destination.
+*/
+
+#include <kernel/util/kutil.h>
+
+
+#define LZ4_MIN_MATCH       (4)     /* Minimum match length; match lengths are stored less this */
+
+
+/*
+    lz4_read_length() - read an extended length field, consisting of a sequence of bytes terminated
+    by a byte other than 0xff, from *<src>, and add it to <len>.  Return the resulting length, or
+    -EDATA if the field overruns <src_end>.
+*/
+static s32 lz4_read_length(const u8 **src, const u8 * const src_end, u32 len)
+{
+    u8 b;
+
+    do
+    {
+        if(*src >= src_end)
+            return -EDATA;
+
+        b = *(*src)++;
+        len += b;
+    } while(b == 0xff);
+
+    return len;
+}
+
+
+/*
+    lz4_decompress() - decompress the LZ4 block of <src_len> bytes at <src> into the buffer of
+    <dst_len> bytes at <dst>.  Return the number of bytes written, or -EDATA if the block is
+    malformed or would overrun the destination buffer.
+*/
+s32 lz4_decompress(const void * const src, ku32 src_len, void * const dst, ku32 dst_len)
+{
+    const u8 *in = (const u8 *) src;
+    const u8 * const in_end = in + src_len;
+    u8 *out = (u8 *) dst;
+    u8 * const out_end = out + dst_len;
+
+    while(in < in_end)
+    {
+        ku8 token = *in++;
+        s32 len;
+        const u8 *match;
+
+        /* Literals */
+        len = token >> 4;
+        if(len == 15)
+        {
+            len = lz4_read_length(&in, in_end, len);
+            if(len < 0)
+                return len;
+        }
+
+        if(((u32) len > (u32) (in_end - in)) || ((u32) len > (u32) (out_end - out)))
+            return -EDATA;
+
+        memcpy(out, in, len);
+        in += len;
+        out += len;
+
+        if(in == in_end)
+            break;          /* The final sequence consists only of literals */
+
+        /* Match */
+        if(in_end - in < 2)
+            return -EDATA;
+
+        match = out - (in[0] | (in[1] << 8));
+        in += 2;
+
+        if((match == out) || (match < (u8 *) dst))
+            return -EDATA;
+
+        len = token & 0xf;
+        if(len == 15)
+        {
+            len = lz4_read_length(&in, in_end, len);
+            if(len < 0)
+                return len;
+        }
+
+        len += LZ4_MIN_MATCH;
+        if((u32) len > (u32) (out_end - out))
+            return -EDATA;
+
+        /* The source and destination of a match may overlap, so the copy must proceed bytewise */
+        while(len--)
+            *out++ = *match++;
+    }
+
+    return out - (u8 *) dst;
+}
@@ -169,6 +169,48 @@ MONITOR_CMD_HANDLER(date)
 #endif /* WITH_RTC */
 
 
+/*
+    dcache [flush]
+
+    Display directory entry cache and node cache statistics, or flush the directory entry cache.
+*/
+#ifdef WITH_MASS_STORAGE
+MONITOR_CMD_HANDLER(dcache)
+{
+    const dcache_stats_t * const st = dcache_stats();
+    const fs_node_cache_stats_t * const nst = fs_node_cache_stats();
+    u32 hits;
+
+    if(num_args == 1)
+    {
+        if(strcmp(args[0], "flush"))
+            return -EINVAL;
+
+        dcache_invalidate_vfs(NULL);
+        return SUCCESS;
+    }
+    else if(num_args)
+        return -EINVAL;
+
+    hits = st->hits + st->negative_hits;
+
+    printf("dcache: %u/%u entries in use\n"
+           "%u lookups, %u hits (%u negative), %u misses, hit rate %u%%\n"
+           "%u evictions, %u invalidations\n",
+           st->entries, DCACHE_ENTRIES, st->lookups, hits, st->negative_hits, st->misses,
+           st->lookups ? (hits * 100) / st->lookups : 0, st->evictions, st->invalidations);
+
+    printf("\nnode cache: %u nodes cached\n"
+           "%u lookups, %u hits, hit rate %u%%\n"
+           "%u evictions, %u metadata write-backs\n",
+           nst->entries, nst->lookups, nst->hits,
+           nst->lookups ? (nst->hits * 100) / nst->lookups : 0, nst->evictions, nst->writebacks);
+
+    return SUCCESS;
+}
+#endif /* WITH_MASS_STORAGE */
+
+
 /*
     dfu <len> <checksum>
 
@@ -400,6 +442,40 @@ MONITOR_CMD_HANDLER(echo)
 }
 
 
+/*
+    exec <path>
+
+    Load the executable at <path> and start it in a new process.
+*/
+#ifdef WITH_MASS_STORAGE
+MONITOR_CMD_HANDLER(exec)
+{
+    exe_img_t *img;
+    pid_t pid;
+    s32 ret;
+
+    if(num_args != 1)
+        return -EINVAL;
+
+    ret = elf_load_file(args[0], &img);
+    if(ret != SUCCESS)
+        return ret;
+
+    ret = proc_create(0, 0, args[0], img, NULL, NULL, PROC_USTACK_LEN, 0, PROC_DEFAULT_WD,
+                      proc_current(), &pid);
+    if(ret != SUCCESS)
+    {
+        exe_img_free(img);
+        return ret;
+    }
+
+    printf("(%d)\n", pid);
+
+    return SUCCESS;
+}
+#endif /* WITH_MASS_STORAGE */
+
+
 /*
     fill <start> <count> <val>
 
@@ -553,6 +629,11 @@ MONITOR_CMD_HANDLER(help)
           "date [<newdate>]\n"
           "    If no argument is supplied, print the current date and time.  If date is specified\n"
           "    in YYYYMMDDHHMMSS format, set the RTC date and time accordingly.\n\n"
+#endif
+#ifdef WITH_MASS_STORAGE
+          "dcache [flush]\n"
+          "    Display directory entry cache and node cache statistics, or flush the directory\n"
+          "    entry cache\n\n"
 #endif
           "dfu <size> <checksum>\n"
           "    Receive <size> bytes and re-flash the firmware ROMs with this data.  <size> must\n"
@@ -564,6 +645,11 @@ MONITOR_CMD_HANDLER(help)
           "    Dump <count> bytes (dump), half-words (dumph) or words (dumpw), starting at <address>\n\n"
           "echo [<arg> ...]\n"
           "    Echo all arguments, each separated by a single space character, to the console\n\n"
+#ifdef WITH_MASS_STORAGE
+          "exec <path>\n"
+          "    Start the executable at <path> in a new process.  Executables in a romfs image in\n"
+          "    ROM run in place\n\n"
+#endif
           "fill[h|w] <start> <count> <value>\n"
           "    Fill <count> bytes (fill), half-words (fillh) or words (fillw), starting at <address>\n"
           "    with <value>\n\n"
@@ -577,6 +663,10 @@ MONITOR_CMD_HANDLER(help)
           "    Display command history\n\n"
           "id\n"
           "    Display device identity\n\n"
+#ifdef WITH_MASS_STORAGE
+          "iostat\n"
+          "    Display block cache and block device request queue statistics\n\n"
+#endif
 #ifdef WITH_MASS_STORAGE
           "ls [<path>]\n"
           "    List directory contents\n\n"
@@ -588,7 +678,8 @@ MONITOR_CMD_HANDLER(help)
 #ifdef WITH_MASS_STORAGE
           "mount [<dev> <fstype> <mountpoint>]\n"
           "    With no arguments, list current mounts.  With arguments, mount block device <dev>\n"
-          "    containing a file system of type <fstype> at <mountpoint>\n\n"
+          "    containing a file system of type <fstype> at <mountpoint>.  Use \"none\" as <dev>\n"
+          "    for file systems which need no device, e.g. tmpfs\n\n"
 #endif
 #ifdef WITH_NETWORKING
           "netif show <interface>\n"
@@ -597,6 +688,15 @@ MONITOR_CMD_HANDLER(help)
 #endif
           "raw\n"
           "    Dump raw characters in hex format.  Ctrl-A stops.\n\n"
+#ifdef WITH_DRV_MST_RAMDISK
+          "ramdisk\n"
+          "ramdisk create <size> [<image addr> [<image len>]]\n"
+          "ramdisk rom <image addr> [<image len>]\n"
+          "ramdisk latency <dev> <request us> [<block us>]\n"
+          "    List RAM disks, create a RAM disk of <size> bytes (optionally preloaded from an\n"
+          "    image, or a romfs image if <image len> is omitted), create a read-only disk from an\n"
+          "    image in place, or set a RAM disk's latency\n\n"
+#endif
 #ifdef WITH_MASS_STORAGE
           "rootfs [<partition> <type>]\n"
           "    Set/read root partition in BIOS data area.\n\n"
@@ -669,12 +769,57 @@ MONITOR_CMD_HANDLER(id)
 }
 
 
+/*
+    iostat
+
+    Display block and page cache statistics, and request queue statistics for each block device which has a
+    request queue.
+*/
+#ifdef WITH_MASS_STORAGE
+MONITOR_CMD_HANDLER(iostat)
+{
+    const block_cache_stats_t * const bcs = block_cache_stats();
+    dev_t *dev;
+    UNUSED(num_args);
+    UNUSED(args);
+
+    printf("block cache: %u reads, %u writes, %u hits, %u misses, %u evictions\n",
+           bcs->reads, bcs->writes, bcs->hits, bcs->misses, bcs->evictions);
+    printf("page cache:  %u hits, %u misses, %u write-backs, %u dirty pages\n\n",
+           bcs->page_hits, bcs->page_misses, bcs->page_writebacks, bcs->dirty_pages);
+
+    puts("device   requests   merges  dispatch  expired depth  max  avg lat  max lat");
+
+    for(dev = dev_get_root(); (dev = dev_get_next(dev)) != NULL;)
+    {
+        ioqueue_stats_t st;
+        u32 completed;
+
+        if((dev->type != DEV_TYPE_BLOCK)
+           || (dev->control(dev, dc_get_ioqueue_stats, NULL, &st) != SUCCESS))
+            continue;
+
+        completed = st.requests - st.depth;
+
+        printf("%-8s %8u %8u %9u %8u %5u %4u %6ums %6ums\n", dev->name, st.requests,
+               st.merges, st.dispatches, st.expired, st.depth, st.max_depth,
+               completed ? ((st.total_latency * 1000) / TICK_RATE) / completed : 0,
+               (st.max_latency * 1000) / TICK_RATE);
+    }
+
+    return SUCCESS;
+}
+#endif /* WITH_MASS_STORAGE */
+
+
 /*
     ls <path>
 
     List directory contents.
 */
 #ifdef WITH_MASS_STORAGE
+#define LS_BUFFER_LEN       (2048)      /* Size of the buffer into which entries are read */
+
 MONITOR_CMD_HANDLER(ls)
 {
 
@@ -698,27 +843,41 @@ MONITOR_CMD_HANDLER(ls)
 
         if(node->type == FSNODE_TYPE_DIR)
         {
-            /* Iterate directory */
+            /* Iterate directory, reading as many entries as will fit into the buffer per call */
             vfs_dir_ctx_t *ctx;
+            vfs_dirent_t *buf;
+
+            buf = (vfs_dirent_t *) kmalloc(LS_BUFFER_LEN);
+            if(buf == NULL)
+                ret = -ENOMEM;
+            else
+            {
+                ret = vfs_open_dir(vfs, node, &ctx);
+                if(ret != SUCCESS)
+                    kfree(buf);
+            }
 
-            ret = vfs_open_dir(vfs, node, &ctx);
             if(ret != SUCCESS)
             {
                 puts(kstrerror(-ret));
-                fs_node_free(node);
+                fs_node_put(node);
                 return SUCCESS;
             }
 
-            while((ret = vfs_read_dir(ctx, NULL, node)) != -ENOENT)
+            while((ret = vfs_read_dir_multi(ctx, buf, LS_BUFFER_LEN)) > 0)
             {
-                printf("%9d %s %9d %s\n", node->first_block, fs_node_perm_str(node, perms),
-                       node->size, node->name);
+                const vfs_dirent_t *de;
+
+                for(de = buf; (u8 *) de < (u8 *) buf + ret; de = VFS_DIRENT_NEXT(de))
+                    printf("%9d %s %9d %s\n", de->first_block,
+                           fs_perm_str(de->type, de->permissions, perms), de->size, de->name);
             }
 
-            if(ret != -ENOENT)
+            if(ret < 0)
                 puts(kstrerror(-ret));
 
             vfs_close_dir(ctx);
+            kfree(buf);
         }
         else
         {
@@ -727,7 +886,7 @@ MONITOR_CMD_HANDLER(ls)
                    node->size, node->name);
         }
 
-        fs_node_free(node);
+        fs_node_put(node);
     }
     else
         return -EINVAL;
@@ -811,40 +970,58 @@ MONITOR_CMD_HANDLER(map)
 /*
     mount
 
-    Display mount table, or mount a filesystem at the specified location.
+    Display mount table, or mount a filesystem at the specified location.  A <dev> of "none"
+    mounts a file system which needs no device, e.g. tmpfs.
     Syntax: mount [<dev> <fstype> <mountpoint>]
 */
 #ifdef WITH_MASS_STORAGE
 MONITOR_CMD_HANDLER(mount)
 {
-    UNUSED(num_args);
-    UNUSED(args);
-
-    return -ENOSYS;
-#if 0
     if(num_args == 0)
     {
         /* Display mount table */
         mount_ent_t *ent;
         extern mount_ent_t *g_mount_table;
-        for(ent = g_mount_table; ent; ent = ent->next)
-        {
-            if(ent->vfs)
-                printf("%-10s %-10s %s\n", ent->vfs->dev->name,
-                       ent->vfs->driver->name, ent->mount_point);
-        }
 
+        for(ent = g_mount_table; ent; ent = ent->next)
+            printf("%-10s %-10s %s\n",
+                   (ent->inner_vfs->dev != NULL) ? ent->inner_vfs->dev->name : "none",
+                   ent->inner_vfs->driver->name,
+                   (ent->host_node != NULL) ? ent->host_node->name : ROOT_DIR);
     }
     else if(num_args == 3)
     {
         /* Mount filesystem */
-        return mount_add(args[2], vfs_get_driver_by_name(args[1]), dev_find(args[0]));
+        vfs_driver_t * const driver = vfs_get_driver_by_name(args[1]);
+        dev_t *dev = NULL;
+        vfs_t *vfs;
+        fs_node_t *node;
+        s32 ret;
+
+        if(driver == NULL)
+            return -EINVAL;
+
+        if(strcmp(args[0], "none"))
+        {
+            dev = dev_find(args[0]);
+            if(dev == NULL)
+                return -ENODEV;
+        }
+
+        ret = path_open(args[2], &vfs, &node);
+        if(ret != SUCCESS)
+            return ret;
+
+        /* The mount takes its own reference to the mount point node */
+        ret = (node->type == FSNODE_TYPE_DIR) ? mount_add(vfs, node, driver, dev) : -ENOTDIR;
+        fs_node_put(node);
+
+        return ret;
     }
     else
         return -EINVAL;
 
     return SUCCESS;
-#endif
 }
 #endif /* WITH_MASS_STORAGE */
 
@@ -930,6 +1107,126 @@ MONITOR_CMD_HANDLER(raw)
 }
 
 
+/*
+    ramdisk
+    ramdisk create <size> [<image addr> [<image len>]]
+    ramdisk latency <dev> <request us> [<block us>]
+
+    With no arguments, list RAM disks.  Otherwise, create a RAM disk of <size> bytes, optionally
+    preloaded from an image (or a romfs image, if <image len> is omitted), and scan it for
+    partitions; or set the artificial latency applied to each request made to RAM disk <dev>.
+*/
+#ifdef WITH_DRV_MST_RAMDISK
+MONITOR_CMD_HANDLER(ramdisk)
+{
+    ramdisk_latency_t lat;
+    dev_t *dev;
+    s32 ret;
+
+    if(!num_args)
+    {
+        puts("device       size   req lat   blk lat     reads  blk read    writes  blk wrtn");
+
+        for(dev = dev_get_root(); (dev = dev_get_next(dev)) != NULL;)
+        {
+            blockdev_stats_t st;
+
+            if((dev->type != DEV_TYPE_BLOCK)
+               || (dev->control(dev, dc_ramdisk_get_latency, NULL, &lat) != SUCCESS)
+               || (dev->control(dev, dc_get_blockdev_stats, NULL, &st) != SUCCESS))
+                continue;
+
+            printf("%-8s %7uK %7uus %7uus %9u %9u %9u %9u\n", dev->name, dev->len >> 1,
+                   lat.request_us, lat.block_us, st.reads, st.blocks_read, st.writes,
+                   st.blocks_written);
+        }
+
+        return SUCCESS;
+    }
+
+    if(!strcmp(args[0], "create") && (num_args >= 2) && (num_args <= 4))
+    {
+        u32 size, image = 0, image_len = 0;
+
+        ret = monitor_parse_arg(args[1], &size, MPA_NOT_ZERO);
+        if(ret != SUCCESS)
+            return ret;
+
+        if(num_args >= 3)
+        {
+            ret = monitor_parse_arg(args[2], &image, MPA_NONE);
+            if(ret != SUCCESS)
+                return ret;
+        }
+
+        if(num_args == 4)
+        {
+            ret = monitor_parse_arg(args[3], &image_len, MPA_NOT_ZERO);
+            if(ret != SUCCESS)
+                return ret;
+        }
+
+        ret = ramdisk_create(NULL, size, (const void *) image, image_len, &dev);
+        if(ret != SUCCESS)
+            return ret;
+
+        printf("%s: %uK RAM disk\n", dev->name, dev->len >> 1);
+#ifdef WITH_DRV_MST_PARTITION
+        partition_scan(dev);
+#endif
+        return SUCCESS;
+    }
+
+    if(!strcmp(args[0], "rom") && (num_args >= 2) && (num_args <= 3))
+    {
+        u32 image, image_len = 0;
+
+        ret = monitor_parse_arg(args[1], &image, MPA_NOT_ZERO);
+        if(ret != SUCCESS)
+            return ret;
+
+        if(num_args == 3)
+        {
+            ret = monitor_parse_arg(args[2], &image_len, MPA_NOT_ZERO);
+            if(ret != SUCCESS)
+                return ret;
+        }
+
+        /* Use the image in place, as a read-only disk */
+        ret = ramdisk_create((void *) image, 0, (const void *) image, image_len, &dev);
+        if(ret != SUCCESS)
+            return ret;
+
+        printf("%s: %uK ROM disk\n", dev->name, dev->len >> 1);
+        return SUCCESS;
+    }
+
+    if(!strcmp(args[0], "latency") && (num_args >= 3) && (num_args <= 4))
+    {
+        dev = dev_find(args[1]);
+        if(dev == NULL)
+            return -ENODEV;
+
+        ret = monitor_parse_arg(args[2], &lat.request_us, MPA_NONE);
+        if(ret != SUCCESS)
+            return ret;
+
+        lat.block_us = 0;
+        if(num_args == 4)
+        {
+            ret = monitor_parse_arg(args[3], &lat.block_us, MPA_NONE);
+            if(ret != SUCCESS)
+                return ret;
+        }
+
+        return dev->control(dev, dc_ramdisk_set_latency, &lat, NULL);
+    }
+
+    return -EINVAL;
+}
+#endif /* WITH_DRV_MST_RAMDISK */
+
+
 /*
     rootfs
 
@@ -1222,6 +1519,65 @@ MONITOR_CMD_HANDLER(symbol)
 #include <kernel/include/tick.h>
 #include <kernel/include/net/dhcp.h>
 #include <kernel/include/net/tftp.h>
+#include <kernel/include/platform.h>
+
+#define PIO_TEST_WORDS      (256)       /* Half-words per transfer: one 512-byte sector */
+
+/*
+    test_pio_primitives() - measure the speed, in CPU cycles per half-word, of the primitives used
+    to move data between memory and 16-bit peripherals, and of a plain C loop for comparison.  Each
+    primitive is run repeatedly for one second.  A half-word in RAM stands in for the peripheral's
+    data port, so the figures exclude any wait states which a real peripheral would impose.
+*/
+static s32 test_pio_primitives()
+{
+    static const char * const names[] =
+    {
+        "C loop (read)", "mem_scatter16v", "mem_scatter16v_bswap", "mem_gather16v",
+        "mem_gather16v_bswap", "mem_gather16v_zf", "mem_copy16v"
+    };
+    static u16 buf[PIO_TEST_WORDS], mem[PIO_TEST_WORDS + 1];
+    static vu16 port;
+    u32 clk_hz;
+    u8 i;
+
+    if(plat_get_cpu_clock(&clk_hz) != SUCCESS)
+        return -ENOSYS;
+
+    for(i = 0; i < ARRAY_COUNT(names); ++i)
+    {
+        u32 start, elapsed, n, tenths;
+        u16 j;
+
+        /* Start timing at a tick boundary */
+        for(start = get_ticks(); get_ticks() == start;)
+            ;
+
+        for(start = get_ticks(), n = 0; (elapsed = get_ticks() - start) < TICK_RATE; ++n)
+        {
+            switch(i)
+            {
+                case 0:
+                    for(j = 0; j < PIO_TEST_WORDS; ++j)
+                        buf[j] = port;
+                    break;
+
+                case 1: mem_scatter16v(buf, &port, PIO_TEST_WORDS);         break;
+                case 2: mem_scatter16v_bswap(buf, &port, PIO_TEST_WORDS);   break;
+                case 3: mem_gather16v(&port, buf, PIO_TEST_WORDS);          break;
+                case 4: mem_gather16v_bswap(&port, buf, PIO_TEST_WORDS);    break;
+                case 5: mem_gather16v_zf(&port, PIO_TEST_WORDS);            break;
+                case 6: mem_copy16v(buf, mem, PIO_TEST_WORDS);              break;
+            }
+        }
+
+        tenths = ((clk_hz / TICK_RATE) * elapsed * 10) / (n * PIO_TEST_WORDS);
+        printf("%-22s %4u.%u cycles/half-word\n", names[i], tenths / 10, tenths % 10);
+    }
+
+    return SUCCESS;
+}
+
 
 MONITOR_CMD_HANDLER(test)
 {
@@ -1296,12 +1652,10 @@ MONITOR_CMD_HANDLER(test)
 
         for(i = 0; i < 10; ++i)
         {
-            ret = elf_load_exe(addr, sizeof(testapp), &(img[i]));
+            ret = elf_load_exe(addr, sizeof(testapp), 0, &(img[i]));
             if(ret != SUCCESS)
                 printf("elf_load_exe() returned %u: %s\n", ret, kstrerror(-ret));
 
-            /* FIXME - there's currently no way to free an exe_img_t cleanly */
-
             ret = proc_create(0, 0, "testapp", img[i], NULL, NULL, 1024, 0, PROC_DEFAULT_WD,
                               proc_current(), &pid);
             printf("(%d)\n", pid);
@@ -1331,6 +1685,8 @@ MONITOR_CMD_HANDLER(test)
         return tftp_read_request(&server, "test.txt");
     }
 #endif /* WITH_NETWORKING */
+    else if(testnum == 4)
+        return test_pio_primitives();
 
     return -EINVAL;
 }
@@ -10,13 +10,19 @@
 */
 
 #include <platform/lambda/include/dfu.h>
+#include <kernel/include/fs/dcache.h>
 #include <kernel/include/fs/file.h>
 #include <kernel/include/fs/mount.h>
 #include <kernel/include/fs/path.h>
 #include <kernel/include/fs/vfs.h>
 #include <kernel/include/console.h>
 #include <kernel/include/defs.h>
+#include <kernel/include/device/block.h>
+#include <kernel/include/device/ioqueue.h>
 #include <kernel/include/device/nvram.h>
+#include <kernel/include/device/partition.h>
+#include <kernel/include/device/ramdisk.h>
+#include <kernel/include/elf.h>
 #include <kernel/include/fs/vfs.h>
 #include <kernel/include/ksym.h>
 #include <kernel/include/memory/kmalloc.h>
@@ -24,6 +30,7 @@
 #include <kernel/include/memory/slab.h>
 #include <kernel/include/net/arp.h>
 #include <kernel/include/net/ipv4.h>
+#include <kernel/include/process.h>
 #include <kernel/include/version.h>
 #include <kernel/util/kutil.h>
 #include <klibc/include/stdio.h>
@@ -73,11 +80,18 @@ s32 monitor_parse_arg(const char *arg, unsigned int *val, unsigned int flags);
 /* command handler declarations */
 
 #ifdef WITH_MASS_STORAGE
+MONITOR_CMD_HANDLER(dcache);
+MONITOR_CMD_HANDLER(exec);
+MONITOR_CMD_HANDLER(iostat);
 MONITOR_CMD_HANDLER(ls);
 MONITOR_CMD_HANDLER(mount);
 MONITOR_CMD_HANDLER(rootfs);
 #endif /* WITH_MASS_STORAGE */
 
+#ifdef WITH_DRV_MST_RAMDISK
+MONITOR_CMD_HANDLER(ramdisk);
+#endif /* WITH_DRV_MST_RAMDISK */
+
 #ifdef WITH_NETWORKING
 MONITOR_CMD_HANDLER(arp);
 MONITOR_CMD_HANDLER(netif);
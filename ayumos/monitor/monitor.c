@@ -25,12 +25,18 @@ const struct command g_commands[] =
 #endif /* WITH_NETWORKING */
     {"cat",             cmd_cat},
     {"date",            cmd_date},
+#ifdef WITH_MASS_STORAGE
+    {"dcache",          cmd_dcache},
+#endif /* WITH_MASS_STORAGE */
     {"dfu",             cmd_dfu},
     {"disassemble",     cmd_disassemble},
     {"dump",            cmd_dump},
     {"dumph",           cmd_dumph},
     {"dumpw",           cmd_dumpw},
     {"echo",            cmd_echo},
+#ifdef WITH_MASS_STORAGE
+    {"exec",            cmd_exec},
+#endif /* WITH_MASS_STORAGE */
     {"fill",            cmd_fill},
     {"fillh",           cmd_fillh},
     {"fillw",           cmd_fillw},
@@ -39,6 +45,9 @@ const struct command g_commands[] =
     {"help",            cmd_help},
     {"history",         cmd_history},
     {"id",              cmd_id},
+#ifdef WITH_MASS_STORAGE
+    {"iostat",          cmd_iostat},
+#endif /* WITH_MASS_STORAGE */
     {"ls",              cmd_ls},
     {"lsdev",           cmd_lsdev},
     {"map",             cmd_map},
@@ -47,6 +56,9 @@ const struct command g_commands[] =
     {"netif",           cmd_netif},
 #endif /* WITH_NETWORKING */
     {"raw",             cmd_raw},
+#ifdef WITH_DRV_MST_RAMDISK
+    {"ramdisk",         cmd_ramdisk},
+#endif /* WITH_DRV_MST_RAMDISK */
     {"rootfs",          cmd_rootfs},
 #ifdef WITH_NETWORKING
     {"route",           cmd_route},
@@ -6,8 +6,13 @@
 
     (c) Stuart Wallace, February 2017.
 
-    Syntax: mkromfs [-l <volume_label>] -r <root_dir> [-o <image_file>]
+    Syntax: mkromfs [-c|-C] [-l <volume_label>] -r <root_dir> [-o <image_file>]
             mkromfs -h
+
+    With -c, the contents of non-executable files are LZ4-compressed in independently-decompressible
+    chunks of ROMFS_CHUNK_SIZE bytes; executables are left uncompressed, so that the kernel can run
+    them in place.  -C compresses executables as well.  A file is only stored compressed if doing so
+    makes it smaller.
 */
 
 #define TARGET_LITTLEENDIAN
@@ -34,9 +39,20 @@
 /* Meaningless "magic number" which validates a romfs superblock */
 #define ROMFS_SUPERBLOCK_MAGIC      (0x6c1f39e4)
 
+/* Image format version emitted: directory contents are contiguous and sorted by name */
+#define ROMFS_VERSION_SORTED        (1)
+
+/* Optional image features */
+#define ROMFS_FEATURE_COMPRESSED    (0x0001)    /* Image may contain compressed files   */
+
+/* Compressed files are divided into independently-compressed chunks of ROMFS_CHUNK_SIZE bytes */
+#define ROMFS_LOG_CHUNK_SIZE        (12)
+#define ROMFS_CHUNK_SIZE            (1U << ROMFS_LOG_CHUNK_SIZE)
+
 /* Flags associated with a romfs_node_t */
 #define RN_FILE         (0x0001)    /* Node represents a file       */
 #define RN_DIR          (0x0002)    /* Node represents a directory  */
+#define RN_COMPRESSED   (0x0004)    /* File contents are compressed */
 
 typedef struct romfs_superblock
 {
@@ -45,6 +61,9 @@ typedef struct romfs_superblock
     u32     cdate;              /* Timestamp at which the fs image was created      */
     u16     nnodes;             /* Number of romfs_node_t structures in the fs      */
     char    label[16];          /* Zero-terminated volume label (name) string       */
+    u16     version;            /* Image format version                             */
+    u16     root_nchildren;     /* Number of nodes in the root directory            */
+    u16     features;           /* Optional features used                           */
 } romfs_superblock_t;
 
 /* romfs_node_t: metadata for a "node", i.e. a directory entry, within the file system */
@@ -52,8 +71,9 @@ typedef struct romfs_node
 {
     u16         id;             /* Unique identifier of this node                               */
     u16         parent_id;      /* Identifier of this node's parent                             */
-    u32         size;           /* Size of this node's data block; zero for directory nodes     */
-    u32         offset;         /* Offset of the data block, from the start of the superblock   */
+    u32         size;           /* Size of this node's data block; dirs: number of children     */
+    u32         offset;         /* Offset of the data block, from the start of the superblock;  */
+                                /* dirs: index of the first child node                          */
     u32         name_offset;    /* Offset of the node name, from the start of the superblock    */
     u32         mdate;          /* Node last-modification timestamp                             */
     u16         uid;            /* Owner user ID                                                */
@@ -82,17 +102,36 @@ typedef struct romfs_node
 
 #define LABEL_MAX_LEN           15              /* Max length of a volume label string */
 
+/* LZ4 block format parameters */
+#define LZ4_MIN_MATCH           4               /* Minimum match length                         */
+#define LZ4_MAX_OFFSET          65535           /* Maximum distance from a match to its source  */
+#define LZ4_LAST_LITERALS       5               /* Last bytes of a block must be literals       */
+#define LZ4_MF_LIMIT            12              /* Last match must start this far before end    */
+#define LZ4_HASH_LOG            12              /* log2 of the number of hash table entries     */
 
-int add_node(romfs_node_t *node);
-int add_dir(const char *path, int parent_id);
+/* File compression modes */
+typedef enum compress_mode
+{
+    COMPRESS_NONE,                              /* Don't compress any files                     */
+    COMPRESS_DATA,                              /* Compress non-executable files                */
+    COMPRESS_ALL                                /* Compress all files                           */
+} compress_mode_t;
+
+
+int add_node(romfs_node_t *node, const char *path);
+file_perm_t mode_to_perm(const mode_t mode);
+unsigned int add_dir(const char *path, int parent_id);
+int dirent_filter(const struct dirent *ent);
+int dirent_compare(const struct dirent **a, const struct dirent **b);
 unsigned int add_name(const char *name);
 unsigned int add_data(const char *pathname, unsigned int size);
+int compress_data(unsigned int data_start, unsigned int size);
+unsigned int lz4_compress(const unsigned char *src, unsigned int len, unsigned char *dst);
+unsigned char *lz4_put_length(unsigned char *out, unsigned int len);
 void checked_fwrite(const void *data, size_t len, FILE *fp);
 void *checked_malloc(size_t size, const char *name);
 int usage(const char *imagename);
 
-int next_id = 0;
-
 unsigned int data_len = 0;
 unsigned int data_pos = 0;
 unsigned char *data;
@@ -104,6 +143,10 @@ char *names;
 unsigned int nodes_pos = 0;
 unsigned int nodes_len = 0;
 romfs_node_t *nodes;
+char **node_paths;          /* Host path of each directory node; NULL for files */
+
+compress_mode_t compress_mode = COMPRESS_NONE;
+u16 features = 0;
 
 
 /*
@@ -114,17 +157,25 @@ int main(int argc, char **argv)
     FILE *fp_out;
     DIR *dir;
     romfs_superblock_t sblk;
-    u32 names_offset, data_offset, i;
+    u32 names_offset, data_offset, root_nchildren, i;
     char label[LABEL_MAX_LEN + 1] = {0}, root[PATH_MAX + 1] = {0};
     int opt;
 
     fp_out = stdout;
 
     /* Process and validate command-line arguments */
-    while((opt = getopt(argc, argv, "l:r:o:h")) != -1)
+    while((opt = getopt(argc, argv, "cCl:r:o:h")) != -1)
     {
         switch(opt)
         {
+            case 'c':       /* "-c" - compress non-executable files */
+                compress_mode = COMPRESS_DATA;
+                break;
+
+            case 'C':       /* "-C" - compress all files, including executables */
+                compress_mode = COMPRESS_ALL;
+                break;
+
             case 'l':       /* "-l <label>" - specify volume label */
                 if(strlen(optarg) > LABEL_MAX_LEN)
                     error(E_SYNTAX, 0, "Label too long (%d chars max)", LABEL_MAX_LEN);
@@ -168,15 +219,40 @@ int main(int argc, char **argv)
 
     /* Allocate initial nodes buffer */
     nodes = checked_malloc(INITIAL_NODES_BUF_LEN * sizeof(romfs_node_t), "nodes");
+    node_paths = checked_malloc(INITIAL_NODES_BUF_LEN * sizeof(char *), "node paths");
     nodes_len = INITIAL_NODES_BUF_LEN;
 
-    add_dir(root, next_id);
+    /*
+        Add the tree breadth-first: the contents of each directory are added as a contiguous run of
+        nodes once its parent directory is complete, and the range is recorded in its node.
+    */
+    root_nchildren = add_dir(root, 0);
 
-    sblk.magic      = N2BE32(ROMFS_SUPERBLOCK_MAGIC);
-    sblk.len        = N2BE32(sizeof(romfs_superblock_t) + (nodes_pos * sizeof(romfs_node_t))
-                                + names_pos + data_pos);
-    sblk.cdate      = N2BE32(time(NULL));
-    sblk.nnodes     = N2BE16(nodes_pos);
+    for(i = 0; i < nodes_pos; ++i)
+    {
+        if(node_paths[i] != NULL)
+        {
+            ku32 first = nodes_pos, count = add_dir(node_paths[i], i + 1);
+
+            nodes[i].offset = N2BE32(first);
+            nodes[i].size = N2BE32(count);
+
+            free(node_paths[i]);
+        }
+    }
+
+    if(nodes_pos > 0xffff)
+        error(E_SYNTAX, 0, "Too many files and directories (65535 max)");
+
+    sblk.magic          = N2BE32(ROMFS_SUPERBLOCK_MAGIC);
+    sblk.len            = N2BE32(sizeof(romfs_superblock_t) + (nodes_pos * sizeof(romfs_node_t))
+                                     + names_pos + data_pos);
+    sblk.cdate          = N2BE32(time(NULL));
+    sblk.nnodes         = N2BE16(nodes_pos);
+    sblk.version        = N2BE16(ROMFS_VERSION_SORTED);
+    sblk.root_nchildren = N2BE16(root_nchildren);
+    sblk.features       = N2BE16(features);
+    memset(sblk.label, 0, sizeof(sblk.label));
     strcpy(sblk.label, label);
 
     /* Fix up data and names offsets in nodes */
@@ -185,7 +261,9 @@ int main(int argc, char **argv)
 
     for(i = 0; i < nodes_pos; ++i)
     {
-        nodes[i].offset = N2BE32(BE2N32(nodes[i].offset) + data_offset);
+        if(BE2N16(nodes[i].flags) & RN_FILE)
+            nodes[i].offset = N2BE32(BE2N32(nodes[i].offset) + data_offset);
+
         nodes[i].name_offset = N2BE32(BE2N32(nodes[i].name_offset) + names_offset);
     }
 
@@ -195,6 +273,7 @@ int main(int argc, char **argv)
     checked_fwrite(data, data_pos, fp_out);
     checked_fwrite(names, names_pos, fp_out);
 
+    free(node_paths);
     free(nodes);
     free(names);
     free(data);
@@ -205,95 +284,147 @@ int main(int argc, char **argv)
 
 
 /*
-    add_dir() - add dir <path> to the romfs image, recursively adding sub-directories too.  Use
-    <parent_id> as the node ID of <path>'s parent node.
+    add_dir() - add the entries in dir <path> to the romfs image, as a contiguous run of nodes sorted
+    by name.  Use <parent_id> as the node ID of <path>'s parent node.  Sub-directories are not
+    added; their host paths are recorded in node_paths, so that main() can add them once this
+    directory is complete.  Return the number of nodes added.
 */
-int add_dir(const char *path, int parent_id)
+unsigned int add_dir(const char *path, int parent_id)
 {
     char pathname[PATH_MAX + 1];
-    DIR *dir;
-    struct dirent *ent;
+    struct dirent **ents;
     struct stat statbuf;
+    int i, n;
+    unsigned int count = 0;
 
     errno = 0;
 
-    dir = opendir(path);
-    if(!dir)
+    n = scandir(path, &ents, dirent_filter, dirent_compare);
+    if(n < 0)
         error(E_FILE, errno, "Unable to open directory '%s'", path);
 
-    while((ent = readdir(dir)) != NULL)
+    for(i = 0; i < n; ++i)
     {
-        int ret, node_id;
+        int ret;
         romfs_node_t node;
 
-        if(!strcmp(".", ent->d_name) || !strcmp("..", ent->d_name))
-            continue;
-
-        if(snprintf(pathname, PATH_MAX, "%s/%s", path, ent->d_name) < 0)
+        if(snprintf(pathname, PATH_MAX, "%s/%s", path, ents[i]->d_name) < 0)
             error(E_PRINTF, 0, "Failed to generate path string");
 
         ret = stat(pathname, &statbuf);
         if(ret != 0)
             error(E_STAT, errno, "Failed to stat() '%s'", pathname);
 
-        node_id = ++next_id;
-
-        node.id             = N2BE16(node_id);
-        node.parent_id      = N2BE16(parent_id);
-        node.name_offset    = N2BE32(add_name(ent->d_name));
-        node.mdate          = N2BE32(statbuf.st_mtime);
-        node.uid            = N2BE16(statbuf.st_uid);
-        node.gid            = N2BE16(statbuf.st_gid);
-        node.permissions    = N2BE16(statbuf.st_mode & 0x777);
-
         if(S_ISDIR(statbuf.st_mode))
         {
+            /* The range of child nodes is filled in when the directory's contents are added */
             node.flags  = N2BE16(RN_DIR);
             node.offset = 0;
             node.size   = 0;
         }
         else if(S_ISREG(statbuf.st_mode))
         {
+            ku32 offset = add_data(pathname, statbuf.st_size);
+
             node.flags  = N2BE16(RN_FILE);
-            node.offset = N2BE32(add_data(pathname, statbuf.st_size));
+            node.offset = N2BE32(offset);
             node.size   = N2BE32(statbuf.st_size);
+
+            if(((compress_mode == COMPRESS_ALL)
+                || ((compress_mode == COMPRESS_DATA)
+                    && !(statbuf.st_mode & (S_IXUSR | S_IXGRP | S_IXOTH))))
+               && compress_data(offset, statbuf.st_size))
+            {
+                node.flags = N2BE16(RN_FILE | RN_COMPRESSED);
+                features |= ROMFS_FEATURE_COMPRESSED;
+            }
         }
         else
             continue;       /* Ignore anything that isn't a dir or a file */
 
-        add_node(&node);
+        /* Node IDs are the index of the node, plus one, so the kernel can find nodes by ID */
+        node.id             = N2BE16(nodes_pos + 1);
+        node.parent_id      = N2BE16(parent_id);
+        node.name_offset    = N2BE32(add_name(ents[i]->d_name));
+        node.mdate          = N2BE32(statbuf.st_mtime);
+        node.uid            = N2BE16(statbuf.st_uid);
+        node.gid            = N2BE16(statbuf.st_gid);
+        node.permissions    = N2BE16(mode_to_perm(statbuf.st_mode));
 
-        if(S_ISDIR(statbuf.st_mode))
-            add_dir(pathname, node_id);
+        add_node(&node, S_ISDIR(statbuf.st_mode) ? pathname : NULL);
+        ++count;
     }
 
-    closedir(dir);
+    for(i = 0; i < n; ++i)
+        free(ents[i]);
 
-    return 0;
+    free(ents);
+
+    return count;
+}
+
+
+/*
+    dirent_filter() - scandir() filter which excludes the "." and ".." directory entries.
+*/
+int dirent_filter(const struct dirent *ent)
+{
+    return strcmp(".", ent->d_name) && strcmp("..", ent->d_name);
+}
+
+
+/*
+    dirent_compare() - scandir() comparison function which sorts entries by name, in the order used
+    by the kernel's strcmp().
+*/
+int dirent_compare(const struct dirent **a, const struct dirent **b)
+{
+    return strcmp((*a)->d_name, (*b)->d_name);
 }
 
 
 /*
     add_node() - add a romfs_node_t structure to the nodes array, resizing the array if necessary.
+    If the node is a directory, <path> is its host path; otherwise <path> is NULL.
 */
-int add_node(romfs_node_t *node)
+int add_node(romfs_node_t *node, const char *path)
 {
     if(nodes_pos == nodes_len)
     {
         nodes = realloc(nodes, (nodes_pos + NODES_BUF_INCREMENT) * sizeof(romfs_node_t));
-        if(nodes == NULL)
+        node_paths = realloc(node_paths, (nodes_pos + NODES_BUF_INCREMENT) * sizeof(char *));
+        if((nodes == NULL) || (node_paths == NULL))
             error(E_MALLOC, errno, "Failed to realloc() %ld bytes",
                     (nodes_pos + NODES_BUF_INCREMENT) * sizeof(romfs_node_t));
 
         nodes_len += NODES_BUF_INCREMENT;
     }
 
+    node_paths[nodes_pos] = NULL;
+    if(path != NULL)
+    {
+        node_paths[nodes_pos] = strdup(path);
+        if(node_paths[nodes_pos] == NULL)
+            error(E_MALLOC, errno, "Failed to allocate path buffer");
+    }
+
     memcpy(&nodes[nodes_pos++], node, sizeof(romfs_node_t));
 
     return 0;
 }
 
 
+/*
+    mode_to_perm() - convert the permissions in a host file mode to a file_perm_t.
+*/
+file_perm_t mode_to_perm(const mode_t mode)
+{
+    return (((mode >> 6) & 7) << (FS_PERM_SHIFT_U + 1))
+            | (((mode >> 3) & 7) << (FS_PERM_SHIFT_G + 1))
+            | ((mode & 7) << (FS_PERM_SHIFT_O + 1));
+}
+
+
 /*
     add_name() - add a node name to the "names" string table, resizing the table if necessary.
     Return the offset of the name from the start of the string table.
@@ -309,7 +440,7 @@ unsigned int add_name(const char *name)
     {
         unsigned int extend_by = MAX(NAMES_BUF_INCREMENT, len);
 
-        name = realloc(names, names_pos + extend_by);
+        names = realloc(names, names_pos + extend_by);
         if(names == NULL)
             error(E_MALLOC, errno, "Failed to realloc() %d bytes", names_pos + extend_by);
 
@@ -340,7 +471,7 @@ unsigned int add_data(const char *pathname, unsigned int size)
     data_start = data_pos;
 
     /* Round size up to the next multiple of four bytes */
-    size_rounded = (size + 3) & ~4;
+    size_rounded = (size + 3) & ~3;
 
     /* Increase data buffer size if needed */
     if(data_pos + size_rounded >= data_len)
@@ -373,6 +504,153 @@ unsigned int add_data(const char *pathname, unsigned int size)
 }
 
 
+/*
+    compress_data() - attempt to compress the <size>-byte file whose contents were added to the data
+    area at offset <data_start> by add_data().  The contents are split into ROMFS_CHUNK_SIZE-byte
+    chunks, each of which is compressed independently, and preceded by a table giving the offset of
+    the end of each chunk's compressed data.  Chunks which do not shrink are stored uncompressed.
+    If the result is smaller than the original, replace the original with it and return non-zero;
+    otherwise leave the data area unchanged and return zero.
+*/
+int compress_data(unsigned int data_start, unsigned int size)
+{
+    const unsigned int nchunks = (size + ROMFS_CHUNK_SIZE - 1) >> ROMFS_LOG_CHUNK_SIZE,
+                       table_len = nchunks * sizeof(u32);
+    unsigned int i, out_len, size_rounded;
+    unsigned char *out, *chunk_buf;
+    u32 *table;
+
+    if(!size)
+        return 0;
+
+    /* Worst case: every chunk is stored uncompressed */
+    out = checked_malloc(table_len + size, "compressed data");
+    chunk_buf = checked_malloc(ROMFS_CHUNK_SIZE + (ROMFS_CHUNK_SIZE / 255) + 16, "chunk");
+    table = (u32 *) out;
+    out_len = table_len;
+
+    for(i = 0; i < nchunks; ++i)
+    {
+        const unsigned char * const src = data + data_start + (i << ROMFS_LOG_CHUNK_SIZE);
+        const unsigned int chunk_len = MIN(ROMFS_CHUNK_SIZE, size - (i << ROMFS_LOG_CHUNK_SIZE));
+        unsigned int len = lz4_compress(src, chunk_len, chunk_buf);
+
+        /* The kernel treats a chunk whose stored length equals its real length as uncompressed */
+        if(len >= chunk_len)
+        {
+            memcpy(out + out_len, src, chunk_len);
+            len = chunk_len;
+        }
+        else
+            memcpy(out + out_len, chunk_buf, len);
+
+        out_len += len;
+        table[i] = N2BE32(out_len);
+    }
+
+    free(chunk_buf);
+
+    size_rounded = (size + 3) & ~3;
+    if(out_len >= size_rounded)
+    {
+        free(out);
+        return 0;
+    }
+
+    memcpy(data + data_start, out, out_len);
+    free(out);
+
+    for(; out_len & 3; ++out_len)
+        data[data_start + out_len] = 0;
+
+    data_pos = data_start + out_len;
+
+    return 1;
+}
+
+
+/*
+    lz4_compress() - compress the <len> bytes at <src> into an LZ4 block at <dst>, which must have
+    room for at least (len + (len / 255) + 16) bytes.  Return the length of the block.  This is a
+    simple greedy compressor: speed of decompression matters here, not speed of compression.
+*/
+unsigned int lz4_compress(const unsigned char *src, unsigned int len, unsigned char *dst)
+{
+    int hash_table[1 << LZ4_HASH_LOG];
+    unsigned int ip = 0, anchor = 0, lit_len;
+    unsigned char *out = dst, *token;
+
+    memset(hash_table, 0xff, sizeof(hash_table));
+
+    while(len >= LZ4_MF_LIMIT + 1 && ip < len - LZ4_MF_LIMIT)
+    {
+        const u32 seq = src[ip] | (src[ip + 1] << 8) | (src[ip + 2] << 16)
+                        | ((u32) src[ip + 3] << 24);
+        const unsigned int h = (seq * 2654435761U) >> (32 - LZ4_HASH_LOG);
+        const int ref = hash_table[h];
+        unsigned int match_len, offset;
+
+        hash_table[h] = ip;
+
+        if((ref < 0) || (ip - ref > LZ4_MAX_OFFSET) || memcmp(src + ref, src + ip, LZ4_MIN_MATCH))
+        {
+            ++ip;
+            continue;
+        }
+
+        for(match_len = LZ4_MIN_MATCH; (ip + match_len < len - LZ4_LAST_LITERALS)
+                                        && (src[ref + match_len] == src[ip + match_len]); ++match_len)
+            ;
+
+        lit_len = ip - anchor;
+        offset = ip - ref;
+
+        token = out++;
+        *token = (MIN(lit_len, 15U) << 4) | MIN(match_len - LZ4_MIN_MATCH, 15U);
+        if(lit_len >= 15)
+            out = lz4_put_length(out, lit_len - 15);
+
+        memcpy(out, src + anchor, lit_len);
+        out += lit_len;
+
+        *out++ = offset & 0xff;
+        *out++ = offset >> 8;
+
+        if(match_len - LZ4_MIN_MATCH >= 15)
+            out = lz4_put_length(out, match_len - LZ4_MIN_MATCH - 15);
+
+        ip += match_len;
+        anchor = ip;
+    }
+
+    /* The block ends with a sequence consisting only of literals */
+    lit_len = len - anchor;
+    *out++ = MIN(lit_len, 15U) << 4;
+    if(lit_len >= 15)
+        out = lz4_put_length(out, lit_len - 15);
+
+    memcpy(out, src + anchor, lit_len);
+    out += lit_len;
+
+    return out - dst;
+}
+
+
+/*
+    lz4_put_length() - write the extended length field <len> at <out>; return the address of the
+    byte following the field.
+*/
+unsigned char *lz4_put_length(unsigned char *out, unsigned int len)
+{
+    for(; len >= 255; len -= 255)
+        *out++ = 255;
+
+    *out++ = len;
+
+    return out;
+}
+
+
 /*
     checked_fwrite() - do an fwrite(); abort the program with an error message if it fails.
 */
@@ -403,8 +681,11 @@ void *checked_malloc(size_t size, const char *name)
 int usage(const char *imagename)
 {
     fprintf(stderr,
-        "Usage: %s [-l <volume_label>] -r <root_dir> [-o <image_file>]\n"
+        "Usage: %s [-c|-C] [-l <volume_label>] -r <root_dir> [-o <image_file>]\n"
         "       %s -h\n\n"
+        "  -c                  Compress files, other than executables, where doing so\n"
+        "                      saves space.  Executables remain executable in place.\n"
+        "  -C                  Compress all files, including executables.\n"
         "  -l <volume_label>   Set volume label to <volume_label>.\n"
         "  -r <root_dir>       Specify the directory containing the files to be added.\n"
         "                      to the romfs image.\n"
@@ -0,0 +1,609 @@
+/*
+    ext2 read and write throughput benchmark
+
+    Part of ayumos
+
+
+    (c) Stuart Wallace <stuartw@atom.net>, October 2026.
+
+
+    This program mounts one or more ext2 images using the real ext2 driver and block cache, walks
+    each file system, and reads every regular file through the driver's read function.  Each image
+    is walked twice: once with a cold cache and once with a warm cache.  For each pass it reports
+    the throughput, the number of device requests and blocks read per megabyte of file data, and
+    the block cache hit rate.  Every directory entry is then looked up by name, and the number of
+    block cache lookups per name lookup is reported.  Finally, every directory is listed using the
+    batched read_dir_multi operation, with the smallest permitted buffer, and the listing is checked
+    against the one produced by read_dir.
+
+    With -w, the image is then modified: a directory is created, and files in it are extended by
+    appending to each in turn, one request at a time.  The throughput and the number of extents
+    into which each file was allocated are reported, and the data is read back and checked.  One
+    file is then truncated.  Run e2fsck -fn on the image afterwards to check its consistency.
+
+    Usage: ext2bench [-c cache_blocks] [-r request_blocks] [-v] [-w] image...
+
+        -c  size of the block cache, in 512-byte blocks (default 2048)
+        -r  size of each read or write request, in 512-byte blocks (default 128)
+        -v  print the path, size and FNV-1a checksum of each file read
+        -w  run the write test (modifies the image)
+*/
+
+#include <kernel/fs/ext2/ext2.h>
+#include <kernel/include/device/block.h>
+#include <kernel/include/error.h>
+#include <kernel/util/kutil.h>
+#include <klibc/include/stdio.h>
+#include <klibc/include/stdlib.h>
+#include <klibc/include/string.h>
+#include <klibc/include/strings.h>
+
+#include "image.h"
+
+
+#define BENCH_PATH_LEN      (256)
+#define BENCH_WRITE_FILES   (3)         /* Number of files appended to concurrently in write test */
+#define BENCH_WRITE_BLOCKS  (4096)      /* Length of each file written, in 512-byte blocks        */
+#define BENCH_WRITE_EXTENTS (64)        /* Max number of extents reported per file written        */
+
+typedef struct bench_pass
+{
+    u32 files;
+    u32 bytes;
+    u32 errors;
+} bench_pass_t;
+
+static u32 g_request_blocks = 128;
+static u32 g_verbose;
+static u32 g_write;
+static u8 *g_read_buf;
+static blockdev_stats_t g_dev_stats;
+
+
+static s32 bench_dev_read(dev_t *dev, ku32 offset, u32 *len, void *buf)
+{
+    if((offset + *len > dev->len) || image_read(offset, *len, buf))
+        return -EREAD;
+
+    ++g_dev_stats.reads;
+    g_dev_stats.blocks_read += *len;
+
+    return SUCCESS;
+}
+
+
+static s32 bench_dev_write(dev_t *dev, ku32 offset, u32 *len, const void *buf)
+{
+    if((offset + *len > dev->len) || image_write(offset, *len, buf))
+        return -EWRITE;
+
+    ++g_dev_stats.writes;
+    g_dev_stats.blocks_written += *len;
+
+    return SUCCESS;
+}
+
+
+/*
+    bench_read_file() - read the whole of the file described by <node>.
+*/
+static s32 bench_read_file(vfs_t * const vfs, fs_node_t * const node, const char * const path,
+                           bench_pass_t * const pass)
+{
+    ku32 nblocks = (node->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    u32 offset, hash = 0;
+
+    for(offset = 0; offset < nblocks;)
+    {
+        ku32 count = MIN(g_request_blocks, nblocks - offset);
+        ks32 ret = vfs->driver->read(vfs, node, g_read_buf, offset, count);
+
+        if(ret <= 0)
+        {
+            printf("%s: read failed at block %u: %d\n", path, offset, ret);
+            ++pass->errors;
+            return ret ? ret : -EINVAL;
+        }
+
+        /* Checksum the file data, excluding the padding beyond the end of the file */
+        hash ^= fnv1a32(g_read_buf, MIN(ret * BLOCK_SIZE, node->size - (offset * BLOCK_SIZE)));
+        offset += ret;
+    }
+
+    ++pass->files;
+    pass->bytes += node->size;
+
+    if(g_verbose)
+        printf("%-40s %10u %08x\n", path, node->size, hash);
+
+    return SUCCESS;
+}
+
+
+/*
+    bench_walk() - read every file in the directory <inum> and, recursively, its subdirectories.
+*/
+static s32 bench_walk(vfs_t * const vfs, ku32 inum, char * const path, bench_pass_t * const pass)
+{
+    ku32 path_len = strlen(path);
+    fs_node_t node;
+    void *ctx;
+    s32 ret;
+
+    ret = vfs->driver->open_dir(vfs, inum, &ctx);
+    if(ret != SUCCESS)
+        return ret;
+
+    bzero(&node, sizeof(node));
+
+    while((ret = vfs->driver->read_dir(vfs, ctx, NULL, &node)) == SUCCESS)
+    {
+        if(!strcmp(node.name, ".") || !strcmp(node.name, "..")
+           || (path_len + strlen(node.name) + 2 > BENCH_PATH_LEN))
+            continue;
+
+        path[path_len] = '/';
+        strcpy(path + path_len + 1, node.name);
+
+        if(node.type == FSNODE_TYPE_DIR)
+            bench_walk(vfs, node.first_block, path, pass);
+        else
+            bench_read_file(vfs, &node, path, pass);
+
+        path[path_len] = '\0';
+    }
+
+    kfree(node.name);
+    vfs->driver->close_dir(vfs, ctx);
+
+    return (ret == -ENOENT) ? SUCCESS : ret;
+}
+
+
+/*
+    bench_lookup() - look up each entry in the directory <inum> and, recursively, its subdirectories
+    by name, and check that the lookup finds the same inode as the directory iteration.
+*/
+static s32 bench_lookup(vfs_t * const vfs, ku32 inum, bench_pass_t * const pass)
+{
+    fs_node_t node, found;
+    void *ctx, *lookup_ctx;
+    s32 ret;
+
+    ret = vfs->driver->open_dir(vfs, inum, &ctx);
+    if(ret != SUCCESS)
+        return ret;
+
+    bzero(&node, sizeof(node));
+    bzero(&found, sizeof(found));
+
+    while((ret = vfs->driver->read_dir(vfs, ctx, NULL, &node)) == SUCCESS)
+    {
+        if(!strcmp(node.name, ".") || !strcmp(node.name, ".."))
+            continue;
+
+        ret = vfs->driver->open_dir(vfs, inum, &lookup_ctx);
+        if(ret == SUCCESS)
+        {
+            ret = vfs->driver->read_dir(vfs, lookup_ctx, node.name, &found);
+            vfs->driver->close_dir(vfs, lookup_ctx);
+        }
+
+        ++pass->files;
+        if((ret != SUCCESS) || (found.first_block != node.first_block))
+        {
+            printf("lookup of '%s' in directory %u failed: %d\n", node.name, inum, ret);
+            ++pass->errors;
+        }
+
+        if(node.type == FSNODE_TYPE_DIR)
+            bench_lookup(vfs, node.first_block, pass);
+    }
+
+    kfree(node.name);
+    kfree(found.name);
+    vfs->driver->close_dir(vfs, ctx);
+
+    return (ret == -ENOENT) ? SUCCESS : ret;
+}
+
+
+/*
+    bench_list() - list the directory <inum> and, recursively, its subdirectories with read_dir_multi
+    and check that each entry matches the one returned by read_dir.  The buffer holds only one
+    maximum-length record, so most calls must leave an entry unread for the next call.
+*/
+static s32 bench_list(vfs_t * const vfs, ku32 inum, bench_pass_t * const pass)
+{
+    u32 buf[VFS_DIRENT_MAX_LEN / sizeof(u32)];
+    fs_node_t node;
+    void *ctx, *multi_ctx;
+    s32 ret, len = 0;
+    u32 pos = 0;
+
+    ret = vfs->driver->open_dir(vfs, inum, &ctx);
+    if(ret != SUCCESS)
+        return ret;
+
+    ret = vfs->driver->open_dir(vfs, inum, &multi_ctx);
+    if(ret != SUCCESS)
+    {
+        vfs->driver->close_dir(vfs, ctx);
+        return ret;
+    }
+
+    bzero(&node, sizeof(node));
+
+    while((ret = vfs->driver->read_dir(vfs, ctx, NULL, &node)) == SUCCESS)
+    {
+        const vfs_dirent_t *de;
+
+        if(pos == (u32) len)
+        {
+            len = vfs->driver->read_dir_multi(vfs, multi_ctx, (vfs_dirent_t *) buf, sizeof(buf));
+            pos = 0;
+            if(len <= 0)
+            {
+                printf("read_dir_multi in directory %u failed at '%s': %d\n", inum, node.name, len);
+                ++pass->errors;
+                break;
+            }
+        }
+
+        de = (const vfs_dirent_t *) ((u8 *) buf + pos);
+        pos += de->len;
+
+        ++pass->files;
+        if(strcmp(de->name, node.name) || (de->first_block != node.first_block)
+           || (de->type != node.type) || (de->size != node.size) || (de->mtime != node.mtime)
+           || (de->permissions != node.permissions))
+        {
+            printf("read_dir_multi entry '%s' in directory %u does not match '%s'\n", de->name,
+                   inum, node.name);
+            ++pass->errors;
+        }
+
+        if((node.type == FSNODE_TYPE_DIR) && strcmp(node.name, ".") && strcmp(node.name, ".."))
+            bench_list(vfs, node.first_block, pass);
+    }
+
+    if((ret == -ENOENT) && ((pos != (u32) len)
+       || vfs->driver->read_dir_multi(vfs, multi_ctx, (vfs_dirent_t *) buf, sizeof(buf))))
+    {
+        printf("read_dir_multi in directory %u returned extra entries\n", inum);
+        ++pass->errors;
+    }
+
+    kfree(node.name);
+    vfs->driver->close_dir(vfs, multi_ctx);
+    vfs->driver->close_dir(vfs, ctx);
+
+    return (ret == -ENOENT) ? SUCCESS : ret;
+}
+
+
+/*
+    bench_fill() - fill the <count> blocks at <buf> with a pattern identifying file <file> and block
+    <block>.
+*/
+static void bench_fill(u8 * const buf, ku32 file, ku32 block, ku32 count)
+{
+    u32 u;
+
+    for(u = 0; u < count * BLOCK_SIZE; ++u)
+        buf[u] = ((block + (u / BLOCK_SIZE)) * 7) ^ (file * 61) ^ u;
+}
+
+
+/*
+    bench_write() - create a directory containing BENCH_WRITE_FILES files, and extend them by
+    appending a request's worth of data to each in turn.  Report the write throughput and the
+    number of extents in each file, then read the files back and check their contents.  Finally,
+    truncate the last file to half its length.
+*/
+static s32 bench_write(vfs_t * const vfs)
+{
+    const block_cache_stats_t before = *block_cache_stats();
+    const blockdev_stats_t dev_before = g_dev_stats;
+    fs_node_t dir, node[BENCH_WRITE_FILES];
+    ext2_extent_t ext[BENCH_WRITE_EXTENTS];
+    block_cache_stats_t after;
+    u32 f, offset, lookups, errors = 0;
+    u8 * const check = (u8 *) kmalloc(g_request_blocks * BLOCK_SIZE);
+    double start, elapsed, mbytes;
+    s32 ret;
+
+    if(check == NULL)
+        return -ENOMEM;
+
+    bzero(&dir, sizeof(dir));
+    bzero(node, sizeof(node));
+
+    dir.type = FSNODE_TYPE_DIR;
+    dir.permissions = FS_PERM_URWX | FS_PERM_GRX | FS_PERM_ORX;
+
+    ret = fs_node_set_name(&dir, "bench-write");
+    if(ret == SUCCESS)
+        ret = ext2_create_node(vfs, vfs->root_block, &dir);
+
+    for(f = 0; (ret == SUCCESS) && (f < BENCH_WRITE_FILES); ++f)
+    {
+        char name[16];
+
+        sprintf(name, "file%u", f);
+        node[f].type = FSNODE_TYPE_FILE;
+        node[f].permissions = FS_PERM_URW | FS_PERM_GR | FS_PERM_OR;
+
+        ret = fs_node_set_name(&node[f], name);
+        if(ret == SUCCESS)
+            ret = ext2_create_node(vfs, dir.first_block, &node[f]);
+    }
+
+    if(ret != SUCCESS)
+    {
+        printf("  write: failed to create files: %d\n", ret);
+        kfree(check);
+        return ret;
+    }
+
+    start = bench_time();
+
+    for(offset = 0; (ret == SUCCESS) && (offset < BENCH_WRITE_BLOCKS); offset += g_request_blocks)
+    {
+        ku32 count = MIN(g_request_blocks, BENCH_WRITE_BLOCKS - offset);
+
+        for(f = 0; (ret == SUCCESS) && (f < BENCH_WRITE_FILES); ++f)
+        {
+            bench_fill(g_read_buf, f, offset, count);
+
+            ret = vfs->driver->write(vfs, &node[f], g_read_buf, offset, count);
+            if(ret == (s32) count)
+            {
+                node[f].size = (offset + count) * BLOCK_SIZE;
+                ret = SUCCESS;
+            }
+            else if(ret >= 0)
+                ret = -EWRITE;
+        }
+    }
+
+    for(f = 0; (ret == SUCCESS) && (f < BENCH_WRITE_FILES); ++f)
+        ret = vfs->driver->write_node(vfs, &node[f]);
+
+    elapsed = bench_time() - start;
+
+    if(ret != SUCCESS)
+    {
+        printf("  write: failed: %d\n", ret);
+        kfree(check);
+        return ret;
+    }
+
+    mbytes = (BENCH_WRITE_FILES * BENCH_WRITE_BLOCKS * BLOCK_SIZE) / 1048576.0;
+
+    after = *block_cache_stats();
+    lookups = (after.hits - before.hits) + (after.misses - before.misses);
+
+    printf("  write: %u files, %u bytes, %.3f s, %.1f MB/s\n", BENCH_WRITE_FILES,
+           BENCH_WRITE_FILES * BENCH_WRITE_BLOCKS * BLOCK_SIZE, elapsed,
+           elapsed > 0 ? mbytes / elapsed : 0.0);
+    printf("        %u device writes (%u blocks); cache hit rate %.1f%%\n",
+           g_dev_stats.writes - dev_before.writes,
+           g_dev_stats.blocks_written - dev_before.blocks_written,
+           lookups ? (100.0 * (after.hits - before.hits)) / lookups : 0.0);
+
+    /* Report the layout of each file, and check its contents */
+    for(f = 0; f < BENCH_WRITE_FILES; ++f)
+    {
+        ext2_inode_t inode;
+        s32 n;
+
+        ret = ext2_read_inode(vfs, node[f].first_block, &inode);
+        if(ret != SUCCESS)
+            break;
+
+        n = ext2_bmap_range(vfs, 0, &inode, 0, ~0U, ext, BENCH_WRITE_EXTENTS);
+        printf("         %s: inode %u, %d extent%s", node[f].name, node[f].first_block, n,
+               (n == 1) ? "" : "s");
+        if(n > 0)
+            printf(" starting at block %u", ext[0].physical);
+        puts("");
+
+        for(offset = 0; offset < BENCH_WRITE_BLOCKS; offset += g_request_blocks)
+        {
+            ku32 count = MIN(g_request_blocks, BENCH_WRITE_BLOCKS - offset);
+
+            bench_fill(check, f, offset, count);
+            if((vfs->driver->read(vfs, &node[f], g_read_buf, offset, count) != (s32) count)
+               || memcmp(check, g_read_buf, count * BLOCK_SIZE))
+            {
+                printf("         %s: data mismatch at block %u\n", node[f].name, offset);
+                ++errors;
+                break;
+            }
+        }
+    }
+
+    /* Truncate the last file to half its length */
+    f = BENCH_WRITE_FILES - 1;
+    if(ret == SUCCESS)
+        ret = vfs->driver->reallocate(vfs, &node[f], node[f].size / 2);
+
+    if(ret == SUCCESS)
+    {
+        node[f].size /= 2;
+        ret = vfs->driver->write_node(vfs, &node[f]);
+    }
+
+    if(ret != SUCCESS)
+        printf("  write: failed: %d\n", ret);
+
+    for(f = 0; f < BENCH_WRITE_FILES; ++f)
+        kfree(node[f].name);
+
+    kfree(dir.name);
+    kfree(check);
+
+    return (ret == SUCCESS) && errors ? -EINVAL : ret;
+}
+
+
+/*
+    bench_image() - mount the image at <path> and walk it twice, reporting statistics for each pass.
+*/
+static s32 bench_image(const char * const image)
+{
+    const char * const pass_name[] = {"cold", "warm"};
+    char path[BENCH_PATH_LEN];
+    dev_t *dev;
+    vfs_t vfs;
+    s32 ret;
+    u32 pass;
+
+    dev = (dev_t *) CHECKED_KCALLOC(1, sizeof(dev_t));
+
+    dev->type = DEV_TYPE_BLOCK;
+    dev->subtype = DEV_SUBTYPE_MASS_STORAGE;
+    dev->block_size = BLOCK_SIZE;
+    dev->read = bench_dev_read;
+    dev->write = bench_dev_write;
+    dev->len = image_open(image, g_write);
+    if(!dev->len)
+        return -ENOENT;
+
+    vfs.driver = &g_ext2_ops;
+    vfs.dev = dev;
+    vfs.data = NULL;
+
+    ret = vfs.driver->mount(&vfs);
+    if(ret != SUCCESS)
+    {
+        printf("%s: mount failed: %d\n", image, ret);
+        image_close();
+        return ret;
+    }
+
+    printf("%s: %u-byte blocks, %u inodes per group\n", image,
+           ((ext2_fs_t *) vfs.data)->block_size, ((ext2_fs_t *) vfs.data)->inodes_per_group);
+
+    for(pass = 0; pass < 2; ++pass)
+    {
+        const block_cache_stats_t before = *block_cache_stats();
+        const blockdev_stats_t dev_before = g_dev_stats;
+        bench_pass_t result = {0};
+        block_cache_stats_t after;
+        u32 lookups, reqs, blocks;
+        double start, elapsed, mbytes;
+
+        path[0] = '\0';
+
+        start = bench_time();
+        ret = bench_walk(&vfs, vfs.root_block, path, &result);
+        elapsed = bench_time() - start;
+
+        after = *block_cache_stats();
+        lookups = (after.hits - before.hits) + (after.misses - before.misses);
+        reqs = g_dev_stats.reads - dev_before.reads;
+        blocks = g_dev_stats.blocks_read - dev_before.blocks_read;
+        mbytes = result.bytes / 1048576.0;
+
+        printf("  %s: %u files, %u bytes, %u errors, %.3f s, %.1f MB/s\n", pass_name[pass],
+               result.files, result.bytes, result.errors, elapsed,
+               elapsed > 0 ? mbytes / elapsed : 0.0);
+        printf("        %u device reads (%u blocks); %.1f reads/MB, %.1f blocks/MB; "
+               "cache hit rate %.1f%%\n", reqs, blocks,
+               mbytes > 0 ? reqs / mbytes : 0.0, mbytes > 0 ? blocks / mbytes : 0.0,
+               lookups ? (100.0 * (after.hits - before.hits)) / lookups : 0.0);
+
+        if(ret != SUCCESS)
+        {
+            printf("%s: walk failed: %d\n", image, ret);
+            break;
+        }
+    }
+
+    if(ret == SUCCESS)
+    {
+        const block_cache_stats_t before = *block_cache_stats();
+        bench_pass_t result = {0};
+        block_cache_stats_t after;
+        double start, elapsed;
+
+        start = bench_time();
+        ret = bench_lookup(&vfs, vfs.root_block, &result);
+        elapsed = bench_time() - start;
+
+        after = *block_cache_stats();
+
+        printf("  lookup: %u names, %u errors, %.3f s; %.1f block lookups per name\n",
+               result.files, result.errors, elapsed,
+               result.files ? ((after.hits - before.hits) + (after.misses - before.misses))
+                                / (double) result.files : 0.0);
+
+        if((ret == SUCCESS) && result.errors)
+            ret = -ENOENT;
+    }
+
+    if(ret == SUCCESS)
+    {
+        bench_pass_t result = {0};
+        double start, elapsed;
+
+        start = bench_time();
+        ret = bench_list(&vfs, vfs.root_block, &result);
+        elapsed = bench_time() - start;
+
+        printf("  list: %u entries, %u errors, %.3f s\n", result.files, result.errors, elapsed);
+
+        if((ret == SUCCESS) && result.errors)
+            ret = -EINVAL;
+    }
+
+    if((ret == SUCCESS) && g_write)
+        ret = bench_write(&vfs);
+
+    vfs.driver->unmount(&vfs);
+    image_close();
+
+    return ret;
+}
+
+
+int main(int argc, char **argv)
+{
+    u32 cache_blocks = 2048, failures = 0;
+    s32 i;
+
+    for(i = 1; (i < argc) && (argv[i][0] == '-'); ++i)
+    {
+        if(!strcmp(argv[i], "-v"))
+            g_verbose = 1;
+        else if(!strcmp(argv[i], "-w"))
+            g_write = 1;
+        else if(!strcmp(argv[i], "-c") && (i + 1 < argc))
+            cache_blocks = strtoul(argv[++i], NULL, 10);
+        else if(!strcmp(argv[i], "-r") && (i + 1 < argc))
+            g_request_blocks = strtoul(argv[++i], NULL, 10);
+        else
+            break;
+    }
+
+    if((i == argc) || !g_request_blocks)
+    {
+        puts("Usage: ext2bench [-c cache_blocks] [-r request_blocks] [-v] [-w] image...");
+        return 1;
+    }
+
+    if(block_cache_init(cache_blocks) != SUCCESS)
+        return 1;
+
+    g_read_buf = (u8 *) kmalloc(g_request_blocks * BLOCK_SIZE);
+    if(g_read_buf == NULL)
+        return 1;
+
+    for(; i < argc; ++i)
+        if(bench_image(argv[i]) != SUCCESS)
+            ++failures;
+
+    return failures ? 1 : 0;
+}
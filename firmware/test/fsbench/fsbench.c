@@ -0,0 +1,729 @@
+/*
+    File system benchmark
+
+    Part of ayumos
+
+
+    (c) Stuart Wallace <stuartw@atom.net>, October 2026.
+
+
+    This program mounts a FAT or ext2 image using the real file system driver and block cache, and
+    runs a scripted workload against it.  Each line of the script is one command:
+
+        lookup <path> [n]           look up <path>, one component at a time, <n> times (default 1)
+        read <path>                 read the whole of a file, one request at a time
+        randread <path> <n> [len]   make <n> reads of <len> blocks (default 1) at random offsets
+        append <path> <blocks>      append <blocks> blocks to a file, creating it if necessary
+        list <path>                 list a directory with read_dir_multi, a batch at a time
+        walk <path>                 enumerate a directory tree with read_dir
+        request <blocks>            set the size of each read or write request (default 128)
+        drop                        write back and discard the cache, and remount the image
+        sync                        write back dirty blocks
+        # ...                       comment
+
+    For each command, the program reports the number of operations performed (names looked up,
+    requests made or directory entries read), the number of bytes transferred, the elapsed time,
+    the throughput, the number of device reads and writes (and blocks read and written) per
+    operation, and the block cache hit rate.  Block numbers and lengths are in 512-byte blocks.
+
+    Appends write whole blocks, beginning at the block after the file's last (possibly partial)
+    block.  The FAT driver cannot create files, so on a FAT image, append only extends existing
+    files.  Scripts which append must be run with -w; run fsck on the image afterwards to check its
+    consistency.
+
+    Usage: fsbench [-c cache_blocks] [-r request_blocks] [-s seed] [-t ext2|fat] [-w] image script
+
+        -c  size of the block cache, in 512-byte blocks (default 2048)
+        -r  initial size of each read or write request, in 512-byte blocks (default 128)
+        -s  seed for the random offsets used by randread (default 1)
+        -t  file system type (default: try each driver in turn)
+        -w  open the image for writing
+*/
+
+#include <kernel/fs/ext2/ext2.h>
+#include <kernel/fs/fat/fat.h>
+#include <kernel/include/device/block.h>
+#include <kernel/include/error.h>
+#include <klibc/include/stdio.h>
+#include <klibc/include/stdlib.h>
+#include <klibc/include/string.h>
+#include <klibc/include/strings.h>
+
+#include "image.h"
+
+
+#define BENCH_MAX_ARGS      (4)         /* Max number of words in a script command              */
+#define BENCH_NAME_LEN      (256)       /* Max length of a path component                       */
+#define BENCH_LIST_LEN      (2048)      /* Length of the buffer passed to read_dir_multi        */
+
+/* Statistics sampled at the start of each command */
+typedef struct bench_sample
+{
+    block_cache_stats_t cache;
+    blockdev_stats_t dev;
+    double time;
+} bench_sample_t;
+
+/* Counts accumulated by a command */
+typedef struct bench_result
+{
+    u32 ops;
+    u32 bytes;
+    u32 errors;
+} bench_result_t;
+
+static vfs_driver_t * const g_drivers[] = {&g_ext2_ops, &g_fat_ops};
+
+static u32 g_request_blocks = 128;
+static u32 g_rand_state = 1;
+static u32 g_write;
+static u8 *g_buf;
+static blockdev_stats_t g_dev_stats;
+
+
+static s32 bench_dev_read(dev_t *dev, ku32 offset, u32 *len, void *buf)
+{
+    if((offset + *len > dev->len) || image_read(offset, *len, buf))
+        return -EREAD;
+
+    ++g_dev_stats.reads;
+    g_dev_stats.blocks_read += *len;
+
+    return SUCCESS;
+}
+
+
+static s32 bench_dev_write(dev_t *dev, ku32 offset, u32 *len, const void *buf)
+{
+    if((offset + *len > dev->len) || image_write(offset, *len, buf))
+        return -EWRITE;
+
+    ++g_dev_stats.writes;
+    g_dev_stats.blocks_written += *len;
+
+    return SUCCESS;
+}
+
+
+/*
+    bench_rand() - return the next value from a linear congruential generator, so that randread
+    offsets are reproducible on every host.
+*/
+static u32 bench_rand()
+{
+    g_rand_state = (g_rand_state * 1103515245) + 12345;
+
+    return g_rand_state >> 8;
+}
+
+
+static void bench_begin(bench_sample_t * const sample)
+{
+    sample->cache = *block_cache_stats();
+    sample->dev = g_dev_stats;
+    sample->time = bench_time();
+}
+
+
+/*
+    bench_report() - print the statistics for the command <cmd>, which began at <sample>.
+*/
+static void bench_report(const char * const cmd, const bench_sample_t * const sample,
+                         const bench_result_t * const result)
+{
+    const double elapsed = bench_time() - sample->time, mbytes = result->bytes / 1048576.0,
+                 ops = result->ops ? result->ops : 1;
+    const block_cache_stats_t * const cache = block_cache_stats();
+    ku32 hits = cache->hits - sample->cache.hits,
+         lookups = hits + (cache->misses - sample->cache.misses);
+
+    printf("%s: %u ops, %u bytes, %u errors, %.3f s, %.1f MB/s\n", cmd, result->ops,
+           result->bytes, result->errors, elapsed, elapsed > 0 ? mbytes / elapsed : 0.0);
+    printf("    per op: %.2f reads (%.2f blocks), %.2f writes (%.2f blocks); "
+           "cache hit rate %.1f%%\n",
+           (g_dev_stats.reads - sample->dev.reads) / ops,
+           (g_dev_stats.blocks_read - sample->dev.blocks_read) / ops,
+           (g_dev_stats.writes - sample->dev.writes) / ops,
+           (g_dev_stats.blocks_written - sample->dev.blocks_written) / ops,
+           lookups ? (100.0 * hits) / lookups : 0.0);
+}
+
+
+/*
+    bench_lookup() - look up <path>, one component at a time, and return its node through <node>.
+    The node's name must be freed by the caller.
+*/
+static s32 bench_lookup(vfs_t * const vfs, const char *path, fs_node_t * const node)
+{
+    char name[BENCH_NAME_LEN];
+
+    bzero(node, sizeof(*node));
+    node->type = FSNODE_TYPE_DIR;
+    node->first_block = vfs->root_block;
+
+    while(*path)
+    {
+        void *ctx;
+        u32 len;
+        s32 ret;
+
+        for(; *path == '/'; ++path)
+            ;
+
+        for(len = 0; path[len] && (path[len] != '/'); ++len)
+            ;
+
+        if(!len)
+            break;
+
+        if(len >= BENCH_NAME_LEN)
+            return -ENAMETOOLONG;
+
+        if(node->type != FSNODE_TYPE_DIR)
+            return -ENOTDIR;
+
+        memcpy(name, path, len);
+        name[len] = '\0';
+        path += len;
+
+        ret = vfs->driver->open_dir(vfs, node->first_block, &ctx);
+        if(ret != SUCCESS)
+            return ret;
+
+        ret = vfs->driver->read_dir(vfs, ctx, name, node);
+        vfs->driver->close_dir(vfs, ctx);
+
+        if(ret != SUCCESS)
+            return ret;
+    }
+
+    return SUCCESS;
+}
+
+
+/*
+    bench_create() - create the regular file <path>, whose parent directory must exist, and return
+    its node through <node>.
+*/
+static s32 bench_create(vfs_t * const vfs, char * const path, fs_node_t * const node)
+{
+    char * const slash = strrchr(path, '/');
+    fs_node_t parent;
+    s32 ret;
+
+    if(vfs->driver->create_node == NULL)
+        return -ENOSYS;
+
+    if(slash != NULL)
+        *slash = '\0';
+
+    ret = bench_lookup(vfs, (slash != NULL) ? path : "", &parent);
+    kfree(parent.name);
+
+    if(slash != NULL)
+        *slash = '/';
+
+    if(ret != SUCCESS)
+        return ret;
+
+    if(parent.type != FSNODE_TYPE_DIR)
+        return -ENOTDIR;
+
+    bzero(node, sizeof(*node));
+    node->type = FSNODE_TYPE_FILE;
+    node->permissions = FS_PERM_URW | FS_PERM_GR | FS_PERM_OR;
+
+    ret = fs_node_set_name(node, (slash != NULL) ? slash + 1 : path);
+    if(ret != SUCCESS)
+        return ret;
+
+    return vfs->driver->create_node(vfs, parent.first_block, node);
+}
+
+
+/*
+    bench_read() - read <count> blocks from the file <node>, starting at block <offset>, one request
+    at a time.
+*/
+static s32 bench_read(vfs_t * const vfs, fs_node_t * const node, u32 offset, u32 count,
+                      bench_result_t * const result)
+{
+    while(count)
+    {
+        ks32 ret = vfs->driver->read(vfs, node, g_buf, offset, MIN(count, g_request_blocks));
+
+        ++result->ops;
+        if(ret <= 0)
+            return ret ? ret : -EREAD;
+
+        result->bytes += ret * BLOCK_SIZE;
+        offset += ret;
+        count -= ret;
+    }
+
+    return SUCCESS;
+}
+
+
+/*
+    bench_append() - append <count> blocks to the file <node>, one request at a time, extending the
+    file before each request.
+*/
+static s32 bench_append(vfs_t * const vfs, fs_node_t * const node, u32 count,
+                        bench_result_t * const result)
+{
+    u32 offset = (node->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    while(count)
+    {
+        ku32 len = MIN(count, g_request_blocks);
+        s32 ret;
+
+        memset(g_buf, offset & 0xff, len * BLOCK_SIZE);
+
+        /* Extend the file first: the FAT driver does not allow writes beyond the end of a file */
+        ret = vfs->driver->reallocate(vfs, node, (offset + len) * BLOCK_SIZE);
+        if(ret == SUCCESS)
+        {
+            node->size = (offset + len) * BLOCK_SIZE;
+            ret = vfs->driver->write(vfs, node, g_buf, offset, len);
+        }
+
+        ++result->ops;
+        if(ret != (s32) len)
+            return (ret < 0) ? ret : -EWRITE;
+
+        if(vfs->driver->write_node != NULL)
+        {
+            ret = vfs->driver->write_node(vfs, node);
+            if(ret != SUCCESS)
+                return ret;
+        }
+
+        result->bytes += len * BLOCK_SIZE;
+        offset += len;
+        count -= len;
+    }
+
+    return SUCCESS;
+}
+
+
+/*
+    bench_list() - list the directory <node> with read_dir_multi.  As in syscall_read_dir(), the
+    directory is reopened for each batch of entries, and the position reached by the previous batch
+    is restored with seek_dir.
+*/
+static s32 bench_list(vfs_t * const vfs, fs_node_t * const node, bench_result_t * const result)
+{
+    u32 buf[BENCH_LIST_LEN / sizeof(u32)];
+    u32 pos = 0;
+    s32 ret;
+
+    if(node->type != FSNODE_TYPE_DIR)
+        return -ENOTDIR;
+
+    do
+    {
+        const vfs_dirent_t *de;
+        void *ctx;
+
+        ret = vfs->driver->open_dir(vfs, node->first_block, &ctx);
+        if(ret != SUCCESS)
+            return ret;
+
+        ret = vfs->driver->seek_dir(vfs, ctx, pos);
+        if(ret == SUCCESS)
+            ret = vfs->driver->read_dir_multi(vfs, ctx, (vfs_dirent_t *) buf, sizeof(buf));
+
+        if(ret > 0)
+            vfs->driver->tell_dir(vfs, ctx, &pos);
+
+        vfs->driver->close_dir(vfs, ctx);
+
+        for(de = (const vfs_dirent_t *) buf; (u8 *) de < (u8 *) buf + ret; de = VFS_DIRENT_NEXT(de))
+        {
+            ++result->ops;
+            result->bytes += de->len;
+        }
+    } while(ret > 0);
+
+    return ret;
+}
+
+
+/*
+    bench_walk() - enumerate the directory <dir> and, recursively, its subdirectories with read_dir.
+*/
+static s32 bench_walk(vfs_t * const vfs, ku32 dir, bench_result_t * const result)
+{
+    fs_node_t node;
+    void *ctx;
+    s32 ret;
+
+    ret = vfs->driver->open_dir(vfs, dir, &ctx);
+    if(ret != SUCCESS)
+        return ret;
+
+    bzero(&node, sizeof(node));
+
+    while((ret = vfs->driver->read_dir(vfs, ctx, NULL, &node)) == SUCCESS)
+    {
+        ++result->ops;
+
+        if((node.type == FSNODE_TYPE_DIR) && strcmp(node.name, ".") && strcmp(node.name, ".."))
+        {
+            ret = bench_walk(vfs, node.first_block, result);
+            if(ret != SUCCESS)
+                break;
+        }
+    }
+
+    kfree(node.name);
+    vfs->driver->close_dir(vfs, ctx);
+
+    return (ret == -ENOENT) ? SUCCESS : ret;
+}
+
+
+/*
+    bench_mount() - mount the file system on <vfs->dev>, using the driver <driver> if it is
+    non-NULL, or otherwise trying each driver in turn.
+*/
+static s32 bench_mount(vfs_t * const vfs, vfs_driver_t * const driver)
+{
+    s32 ret = -EINVAL;
+    u32 u;
+
+    for(u = 0; u < ARRAY_COUNT(g_drivers); ++u)
+    {
+        if((driver != NULL) && (driver != g_drivers[u]))
+            continue;
+
+        vfs->driver = g_drivers[u];
+        vfs->data = NULL;
+
+        ret = vfs->driver->mount(vfs);
+        if(ret == SUCCESS)
+            break;
+    }
+
+    return ret;
+}
+
+
+/*
+    bench_drop() - unmount the file system, discard the device's cached blocks, and remount it, so
+    that the next command starts with a cold cache.
+*/
+static s32 bench_drop(vfs_t * const vfs)
+{
+    s32 ret;
+
+    ret = vfs->driver->unmount(vfs);
+    if(ret == SUCCESS)
+        ret = block_cache_sync();
+
+    /* Changing the device's cache block size evicts all of its blocks */
+    if(ret == SUCCESS)
+        ret = block_cache_set_block_size(vfs->dev, BLOCK_SIZE << 1);
+    if(ret == SUCCESS)
+        ret = block_cache_set_block_size(vfs->dev, BLOCK_SIZE);
+
+    return (ret == SUCCESS) ? bench_mount(vfs, vfs->driver) : ret;
+}
+
+
+/*
+    bench_command() - run the script command whose words are in <argv>, and report its statistics.
+*/
+static s32 bench_command(vfs_t * const vfs, ku32 argc, char **argv, const char * const line)
+{
+    const char * const cmd = argv[0];
+    bench_result_t result = {0};
+    bench_sample_t sample;
+    fs_node_t node;
+    s32 ret = SUCCESS;
+    u32 u;
+
+    bzero(&node, sizeof(node));
+    bench_begin(&sample);
+
+    if(!strcmp(cmd, "lookup") && ((argc == 2) || (argc == 3)))
+    {
+        ku32 n = (argc == 3) ? strtoul(argv[2], NULL, 0) : 1;
+
+        for(u = 0; (ret == SUCCESS) && (u < n); ++u, ++result.ops)
+        {
+            kfree(node.name);
+            ret = bench_lookup(vfs, argv[1], &node);
+        }
+    }
+    else if(!strcmp(cmd, "read") && (argc == 2))
+    {
+        ret = bench_lookup(vfs, argv[1], &node);
+        if(ret == SUCCESS)
+            ret = bench_read(vfs, &node, 0, (node.size + BLOCK_SIZE - 1) / BLOCK_SIZE, &result);
+    }
+    else if(!strcmp(cmd, "randread") && ((argc == 3) || (argc == 4)))
+    {
+        ku32 n = strtoul(argv[2], NULL, 0), len = (argc == 4) ? strtoul(argv[3], NULL, 0) : 1;
+
+        ret = bench_lookup(vfs, argv[1], &node);
+        if((ret == SUCCESS) && (!len || (len > g_request_blocks)
+                                || (len > (node.size + BLOCK_SIZE - 1) / BLOCK_SIZE)))
+            ret = -EINVAL;
+
+        for(u = 0; (ret == SUCCESS) && (u < n); ++u)
+        {
+            ku32 nblocks = (node.size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+            ret = bench_read(vfs, &node, bench_rand() % (nblocks - len + 1), len, &result);
+        }
+    }
+    else if(!strcmp(cmd, "append") && (argc == 3))
+    {
+        if(!g_write)
+        {
+            printf("%s: the image must be opened for writing (-w)\n", line);
+            return -EPERM;
+        }
+
+        ret = bench_lookup(vfs, argv[1], &node);
+        if(ret == -ENOENT)
+        {
+            kfree(node.name);
+            node.name = NULL;
+            ret = bench_create(vfs, argv[1], &node);
+        }
+
+        if((ret == SUCCESS) && (node.type != FSNODE_TYPE_FILE))
+            ret = -EISDIR;
+
+        if(ret == SUCCESS)
+            ret = bench_append(vfs, &node, strtoul(argv[2], NULL, 0), &result);
+    }
+    else if(!strcmp(cmd, "list") && (argc == 2))
+    {
+        ret = bench_lookup(vfs, argv[1], &node);
+        if(ret == SUCCESS)
+            ret = bench_list(vfs, &node, &result);
+    }
+    else if(!strcmp(cmd, "walk") && (argc == 2))
+    {
+        ret = bench_lookup(vfs, argv[1], &node);
+        if((ret == SUCCESS) && (node.type != FSNODE_TYPE_DIR))
+            ret = -ENOTDIR;
+
+        if(ret == SUCCESS)
+            ret = bench_walk(vfs, node.first_block, &result);
+    }
+    else if(!strcmp(cmd, "request") && (argc == 2))
+    {
+        ku32 blocks = strtoul(argv[1], NULL, 0);
+        u8 * const buf = blocks ? (u8 *) kmalloc(blocks * BLOCK_SIZE) : NULL;
+
+        if(buf == NULL)
+        {
+            printf("%s: invalid request size\n", line);
+            return -EINVAL;
+        }
+
+        kfree(g_buf);
+        g_buf = buf;
+        g_request_blocks = blocks;
+
+        return SUCCESS;
+    }
+    else if(!strcmp(cmd, "drop") && (argc == 1))
+    {
+        ret = bench_drop(vfs);
+        if(ret != SUCCESS)
+        {
+            printf("%s: remount failed: %d\n", line, ret);
+            return ret;
+        }
+
+        return SUCCESS;
+    }
+    else if(!strcmp(cmd, "sync") && (argc == 1))
+    {
+        ret = block_cache_sync();
+        result.ops = 1;
+    }
+    else
+    {
+        printf("%s: unrecognised command\n", line);
+        return -EINVAL;
+    }
+
+    kfree(node.name);
+
+    if(ret != SUCCESS)
+    {
+        printf("%s: failed: %d\n", line, ret);
+        ++result.errors;
+    }
+
+    bench_report(line, &sample, &result);
+
+    return ret;
+}
+
+
+/*
+    bench_script() - run each command in the script <script> against the mounted file system <vfs>.
+    Returns the number of commands which failed.
+*/
+static u32 bench_script(vfs_t * const vfs, char *script)
+{
+    u32 failures = 0;
+
+    while(*script)
+    {
+        char *argv[BENCH_MAX_ARGS + 1], *p, *line = script;
+        u32 argc = 0;
+
+        for(; *script && (*script != '\n'); ++script)
+            ;
+
+        if(*script)
+            *script++ = '\0';
+
+        for(p = line; (*p == ' ') || (*p == '\t'); ++p)
+            ;
+
+        if(!*p || (*p == '#'))
+            continue;
+
+        line = p;
+
+        /* Split a copy of the line into words, so that the line can be quoted in the report */
+        p = strdup(line);
+        if(p == NULL)
+            return failures + 1;
+
+        argv[0] = p;
+        while(*p && (argc <= BENCH_MAX_ARGS))
+        {
+            for(; (*p == ' ') || (*p == '\t'); ++p)
+                *p = '\0';
+
+            if(*p)
+                argv[argc++] = p;
+
+            for(; *p && (*p != ' ') && (*p != '\t'); ++p)
+                ;
+        }
+
+        if(argc > BENCH_MAX_ARGS)
+        {
+            printf("%s: too many arguments\n", line);
+            ++failures;
+        }
+        else if(bench_command(vfs, argc, argv, line) != SUCCESS)
+            ++failures;
+
+        kfree(argv[0]);
+    }
+
+    return failures;
+}
+
+
+int main(int argc, char **argv)
+{
+    vfs_driver_t *driver = NULL;
+    u32 cache_blocks = 2048, failures;
+    char *script;
+    dev_t *dev;
+    vfs_t vfs;
+    s32 i, ret;
+
+    for(i = 1; (i < argc) && (argv[i][0] == '-'); ++i)
+    {
+        if(!strcmp(argv[i], "-w"))
+            g_write = 1;
+        else if(!strcmp(argv[i], "-c") && (i + 1 < argc))
+            cache_blocks = strtoul(argv[++i], NULL, 10);
+        else if(!strcmp(argv[i], "-r") && (i + 1 < argc))
+            g_request_blocks = strtoul(argv[++i], NULL, 10);
+        else if(!strcmp(argv[i], "-s") && (i + 1 < argc))
+            g_rand_state = strtoul(argv[++i], NULL, 10);
+        else if(!strcmp(argv[i], "-t") && (i + 1 < argc))
+        {
+            u32 u;
+
+            ++i;
+            for(u = 0; u < ARRAY_COUNT(g_drivers); ++u)
+                if(!strcmp(argv[i], g_drivers[u]->name))
+                    driver = g_drivers[u];
+
+            if(driver == NULL)
+                break;
+        }
+        else
+            break;
+    }
+
+    if((i + 2 != argc) || !g_request_blocks)
+    {
+        puts("Usage: fsbench [-c cache_blocks] [-r request_blocks] [-s seed] [-t ext2|fat] [-w] "
+             "image script");
+        return 1;
+    }
+
+    if(block_cache_init(cache_blocks) != SUCCESS)
+        return 1;
+
+    g_buf = (u8 *) kmalloc(g_request_blocks * BLOCK_SIZE);
+    script = script_load(argv[i + 1]);
+    if((g_buf == NULL) || (script == NULL))
+        return 1;
+
+    dev = (dev_t *) CHECKED_KCALLOC(1, sizeof(dev_t));
+
+    dev->type = DEV_TYPE_BLOCK;
+    dev->subtype = DEV_SUBTYPE_MASS_STORAGE;
+    dev->block_size = BLOCK_SIZE;
+    dev->read = bench_dev_read;
+    dev->write = bench_dev_write;
+    dev->len = image_open(argv[i], g_write);
+    if(!dev->len)
+        return 1;
+
+    for(i = 0; i < (s32) ARRAY_COUNT(g_drivers); ++i)
+        if(g_drivers[i]->init != NULL)
+            g_drivers[i]->init();
+
+    bzero(&vfs, sizeof(vfs));
+    vfs.dev = dev;
+
+    ret = bench_mount(&vfs, driver);
+    if(ret != SUCCESS)
+    {
+        printf("%s: mount failed: %d\n", argv[argc - 2], ret);
+        image_close();
+        return 1;
+    }
+
+    printf("%s: %s file system, %u blocks; cache %u blocks, requests %u blocks\n", argv[argc - 2],
+           vfs.driver->name, dev->len, cache_blocks, g_request_blocks);
+
+    failures = bench_script(&vfs, script);
+
+    ret = vfs.driver->unmount(&vfs);
+    if(ret == SUCCESS)
+        ret = block_cache_sync();
+
+    if(ret != SUCCESS)
+    {
+        printf("%s: unmount failed: %d\n", argv[argc - 2], ret);
+        ++failures;
+    }
+
+    image_close();
+    free(script);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,10 @@
+/*
+    Build configuration for kernel sources compiled into host-side test programs.  Only the options
+    needed by the file system drivers and block cache are enabled.
+*/
+
+#define WITH_FS_EXT2
+#define WITH_FS_FAT
+#define WITH_MASS_STORAGE
+
+#define TARGET_LITTLEENDIAN
@@ -0,0 +1,63 @@
+#ifndef CPU_ARCH_SPECIFIC_H_INC
+#define CPU_ARCH_SPECIFIC_H_INC
+/*
+    Host stand-in for the CPU-architecture-specific header
+
+    Part of ayumos
+
+
+    (c) Stuart Wallace <stuartw@atom.net>, October 2026.
+
+
+    This header replaces cpu/arch_specific.h when kernel sources are compiled into host-side test
+    programs.  The host programs are single-threaded, so interrupt masking is a no-op and
+    test-and-set need not be atomic.
+*/
+
+#ifndef IN_CPU_H
+#error "This file should not be #include'd directly."
+#endif
+
+#include <kernel/include/types.h>
+
+#define CPU_MAX_IRQL        255
+
+struct regs
+{
+    u32 d[8];
+    u32 a[8];
+    u32 sr;
+    u32 pc;
+};
+
+inline void cpu_enable_interrupts(void)
+{
+}
+
+
+inline void cpu_disable_interrupts(void)
+{
+}
+
+
+inline u32 cpu_disable_interrupts_save(void)
+{
+    return 0;
+}
+
+
+inline void cpu_restore_interrupts(ku32 sr)
+{
+    (void) sr;
+}
+
+
+inline u8 cpu_tas(u8 *addr)
+{
+    ku8 old = *addr;
+
+    *addr = 1;
+    return old;
+}
+
+#endif
@@ -0,0 +1,155 @@
+/*
+    Host-side support for the benchmarks: disk image access, script loading and timing
+
+    Part of ayumos
+
+
+    (c) Stuart Wallace <stuartw@atom.net>, October 2026.
+
+
+    This file is compiled against the host's C library, rather than the kernel headers, and exports
+    a minimal interface using plain C types.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "image.h"
+
+
+static int g_image_fd = -1;
+
+
+/*
+    image_open() - open the disk image at <path>.  Returns the length of the image in
+    IMAGE_BLOCK_SIZE-byte blocks, or 0 on failure.
+*/
+unsigned image_open(const char *path, int writable)
+{
+    struct stat st;
+
+    image_close();
+
+    g_image_fd = open(path, writable ? O_RDWR : O_RDONLY);
+    if(g_image_fd < 0)
+    {
+        perror(path);
+        return 0;
+    }
+
+    if(fstat(g_image_fd, &st) < 0)
+    {
+        perror("fstat()");
+        image_close();
+        return 0;
+    }
+
+    return st.st_size / IMAGE_BLOCK_SIZE;
+}
+
+
+void image_close(void)
+{
+    if(g_image_fd >= 0)
+    {
+        close(g_image_fd);
+        g_image_fd = -1;
+    }
+}
+
+
+/*
+    image_read() - read <count> blocks, starting at <block>, into <buf>.  Returns 0 on success.
+*/
+int image_read(unsigned block, unsigned count, void *buf)
+{
+    const size_t len = (size_t) count * IMAGE_BLOCK_SIZE;
+
+    return (pread(g_image_fd, buf, len, (off_t) block * IMAGE_BLOCK_SIZE) == (ssize_t) len) ? 0 : -1;
+}
+
+
+/*
+    image_write() - write <count> blocks, starting at <block>, from <buf>.  If <buf> is NULL, the
+    blocks are zero-filled.  Returns 0 on success.
+*/
+int image_write(unsigned block, unsigned count, const void *buf)
+{
+    static const char zero[IMAGE_BLOCK_SIZE];
+    unsigned u;
+
+    if(buf != NULL)
+    {
+        const size_t len = (size_t) count * IMAGE_BLOCK_SIZE;
+
+        return (pwrite(g_image_fd, buf, len, (off_t) block * IMAGE_BLOCK_SIZE) == (ssize_t) len)
+                    ? 0 : -1;
+    }
+
+    for(u = 0; u < count; ++u)
+        if(pwrite(g_image_fd, zero, IMAGE_BLOCK_SIZE, (off_t) (block + u) * IMAGE_BLOCK_SIZE)
+                != IMAGE_BLOCK_SIZE)
+            return -1;
+
+    return 0;
+}
+
+
+/*
+    script_load() - read the whole of the text file at <path> into a nul-terminated buffer, which
+    the caller must free.  Returns NULL on failure.
+*/
+char *script_load(const char *path)
+{
+    FILE *fp;
+    char *buf;
+    long len;
+
+    fp = fopen(path, "r");
+    if(fp == NULL)
+    {
+        perror(path);
+        return NULL;
+    }
+
+    if((fseek(fp, 0, SEEK_END) < 0) || ((len = ftell(fp)) < 0) || (fseek(fp, 0, SEEK_SET) < 0))
+    {
+        perror(path);
+        fclose(fp);
+        return NULL;
+    }
+
+    buf = malloc(len + 1);
+    if((buf != NULL) && (fread(buf, 1, len, fp) != (size_t) len))
+    {
+        perror(path);
+        free(buf);
+        buf = NULL;
+    }
+
+    if(buf != NULL)
+        buf[len] = '\0';
+
+    fclose(fp);
+
+    return buf;
+}
+
+
+/*
+    bench_time() - return the current value of a monotonic clock, in seconds.
+*/
+double bench_time(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
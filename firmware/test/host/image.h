@@ -0,0 +1,25 @@
+#ifndef TEST_HOST_IMAGE_H_INC
+#define TEST_HOST_IMAGE_H_INC
+/*
+    Host-side support for the benchmarks: disk image access, script loading and timing
+
+    Part of ayumos
+
+
+    (c) Stuart Wallace <stuartw@atom.net>, October 2026.
+
+
+    This header is included both by host code and by code compiled against the kernel headers, so
+    it uses only plain C types.
+*/
+
+#define IMAGE_BLOCK_SIZE    (512)
+
+unsigned image_open(const char *path, int writable);
+void image_close(void);
+int image_read(unsigned block, unsigned count, void *buf);
+int image_write(unsigned block, unsigned count, const void *buf);
+char *script_load(const char *path);
+double bench_time(void);
+
+#endif
@@ -0,0 +1,148 @@
+/*
+    Kernel support stubs for host-side test programs
+
+    Part of ayumos
+
+
+    (c) Stuart Wallace <stuartw@atom.net>, October 2026.
+
+
+    The host-side benchmarks (ext2bench and fsbench) link the real file system drivers and block
+    cache against these stand-ins for the kernel services they use.  Memory is allocated from the
+    host's heap (malloc() etc. resolve to the host C library); semaphores and pre-emption control
+    are trivial, because the benchmarks are single-threaded.
+*/
+
+#include <kernel/include/device/device.h>
+#include <kernel/include/fs/node.h>
+#include <kernel/include/memory/kmalloc.h>
+#include <kernel/include/memory/slab.h>
+#include <kernel/include/preempt.h>
+#include <kernel/include/semaphore.h>
+#include <klibc/include/stdlib.h>
+#include <klibc/include/string.h>
+
+
+/* Emit external definitions of the inline functions used by the kernel sources */
+extern inline void cpu_enable_interrupts(void);
+extern inline void cpu_disable_interrupts(void);
+extern inline u32 cpu_disable_interrupts_save(void);
+extern inline void cpu_restore_interrupts(ku32 sr);
+extern inline u8 cpu_tas(u8 *addr);
+extern inline void preempt_disable();
+extern inline void preempt_enable();
+extern inline s32 sem_try_acquire(sem_t *sem);
+
+vu32 preempt_count;
+u32 preempt_saved_sr;
+
+
+void *kmalloc(u32 size)
+{
+    return malloc(size);
+}
+
+
+void *kcalloc(ku32 nmemb, ku32 size)
+{
+    return calloc(nmemb, size);
+}
+
+
+void *krealloc(void *ptr, u32 size)
+{
+    return realloc(ptr, size);
+}
+
+
+void kfree(void *ptr)
+{
+    free(ptr);
+}
+
+
+void *umalloc(u32 size)
+{
+    return malloc(size);
+}
+
+
+void ufree(void *ptr)
+{
+    free(ptr);
+}
+
+
+void *slab_alloc(size_t size)
+{
+    return malloc(size);
+}
+
+
+void slab_free(void *obj)
+{
+    free(obj);
+}
+
+
+s32 sem_init(sem_t *sem)
+{
+    *sem = 0;
+    return SUCCESS;
+}
+
+
+void sem_destroy(sem_t *sem)
+{
+    UNUSED(sem);
+}
+
+
+void sem_acquire(sem_t *sem)
+{
+    *sem = 1;
+}
+
+
+void sem_release(sem_t *sem)
+{
+    *sem = 0;
+}
+
+
+/* There are no devices other than the image; in particular there is no RTC */
+dev_t *dev_find(const char * const name)
+{
+    UNUSED(name);
+
+    return NULL;
+}
+
+
+s32 fs_node_alloc(fs_node_t **node)
+{
+    *node = (fs_node_t *) CHECKED_KCALLOC(1, sizeof(fs_node_t));
+
+    return SUCCESS;
+}
+
+
+s32 fs_node_set_name(fs_node_t *node, const char * const name)
+{
+    char * const name_ = kmalloc(strlen(name) + 1);
+    if(name_ == NULL)
+        return -ENOMEM;
+
+    strcpy(name_, name);
+    kfree(node->name);
+    node->name = name_;
+
+    return SUCCESS;
+}
+
+
+void fs_node_free(fs_node_t *node)
+{
+    kfree(node->name);
+    kfree(node);
+}